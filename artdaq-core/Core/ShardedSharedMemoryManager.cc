@@ -0,0 +1,255 @@
+#define TRACE_NAME "ShardedSharedMemoryManager"
+
+#include "artdaq-core/Core/ShardedSharedMemoryManager.hh"
+
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+#include "cetlib_except/exception.h"
+#include "TRACE/tracemf.h"
+
+#define TLVL_SHARD 37
+
+std::vector<uint32_t> artdaq::ShardedSharedMemoryManager::ShardKeys(uint32_t shm_key, size_t shard_count, uint32_t key_stride)
+{
+	std::vector<uint32_t> keys;
+	for (size_t ii = 0; ii < shard_count; ++ii)
+	{
+		// A key which wraps around could land on another shard or on 0 (IPC_PRIVATE)
+		auto key = static_cast<uint64_t>(shm_key) + static_cast<uint64_t>(ii) * key_stride;
+		if (key > UINT32_MAX || key == 0)
+		{
+			throw cet::exception("ShardedSharedMemoryManager") << "Shard keys overlap: shard " << ii << " of " << shard_count << " starting at key 0x" << std::hex << shm_key  // NOLINT(cert-err60-cpp)
+			                                                   << " with stride 0x" << key_stride << " does not have a valid key (0x" << key << ")";
+		}
+		keys.push_back(static_cast<uint32_t>(key));
+	}
+	return keys;
+}
+
+artdaq::ShardedSharedMemoryManager::ShardedSharedMemoryManager(uint32_t shm_key, size_t shard_count, size_t buffer_count, size_t buffer_size, uint64_t buffer_timeout_us,
+                                                               bool destructive_read_mode, SharedMemoryManager::SegmentOptions const& options)
+    : ShardedSharedMemoryManager(ShardKeys(shm_key, shard_count), buffer_count, buffer_size, buffer_timeout_us, destructive_read_mode, options)
+{
+}
+
+artdaq::ShardedSharedMemoryManager::ShardedSharedMemoryManager(std::vector<uint32_t> const& shard_keys, size_t buffer_count, size_t buffer_size, uint64_t buffer_timeout_us,
+                                                               bool destructive_read_mode, SharedMemoryManager::SegmentOptions const& options)
+    : home_shard_(0)
+    , next_write_shard_(0)
+{
+	if (shard_keys.empty())
+	{
+		throw cet::exception("ShardedSharedMemoryManager") << "At least one shard is required";  // NOLINT(cert-err60-cpp)
+	}
+	if (std::set<uint32_t>(shard_keys.begin(), shard_keys.end()).size() != shard_keys.size())
+	{
+		throw cet::exception("ShardedSharedMemoryManager") << "Shard keys overlap: " << shard_keys.size() << " shards starting at key 0x" << std::hex << shard_keys[0] << std::dec  // NOLINT(cert-err60-cpp)
+		                                                   << " do not have distinct keys";
+	}
+	if (std::find(shard_keys.begin(), shard_keys.end(), 0) != shard_keys.end())
+	{
+		throw cet::exception("ShardedSharedMemoryManager") << "Shard keys overlap: key 0 (IPC_PRIVATE) cannot be used for a shard";  // NOLINT(cert-err60-cpp)
+	}
+	auto shard_count = shard_keys.size();
+	for (size_t ii = 0; ii < shard_count; ++ii)
+	{
+		// The tag names the queue and the shard's place in it, so that a key which is also used by another queue (or as a
+		// shard of this queue with a different shard count) is refused instead of being shared
+		auto shard_options = options;
+		shard_options.segment_tag = (static_cast<uint64_t>(shard_keys[0]) << 32) | (static_cast<uint64_t>(shard_count & 0xFFFF) << 16) | (ii & 0xFFFF);
+		shards_.emplace_back(std::make_unique<SharedMemoryManager>(shard_keys[ii], buffer_count, buffer_size, buffer_timeout_us, destructive_read_mode, shard_options));
+		shards_.back()->SetNotifyGroup(shards_[0].get());
+	}
+	if (IsValid())
+	{
+		for (auto const& shard : shards_)
+		{
+			if (shard->size() != ShardSize())
+			{
+				TLOG(TLVL_WARNING) << "Shard with key 0x" << std::hex << shard->GetKey() << std::dec << " has " << shard->size()
+				                   << " buffers, expected " << ShardSize() << "; global buffer indices will be wrong";
+			}
+		}
+		// Spread readers (and the first shard of round-robin writers) across the shards by manager ID
+		home_shard_ = shards_[0]->GetMyId() >= 0 ? shards_[0]->GetMyId() % shard_count : 0;
+		next_write_shard_ = home_shard_;
+	}
+	TLOG(TLVL_SHARD) << "ShardedSharedMemoryManager: " << shard_count << " shards starting at key 0x" << std::hex << shard_keys[0] << std::dec << ", home shard " << home_shard_;
+}
+
+artdaq::ShardedSharedMemoryManager::~ShardedSharedMemoryManager()
+{
+	// The other shards signal the first one's channels, so it goes last
+	while (!shards_.empty())
+	{
+		shards_.pop_back();
+	}
+}
+
+bool artdaq::ShardedSharedMemoryManager::IsValid() const
+{
+	return !shards_.empty() && std::all_of(shards_.begin(), shards_.end(), [](auto const& shard) { return shard->IsValid(); });
+}
+
+int artdaq::ShardedSharedMemoryManager::GetBufferForWriting(bool overwrite, size_t size_hint)
+{
+	// Try every shard once, starting with the next one in round-robin order, so that a full shard does not block writers
+	auto first = next_write_shard_.fetch_add(1);
+	for (size_t ii = 0; ii < shards_.size(); ++ii)
+	{
+		auto shard = (first + ii) % shards_.size();
+		auto buffer = shards_[shard]->GetBufferForWriting(overwrite, size_hint);
+		if (buffer != -1)
+		{
+			TLOG(TLVL_SHARD) << "GetBufferForWriting: Returning buffer " << buffer << " of shard " << shard;
+			return globalIndex_(shard, buffer);
+		}
+	}
+	return -1;
+}
+
+int artdaq::ShardedSharedMemoryManager::GetBufferForWritingByKey(uint64_t key, bool overwrite, size_t size_hint)
+{
+	// splitmix64 finalizer, so that regular keys (e.g. multiples of the shard count) are still spread evenly
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	auto shard = key % shards_.size();
+	return globalIndex_(shard, shards_[shard]->GetBufferForWriting(overwrite, size_hint));
+}
+
+int artdaq::ShardedSharedMemoryManager::GetBufferForReading()
+{
+	for (size_t ii = 0; ii < shards_.size(); ++ii)
+	{
+		auto shard = (home_shard_ + ii) % shards_.size();
+		auto buffer = shards_[shard]->GetBufferForReading();
+		if (buffer != -1)
+		{
+			TLOG(TLVL_SHARD) << "GetBufferForReading: Returning buffer " << buffer << " of shard " << shard << (shard != home_shard_ ? " (stolen)" : "");
+			return globalIndex_(shard, buffer);
+		}
+	}
+	return -1;
+}
+
+int artdaq::ShardedSharedMemoryManager::GetBufferForReadingFromShard(size_t shard)
+{
+	if (shard >= shards_.size())
+	{
+		throw cet::exception("ArgumentOutOfRange") << "Shard " << shard << " does not exist (" << shards_.size() << " shards)";  // NOLINT(cert-err60-cpp)
+	}
+	return globalIndex_(shard, shards_[shard]->GetBufferForReading());
+}
+
+bool artdaq::ShardedSharedMemoryManager::ReadyForRead()
+{
+	return std::any_of(shards_.begin(), shards_.end(), [](auto const& shard) { return shard->ReadyForRead(); });
+}
+
+bool artdaq::ShardedSharedMemoryManager::ReadyForWrite(bool overwrite, size_t size_hint)
+{
+	return std::any_of(shards_.begin(), shards_.end(), [overwrite, size_hint](auto const& shard) { return shard->ReadyForWrite(overwrite, size_hint); });
+}
+
+bool artdaq::ShardedSharedMemoryManager::WaitForReadable(size_t timeout_us)
+{
+	// Every shard signals the first shard's channels, so one futex covers them all
+	return shards_[0]->WaitForReadable(timeout_us, [this]() { return ReadyForRead(); });
+}
+
+bool artdaq::ShardedSharedMemoryManager::WaitForWritable(size_t timeout_us, bool overwrite, size_t size_hint)
+{
+	// Buffers becoming Full do not signal the writable channel, so overwrite mode re-checks every millisecond
+	return shards_[0]->WaitForWritable(
+	    timeout_us, [this, overwrite, size_hint]() { return ReadyForWrite(overwrite, size_hint); }, overwrite ? 1000 : 0);
+}
+
+size_t artdaq::ShardedSharedMemoryManager::ReadReadyCount()
+{
+	size_t count = 0;
+	for (auto& shard : shards_)
+	{
+		count += shard->ReadReadyCount();
+	}
+	return count;
+}
+
+size_t artdaq::ShardedSharedMemoryManager::WriteReadyCount(bool overwrite)
+{
+	size_t count = 0;
+	for (auto& shard : shards_)
+	{
+		count += shard->WriteReadyCount(overwrite);
+	}
+	return count;
+}
+
+size_t artdaq::ShardedSharedMemoryManager::Write(int buffer, void* data, size_t size)
+{
+	int local = -1;
+	return shardFor_(buffer, &local)->Write(local, data, size);
+}
+
+size_t artdaq::ShardedSharedMemoryManager::WriteV(int buffer, SharedMemoryManager::WriteSegment const* segments, size_t count)
+{
+	int local = -1;
+	return shardFor_(buffer, &local)->WriteV(local, segments, count);
+}
+
+bool artdaq::ShardedSharedMemoryManager::Read(int buffer, void* data, size_t size)
+{
+	int local = -1;
+	return shardFor_(buffer, &local)->Read(local, data, size);
+}
+
+void artdaq::ShardedSharedMemoryManager::MarkBufferFull(int buffer, int destination)
+{
+	int local = -1;
+	shardFor_(buffer, &local)->MarkBufferFull(local, destination);
+}
+
+void artdaq::ShardedSharedMemoryManager::MarkBufferEmpty(int buffer, bool force)
+{
+	int local = -1;
+	shardFor_(buffer, &local)->MarkBufferEmpty(local, force);
+}
+
+void* artdaq::ShardedSharedMemoryManager::GetBufferStart(int buffer)
+{
+	int local = -1;
+	return shardFor_(buffer, &local)->GetBufferStart(local);
+}
+
+size_t artdaq::ShardedSharedMemoryManager::BufferDataSize(int buffer)
+{
+	int local = -1;
+	return shardFor_(buffer, &local)->BufferDataSize(local);
+}
+
+std::string artdaq::ShardedSharedMemoryManager::toString()
+{
+	std::ostringstream ostr;
+	ostr << "ShardedSharedMemoryManager: " << shards_.size() << " shards of " << ShardSize() << " buffers, home shard " << home_shard_ << std::endl;
+	for (size_t ii = 0; ii < shards_.size(); ++ii)
+	{
+		ostr << "Shard " << ii << ":" << std::endl
+		     << shards_[ii]->toString();
+	}
+	return ostr.str();
+}
+
+artdaq::SharedMemoryManager* artdaq::ShardedSharedMemoryManager::shardFor_(int buffer, int* local_buffer)
+{
+	auto shard_size = ShardSize();
+	if (buffer < 0 || shard_size == 0 || static_cast<size_t>(buffer) >= size())
+	{
+		throw cet::exception("ArgumentOutOfRange") << "Buffer " << buffer << " does not exist (" << size() << " buffers in " << shards_.size() << " shards)";  // NOLINT(cert-err60-cpp)
+	}
+	*local_buffer = static_cast<int>(buffer % shard_size);
+	return shards_[buffer / shard_size].get();
+}
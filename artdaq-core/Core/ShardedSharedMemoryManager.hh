@@ -0,0 +1,268 @@
+#ifndef artdaq_core_Core_ShardedSharedMemoryManager_hh
+#define artdaq_core_Core_ShardedSharedMemoryManager_hh 1
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "artdaq-core/Core/SharedMemoryManager.hh"
+
+namespace artdaq {
+/**
+	 * \brief The ShardedSharedMemoryManager spreads one logical queue of buffers across several shared memory segments
+	 * ("shards"), so that writers and readers of a busy data path do not all contend on one segment's rings and counters.
+	 *
+	 * Each shard is a segment with its own key, by default shm_key + i * DefaultKeyStride for shard i, so that the shards
+	 * of neighbouring ranks (which usually differ by a small key offset) do not collide; an explicit list of keys may be
+	 * given instead. Every shard is tagged with the first key, the shard count and its index, and a shard whose key is
+	 * already in use by anything else is refused (IsValid returns false). Every shard has the same configuration. Buffers
+	 * are identified by a global index, shard * ShardSize() + the buffer's index in its shard, which is accepted by all of
+	 * the buffer operations below.
+	 *
+	 * Every shard also signals the first shard's wait channels, so that WaitForReadable and WaitForWritable sleep on one
+	 * futex until any shard changes. Changes made through a plain SharedMemoryManager attached to one shard only signal
+	 * that shard; waiters still notice them, within the periodic re-check of the wait.
+	 *
+	 * Writers pick a shard round-robin (moving on to the next shard when one is full), or by hashing a key, in which case
+	 * every buffer written with that key goes to the same shard. Readers start with their own shard and then steal from
+	 * the others. Each shard delivers buffers in the order they were marked Full, so buffers written with the same key
+	 * are read in order by a reader which only reads that key's shard (see GetBufferForReadingFromShard). There is no
+	 * ordering between shards.
+	 */
+class ShardedSharedMemoryManager
+{
+public:
+	/**
+		 * \brief Distance between the keys of consecutive shards, large enough to keep shard keys clear of the per-rank key offsets
+		 */
+	static constexpr uint32_t DefaultKeyStride = 0x01000000;
+
+	/**
+		 * \brief Get the shard keys used by the shm_key constructor
+		 * \param shm_key The key of the first shard
+		 * \param shard_count The number of shards
+		 * \param key_stride Distance between the keys of consecutive shards
+		 * \return shm_key + i * key_stride for each shard i. A key which would not fit in 32 bits, or would be 0
+		 * (IPC_PRIVATE), is a cet::exception.
+		 */
+	static std::vector<uint32_t> ShardKeys(uint32_t shm_key, size_t shard_count, uint32_t key_stride = DefaultKeyStride);
+
+	/**
+		 * \brief ShardedSharedMemoryManager Constructor
+		 * \param shm_key The key of the first shard. Shard i uses shm_key + i * DefaultKeyStride.
+		 * \param shard_count The number of shards
+		 * \param buffer_count The number of buffers in each shard (0 to attach to existing shards)
+		 * \param buffer_size The size of each buffer
+		 * \param buffer_timeout_us The maximum amount of time a buffer can be left untouched by its owner (if 0, buffers do not expire)
+		 * \param destructive_read_mode Whether a read operation empties the buffer (default: true, false for broadcast mode)
+		 * \param options Backend, huge page, pre-fault and memory locking options for every shard
+		 */
+	ShardedSharedMemoryManager(uint32_t shm_key, size_t shard_count, size_t buffer_count = 0, size_t buffer_size = 0, uint64_t buffer_timeout_us = 100 * 1000000,
+	                           bool destructive_read_mode = true, SharedMemoryManager::SegmentOptions const& options = SharedMemoryManager::SegmentOptions());
+
+	/**
+		 * \brief ShardedSharedMemoryManager Constructor with explicit shard keys
+		 * \param shard_keys The key of each shard. Keys must be distinct and non-zero (cet::exception otherwise).
+		 * \param buffer_count The number of buffers in each shard (0 to attach to existing shards)
+		 * \param buffer_size The size of each buffer
+		 * \param buffer_timeout_us The maximum amount of time a buffer can be left untouched by its owner (if 0, buffers do not expire)
+		 * \param destructive_read_mode Whether a read operation empties the buffer (default: true, false for broadcast mode)
+		 * \param options Backend, huge page, pre-fault and memory locking options for every shard (segment_tag is replaced by the shard's tag)
+		 */
+	ShardedSharedMemoryManager(std::vector<uint32_t> const& shard_keys, size_t buffer_count = 0, size_t buffer_size = 0, uint64_t buffer_timeout_us = 100 * 1000000,
+	                           bool destructive_read_mode = true, SharedMemoryManager::SegmentOptions const& options = SharedMemoryManager::SegmentOptions());
+
+	/**
+		 * \brief ShardedSharedMemoryManager Destructor. Detaches from every shard.
+		 */
+	virtual ~ShardedSharedMemoryManager();
+	ShardedSharedMemoryManager(ShardedSharedMemoryManager const&) = delete;             ///< Copy Constructor is deleted
+	ShardedSharedMemoryManager(ShardedSharedMemoryManager&&) = delete;                  ///< Move Constructor is deleted
+	ShardedSharedMemoryManager& operator=(ShardedSharedMemoryManager const&) = delete;  ///< Copy Assignment Operator is deleted
+	ShardedSharedMemoryManager& operator=(ShardedSharedMemoryManager&&) = delete;       ///< Move Assignment Operator is deleted
+
+	/**
+		 * \brief Find a buffer for writing, starting with the next shard in round-robin order
+		 * \param overwrite Whether to consider buffers that are in the Full and Reading state as available (see SharedMemoryManager::GetBufferForWriting)
+		 * \param size_hint Number of bytes which will be written (0: any buffer)
+		 * \return Global index of the buffer, or -1 if no shard has a buffer available
+		 */
+	int GetBufferForWriting(bool overwrite, size_t size_hint = 0);
+
+	/**
+		 * \brief Find a buffer for writing in the shard selected by a key
+		 * \param key Key to hash, e.g. a sequence ID. Every buffer written with the same key goes to the same shard.
+		 * \param overwrite Whether to consider buffers that are in the Full and Reading state as available
+		 * \param size_hint Number of bytes which will be written (0: any buffer)
+		 * \return Global index of the buffer, or -1 if the key's shard has no buffer available
+		 */
+	int GetBufferForWritingByKey(uint64_t key, bool overwrite, size_t size_hint = 0);
+
+	/**
+		 * \brief Find a Full buffer, starting with this manager's own shard and then stealing from the others
+		 * \return Global index of the buffer, or -1 if no shard has a Full buffer
+		 */
+	int GetBufferForReading();
+
+	/**
+		 * \brief Find a Full buffer in one shard, in the order the shard's buffers were marked Full
+		 * \param shard Shard to read from
+		 * \return Global index of the buffer, or -1 if the shard has no Full buffer
+		 */
+	int GetBufferForReadingFromShard(size_t shard);
+
+	/**
+		 * \brief Whether any shard has a buffer available for reading
+		 * \return True if a shard has a Full buffer
+		 */
+	bool ReadyForRead();
+
+	/**
+		 * \brief Whether any shard has a buffer available for writing
+		 * \param overwrite Whether buffers may be overwritten
+		 * \param size_hint Number of bytes which will be written (0: any buffer)
+		 * \return True if a shard has a buffer available
+		 */
+	bool ReadyForWrite(bool overwrite, size_t size_hint = 0);
+
+	/**
+		 * \brief Wait until a buffer is available for reading in any shard
+		 * \param timeout_us Maximum time to wait, in microseconds
+		 * \return Whether a buffer became available before the timeout
+		 */
+	bool WaitForReadable(size_t timeout_us);
+
+	/**
+		 * \brief Wait until a buffer is available for writing in any shard
+		 * \param timeout_us Maximum time to wait, in microseconds
+		 * \param overwrite Whether buffers may be overwritten
+		 * \param size_hint Number of bytes which will be written (0: any buffer)
+		 * \return Whether a buffer became available before the timeout
+		 */
+	bool WaitForWritable(size_t timeout_us, bool overwrite = false, size_t size_hint = 0);
+
+	/**
+		 * \brief Count the buffers available for reading in all shards
+		 * \return The number of buffers available for reading
+		 */
+	size_t ReadReadyCount();
+
+	/**
+		 * \brief Count the buffers available for writing in all shards
+		 * \param overwrite Whether buffers may be overwritten
+		 * \return The number of buffers available for writing
+		 */
+	size_t WriteReadyCount(bool overwrite);
+
+	/**
+		 * \brief Write data to a buffer (see SharedMemoryManager::Write)
+		 * \param buffer Global index of the buffer
+		 * \param data Pointer to the data to write
+		 * \param size Number of bytes to write
+		 * \return Number of bytes written
+		 */
+	size_t Write(int buffer, void* data, size_t size);
+
+	/**
+		 * \brief Write several blocks of data to a buffer under a single lock (see SharedMemoryManager::WriteV)
+		 * \param buffer Global index of the buffer
+		 * \param segments Segments to write, in order
+		 * \param count Number of segments
+		 * \return Number of bytes written
+		 */
+	size_t WriteV(int buffer, SharedMemoryManager::WriteSegment const* segments, size_t count);
+
+	/**
+		 * \brief Read data from a buffer (see SharedMemoryManager::Read)
+		 * \param buffer Global index of the buffer
+		 * \param data Destination of the data
+		 * \param size Number of bytes to read
+		 * \return Whether the read succeeded
+		 */
+	bool Read(int buffer, void* data, size_t size);
+
+	/**
+		 * \brief Release a buffer from a writer, marking it Full (see SharedMemoryManager::MarkBufferFull)
+		 * \param buffer Global index of the buffer
+		 * \param destination ID of the manager in the buffer's shard which should read the buffer (-1 for any)
+		 */
+	void MarkBufferFull(int buffer, int destination = -1);
+
+	/**
+		 * \brief Release a buffer from a reader (see SharedMemoryManager::MarkBufferEmpty)
+		 * \param buffer Global index of the buffer
+		 * \param force Force the buffer to Empty state
+		 */
+	void MarkBufferEmpty(int buffer, bool force = false);
+
+	/**
+		 * \brief Get the address of the start of a buffer's data
+		 * \param buffer Global index of the buffer
+		 * \return Pointer to the buffer's data
+		 */
+	void* GetBufferStart(int buffer);
+
+	/**
+		 * \brief Get the number of bytes written to a buffer
+		 * \param buffer Global index of the buffer
+		 * \return Number of bytes written to the buffer
+		 */
+	size_t BufferDataSize(int buffer);
+
+	/**
+		 * \brief Get the shard holding a buffer
+		 * \param buffer Global index of the buffer
+		 * \return Index of the shard
+		 */
+	size_t ShardOf(int buffer) const { return ShardSize() > 0 ? static_cast<size_t>(buffer) / ShardSize() : 0; }
+
+	/**
+		 * \brief Get the SharedMemoryManager of one shard
+		 * \param shard Index of the shard
+		 * \return Reference to the shard's SharedMemoryManager
+		 */
+	SharedMemoryManager& GetShard(size_t shard) { return *shards_.at(shard); }
+
+	/**
+		 * \brief Get the number of shards
+		 * \return The number of shards
+		 */
+	size_t GetShardCount() const { return shards_.size(); }
+
+	/**
+		 * \brief Get the number of buffers in each shard
+		 * \return The number of buffers in each shard
+		 */
+	size_t ShardSize() const { return shards_.empty() ? 0 : shards_[0]->size(); }
+
+	/**
+		 * \brief Get the total number of buffers
+		 * \return The number of buffers in all shards
+		 */
+	size_t size() const { return ShardSize() * shards_.size(); }
+
+	/**
+		 * \brief Whether every shard is attached
+		 * \return True if every shard's SharedMemoryManager is valid
+		 */
+	bool IsValid() const;
+
+	/**
+		 * \brief Get a report on the state of every shard
+		 * \return A string describing each shard
+		 */
+	std::string toString();
+
+private:
+	SharedMemoryManager* shardFor_(int buffer, int* local_buffer);
+	int globalIndex_(size_t shard, int local_buffer) const { return local_buffer == -1 ? -1 : static_cast<int>(shard * ShardSize()) + local_buffer; }
+
+	std::vector<std::unique_ptr<SharedMemoryManager>> shards_;
+	size_t home_shard_;
+	std::atomic<size_t> next_write_shard_;
+};
+}  // namespace artdaq
+
+#endif  // artdaq_core_Core_ShardedSharedMemoryManager_hh
@@ -2,180 +2,452 @@
 #include "artdaq-core/Core/SharedMemoryEventReceiver.hh"
 
 #include <sys/time.h>
+#include <algorithm>
+#include <cstring>
 #include "artdaq-core/Data/Fragment.hh"
 #define TRACE_NAME "SharedMemoryEventReceiver"
 #include "TRACE/tracemf.h"
 
 artdaq::SharedMemoryEventReceiver::SharedMemoryEventReceiver(uint32_t shm_key, uint32_t broadcast_shm_key)
-    : current_read_buffer_(-1)
-    , initialized_(false)
-    , current_header_(nullptr)
-    , current_data_source_(nullptr)
+    : initialized_(false)
+    , prefetch_(false)
     , data_(shm_key)
     , broadcasts_(broadcast_shm_key)
 {
 	TLOG(TLVL_DEBUG + 33) << "SharedMemoryEventReceiver CONSTRUCTOR";
 }
 
-bool artdaq::SharedMemoryEventReceiver::ReadyForRead(bool broadcast, size_t timeout_us)
+artdaq::SharedMemoryEventReceiver::~SharedMemoryEventReceiver()
 {
-	TLOG(TLVL_DEBUG + 33) << "ReadyForRead BEGIN timeout_us=" << timeout_us;
-	if (current_read_buffer_ != -1 && (current_data_source_ != nullptr) && (current_header_ != nullptr))
+	returnPrefetched_();
+}
+
+void artdaq::SharedMemoryEventReceiver::SetPrefetch(bool enable)
+{
+	TLOG(TLVL_DEBUG + 33) << "SetPrefetch: " << std::boolalpha << enable;
+	prefetch_ = enable;
+	if (!enable)
 	{
-		TLOG(TLVL_DEBUG + 33) << "ReadyForRead Returning true because already reading buffer";
-		return true;
+		returnPrefetched_();
 	}
+}
 
+artdaq::SharedMemoryEventReceiver::EventHandle artdaq::SharedMemoryEventReceiver::AcquireEvent(bool broadcast, size_t timeout_us)
+{
+	TLOG(TLVL_DEBUG + 33) << "AcquireEvent BEGIN timeout_us=" << timeout_us;
 	bool first = true;
 	auto start_time = TimeUtils::gettimeofday_us();
 	uint64_t time_diff = 0;
-	uint64_t max_sleep = 5000000;  // 5 seconds
-	int buf = -1;
+	uint64_t max_wait = 100000;  // Check for broadcasts and End-Of-Data at least every 100 ms
 	while (first || time_diff < timeout_us)
 	{
+		SharedMemoryManager* source = nullptr;
+		int buf = -1;
 		if (broadcasts_.ReadyForRead())
 		{
 			buf = broadcasts_.GetBufferForReading();
-			current_data_source_ = &broadcasts_;
+			source = &broadcasts_;
 		}
-		else if (!broadcast && data_.ReadyForRead())
+		if (buf == -1 && !broadcast && data_.ReadyForRead())
 		{
 			buf = data_.GetBufferForReading();
-			current_data_source_ = &data_;
+			source = &data_;
 		}
-		if (buf != -1 && (current_data_source_ != nullptr))
+		if (buf != -1)
 		{
-			current_read_buffer_ = buf;
-			current_data_source_->ResetReadPos(buf);
-			current_header_ = reinterpret_cast<detail::RawEventHeader*>(current_data_source_->GetReadPos(buf));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
-			TLOG(TLVL_DEBUG + 33) << "ReadyForRead Found buffer, returning true. event hdr sequence_id=" << current_header_->sequence_id;
+			EventHandle event(source, buf, static_cast<detail::RawEventHeader*>(source->GetBufferStart(buf)));
+			TLOG(TLVL_DEBUG + 33) << "AcquireEvent Found buffer " << buf << ", event hdr sequence_id=" << event.Header()->sequence_id;
 
 			// Ignore any Init fragments after the first
-			if (current_data_source_ == &broadcasts_)
+			if (source == &broadcasts_)
 			{
 				bool err;
-				auto types = GetFragmentTypes(err);
-				if (!err && (types.count(Fragment::type_t(Fragment::InitFragmentType)) != 0u) && initialized_)
+				auto types = event.GetFragmentTypes(err);
+				if (!err && (types.count(Fragment::type_t(Fragment::InitFragmentType)) != 0u) && initialized_.exchange(true))
 				{
-					ReleaseBuffer();
+					event.Release();
 					continue;
 				}
-				if (!err && (types.count(Fragment::type_t(Fragment::InitFragmentType)) != 0u))
-				{
-					initialized_ = true;
-				}
 			}
 
-			return true;
+			return event;
 		}
-		current_data_source_ = nullptr;
 		first = false;
 
 		if (broadcasts_.IsEndOfData() || data_.IsEndOfData())
 		{
-			TLOG(TLVL_DEBUG + 33) << "End-Of-Data condition detected, returning false";
-			return false;
+			TLOG(TLVL_DEBUG + 33) << "End-Of-Data condition detected, returning invalid EventHandle";
+			return EventHandle();
+		}
+
+		time_diff = TimeUtils::gettimeofday_us() - start_time;
+		if (time_diff >= timeout_us)
+		{
+			break;
 		}
 
+		// Block on the shared memory futex until a writer marks a buffer Full
+		auto wait_time = std::min(timeout_us - time_diff, max_wait);
+		if (broadcast)
+		{
+			broadcasts_.WaitForReadable(wait_time);
+		}
+		else
+		{
+			data_.WaitForReadable(wait_time);
+		}
 		time_diff = TimeUtils::gettimeofday_us() - start_time;
-		auto sleep_time = time_diff;
-		if (sleep_time < 10000) sleep_time = 10000;
-		if (sleep_time > max_sleep) sleep_time = max_sleep;
-		usleep(sleep_time);
 	}
-	TLOG(TLVL_DEBUG + 33) << "ReadyForRead returning false";
-	return false;
+	TLOG(TLVL_DEBUG + 33) << "AcquireEvent returning invalid EventHandle";
+	return EventHandle();
+}
+
+bool artdaq::SharedMemoryEventReceiver::ReadyForRead(bool broadcast, size_t timeout_us)
+{
+	TLOG(TLVL_DEBUG + 33) << "ReadyForRead BEGIN timeout_us=" << timeout_us;
+	if (current_event_.IsValid())
+	{
+		TLOG(TLVL_DEBUG + 33) << "ReadyForRead Returning true because already reading buffer";
+		return true;
+	}
+
+	if (prefetched_event_.IsValid() && !prefetched_event_.CheckBuffer())
+	{
+		// The buffer timed out and was given to another reader; it is no longer ours to release
+		TLOG(TLVL_WARNING) << "ReadyForRead: Lost read-ahead buffer " << prefetched_event_.GetBuffer();
+		prefetched_event_.reset_();
+	}
+	if (prefetched_event_.IsValid() && !broadcast)
+	{
+		// Broadcasts still come before the buffer read ahead
+		if (broadcasts_.ReadyForRead())
+		{
+			current_event_ = AcquireEvent(true, 0);
+		}
+		if (!current_event_.IsValid())
+		{
+			TLOG(TLVL_DEBUG + 33) << "ReadyForRead using read-ahead buffer " << prefetched_event_.GetBuffer();
+			current_event_ = std::move(prefetched_event_);
+		}
+	}
+	else
+	{
+		current_event_ = AcquireEvent(broadcast, timeout_us);
+	}
+	if (prefetch_ && current_event_.IsValid())
+	{
+		prefetchNext_();
+	}
+	TLOG(TLVL_DEBUG + 33) << "ReadyForRead returning " << std::boolalpha << current_event_.IsValid();
+	return current_event_.IsValid();
+}
+
+void artdaq::SharedMemoryEventReceiver::prefetchNext_()
+{
+	if (prefetched_event_.IsValid() || !data_.ReadyForRead())
+	{
+		return;
+	}
+	auto buf = data_.GetBufferForReading();
+	if (buf == -1)
+	{
+		return;
+	}
+	auto start = static_cast<uint8_t const*>(data_.GetBufferStart(buf));
+	prefetched_event_ = EventHandle(&data_, buf, static_cast<detail::RawEventHeader*>(data_.GetBufferStart(buf)));
+	data_.PrefetchBuffer(buf);
+
+	// Warm the cache lines of the header and TOC; Fragments are only touched when they are read
+	auto size = data_.BufferDataSize(buf);
+	size_t warm = sizeof(detail::RawEventHeader) + sizeof(detail::RawEventTOC);
+	auto toc = tocIn_(start, size);
+	if (toc != nullptr && toc->valid())
+	{
+		warm = sizeof(detail::RawEventHeader) + detail::RawEventTOC::SizeBytes(toc->entry_count);
+	}
+	for (size_t off = 0; off < std::min(warm, size); off += SharedMemoryManager::CacheLineSize)
+	{
+		__builtin_prefetch(start + off);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+	TLOG(TLVL_DEBUG + 33) << "Read ahead buffer " << buf << ", event hdr sequence_id=" << prefetched_event_.Header()->sequence_id;
+}
+
+void artdaq::SharedMemoryEventReceiver::returnPrefetched_()
+{
+	if (!prefetched_event_.IsValid())
+	{
+		return;
+	}
+	TLOG(TLVL_DEBUG + 33) << "Returning read-ahead buffer " << prefetched_event_.GetBuffer() << " unread";
+	try
+	{
+		data_.ReturnBufferUnread(prefetched_event_.GetBuffer());
+	}
+	catch (cet::exception const& e)
+	{
+		TLOG(TLVL_WARNING) << "A cet::exception occured while trying to return the read-ahead buffer: " << e;
+	}
+	prefetched_event_.reset_();
 }
 
 artdaq::detail::RawEventHeader* artdaq::SharedMemoryEventReceiver::ReadHeader(bool& err)
 {
 	TLOG(TLVL_DEBUG + 33) << "ReadHeader BEGIN";
-	if (current_read_buffer_ != -1 && (current_data_source_ != nullptr))
+	if (current_event_.IsValid())
 	{
-		err = !current_data_source_->CheckBuffer(current_read_buffer_, SharedMemoryManager::BufferSemaphoreFlags::Reading);
+		err = !current_event_.CheckBuffer();
 		if (err)
 		{
 			TLOG(TLVL_WARNING) << "Buffer was in incorrect state, resetting";
-			current_data_source_ = nullptr;
-			current_read_buffer_ = -1;
-			current_header_ = nullptr;
+			current_event_.reset_();
 			return nullptr;
 		}
 	}
 	TLOG(TLVL_DEBUG + 33) << "Already have buffer, returning stored header";
-	return current_header_;
+	return current_event_.Header();
+}
+
+artdaq::SharedMemoryEventReceiver::EventHandle& artdaq::SharedMemoryEventReceiver::currentEvent_(char const* caller)
+{
+	if (!current_event_.IsValid())
+	{
+		throw cet::exception("AccessViolation") << "Cannot call " << caller << " when not currently reading a buffer! Call ReadHeader() first!";  // NOLINT(cert-err60-cpp)
+	}
+	return current_event_;
 }
 
 std::set<artdaq::Fragment::type_t> artdaq::SharedMemoryEventReceiver::GetFragmentTypes(bool& err)
 {
-	if (current_read_buffer_ == -1 || (current_header_ == nullptr) || (current_data_source_ == nullptr))
+	return currentEvent_("GetFragmentTypes").GetFragmentTypes(err);
+}
+
+std::unique_ptr<artdaq::Fragments> artdaq::SharedMemoryEventReceiver::GetFragmentsByType(bool& err, Fragment::type_t type)
+{
+	return currentEvent_("GetFragmentsByType").GetFragmentsByType(err, type);
+}
+
+std::map<artdaq::Fragment::type_t, std::unique_ptr<artdaq::Fragments>> artdaq::SharedMemoryEventReceiver::GetFragmentsGroupedByType(bool& err)
+{
+	return currentEvent_("GetFragmentsGroupedByType").GetFragmentsGroupedByType(err);
+}
+
+std::vector<artdaq::SharedMemoryEventReceiver::FragmentView> artdaq::SharedMemoryEventReceiver::GetFragmentViewsByType(bool& err, Fragment::type_t type)
+{
+	return currentEvent_("GetFragmentViewsByType").GetFragmentViewsByType(err, type);
+}
+
+void artdaq::SharedMemoryEventReceiver::ReleaseBuffer()
+{
+	TLOG(TLVL_DEBUG + 33) << "ReleaseBuffer BEGIN";
+	current_event_.Release();
+	TLOG(TLVL_DEBUG + 33) << "ReleaseBuffer END";
+}
+
+bool artdaq::SharedMemoryEventReceiver::EventHandle::CheckBuffer() const
+{
+	return IsValid() && source_->CheckBuffer(buffer_, SharedMemoryManager::BufferSemaphoreFlags::Reading);
+}
+
+std::set<artdaq::Fragment::type_t> artdaq::SharedMemoryEventReceiver::EventHandle::GetFragmentTypes(bool& err) const
+{
+	auto output = std::set<Fragment::type_t>();
+	err = !CheckBuffer();
+	if (err)
+	{
+		return output;
+	}
+
+	auto toc = tocIn_(static_cast<uint8_t const*>(source_->GetBufferStart(buffer_)), source_->BufferDataSize(buffer_));
+	if (toc != nullptr && toc->valid())
+	{
+		// The types are listed in the TOC, no need to touch the Fragments
+		for (uint32_t ii = 0; ii < toc->entry_count; ++ii)
+		{
+			output.insert(toc->entries()[ii].type);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		}
+	}
+	else
+	{
+		err = !forEachFragment_(Fragment::InvalidFragmentType, [&](detail::RawFragmentHeader const* fragHdr) { output.insert(fragHdr->type); });
+	}
+	err = err || !CheckBuffer();
+	if (err)
 	{
-		throw cet::exception("AccessViolation") << "Cannot call GetFragmentTypes when not currently reading a buffer! Call ReadHeader() first!";  // NOLINT(cert-err60-cpp)
+		output.clear();
 	}
+	return output;
+}
 
-	err = !current_data_source_->CheckBuffer(current_read_buffer_, SharedMemoryManager::BufferSemaphoreFlags::Reading);
+std::unique_ptr<artdaq::Fragments> artdaq::SharedMemoryEventReceiver::EventHandle::GetFragmentsByType(bool& err, Fragment::type_t type) const
+{
+	err = !CheckBuffer();
 	if (err)
 	{
-		return std::set<Fragment::type_t>();
+		return nullptr;
 	}
 
-	current_data_source_->ResetReadPos(current_read_buffer_);
-	current_data_source_->IncrementReadPos(current_read_buffer_, sizeof(detail::RawEventHeader));
-	auto output = std::set<Fragment::type_t>();
+	std::unique_ptr<Fragments> output(new Fragments());
+	err = !forEachFragment_(type, [&](detail::RawFragmentHeader const* fragHdr) {
+		output->emplace_back(fragHdr->word_count - detail::RawFragmentHeader::num_words());
+		memcpy(output->back().headerAddress(), fragHdr, fragHdr->word_count * sizeof(RawDataType));
+		output->back().autoResize();
+	});
 
-	while (current_data_source_->MoreDataInBuffer(current_read_buffer_))
+	// The walk does not lock the buffer for each Fragment; make sure it was not taken away while copying
+	err = err || !CheckBuffer();
+	if (err)
 	{
-		err = !current_data_source_->CheckBuffer(current_read_buffer_, SharedMemoryManager::BufferSemaphoreFlags::Reading);
-		if (err)
+		return nullptr;
+	}
+	return output;
+}
+
+std::map<artdaq::Fragment::type_t, std::unique_ptr<artdaq::Fragments>> artdaq::SharedMemoryEventReceiver::EventHandle::GetFragmentsGroupedByType(bool& err) const
+{
+	std::map<Fragment::type_t, std::unique_ptr<Fragments>> output;
+	err = !CheckBuffer();
+	if (err)
+	{
+		return output;
+	}
+
+	err = !forEachFragment_(Fragment::InvalidFragmentType, [&](detail::RawFragmentHeader const* fragHdr) {
+		auto& frags = output[fragHdr->type];
+		if (!frags)
 		{
-			return std::set<Fragment::type_t>();
+			frags = std::make_unique<Fragments>();
 		}
-		auto fragHdr = reinterpret_cast<artdaq::detail::RawFragmentHeader*>(current_data_source_->GetReadPos(current_read_buffer_));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
-		output.insert(fragHdr->type);
-		current_data_source_->IncrementReadPos(current_read_buffer_, fragHdr->word_count * sizeof(RawDataType));
-	}
+		frags->emplace_back(fragHdr->word_count - detail::RawFragmentHeader::num_words());
+		memcpy(frags->back().headerAddress(), fragHdr, fragHdr->word_count * sizeof(RawDataType));
+		frags->back().autoResize();
+	});
 
+	err = err || !CheckBuffer();
+	if (err)
+	{
+		output.clear();
+	}
 	return output;
 }
 
-std::unique_ptr<artdaq::Fragments> artdaq::SharedMemoryEventReceiver::GetFragmentsByType(bool& err, Fragment::type_t type)
+std::vector<artdaq::SharedMemoryEventReceiver::FragmentView> artdaq::SharedMemoryEventReceiver::EventHandle::GetFragmentViewsByType(bool& err, Fragment::type_t type) const
 {
-	if ((current_data_source_ == nullptr) || (current_header_ == nullptr) || current_read_buffer_ == -1)
+	std::vector<FragmentView> output;
+	err = !CheckBuffer();
+	if (err)
 	{
-		throw cet::exception("AccessViolation") << "Cannot call GetFragmentsByType when not currently reading a buffer! Call ReadHeader() first!";  // NOLINT(cert-err60-cpp)
+		return output;
 	}
-	err = !current_data_source_->CheckBuffer(current_read_buffer_, SharedMemoryManager::BufferSemaphoreFlags::Reading);
+
+	err = !forEachFragment_(type, [&](detail::RawFragmentHeader const* fragHdr) {
+		auto words = reinterpret_cast<RawDataType const*>(fragHdr);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		output.push_back(FragmentView{fragHdr, {words + detail::RawFragmentHeader::num_words(), fragHdr->word_count - detail::RawFragmentHeader::num_words()}});  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	});
+
+	err = err || !CheckBuffer();
 	if (err)
 	{
-		return nullptr;
+		output.clear();
 	}
+	return output;
+}
 
-	current_data_source_->ResetReadPos(current_read_buffer_);
-	current_data_source_->IncrementReadPos(current_read_buffer_, sizeof(detail::RawEventHeader));
+void artdaq::SharedMemoryEventReceiver::EventHandle::Release()
+{
+	if (source_ == nullptr)
+	{
+		return;
+	}
+	TLOG(TLVL_DEBUG + 33) << "Releasing buffer " << buffer_;
+	try
+	{
+		source_->MarkBufferEmpty(buffer_, false, false);
+	}
+	catch (cet::exception const& e)
+	{
+		TLOG(TLVL_WARNING) << "A cet::exception occured while trying to release the buffer: " << e;
+	}
+	catch (...)
+	{
+		TLOG(TLVL_ERROR) << "An unknown exception occured while trying to release the buffer";
+	}
+	reset_();
+}
 
-	std::unique_ptr<Fragments> output(new Fragments());
+bool artdaq::SharedMemoryEventReceiver::EventHandle::forEachFragment_(Fragment::type_t type, std::function<void(detail::RawFragmentHeader const*)> const& func) const
+{
+	// Walk the Fragments in the buffer directly, without moving the buffer's read position,
+	// so that handles on different buffers never share any state in the SharedMemoryManager
+	return forEachFragmentIn_(static_cast<uint8_t const*>(source_->GetBufferStart(buffer_)), source_->BufferDataSize(buffer_), type, func);
+}
 
-	while (current_data_source_->MoreDataInBuffer(current_read_buffer_))
+artdaq::detail::RawEventTOC const* artdaq::SharedMemoryEventReceiver::tocIn_(uint8_t const* start, size_t size)
+{
+	if (size < sizeof(detail::RawEventHeader) + sizeof(detail::RawEventTOC))
 	{
-		err = !current_data_source_->CheckBuffer(current_read_buffer_, SharedMemoryManager::BufferSemaphoreFlags::Reading);
-		if (err)
+		return nullptr;
+	}
+	auto toc = reinterpret_cast<detail::RawEventTOC const*>(start + sizeof(detail::RawEventHeader));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	if (toc->zero != 0 || toc->magic != detail::RawEventTOC::MAGIC)
+	{
+		return nullptr;
+	}
+	return toc;
+}
+
+bool artdaq::SharedMemoryEventReceiver::forEachFragmentIn_(uint8_t const* start, size_t size, Fragment::type_t type, std::function<void(detail::RawFragmentHeader const*)> const& func)
+{
+	auto toc = tocIn_(start, size);
+	if (toc != nullptr)
+	{
+		// Only the TOC and the requested Fragments are touched
+		size_t first = sizeof(detail::RawEventHeader) + detail::RawEventTOC::SizeBytes(toc->capacity);
+		if (!toc->valid() || first > size)
 		{
-			return nullptr;
+			TLOG(TLVL_WARNING) << "Event TOC with " << toc->entry_count << " of " << toc->capacity << " entries does not fit in buffer data size " << size;
+			return false;
 		}
-		auto fragHdr = reinterpret_cast<artdaq::detail::RawFragmentHeader*>(current_data_source_->GetReadPos(current_read_buffer_));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
-		if (fragHdr->type == type || type == Fragment::InvalidFragmentType)
+		for (uint32_t ii = 0; ii < toc->entry_count; ++ii)
 		{
-			output->emplace_back(fragHdr->word_count - detail::RawFragmentHeader::num_words());
-			current_data_source_->Read(current_read_buffer_, output->back().headerAddress(), fragHdr->word_count * sizeof(RawDataType));
-			output->back().autoResize();
+			auto const& entry = toc->entries()[ii];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			if (type != Fragment::InvalidFragmentType && entry.type != type)
+			{
+				continue;
+			}
+			size_t fragSize = entry.word_count * sizeof(RawDataType);
+			if (entry.offset < first || entry.word_count < detail::RawFragmentHeader::num_words() || entry.offset + fragSize > size)
+			{
+				TLOG(TLVL_WARNING) << "Event TOC entry " << ii << " points to invalid Fragment at offset " << entry.offset << " with size " << fragSize << " (buffer data size " << size << ")";
+				return false;
+			}
+			auto fragHdr = reinterpret_cast<detail::RawFragmentHeader const*>(start + entry.offset);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			if (fragHdr->word_count != entry.word_count)
+			{
+				TLOG(TLVL_WARNING) << "Event TOC entry " << ii << " has size " << entry.word_count << " words, but the Fragment at offset " << entry.offset << " has " << fragHdr->word_count;
+				return false;
+			}
+			func(fragHdr);
 		}
-		else
+		return true;
+	}
+
+	size_t pos = sizeof(detail::RawEventHeader);
+	while (pos < size)
+	{
+		auto fragHdr = reinterpret_cast<detail::RawFragmentHeader const*>(start + pos);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		size_t fragSize = fragHdr->word_count * sizeof(RawDataType);
+		if (fragHdr->word_count < detail::RawFragmentHeader::num_words() || pos + fragSize > size)
 		{
-			current_data_source_->IncrementReadPos(current_read_buffer_, fragHdr->word_count * sizeof(RawDataType));
+			TLOG(TLVL_WARNING) << "Fragment at offset " << pos << " has invalid size " << fragSize << " (buffer data size " << size << ")";
+			return false;
 		}
+		if (type == Fragment::InvalidFragmentType || fragHdr->type == type)
+		{
+			func(fragHdr);
+		}
+		pos += fragSize;
 	}
-
-	return output;
+	return true;
 }
 
 std::string artdaq::SharedMemoryEventReceiver::printBuffers_(SharedMemoryManager* data_source)
@@ -185,20 +457,21 @@ std::string artdaq::SharedMemoryEventReceiver::printBuffers_(SharedMemoryManager
 	{
 		ostr << "Buffer " << ii << ": " << std::endl;
 
-		data_source->ResetReadPos(ii);
-		data_source->IncrementReadPos(ii, sizeof(detail::RawEventHeader));
-
-		while (data_source->MoreDataInBuffer(ii))
+		auto start = static_cast<uint8_t const*>(data_source->GetBufferStart(ii));
+		auto size = data_source->BufferDataSize(ii);
+		auto toc = tocIn_(start, size);
+		if (toc != nullptr)
 		{
-			auto fragHdr = reinterpret_cast<artdaq::detail::RawFragmentHeader*>(data_source->GetReadPos(ii));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+			ostr << "    TOC: " << toc->entry_count << " of " << toc->capacity << " entries used" << std::endl;
+		}
+		forEachFragmentIn_(start, size, Fragment::InvalidFragmentType, [&](detail::RawFragmentHeader const* fragHdr) {
 			ostr << "    Fragment " << fragHdr->fragment_id << ": Sequence ID: " << fragHdr->sequence_id << ", Type:" << fragHdr->type;
 			if (artdaq::detail::RawFragmentHeader::MakeVerboseSystemTypeMap().count(fragHdr->type) != 0u)
 			{
 				ostr << " (" << artdaq::detail::RawFragmentHeader::MakeVerboseSystemTypeMap()[fragHdr->type] << ")";
 			}
 			ostr << ", Size: " << fragHdr->word_count << " words." << std::endl;
-			data_source->IncrementReadPos(ii, fragHdr->word_count * sizeof(RawDataType));
-		}
+		});
 	}
 	return ostr.str();
 }
@@ -219,27 +492,3 @@ std::string artdaq::SharedMemoryEventReceiver::toString()
 
 	return ostr.str();
 }
-
-void artdaq::SharedMemoryEventReceiver::ReleaseBuffer()
-{
-	TLOG(TLVL_DEBUG + 33) << "ReleaseBuffer BEGIN";
-	try
-	{
-		if (current_data_source_ != nullptr)
-		{
-			current_data_source_->MarkBufferEmpty(current_read_buffer_, false, false);
-		}
-	}
-	catch (cet::exception const& e)
-	{
-		TLOG(TLVL_WARNING) << "A cet::exception occured while trying to release the buffer: " << e;
-	}
-	catch (...)
-	{
-		TLOG(TLVL_ERROR) << "An unknown exception occured while trying to release the buffer";
-	}
-	current_read_buffer_ = -1;
-	current_header_ = nullptr;
-	current_data_source_ = nullptr;
-	TLOG(TLVL_DEBUG + 33) << "ReleaseBuffer END";
-}
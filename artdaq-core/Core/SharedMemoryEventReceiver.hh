@@ -1,7 +1,11 @@
 #ifndef artdaq_core_Core_SharedMemoryEventReceiver_hh
 #define artdaq_core_Core_SharedMemoryEventReceiver_hh 1
 
+#include <atomic>
+#include <functional>
+#include <map>
 #include <set>
+#include <vector>
 
 #include "artdaq-core/Core/SharedMemoryManager.hh"
 #include "artdaq-core/Data/Fragment.hh"
@@ -10,10 +14,158 @@
 namespace artdaq {
 /**
 	 * \brief SharedMemoryEventReceiver can receive events (as written by SharedMemoryEventManager) from Shared Memory
+	 *
+	 * Each buffer holds a RawEventHeader followed by the event's Fragments. When the writer puts a detail::RawEventTOC
+	 * after the header, Fragments are located through it, and GetFragmentTypes only reads the TOC.
 	 */
 class SharedMemoryEventReceiver
 {
 public:
+	/**
+		 * \brief A read-only, zero-copy view of a Fragment stored in the Shared Memory buffer currently being read.
+		 *
+		 * Views point directly into Shared Memory and are only valid until the buffer is released.
+		 */
+	struct FragmentView
+	{
+		detail::RawFragmentHeader const* header;                     ///< Header of the Fragment, in Shared Memory
+		SharedMemoryManager::BufferSpan<RawDataType const> payload;  ///< Words following the header (metadata and payload), in Shared Memory
+
+		/**
+			 * \brief Get the total size of the Fragment, including its header
+			 * \return Size of the Fragment, in bytes
+			 */
+		size_t sizeBytes() const { return header->word_count * sizeof(RawDataType); }
+	};
+
+	/**
+		 * \brief An EventHandle owns one Shared Memory buffer being read, so that several threads can each process their own event.
+		 *
+		 * Handles are obtained from SharedMemoryEventReceiver::AcquireEvent and release their buffer when destroyed
+		 * (or when Release() is called). A handle must not outlive the SharedMemoryEventReceiver which created it.
+		 */
+	class EventHandle
+	{
+	public:
+		/**
+			 * \brief Construct an invalid (empty) EventHandle
+			 */
+		EventHandle()
+		    : source_(nullptr), buffer_(-1), header_(nullptr) {}
+
+		/**
+			 * \brief EventHandle Destructor. Releases the buffer if it is still held.
+			 */
+		~EventHandle() { Release(); }
+
+		/**
+			 * \brief Move Constructor. The moved-from handle becomes invalid.
+			 * \param other EventHandle to take ownership of the buffer from
+			 */
+		EventHandle(EventHandle&& other) noexcept
+		    : source_(other.source_), buffer_(other.buffer_), header_(other.header_)
+		{
+			other.reset_();
+		}
+
+		/**
+			 * \brief Move Assignment Operator. Releases any buffer currently held by this handle.
+			 * \param other EventHandle to take ownership of the buffer from
+			 * \return Reference to this EventHandle
+			 */
+		EventHandle& operator=(EventHandle&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Release();
+				source_ = other.source_;
+				buffer_ = other.buffer_;
+				header_ = other.header_;
+				other.reset_();
+			}
+			return *this;
+		}
+
+		EventHandle(EventHandle const&) = delete;             ///< Copy Constructor is deleted
+		EventHandle& operator=(EventHandle const&) = delete;  ///< Copy Assignment Operator is deleted
+
+		/**
+			 * \brief Whether this handle holds a buffer
+			 * \return True if the handle holds a buffer
+			 */
+		bool IsValid() const { return source_ != nullptr && buffer_ != -1 && header_ != nullptr; }
+
+		/**
+			 * \brief Check that the buffer is still held by this reader
+			 * \return True if the buffer is still in the Reading state and owned by this reader
+			 */
+		bool CheckBuffer() const;
+
+		/**
+			 * \brief Get the Event header
+			 * \return Pointer to RawEventHeader in the buffer, or nullptr if the handle is not valid
+			 */
+		detail::RawEventHeader* Header() const { return header_; }
+
+		/**
+			 * \brief Get the buffer ID held by this handle
+			 * \return Buffer ID, or -1 if the handle is not valid
+			 */
+		int GetBuffer() const { return buffer_; }
+
+		/**
+			 * \brief Get a set of Fragment Types present in the event
+			 * \param err Flag used to indicate if an error has occurred
+			 * \return std::set of Fragment::type_t of all Fragment types in the event
+			 */
+		std::set<Fragment::type_t> GetFragmentTypes(bool& err) const;
+
+		/**
+			 * \brief Get a pointer to the Fragments of a given type in the event
+			 * \param err Flag used to indicate if an error has occurred
+			 * \param type Type of Fragments to get. (Use InvalidFragmentType to get all Fragments)
+			 * \return std::unique_ptr to a Fragments object containing returned Fragment objects
+			 */
+		std::unique_ptr<Fragments> GetFragmentsByType(bool& err, Fragment::type_t type) const;
+
+		/**
+			 * \brief Get all Fragments in the event, grouped by type, in a single pass over the buffer
+			 * \param err Flag used to indicate if an error has occurred
+			 * \return Map from Fragment type to a std::unique_ptr to a Fragments object containing the Fragments of that type
+			 */
+		std::map<Fragment::type_t, std::unique_ptr<Fragments>> GetFragmentsGroupedByType(bool& err) const;
+
+		/**
+			 * \brief Get zero-copy views of the Fragments of a given type in the event
+			 * \param err Flag used to indicate if an error has occurred
+			 * \param type Type of Fragments to get. (Use InvalidFragmentType to get all Fragments)
+			 * \return FragmentView objects pointing into Shared Memory. They are invalidated by Release().
+			 */
+		std::vector<FragmentView> GetFragmentViewsByType(bool& err, Fragment::type_t type) const;
+
+		/**
+			 * \brief Release the buffer to the Empty state
+			 */
+		void Release();
+
+	private:
+		friend class SharedMemoryEventReceiver;
+		EventHandle(SharedMemoryManager* source, int buffer, detail::RawEventHeader* header)
+		    : source_(source), buffer_(buffer), header_(header) {}
+
+		void reset_()
+		{
+			source_ = nullptr;
+			buffer_ = -1;
+			header_ = nullptr;
+		}
+		bool forEachFragment_(Fragment::type_t type, std::function<void(detail::RawFragmentHeader const*)> const& func) const;
+
+		SharedMemoryManager* source_;
+		int buffer_;
+		detail::RawEventHeader* header_;
+	};
+
 	/**
 		 * \brief Connect to a Shared Memory segment using the given parameters
 		 * \param shm_key Key of the Shared Memory segment
@@ -21,9 +173,35 @@ public:
 		 */
 	SharedMemoryEventReceiver(uint32_t shm_key, uint32_t broadcast_shm_key);
 	/**
-		 * \brief SharedMemoryEventReceiver Destructor
+		 * \brief SharedMemoryEventReceiver Destructor. A buffer reserved by read-ahead is returned unread.
+		 */
+	virtual ~SharedMemoryEventReceiver();
+
+	/**
+		 * \brief Enable or disable read-ahead in ReadyForRead
+		 *
+		 * With read-ahead, every time ReadyForRead starts on an event it also reserves the next Full data buffer, asks the
+		 * kernel to map its pages and prefetches its RawEventHeader and TOC into the cache, so that they are warm by the
+		 * time the current event has been processed. Broadcasts are still delivered first. The reserved buffer is held in
+		 * the Reading state, so other receivers on the segment cannot take it; disabling read-ahead returns it unread.
+		 * \param enable Whether to read ahead
 		 */
-	virtual ~SharedMemoryEventReceiver() = default;
+	void SetPrefetch(bool enable);
+
+	/**
+		 * \brief Whether ReadyForRead reads ahead
+		 * \return True if read-ahead is enabled
+		 */
+	bool GetPrefetch() const { return prefetch_; }
+
+	/**
+		 * \brief Acquire an event for reading, independently of the buffer used by ReadyForRead/ReleaseBuffer.
+		 * This method may be called concurrently from several threads; each thread processes and releases its own EventHandle.
+		 * \param broadcast (Default false) Whether to wait for a broadcast buffer only
+		 * \param timeout_us (Default 1000000) Time to wait for buffer to become available.
+		 * \return An EventHandle owning the buffer. If no event became available, the handle is not valid.
+		 */
+	EventHandle AcquireEvent(bool broadcast = false, size_t timeout_us = 1000000);
 
 	/**
 		 * \brief Determine whether an event is available for reading
@@ -55,6 +233,21 @@ public:
 		 */
 	std::unique_ptr<Fragments> GetFragmentsByType(bool& err, Fragment::type_t type);
 
+	/**
+		 * \brief Get all Fragments in the event, grouped by type, in a single pass over the buffer
+		 * \param err Flag used to indicate if an error has occurred
+		 * \return Map from Fragment type to a std::unique_ptr to a Fragments object containing the Fragments of that type
+		 */
+	std::map<Fragment::type_t, std::unique_ptr<Fragments>> GetFragmentsGroupedByType(bool& err);
+
+	/**
+		 * \brief Get zero-copy views of the Fragments of a given type in the event
+		 * \param err Flag used to indicate if an error has occurred
+		 * \param type Type of Fragments to get. (Use InvalidFragmentType to get all Fragments)
+		 * \return FragmentView objects pointing into Shared Memory. They are invalidated by ReleaseBuffer().
+		 */
+	std::vector<FragmentView> GetFragmentViewsByType(bool& err, Fragment::type_t type);
+
 	/**
 		* \brief Write out information about the Shared Memory to a string
 		* \return String containing information about the current Shared Memory buffers
@@ -88,7 +281,7 @@ public:
 		 * \brief Get the count of available buffers, both broadcasts and data
 		 * \return The sum of the available data buffer count and the available broadcast buffer count
 		 */
-	int ReadReadyCount() { return data_.ReadReadyCount() + broadcasts_.ReadReadyCount(); }
+	int ReadReadyCount() { return data_.ReadReadyCount() + broadcasts_.ReadReadyCount() + (prefetched_event_.IsValid() ? 1 : 0); }
 
 	/**
 		 * \brief Get the size of the data buffer
@@ -103,13 +296,18 @@ private:
 	SharedMemoryEventReceiver& operator=(SharedMemoryEventReceiver&&) = delete;
 
 	std::string printBuffers_(SharedMemoryManager* data_source);
+	static detail::RawEventTOC const* tocIn_(uint8_t const* start, size_t size);
+	static bool forEachFragmentIn_(uint8_t const* start, size_t size, Fragment::type_t type, std::function<void(detail::RawFragmentHeader const*)> const& func);
+	EventHandle& currentEvent_(char const* caller);
+	void prefetchNext_();
+	void returnPrefetched_();
 
-	int current_read_buffer_;
-	bool initialized_;
-	detail::RawEventHeader* current_header_;
-	SharedMemoryManager* current_data_source_;
+	std::atomic<bool> initialized_;
+	bool prefetch_;
 	SharedMemoryManager data_;
 	SharedMemoryManager broadcasts_;
+	EventHandle current_event_;     // Declared last so that it is released before the managers detach
+	EventHandle prefetched_event_;  // Next data buffer reserved by read-ahead
 };
 }  // namespace artdaq
 
@@ -1,28 +1,179 @@
 
 #define TRACE_NAME "SharedMemoryFragmentManager"
 #include "artdaq-core/Core/SharedMemoryFragmentManager.hh"
+#include <algorithm>
 #include "TRACE/tracemf.h"
+#include "cetlib_except/exception.h"
 
-artdaq::SharedMemoryFragmentManager::SharedMemoryFragmentManager(uint32_t shm_key, size_t buffer_count, size_t max_buffer_size, size_t buffer_timeout_us)
-    : SharedMemoryManager(shm_key, buffer_count, max_buffer_size, buffer_timeout_us)
+artdaq::SharedMemoryFragmentManager::SharedMemoryFragmentManager(uint32_t shm_key, size_t buffer_count, size_t max_buffer_size, size_t buffer_timeout_us, SegmentOptions const& options)
+    : SharedMemoryManager(shm_key, buffer_count, max_buffer_size, buffer_timeout_us, true, options)
     , active_buffer_(-1)
+    , read_buffer_(-1)
+    , packed_buffer_(-1)
+    , packed_count_(0)
+    , packing_stop_(false)
 {
 }
 
-bool artdaq::SharedMemoryFragmentManager::ReadyForWrite(bool overwrite)
+artdaq::SharedMemoryFragmentManager::SharedMemoryFragmentManager(uint32_t shm_key, std::vector<SizeClass> const& size_classes, size_t buffer_timeout_us, SegmentOptions const& options)
+    : SharedMemoryManager(shm_key, size_classes, buffer_timeout_us, true, options)
+    , active_buffer_(-1)
+    , read_buffer_(-1)
+    , packed_buffer_(-1)
+    , packed_count_(0)
+    , packing_stop_(false)
+{
+}
+
+artdaq::SharedMemoryFragmentManager::~SharedMemoryFragmentManager()
+{
+	stopPackingTimer_();
+	// Packed Fragments which have not been released yet would otherwise be lost when the buffer times out
+	if (IsValid())
+	{
+		FlushPackedFragments();
+	}
+}
+
+void artdaq::SharedMemoryFragmentManager::SetPacking(PackingOptions const& options)
+{
+	stopPackingTimer_();
+	{
+		std::lock_guard<std::mutex> lk(packing_mutex_);
+		flushPacked_();
+		packing_ = options;
+	}
+	TLOG(TLVL_DEBUG + 40) << "SetPacking: max_fragments=" << packing_.max_fragments << ", max_bytes=" << packing_.max_bytes << ", max_delay_us=" << packing_.max_delay_us;
+	if (packingEnabled_() && packing_.max_delay_us != 0)
+	{
+		startPackingTimer_();
+	}
+}
+
+size_t artdaq::SharedMemoryFragmentManager::FlushPackedFragments()
+{
+	std::lock_guard<std::mutex> lk(packing_mutex_);
+	return flushPacked_();
+}
+
+size_t artdaq::SharedMemoryFragmentManager::flushPacked_()
+{
+	if (packed_buffer_ == -1)
+	{
+		return 0;
+	}
+	auto count = packed_count_;
+	if (IsValid() && CheckBuffer(packed_buffer_, BufferSemaphoreFlags::Writing))
+	{
+		TLOG(TLVL_DEBUG + 41) << "FlushPackedFragments: Marking buffer " << packed_buffer_ << " Full with " << count << " Fragments";
+		MarkBufferFull(packed_buffer_);
+	}
+	else
+	{
+		TLOG(TLVL_WARNING) << "FlushPackedFragments: Buffer " << packed_buffer_ << " is no longer owned by this manager, " << count << " packed Fragments were lost";
+		count = 0;
+	}
+	packed_buffer_ = -1;
+	packed_count_ = 0;
+	return count;
+}
+
+void artdaq::SharedMemoryFragmentManager::flushPackedIfDue_()
+{
+	if (packed_buffer_ == -1)
+	{
+		return;
+	}
+	auto dataSize = BufferDataSize(packed_buffer_);
+	auto hdrSize = artdaq::detail::RawFragmentHeader::num_words() * sizeof(artdaq::RawDataType);
+	if ((packing_.max_fragments != 0 && packed_count_ >= packing_.max_fragments) ||
+	    (packing_.max_bytes != 0 && dataSize + hdrSize > packing_.max_bytes) ||
+	    dataSize + hdrSize > BufferSize(packed_buffer_) ||
+	    (packing_.max_delay_us != 0 && TimeUtils::GetElapsedTimeMicroseconds(packed_since_) >= packing_.max_delay_us))
+	{
+		flushPacked_();
+	}
+}
+
+void artdaq::SharedMemoryFragmentManager::startPackingTimer_()
+{
+	packing_stop_ = false;
+	packing_thread_ = std::thread([this] { packingTimerLoop_(); });
+}
+
+void artdaq::SharedMemoryFragmentManager::stopPackingTimer_()
+{
+	if (!packing_thread_.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lk(packing_mutex_);
+		packing_stop_ = true;
+	}
+	packing_cv_.notify_all();
+	packing_thread_.join();
+}
+
+void artdaq::SharedMemoryFragmentManager::packingTimerLoop_()
+{
+	// Sleeps until the open packed buffer reaches its deadline, so that the last Fragments written before the writer
+	// goes idle are released without waiting for another write. WriteFragment wakes the timer when it opens a buffer.
+	std::unique_lock<std::mutex> lk(packing_mutex_);
+	try
+	{
+		while (!packing_stop_)
+		{
+			if (packed_buffer_ == -1)
+			{
+				packing_cv_.wait(lk);
+				continue;
+			}
+			auto deadline = packed_since_ + std::chrono::microseconds(packing_.max_delay_us);
+			if (std::chrono::steady_clock::now() < deadline)
+			{
+				packing_cv_.wait_until(lk, deadline);
+				continue;
+			}
+			TLOG(TLVL_DEBUG + 41) << "Packed buffer " << packed_buffer_ << " reached its deadline of " << packing_.max_delay_us << " us, flushing";
+			flushPacked_();
+		}
+	}
+	catch (cet::exception const& ex)
+	{
+		TLOG(TLVL_ERROR) << "Packing timer caught exception, stopping: " << ex.explain_self();
+	}
+}
+
+bool artdaq::SharedMemoryFragmentManager::ReadyForWrite(bool overwrite, size_t size_hint)
+{
+	std::lock_guard<std::mutex> lk(packing_mutex_);
+	return readyForWrite_(overwrite, size_hint);
+}
+
+bool artdaq::SharedMemoryFragmentManager::readyForWrite_(bool overwrite, size_t size_hint)
 {
 	TLOG(TLVL_DEBUG + 40) << "ReadyForWrite: active_buffer is " << active_buffer_;
+	flushPackedIfDue_();
 	if (active_buffer_ != -1)
 	{
-		return true;
+		if (BufferSize(active_buffer_) >= size_hint)
+		{
+			return true;
+		}
+		// The reserved buffer is from a size class which is too small, give it back
+		TLOG(TLVL_DEBUG + 40) << "ReadyForWrite: active_buffer " << active_buffer_ << " is too small for " << size_hint << " bytes, releasing it";
+		MarkBufferEmpty(active_buffer_, true);
+		active_buffer_ = -1;
 	}
-	active_buffer_ = GetBufferForWriting(overwrite);
+	active_buffer_ = GetBufferForWriting(overwrite, size_hint);
 
 	return active_buffer_ != -1;
 }
 
 int artdaq::SharedMemoryFragmentManager::WriteFragment(Fragment&& fragment, bool overwrite, size_t timeout_us)
 {
+	std::unique_lock<std::mutex> lk(packing_mutex_);
 	if (!IsValid() || IsEndOfData())
 	{
 		TLOG(TLVL_WARNING) << "WriteFragment: Shared memory is not connected! Attempting reconnect...";
@@ -34,34 +185,72 @@ int artdaq::SharedMemoryFragmentManager::WriteFragment(Fragment&& fragment, bool
 		TLOG(TLVL_INFO) << "WriteFragment: Shared memory was successfully reconnected";
 	}
 
-	auto waitStart = std::chrono::steady_clock::now();
-	while (!ReadyForWrite(overwrite) && TimeUtils::GetElapsedTimeMicroseconds(waitStart) < 1000)
+	size_t fragSize = fragment.size() * sizeof(artdaq::RawDataType);
+	if (packed_buffer_ != -1)
 	{
-		// BURN THAT CPU!
+		size_t limit = BufferSize(packed_buffer_);
+		if (packing_.max_bytes != 0)
+		{
+			limit = std::min(limit, packing_.max_bytes);
+		}
+		if (BufferDataSize(packed_buffer_) + fragSize <= limit)
+		{
+			TLOG(TLVL_DEBUG + 41) << "Packing fragment with seqID=" << fragment.sequenceID() << " into buffer " << packed_buffer_ << " after " << packed_count_ << " Fragments";
+			auto sts = Write(packed_buffer_, fragment.headerAddress(), fragSize);
+			if (sts != fragSize)
+			{
+				TLOG(TLVL_ERROR) << "Unexpected status from SharedMemory Write call! Dropping the " << packed_count_ << " Fragments packed in buffer " << packed_buffer_;
+				if (IsValid() && CheckBuffer(packed_buffer_, BufferSemaphoreFlags::Writing))
+				{
+					MarkBufferEmpty(packed_buffer_, true);
+				}
+				packed_buffer_ = -1;
+				packed_count_ = 0;
+				return -2;
+			}
+			++packed_count_;
+			flushPackedIfDue_();
+			return 0;
+		}
+		flushPacked_();
 	}
-	if (!ReadyForWrite(overwrite))
+
+	// Ask for a buffer from the smallest size class which can hold the Fragment (or, when packing, max_bytes of
+	// Fragments). Oversized Fragments still get a buffer, so that Write reports the error instead of waiting forever.
+	size_t size_hint = fragSize <= BufferSize() ? fragSize : 0;
+	if (packingEnabled_() && size_hint != 0 && packing_.max_bytes > size_hint)
 	{
-		int64_t loopCount = 0;
-		size_t sleepTime = 1000;  // microseconds
-		int64_t nloops = (timeout_us - 1000) / sleepTime;
+		size_hint = std::min(packing_.max_bytes, BufferSize());
+	}
 
-		while (!ReadyForWrite(overwrite) && (!overwrite || timeout_us == 0 || loopCount < nloops))
+	auto waitStart = std::chrono::steady_clock::now();
+	while (!readyForWrite_(overwrite, size_hint))
+	{
+		auto elapsed = TimeUtils::GetElapsedTimeMicroseconds(waitStart);
+		if (overwrite && timeout_us != 0 && elapsed >= timeout_us)
 		{
-			if (!IsValid() || IsEndOfData())
+			break;
+		}
+		if (!IsValid() || IsEndOfData())
+		{
+			TLOG(TLVL_WARNING) << "WriteFragment: Shared memory is not connected! Attempting reconnect...";
+			auto sts = Attach(timeout_us);
+			if (!sts)
 			{
-				TLOG(TLVL_WARNING) << "WriteFragment: Shared memory is not connected! Attempting reconnect...";
-				auto sts = Attach(timeout_us);
-				if (!sts)
-				{
-					return -1;
-				}
-				TLOG(TLVL_INFO) << "WriteFragment: Shared memory was successfully reconnected";
+				return -1;
 			}
-			usleep(sleepTime);
-			++loopCount;
+			TLOG(TLVL_INFO) << "WriteFragment: Shared memory was successfully reconnected";
 		}
+
+		// Wait for a buffer using this manager's WaitStrategy (by default, sleep on the writable futex); check the connection at least once a second.
+		// Any packed buffer was flushed above, so the packing timer, ReadyForWrite and FlushPackedFragments may run meanwhile.
+		size_t wait_us = 1000000;
+		if (overwrite && timeout_us != 0) wait_us = std::min(wait_us, timeout_us - elapsed);
+		lk.unlock();
+		WaitForWritable(wait_us, overwrite, size_hint);
+		lk.lock();
 	}
-	if (!ReadyForWrite(overwrite))
+	if (!readyForWrite_(overwrite, size_hint))
 	{
 		TLOG(TLVL_WARNING) << "No available buffers after waiting for " << TimeUtils::GetElapsedTimeMicroseconds(waitStart) << " us.";
 		return -3;
@@ -69,12 +258,23 @@ int artdaq::SharedMemoryFragmentManager::WriteFragment(Fragment&& fragment, bool
 
 	TLOG(TLVL_DEBUG + 41) << "Sending fragment with seqID=" << fragment.sequenceID() << " using buffer " << active_buffer_;
 	artdaq::RawDataType* fragAddr = fragment.headerAddress();
-	size_t fragSize = fragment.size() * sizeof(artdaq::RawDataType);
 
 	auto sts = Write(active_buffer_, fragAddr, fragSize);
 	if (sts == fragSize)
 	{
 		TLOG(TLVL_DEBUG + 41) << "Done sending Fragment with seqID=" << fragment.sequenceID() << " using buffer " << active_buffer_;
+		if (packingEnabled_())
+		{
+			// Keep the buffer open for the following Fragments. Another thread may have opened one while this one was waiting.
+			flushPacked_();
+			packed_buffer_ = active_buffer_;
+			packed_count_ = 1;
+			packed_since_ = std::chrono::steady_clock::now();
+			active_buffer_ = -1;
+			flushPackedIfDue_();
+			packing_cv_.notify_all();
+			return 0;
+		}
 		MarkBufferFull(active_buffer_);
 		active_buffer_ = -1;
 		return 0;
@@ -112,45 +312,59 @@ int artdaq::SharedMemoryFragmentManager::ReadFragmentHeader(detail::RawFragmentH
 	}
 
 	size_t hdrSize = artdaq::detail::RawFragmentHeader::num_words() * sizeof(artdaq::RawDataType);
-	active_buffer_ = GetBufferForReading();
+	if (read_buffer_ != -1 && !CheckBuffer(read_buffer_, BufferSemaphoreFlags::Reading))
+	{
+		TLOG(TLVL_WARNING) << "ReadFragmentHeader: Lost buffer " << read_buffer_ << " before reading all of its packed Fragments";
+		read_buffer_ = -1;
+	}
+	// Continue with the next Fragment of a packed buffer before taking a new one
+	if (read_buffer_ == -1)
+	{
+		read_buffer_ = GetBufferForReading();
+	}
 
-	if (active_buffer_ == -1)
+	if (read_buffer_ == -1)
 	{
-		TLOG(TLVL_DEBUG + 43) << "ReadFragmentHeader: active_buffer==-1, returning -1";
+		TLOG(TLVL_DEBUG + 43) << "ReadFragmentHeader: read_buffer==-1, returning -1";
 		return -1;
 	}
 
-	auto sts = Read(active_buffer_, &header, hdrSize);
+	auto sts = Read(read_buffer_, &header, hdrSize);
 	if (!sts)
 	{
-		TLOG(TLVL_ERROR) << "ReadFragmentHeader: Buffer " << active_buffer_ << " returned bad status code from Read";
-		MarkBufferEmpty(active_buffer_);
-		active_buffer_ = -1;
+		TLOG(TLVL_ERROR) << "ReadFragmentHeader: Buffer " << read_buffer_ << " returned bad status code from Read";
+		MarkBufferEmpty(read_buffer_);
+		read_buffer_ = -1;
 		return -2;
 	}
 
-	TLOG(TLVL_DEBUG + 43) << "ReadFragmentHeader: read active_buffer_=" << active_buffer_ << " sequence_id=" << header.sequence_id;
+	TLOG(TLVL_DEBUG + 43) << "ReadFragmentHeader: read read_buffer_=" << read_buffer_ << " sequence_id=" << header.sequence_id;
 	return 0;
 }
 
 int artdaq::SharedMemoryFragmentManager::ReadFragmentData(RawDataType* destination, size_t words)
 {
-	if (!IsValid() || active_buffer_ == -1 || !CheckBuffer(active_buffer_, BufferSemaphoreFlags::Reading))
+	if (!IsValid() || read_buffer_ == -1 || !CheckBuffer(read_buffer_, BufferSemaphoreFlags::Reading))
 	{
-		TLOG(TLVL_ERROR) << "ReadFragmentData: Buffer " << active_buffer_ << " failed status checks: IsValid()=" << std::boolalpha << IsValid() << ", CheckBuffer=" << CheckBuffer(active_buffer_, BufferSemaphoreFlags::Reading);
+		TLOG(TLVL_ERROR) << "ReadFragmentData: Buffer " << read_buffer_ << " failed status checks: IsValid()=" << std::boolalpha << IsValid() << ", CheckBuffer=" << CheckBuffer(read_buffer_, BufferSemaphoreFlags::Reading);
 		return -3;
 	}
 
-	auto sts = Read(active_buffer_, destination, words * sizeof(RawDataType));
+	auto sts = Read(read_buffer_, destination, words * sizeof(RawDataType));
 	if (!sts)
 	{
-		TLOG(TLVL_ERROR) << "ReadFragmentData: Buffer " << active_buffer_ << " returned bad status code from Read";
-		MarkBufferEmpty(active_buffer_);
-		active_buffer_ = -1;
+		TLOG(TLVL_ERROR) << "ReadFragmentData: Buffer " << read_buffer_ << " returned bad status code from Read";
+		MarkBufferEmpty(read_buffer_);
+		read_buffer_ = -1;
 		return -2;
 	}
 
-	MarkBufferEmpty(active_buffer_);
-	active_buffer_ = -1;
+	if (MoreDataInBuffer(read_buffer_))
+	{
+		TLOG(TLVL_DEBUG + 43) << "ReadFragmentData: Buffer " << read_buffer_ << " holds more packed Fragments";
+		return 0;
+	}
+	MarkBufferEmpty(read_buffer_);
+	read_buffer_ = -1;
 	return 0;
 }
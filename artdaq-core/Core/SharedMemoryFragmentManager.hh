@@ -1,16 +1,42 @@
 #ifndef ARTDAQ_CORE_CORE_SHARED_MEMORY_FRAGMENT_MANAGER_HH
 #define ARTDAQ_CORE_CORE_SHARED_MEMORY_FRAGMENT_MANAGER_HH 1
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "artdaq-core/Core/SharedMemoryManager.hh"
 #include "artdaq-core/Data/RawEvent.hh"
 
 namespace artdaq {
 /**
 	 * \brief The SharedMemoryFragmentManager is a SharedMemoryManager that deals with Fragment transfers using a SharedMemoryManager.
+	 *
+	 * A buffer holds one or more Fragments stored back to back. By default every Fragment gets its own buffer; with
+	 * packing enabled (see SetPacking), small Fragments are appended to the same buffer until it is full enough. Readers
+	 * handle both layouts, so only the writer needs to be configured. While a packed buffer is open, a timer thread marks
+	 * it Full once it reaches PackingOptions::max_delay_us, so that a writer which goes idle does not hold back its last Fragments.
 	 */
 class SharedMemoryFragmentManager : public SharedMemoryManager
 {
 public:
+	/**
+		 * \brief When a writer which packs several Fragments into one buffer marks that buffer Full
+		 */
+	struct PackingOptions
+	{
+		size_t max_fragments;  ///< Mark the buffer Full once it holds this many Fragments (1: one Fragment per buffer, packing disabled; 0: no limit)
+		size_t max_bytes;      ///< Most bytes to put in one buffer; a Fragment which would go past it starts a new buffer (0: the buffer size)
+		size_t max_delay_us;   ///< Mark the buffer Full once its first Fragment is this old, even if no more Fragments are written (0: no deadline)
+
+		/**
+			 * \brief Construct the default PackingOptions (packing disabled)
+			 */
+		PackingOptions()
+		    : max_fragments(1), max_bytes(0), max_delay_us(1000) {}
+	};
+
 	/**
 		* \brief SharedMemoryFragmentManager Constructor
 		* \param shm_key The key to use when attaching/creating the shared memory segment
@@ -18,13 +44,24 @@ public:
 		* \param max_buffer_size The size of each buffer
 		* \param buffer_timeout_us The maximum amount of time a buffer may be locked
 		* before being returned to its previous state. This timer is reset upon any operation by the owning SharedMemoryManager.
+		* \param options Huge page, pre-fault and memory locking options for the segment
+		*/
+	SharedMemoryFragmentManager(uint32_t shm_key, size_t buffer_count = 0, size_t max_buffer_size = 0, size_t buffer_timeout_us = 100 * 1000000, SegmentOptions const& options = SegmentOptions());
+
+	/**
+		* \brief SharedMemoryFragmentManager Constructor for a segment with several buffer size classes
+		* \param shm_key The key to use when attaching/creating the shared memory segment
+		* \param size_classes The sizes and counts of the buffers in the shared memory. Each Fragment is written to the smallest available buffer which can hold it.
+		* \param buffer_timeout_us The maximum amount of time a buffer may be locked
+		* before being returned to its previous state. This timer is reset upon any operation by the owning SharedMemoryManager.
+		* \param options Huge page, pre-fault and memory locking options for the segment
 		*/
-	SharedMemoryFragmentManager(uint32_t shm_key, size_t buffer_count = 0, size_t max_buffer_size = 0, size_t buffer_timeout_us = 100 * 1000000);
+	SharedMemoryFragmentManager(uint32_t shm_key, std::vector<SizeClass> const& size_classes, size_t buffer_timeout_us = 100 * 1000000, SegmentOptions const& options = SegmentOptions());
 
 	/**
 		 * \brief SharedMemoryFragmentManager destructor
 		 */
-	virtual ~SharedMemoryFragmentManager() = default;
+	virtual ~SharedMemoryFragmentManager();
 	SharedMemoryFragmentManager(SharedMemoryFragmentManager const&) = delete;             ///< Copy Constructor is deleted
 	SharedMemoryFragmentManager(SharedMemoryFragmentManager&&) = delete;                  ///< Move Constructor is deleted
 	SharedMemoryFragmentManager& operator=(SharedMemoryFragmentManager const&) = delete;  ///< Copy Assignment Operator is deleted
@@ -32,6 +69,9 @@ public:
 
 	/**
 		 * \brief Write a Fragment to the Shared Memory
+		 *
+		 * With packing enabled, the Fragment may be appended to the buffer holding the previous Fragments, and only becomes
+		 * visible to readers once that buffer is marked Full (see PackingOptions and FlushPackedFragments).
 		 * \param fragment Fragment to write
 		 * \param overwrite Whether to set the overwrite flag
 		 * \param timeout_us Time to wait for shared memory to be free (0: No timeout) (Timeout does not apply if overwrite == false)
@@ -39,6 +79,24 @@ public:
 		 */
 	int WriteFragment(Fragment&& fragment, bool overwrite, size_t timeout_us);
 
+	/**
+		 * \brief Set how Fragments are packed into buffers by WriteFragment. Any partially-filled buffer is marked Full first.
+		 * \param options Packing thresholds
+		 */
+	void SetPacking(PackingOptions const& options);
+
+	/**
+		 * \brief Get the packing thresholds used by WriteFragment
+		 * \return The PackingOptions in use
+		 */
+	PackingOptions GetPacking() const { return packing_; }
+
+	/**
+		 * \brief Mark the buffer holding packed Fragments Full, so that readers can see them
+		 * \return The number of Fragments released to readers
+		 */
+	size_t FlushPackedFragments();
+
 	/**
 		 * \brief Read a Fragment from the Shared Memory
 		 * \param fragment Output Fragment object
@@ -48,13 +106,15 @@ public:
 
 	/**
 		 * \brief Read a Fragment Header from the Shared Memory
+		 *
+		 * If the buffer of the previous Fragment holds more Fragments, the next one is read from it; otherwise a new buffer is taken.
 		 * \param header Output Fragment Header
 		 * \return 0 on success
 		 */
 	int ReadFragmentHeader(detail::RawFragmentHeader& header);
 
 	/**
-		* \brief Read Fragment Data from the Shared Memory
+		* \brief Read Fragment Data from the Shared Memory. The buffer is released once its last Fragment has been read.
 		* \param destination Destination for data
 		* \param words RawDataType Word count to read
 		* \return 0 on success
@@ -64,12 +124,32 @@ public:
 	/**
 		 * \brief Check if a buffer is ready for writing, and if so, reserves it for use
 		 * \param overwrite Whether to overwrite Full buffers (non-reliable mode)
+		 * \param size_hint Size of the Fragment which will be written, in bytes. A reserved buffer which is too small is released.
 		 * \return True if SharedMemoryFragmentManager is ready for Fragment data
 		 */
-	bool ReadyForWrite(bool overwrite) override;
+	bool ReadyForWrite(bool overwrite, size_t size_hint = 0) override;
 
 private:
+	bool packingEnabled_() const { return packing_.max_fragments != 1; }
+	bool readyForWrite_(bool overwrite, size_t size_hint);
+	size_t flushPacked_();
+	void flushPackedIfDue_();
+	void startPackingTimer_();
+	void stopPackingTimer_();
+	void packingTimerLoop_();
+
 	int active_buffer_;
+	int read_buffer_;
+
+	PackingOptions packing_;
+	int packed_buffer_;
+	size_t packed_count_;
+	std::chrono::steady_clock::time_point packed_since_;
+
+	std::thread packing_thread_;
+	bool packing_stop_;
+	std::mutex packing_mutex_;  ///< Protects the packing state, shared by the writing thread and the packing timer
+	std::condition_variable packing_cv_;
 };
 }  // namespace artdaq
 
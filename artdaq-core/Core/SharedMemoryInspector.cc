@@ -0,0 +1,332 @@
+#define TRACE_NAME "SharedMemoryInspector"
+
+#include "artdaq-core/Core/SharedMemoryInspector.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+#include "artdaq-core/Data/RawEvent.hh"
+#include "artdaq-core/Data/detail/RawFragmentHeader.hh"
+#include "artdaq-core/Utilities/TimeUtils.hh"
+#include "TRACE/tracemf.h"
+
+#define TLVL_INSPECT 38
+
+// A descriptor whose state or sequence ID changes while it is being copied is copied again, at most this many times
+static constexpr int descriptor_read_attempts = 3;
+
+artdaq::SharedMemoryInspector::SharedMemoryInspector(uint32_t shm_key, SharedMemoryBackend backend, std::string const& directory)
+    : shm_key_(shm_key)
+    , segment_(SharedMemorySegment::Make(backend, shm_key, directory, true))
+    , shm_ptr_(nullptr)
+    , segment_size_(0)
+{}
+
+artdaq::SharedMemoryInspector::~SharedMemoryInspector()
+{
+	Detach();
+}
+
+bool artdaq::SharedMemoryInspector::Attach()
+{
+	if (IsValid())
+	{
+		return true;
+	}
+	if (!segment_->Open(sizeof(SharedMemoryManager::ShmStruct)))
+	{
+		TLOG(TLVL_ERROR) << "Could not open " << segment_->Describe() << " read-only, errno=" << errno << " (" << strerror(errno) << ")";
+		return false;
+	}
+	auto ptr = static_cast<SharedMemoryManager::ShmStruct const*>(segment_->Map());
+	if (ptr == nullptr)
+	{
+		TLOG(TLVL_ERROR) << "Could not map " << segment_->Describe() << " read-only, errno=" << errno << " (" << strerror(errno) << ")";
+		segment_->Close();
+		return false;
+	}
+	segment_size_ = segment_->Size();
+
+	if (ptr->layout_magic != SharedMemoryManager::LayoutMagic || ptr->layout_version != SharedMemoryManager::LayoutVersion || ptr->header_size != sizeof(SharedMemoryManager::ShmStruct))
+	{
+		TLOG(TLVL_ERROR) << "Cannot inspect " << segment_->Describe() << ": expected shared memory layout version " << SharedMemoryManager::LayoutVersion
+		                 << " (header size " << sizeof(SharedMemoryManager::ShmStruct) << "), found magic 0x" << std::hex << ptr->layout_magic.load() << std::dec
+		                 << ", version " << ptr->layout_version << ", header size " << ptr->header_size;
+		segment_->Close();
+		return false;
+	}
+	if (ptr->buffer_count <= 0 || SharedMemoryManager::dataOffset_(ptr->buffer_count) > segment_size_)
+	{
+		TLOG(TLVL_ERROR) << "Cannot inspect " << segment_->Describe() << ": " << ptr->buffer_count << " buffers do not fit in segment size " << segment_size_;
+		segment_->Close();
+		return false;
+	}
+
+	shm_ptr_ = ptr;
+	TLOG(TLVL_INSPECT) << "Attached read-only to " << segment_->Describe() << ", " << shm_ptr_->buffer_count << " buffers, size " << segment_size_;
+	return true;
+}
+
+void artdaq::SharedMemoryInspector::Detach()
+{
+	shm_ptr_ = nullptr;
+	segment_size_ = 0;
+	segment_->Close();
+}
+
+artdaq::SharedMemoryInspector::SegmentSnapshot artdaq::SharedMemoryInspector::Snapshot(BufferContents contents, bool summarize_contents) const
+{
+	SegmentSnapshot output{};
+	output.time_us = TimeUtils::gettimeofday_us();
+	if (!IsValid())
+	{
+		output.description = segment_->Describe() + " (not attached)";
+		return output;
+	}
+
+	output.description = segment_->Describe();
+	output.attached_count = segment_->AttachedCount();
+	output.removed = segment_->IsRemoved();
+	output.buffer_count = shm_ptr_->buffer_count;
+	output.buffer_size = shm_ptr_->buffer_size;
+	output.destructive_read_mode = shm_ptr_->destructive_read_mode;
+	output.rank = shm_ptr_->rank;
+	output.next_sequence_id = shm_ptr_->next_sequence_id.load();
+	output.addressed_full = shm_ptr_->addressed_full.load();
+	output.readable_waiters = shm_ptr_->readable_channel.waiters.load();
+	output.writable_waiters = shm_ptr_->writable_channel.waiters.load();
+	output.reaper_active = shm_ptr_->reaper_active.load();
+	auto heartbeat = shm_ptr_->reaper_heartbeat_us.load();
+	output.reaper_age_us = output.time_us > heartbeat ? output.time_us - heartbeat : 0;
+	output.destinations = std::max(shm_ptr_->destination_count.load(), 0);
+
+	size_t* counts[] = {&output.state_counts.empty, &output.state_counts.writing, &output.state_counts.full, &output.state_counts.reading};  // NOLINT(cppcoreguidelines-avoid-c-arrays,hicpp-avoid-c-arrays,modernize-avoid-c-arrays)
+	for (auto cls = 0; cls < std::min(shm_ptr_->size_class_count, static_cast<int>(SharedMemoryManager::MaxSizeClasses)); ++cls)
+	{
+		for (size_t state = 0; state < 4; ++state)
+		{
+			// A counter can be briefly negative between the two halves of a state change
+			*counts[state] += std::max(shm_ptr_->state_counts[cls].count[state].load(), 0);  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		}
+	}
+	if (!output.destructive_read_mode)
+	{
+		for (auto const& cursor : shm_ptr_->reader_cursors)
+		{
+			if (cursor.manager_id.load() != -1)
+			{
+				++output.broadcast_readers;
+			}
+		}
+	}
+
+	auto base = reinterpret_cast<uint8_t const*>(shm_ptr_);                             // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+	auto info = base + SharedMemoryManager::bufferInfoOffset_(shm_ptr_->buffer_count);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	auto data_offset = SharedMemoryManager::dataOffset_(shm_ptr_->buffer_count);
+	auto data_size = segment_size_ - data_offset;
+	output.buffers.reserve(output.buffer_count);
+	for (auto ii = 0; ii < output.buffer_count; ++ii)
+	{
+		auto buf = reinterpret_cast<SharedMemoryManager::ShmBuffer const*>(info + ii * sizeof(SharedMemoryManager::ShmBuffer));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		BufferSnapshot snap{};
+		snap.index = ii;
+		size_t buffer_offset = 0;
+		uint64_t last_touch = 0;
+		for (auto attempt = 0; attempt < descriptor_read_attempts; ++attempt)
+		{
+			snap.state = buf->sem.load();
+			snap.sequence_id = buf->sequence_id.load();
+			snap.owner_id = buf->sem_id.load();
+			snap.owner_pid = buf->owner_pid.load();
+			snap.read_count = buf->read_count.load();
+			snap.write_pos = buf->writePos;
+			snap.read_pos = buf->readPos;
+			snap.capacity = buf->capacity;
+			snap.size_class = buf->size_class;
+			buffer_offset = buf->data_offset;
+			last_touch = buf->last_touch_time.load();
+			if (buf->sem.load() == snap.state && buf->sequence_id.load() == snap.sequence_id)
+			{
+				break;
+			}
+		}
+		snap.idle_us = output.time_us > last_touch ? output.time_us - last_touch : 0;
+
+		if (summarize_contents && snap.state != SharedMemoryManager::BufferSemaphoreFlags::Empty && buffer_offset <= data_size && snap.capacity <= data_size - buffer_offset)
+		{
+			auto start = base + data_offset + buffer_offset;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			snap.fragments = SummarizeFragments(start, std::min(snap.write_pos, snap.capacity), contents);
+		}
+		output.buffers.push_back(snap);
+	}
+	return output;
+}
+
+artdaq::SharedMemoryInspector::FragmentSummary artdaq::SharedMemoryInspector::SummarizeFragments(uint8_t const* start, size_t size, BufferContents contents)
+{
+	switch (contents)
+	{
+		case BufferContents::Fragments:
+			return summarizeFragments_(start, size, 0);
+		case BufferContents::Events:
+			return summarizeEvent_(start, size);
+		case BufferContents::Auto:
+			break;
+	}
+
+	auto event = summarizeEvent_(start, size);
+	if (event.has_toc)
+	{
+		return event;
+	}
+	auto fragments = summarizeFragments_(start, size, 0);
+	return fragments.complete ? fragments : event;
+}
+
+artdaq::SharedMemoryInspector::FragmentSummary artdaq::SharedMemoryInspector::summarizeFragments_(uint8_t const* start, size_t size, size_t offset)
+{
+	FragmentSummary output{};
+	output.first_sequence_id = std::numeric_limits<uint64_t>::max();
+
+	// Each header is copied out of the buffer before it is checked, so that a writer changing it cannot make us overrun the buffer
+	size_t pos = offset;
+	bool valid = pos <= size;
+	while (valid && size - pos >= sizeof(detail::RawFragmentHeader))
+	{
+		detail::RawFragmentHeader hdr;
+		memcpy(&hdr, start + pos, sizeof(hdr));  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		size_t frag_size = hdr.word_count * sizeof(RawDataType);
+		if (hdr.word_count < detail::RawFragmentHeader::num_words() || frag_size > size - pos)
+		{
+			valid = false;
+			break;
+		}
+		++output.fragment_count;
+		output.fragment_bytes += frag_size;
+		output.first_sequence_id = std::min(output.first_sequence_id, static_cast<uint64_t>(hdr.sequence_id));
+		output.last_sequence_id = std::max(output.last_sequence_id, static_cast<uint64_t>(hdr.sequence_id));
+		++output.type_counts[hdr.type];
+		pos += frag_size;
+	}
+	output.complete = valid && pos == size;
+	if (output.fragment_count == 0)
+	{
+		output.first_sequence_id = 0;
+	}
+	return output;
+}
+
+artdaq::SharedMemoryInspector::FragmentSummary artdaq::SharedMemoryInspector::summarizeEvent_(uint8_t const* start, size_t size)
+{
+	if (size < sizeof(detail::RawEventHeader))
+	{
+		FragmentSummary output{};
+		output.is_event = true;
+		return output;
+	}
+	detail::RawEventHeader hdr;
+	memcpy(&hdr, start, sizeof(hdr));
+
+	size_t first = sizeof(detail::RawEventHeader);
+	bool has_toc = false;
+	detail::RawEventTOC toc;
+	if (size - first >= sizeof(detail::RawEventTOC))
+	{
+		memcpy(&toc, start + first, sizeof(toc));  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		has_toc = toc.zero == 0 && toc.magic == detail::RawEventTOC::MAGIC;
+		if (has_toc)
+		{
+			// The Fragments after a corrupt TOC cannot be located; the walk below then reports the event as incomplete
+			first = toc.valid() ? first + detail::RawEventTOC::SizeBytes(toc.capacity) : size + 1;
+		}
+	}
+
+	auto output = summarizeFragments_(start, size, first);
+	output.is_event = true;
+	output.event_sequence_id = hdr.sequence_id;
+	output.has_toc = has_toc;
+	output.toc_entries = has_toc ? toc.entry_count : 0;
+	output.toc_capacity = has_toc ? toc.capacity : 0;
+	return output;
+}
+
+std::string artdaq::SharedMemoryInspector::Format(SegmentSnapshot const& snapshot, SegmentSnapshot const* previous)
+{
+	std::ostringstream ostr;
+	ostr << snapshot.description << ", " << snapshot.attached_count << " attached" << (snapshot.removed ? ", marked for removal" : "") << std::endl;
+	if (snapshot.buffer_count == 0)
+	{
+		return ostr.str();
+	}
+
+	ostr << "Buffers: " << snapshot.buffer_count << " of up to " << snapshot.buffer_size << " bytes, " << (snapshot.destructive_read_mode ? "destructive" : "broadcast")
+	     << " reads, writer rank " << snapshot.rank << ", " << snapshot.next_sequence_id << " written";
+	if (previous != nullptr && snapshot.time_us > previous->time_us && snapshot.next_sequence_id >= previous->next_sequence_id)
+	{
+		ostr << " (" << std::fixed << std::setprecision(1) << (snapshot.next_sequence_id - previous->next_sequence_id) * 1e6 / (snapshot.time_us - previous->time_us) << "/s)";
+	}
+	ostr << std::endl
+	     << "States: " << snapshot.state_counts.empty << " Empty, " << snapshot.state_counts.writing << " Writing, " << snapshot.state_counts.full << " Full ("
+	     << snapshot.addressed_full << " addressed), " << snapshot.state_counts.reading << " Reading" << std::endl
+	     << "Waiting: " << snapshot.readable_waiters << " for Full, " << snapshot.writable_waiters << " for Empty; "
+	     << "Readers: " << snapshot.broadcast_readers << " broadcast, " << snapshot.destinations << " destinations; "
+	     << "Reaper: " << (snapshot.reaper_active ? "active, last ran " + std::to_string(snapshot.reaper_age_us / 1000) + " ms ago" : "inactive") << std::endl
+	     << std::endl;
+
+	ostr << std::setw(5) << "BUF" << " " << std::left << std::setw(8) << "STATE" << std::right << std::setw(6) << "OWNER" << std::setw(8) << "PID"
+	     << std::setw(12) << "SEQ_ID" << std::setw(22) << "FILL" << std::setw(10) << "IDLE_S" << std::setw(7) << "FRAGS" << "  CONTENTS" << std::endl;
+	for (auto const& buf : snapshot.buffers)
+	{
+		auto fill = buf.capacity > 0 ? 100.0 * std::min(buf.write_pos, buf.capacity) / buf.capacity : 0.0;
+		std::ostringstream fill_str;
+		fill_str << buf.write_pos << "/" << buf.capacity << " " << std::fixed << std::setprecision(0) << std::setw(3) << fill << "%";
+
+		ostr << std::setw(5) << buf.index << " " << std::left << std::setw(8) << SharedMemoryManager::FlagToString(buf.state) << std::right << std::setw(6) << buf.owner_id
+		     << std::setw(8) << buf.owner_pid << std::setw(12) << buf.sequence_id << std::setw(22) << fill_str.str()
+		     << std::setw(10) << std::fixed << std::setprecision(2) << buf.idle_us / 1e6 << std::setw(7) << buf.fragments.fragment_count << "  ";
+
+		auto const& frags = buf.fragments;
+		if (buf.state == SharedMemoryManager::BufferSemaphoreFlags::Empty)
+		{
+			ostr << std::endl;
+			continue;
+		}
+		if (frags.is_event)
+		{
+			ostr << "event " << frags.event_sequence_id;
+			if (frags.has_toc)
+			{
+				ostr << " toc " << frags.toc_entries << "/" << frags.toc_capacity;
+			}
+			ostr << ", ";
+		}
+		if (frags.fragment_count > 0)
+		{
+			ostr << "seq " << frags.first_sequence_id;
+			if (frags.last_sequence_id != frags.first_sequence_id)
+			{
+				ostr << "-" << frags.last_sequence_id;
+			}
+			ostr << ", types";
+			for (auto const& type : frags.type_counts)
+			{
+				ostr << " " << static_cast<int>(type.first);
+				if (type.first >= detail::RawFragmentHeader::FIRST_SYSTEM_TYPE)
+				{
+					ostr << "(" << detail::RawFragmentHeader::SystemTypeToString(type.first) << ")";
+				}
+				ostr << "x" << type.second;
+			}
+		}
+		if (!frags.complete)
+		{
+			ostr << (frags.fragment_count > 0 ? ", " : "") << "incomplete";
+		}
+		ostr << std::endl;
+	}
+	return ostr.str();
+}
@@ -0,0 +1,177 @@
+#ifndef artdaq_core_Core_SharedMemoryInspector_hh
+#define artdaq_core_Core_SharedMemoryInspector_hh 1
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "artdaq-core/Core/SharedMemoryManager.hh"
+#include "artdaq-core/Core/SharedMemorySegment.hh"
+
+namespace artdaq {
+/**
+	 * \brief The SharedMemoryInspector attaches to a SharedMemoryManager segment read-only (SHM_RDONLY or PROT_READ)
+	 * and takes snapshots of its header, buffer descriptors and buffer contents.
+	 *
+	 * The inspector does not take a manager ID, register as a reader, take any lock or write to the segment, so it can
+	 * be pointed at a production data path without changing its behavior. The price is that a snapshot is not atomic:
+	 * each buffer descriptor is read consistently (it is re-read if its state or sequence ID changed while it was being
+	 * copied), but different buffers are read at slightly different times, and buffer contents may be overwritten while
+	 * they are summarized. Every read of buffer contents is bounds-checked, so a torn read produces a wrong summary,
+	 * never an invalid access.
+	 */
+class SharedMemoryInspector
+{
+public:
+	/**
+		 * \brief How the data in each buffer is laid out
+		 */
+	enum class BufferContents
+	{
+		Auto,       ///< Use Events if the buffer has an event table of contents, then Fragments if the buffer is exactly a sequence of Fragments, then Events
+		Fragments,  ///< A sequence of Fragments starting at the beginning of the buffer (SharedMemoryFragmentManager)
+		Events      ///< A RawEventHeader, an optional RawEventTOC, then a sequence of Fragments (SharedMemoryEventReceiver)
+	};
+
+	/**
+		 * \brief Summary of the Fragments found in one buffer
+		 */
+	struct FragmentSummary
+	{
+		bool is_event;                           ///< Whether the buffer was read as an event (RawEventHeader first)
+		uint64_t event_sequence_id;              ///< Sequence ID from the RawEventHeader (events only)
+		bool has_toc;                            ///< Whether the event has a table of contents
+		uint32_t toc_entries;                    ///< Number of used table of contents entries
+		uint32_t toc_capacity;                   ///< Number of table of contents entries
+		size_t fragment_count;                   ///< Number of Fragments found
+		size_t fragment_bytes;                   ///< Total size of the Fragments found, in bytes
+		uint64_t first_sequence_id;              ///< Lowest Fragment sequence ID
+		uint64_t last_sequence_id;               ///< Highest Fragment sequence ID
+		std::map<uint8_t, size_t> type_counts;   ///< Number of Fragments of each type
+		bool complete;                           ///< Whether every Fragment header was valid and the Fragments end at the write position
+	};
+
+	/**
+		 * \brief Copy of one buffer descriptor, and a summary of the buffer's contents
+		 */
+	struct BufferSnapshot
+	{
+		int index;                                         ///< Index of the buffer
+		SharedMemoryManager::BufferSemaphoreFlags state;  ///< State of the buffer
+		int16_t owner_id;                                  ///< Manager ID of the owner of the buffer (-1 if none)
+		int32_t owner_pid;                                 ///< PID of the process which last acquired the buffer
+		size_t sequence_id;                                ///< Sequence ID of the buffer
+		size_t write_pos;                                  ///< Number of bytes written to the buffer
+		size_t read_pos;                                   ///< Read position of the current reader (destructive read mode only)
+		size_t capacity;                                   ///< Size of the buffer's data area, in bytes
+		int size_class;                                    ///< Size class of the buffer
+		int16_t read_count;                                ///< Number of readers currently holding the buffer (broadcast mode only)
+		uint64_t idle_us;                                  ///< Time since the buffer was last touched by its owner, in microseconds
+		FragmentSummary fragments;                         ///< Summary of the Fragments in the buffer (empty if contents were not summarized)
+	};
+
+	/**
+		 * \brief Snapshot of a whole segment
+		 */
+	struct SegmentSnapshot
+	{
+		uint64_t time_us;                                    ///< Time the snapshot was started (gettimeofday_us)
+		std::string description;                            ///< Description of the segment
+		uint16_t attached_count;                            ///< Number of processes attached to the segment
+		bool removed;                                       ///< Whether the segment has been marked for removal
+		int buffer_count;                                   ///< Number of buffers
+		size_t buffer_size;                                 ///< Size of the largest buffers, in bytes
+		bool destructive_read_mode;                         ///< Whether reads are destructive
+		int rank;                                           ///< Rank of the writer which created the segment
+		size_t next_sequence_id;                            ///< Number of buffers written since the segment was created
+		SharedMemoryManager::BufferStateCounts state_counts;  ///< Buffer state counters kept by the segment
+		int32_t addressed_full;                             ///< Full buffers addressed to a destination
+		uint32_t readable_waiters;                          ///< Processes waiting for a Full buffer
+		uint32_t writable_waiters;                          ///< Processes waiting for an Empty buffer
+		bool reaper_active;                                 ///< Whether a reaper thread is running
+		uint64_t reaper_age_us;                             ///< Time since the reaper thread last ran, in microseconds
+		size_t broadcast_readers;                           ///< Number of registered broadcast-mode readers
+		size_t destinations;                                ///< Number of registered destinations
+		std::vector<BufferSnapshot> buffers;                ///< Every buffer descriptor
+	};
+
+	/**
+		 * \brief SharedMemoryInspector Constructor
+		 * \param shm_key Key of the segment to inspect
+		 * \param backend Operating system facility holding the segment
+		 * \param directory Directory holding the segment file (File backend only)
+		 */
+	explicit SharedMemoryInspector(uint32_t shm_key, SharedMemoryBackend backend = SharedMemoryBackend::SysV, std::string const& directory = "");
+
+	/**
+		 * \brief SharedMemoryInspector Destructor. Unmaps the segment.
+		 */
+	virtual ~SharedMemoryInspector();
+	SharedMemoryInspector(SharedMemoryInspector const&) = delete;             ///< Copy Constructor is deleted
+	SharedMemoryInspector(SharedMemoryInspector&&) = delete;                  ///< Move Constructor is deleted
+	SharedMemoryInspector& operator=(SharedMemoryInspector const&) = delete;  ///< Copy Assignment Operator is deleted
+	SharedMemoryInspector& operator=(SharedMemoryInspector&&) = delete;       ///< Move Assignment Operator is deleted
+
+	/**
+		 * \brief Open and map the segment read-only, and check that it has been initialized with this build's layout
+		 * \return Whether the segment can be inspected. Errors are logged.
+		 */
+	bool Attach();
+
+	/**
+		 * \brief Unmap the segment
+		 */
+	void Detach();
+
+	/**
+		 * \brief Whether the segment is mapped
+		 * \return True if Attach succeeded and Detach has not been called
+		 */
+	bool IsValid() const { return shm_ptr_ != nullptr; }
+
+	/**
+		 * \brief Get the key of the segment
+		 * \return The key of the segment
+		 */
+	uint32_t GetKey() const { return shm_key_; }
+
+	/**
+		 * \brief Copy the segment header and every buffer descriptor, and summarize the buffers' contents
+		 * \param contents How the data in each buffer is laid out
+		 * \param summarize_contents Whether to walk the Fragments in each buffer (Empty buffers are never walked)
+		 * \return The snapshot. If the inspector is not attached, buffer_count is 0.
+		 */
+	SegmentSnapshot Snapshot(BufferContents contents = BufferContents::Auto, bool summarize_contents = true) const;
+
+	/**
+		 * \brief Summarize the Fragments in a block of memory
+		 * \param start Start of the data
+		 * \param size Number of bytes of data
+		 * \param contents How the data is laid out
+		 * \return Summary of the Fragments found. Every header is copied and bounds-checked before it is used.
+		 */
+	static FragmentSummary SummarizeFragments(uint8_t const* start, size_t size, BufferContents contents);
+
+	/**
+		 * \brief Format a snapshot as a table, one line per buffer
+		 * \param snapshot The snapshot to format
+		 * \param previous An earlier snapshot of the same segment, used to compute rates (nullptr for none)
+		 * \return The formatted snapshot
+		 */
+	static std::string Format(SegmentSnapshot const& snapshot, SegmentSnapshot const* previous = nullptr);
+
+private:
+	static FragmentSummary summarizeFragments_(uint8_t const* start, size_t size, size_t offset);
+	static FragmentSummary summarizeEvent_(uint8_t const* start, size_t size);
+
+	uint32_t shm_key_;
+	std::unique_ptr<SharedMemorySegment> segment_;
+	SharedMemoryManager::ShmStruct const* shm_ptr_;
+	size_t segment_size_;
+};
+}  // namespace artdaq
+
+#endif  // artdaq_core_Core_SharedMemoryInspector_hh
@@ -1,12 +1,17 @@
 #define TRACE_NAME "SharedMemoryManager"
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <algorithm>
 #include <cstring>
 #include <list>
 #include <unordered_map>
-#ifndef SHM_DEST  // Lynn reports that this is missing on Mac OS X?!?
-#define SHM_DEST 01000
-#endif
 #include <csignal>
 #include "artdaq-core/Core/SharedMemoryManager.hh"
 #include "artdaq-core/Utilities/TraceLock.hh"
@@ -23,10 +28,130 @@
 #define TLVL_WRITEREADY 46
 #define TLVL_POS 48
 #define TLVL_RESET 51
-#define TLVL_BUFINFO 52
 #define TLVL_WRITE 53
 #define TLVL_READ 54
 #define TLVL_CHKBUFFER 55
+#define TLVL_REAPER 56
+
+// The reaper's timer wheel has this many ticks per buffer timeout, and spans two timeouts
+static constexpr uint64_t reaper_ticks_per_timeout = 16;
+static constexpr uint64_t reaper_wheel_slots = 2 * reaper_ticks_per_timeout;
+
+// Buffers, reader cursors and destinations held by processes which have exited are looked for at most this often
+// (by one process at a time), independently of the buffer timeout
+static constexpr uint64_t liveness_check_interval_us = 10000;
+
+// kill with signal 0 only checks whether the process exists. EPERM means it exists but belongs to another user.
+// PIDs are only meaningful within one PID namespace: all processes using a segment must share it.
+static bool process_exited(int32_t pid)
+{
+	return pid > 0 && pid != getpid() && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && ATOMIC_INT_LOCK_FREE == 2, "Futex words in shared memory must be plain, lock-free 32-bit integers");
+
+// The futex words live in a segment shared between processes, so the non-private futex operations are used.
+static void futex_wait(std::atomic<uint32_t>* word, uint32_t expected, size_t timeout_us)
+{
+#ifdef __linux__
+	struct timespec ts;
+	ts.tv_sec = timeout_us / 1000000;
+	ts.tv_nsec = (timeout_us % 1000000) * 1000;
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, &ts, nullptr, 0);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-type-vararg)
+#else
+	if (word->load() == expected) usleep(std::min(timeout_us, static_cast<size_t>(1000)));
+#endif
+}
+
+// Tell the CPU that this is a spin-wait loop
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+// Segments of a WriteV at least this large are copied with non-temporal stores
+static constexpr size_t non_temporal_copy_threshold = 256 * 1024;
+
+// Copy with streaming stores, which go to memory without allocating cache lines in the writer's cache. Returns whether
+// streaming stores were used, in which case store_fence must be called before the data is published to other processes.
+static bool copy_non_temporal(uint8_t* dest, uint8_t const* src, size_t size)
+{
+#if defined(__SSE2__)
+	// Streaming stores need an aligned destination: copy up to the first 16-byte boundary normally
+	auto head = std::min(size, static_cast<size_t>((16 - reinterpret_cast<uintptr_t>(dest) % 16) % 16));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+	memcpy(dest, src, head);
+	dest += head;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	src += head;   // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	size -= head;
+	for (; size >= 64; size -= 64, dest += 64, src += 64)  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	{
+		auto in = reinterpret_cast<__m128i const*>(src);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		auto out = reinterpret_cast<__m128i*>(dest);      // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		auto v0 = _mm_loadu_si128(in);
+		auto v1 = _mm_loadu_si128(in + 1);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		auto v2 = _mm_loadu_si128(in + 2);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		auto v3 = _mm_loadu_si128(in + 3);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		_mm_stream_si128(out, v0);
+		_mm_stream_si128(out + 1, v1);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		_mm_stream_si128(out + 2, v2);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		_mm_stream_si128(out + 3, v3);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+	memcpy(dest, src, size);
+	return true;
+#else
+	memcpy(dest, src, size);
+	return false;
+#endif
+}
+
+// Order streaming stores before the stores which follow, e.g. the buffer's write position and state
+static inline void store_fence()
+{
+#if defined(__SSE2__)
+	_mm_sfence();
+#endif
+}
+
+static void futex_wake_all(std::atomic<uint32_t>* word)
+{
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-type-vararg)
+#else
+	(void)word;
+#endif
+}
+
+namespace {
+// Serializes access to a structure in the segment between processes. Critical sections only touch memory, so spin.
+class ShmSpinLock
+{
+public:
+	explicit ShmSpinLock(std::atomic<int>* word)
+	    : word_(word)
+	{
+		int spins = 0;
+		int expected = 0;
+		while (!word_->compare_exchange_weak(expected, 1, std::memory_order_acquire))
+		{
+			expected = 0;
+			if (++spins > 64) std::this_thread::yield();
+		}
+	}
+	~ShmSpinLock() { word_->store(0, std::memory_order_release); }
+
+	ShmSpinLock(ShmSpinLock const&) = delete;
+	ShmSpinLock(ShmSpinLock&&) = delete;
+	ShmSpinLock& operator=(ShmSpinLock const&) = delete;
+	ShmSpinLock& operator=(ShmSpinLock&&) = delete;
+
+private:
+	std::atomic<int>* word_;
+};
+}  // namespace
 
 static std::list<artdaq::SharedMemoryManager const*> instances = std::list<artdaq::SharedMemoryManager const*>();
 
@@ -68,15 +193,51 @@ static void signal_handler(int signum)
 	sigaction(signum, &old_actions[signum], nullptr);
 }
 
-artdaq::SharedMemoryManager::SharedMemoryManager(uint32_t shm_key, size_t buffer_count, size_t buffer_size, uint64_t buffer_timeout_us, bool destructive_read_mode)
-    : shm_segment_id_(-1)
+artdaq::SharedMemoryManager::SharedMemoryManager(uint32_t shm_key, size_t buffer_count, size_t buffer_size, uint64_t buffer_timeout_us, bool destructive_read_mode, SegmentOptions const& options)
+    : SharedMemoryManager(shm_key, std::vector<SizeClass>(1, SizeClass{buffer_size, buffer_count}), buffer_timeout_us, destructive_read_mode, options)
+{
+}
+
+artdaq::SharedMemoryManager::SharedMemoryManager(uint32_t shm_key, std::vector<SizeClass> const& size_classes, uint64_t buffer_timeout_us, bool destructive_read_mode, SegmentOptions const& options)
+    : segment_(SharedMemorySegment::Make(options.backend, shm_key, options.directory))
     , shm_ptr_(nullptr)
     , shm_key_(shm_key)
     , manager_id_(-1)
     , last_seen_id_(0)
+    , reader_slot_(-1)
+    , reader_overflow_(false)
+    , destination_slot_(-1)
+    , last_reclaim_time_(0)
+    , segment_options_(options)
+    , wait_strategy_(options.wait_strategy)
+    , spin_us_(options.spin_us)
+    , adaptive_spin_us_(options.spin_us)
+    , notify_deferral_(0)
+    , deferred_notifications_(0)
+    , notify_group_(nullptr)
+    , reaper_stop_(false)
 {
+	// Empty classes are ignored, so that the single-class constructor with no size describes a non-owning manager
+	for (auto const& size_class : size_classes)
+	{
+		if (size_class.buffer_size > 0 && size_class.buffer_count > 0)
+		{
+			requested_size_classes_.push_back(size_class);
+		}
+	}
+	if (requested_size_classes_.size() > static_cast<size_t>(MaxSizeClasses))
+	{
+		throw cet::exception("ArgumentOutOfRange") << "Too many buffer size classes requested (" << requested_size_classes_.size() << ", maximum is " << MaxSizeClasses << ")";  // NOLINT(cert-err60-cpp)
+	}
+	std::sort(requested_size_classes_.begin(), requested_size_classes_.end(), [](SizeClass const& a, SizeClass const& b) { return a.buffer_size < b.buffer_size; });
+
+	size_t buffer_count = 0;
+	for (auto const& size_class : requested_size_classes_)
+	{
+		buffer_count += size_class.buffer_count;
+	}
 	requested_shm_parameters_.buffer_count = buffer_count;
-	requested_shm_parameters_.buffer_size = buffer_size;
+	requested_shm_parameters_.buffer_size = requested_size_classes_.empty() ? 0 : requested_size_classes_.back().buffer_size;
 	requested_shm_parameters_.buffer_timeout_us = buffer_timeout_us;
 	requested_shm_parameters_.destructive_read_mode = destructive_read_mode;
 
@@ -163,7 +324,15 @@ bool artdaq::SharedMemoryManager::Attach(size_t timeout_usec)
 	size_t timeout_us = timeout_usec > 0 ? timeout_usec : 1000000;
 	auto start_time = std::chrono::steady_clock::now();
 	last_seen_id_ = 0;
-	size_t shmSize = requested_shm_parameters_.buffer_count * (requested_shm_parameters_.buffer_size + sizeof(ShmBuffer)) + sizeof(ShmStruct);
+	size_t shmSize = 0;
+	for (auto const& size_class : requested_size_classes_)
+	{
+		for (size_t ii = 0; ii < size_class.buffer_count; ++ii)
+		{
+			shmSize = alignUp_(shmSize, bufferAlignment_(size_class.buffer_size)) + size_class.buffer_size;
+		}
+	}
+	shmSize += dataOffset_(requested_shm_parameters_.buffer_count);
 
 	// 19-Feb-2019, KAB: separating out the determination of whether a given process owns the shared
 	// memory (indicated by manager_id_ == 0) and whether or not the shared memory already exists.
@@ -172,52 +341,64 @@ bool artdaq::SharedMemoryManager::Attach(size_t timeout_usec)
 		manager_id_ = 0;
 	}
 
-	shm_segment_id_ = shmget(shm_key_, shmSize, 0666);
-	if (shm_segment_id_ == -1)
+	bool opened = segment_->Open(shmSize);
+	if (!opened)
 	{
 		if (manager_id_ == 0)
 		{
-			TLOG(TLVL_ATTACH) << "Creating shared memory segment with key 0x" << std::hex << shm_key_ << " and size " << std::dec << shmSize;
-			shm_segment_id_ = shmget(shm_key_, shmSize, IPC_CREAT | 0666);
+			size_t huge_page_size = 0;
+			if (segment_options_.huge_pages == HugePageSize::Size2MB) huge_page_size = 0x200000;
+			if (segment_options_.huge_pages == HugePageSize::Size1GB) huge_page_size = 0x40000000;
+			opened = segment_->Create(shmSize, huge_page_size);
 
-			if (shm_segment_id_ == -1)
+			if (!opened)
 			{
-				TLOG(TLVL_ERROR) << "Error creating shared memory segment with key 0x" << std::hex << shm_key_ << ", errno=" << std::dec << errno << " (" << strerror(errno) << ")";
+				TLOG(TLVL_ERROR) << "Error creating " << segment_->Describe() << ", errno=" << std::dec << errno << " (" << strerror(errno) << ")";
 			}
 		}
 		else
 		{
-			while (shm_segment_id_ == -1 && TimeUtils::GetElapsedTimeMicroseconds(start_time) < timeout_us)
+			while (!opened && TimeUtils::GetElapsedTimeMicroseconds(start_time) < timeout_us)
 			{
-				shm_segment_id_ = shmget(shm_key_, shmSize, 0666);
+				opened = segment_->Open(shmSize);
 			}
 		}
 	}
-	TLOG(TLVL_ATTACH) << "shm_key == 0x" << std::hex << shm_key_ << ", shm_segment_id == " << std::dec << shm_segment_id_;
+	TLOG(TLVL_ATTACH) << "shm_key == 0x" << std::hex << shm_key_ << ", segment == " << segment_->Describe();
 
-	if (shm_segment_id_ > -1)
+	if (opened)
 	{
 		TLOG(TLVL_ATTACH)
-		    << "Attached to shared memory segment with ID = " << shm_segment_id_
+		    << "Attached to " << segment_->Describe()
 		    << " and size " << shmSize
 		    << " bytes";
-		shm_ptr_ = static_cast<ShmStruct*>(shmat(shm_segment_id_, nullptr, 0));
+		shm_ptr_ = static_cast<ShmStruct*>(segment_->Map());
 		TLOG(TLVL_ATTACH)
 		    << "Attached to shared memory segment at address "
 		    << std::hex << static_cast<void*>(shm_ptr_) << std::dec;
-		if ((shm_ptr_ != nullptr) && shm_ptr_ != reinterpret_cast<void*>(-1))  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		if (shm_ptr_ != nullptr)
 		{
 			if (manager_id_ == 0)
 			{
-				if (shm_ptr_->ready_magic == 0xCAFE1111)
+				if (shm_ptr_->layout_magic == LayoutMagic && segment_options_.segment_tag != 0 && shm_ptr_->segment_tag != segment_options_.segment_tag)
+				{
+					// Re-initializing would destroy the buffers of whatever owns the key, e.g. a shard of another ShardedSharedMemoryManager
+					TLOG(TLVL_ERROR) << "Refusing to initialize " << segment_->Describe() << ": it is in use with segment tag 0x" << std::hex << shm_ptr_->segment_tag
+					                 << ", expected 0x" << segment_options_.segment_tag << std::dec;
+					shm_ptr_ = nullptr;
+					segment_->Close();
+					manager_id_ = -1;
+					return false;
+				}
+				if (shm_ptr_->layout_magic == LayoutMagic)
 				{
 					TLOG(TLVL_WARNING) << "Owner encountered already-initialized Shared Memory! "
 					                   << "Once the system is shut down, you can use one of the following commands "
-					                   << "to clean up this shared memory: 'ipcrm -M 0x" << std::hex << shm_key_
-					                   << "' or 'ipcrm -m " << std::dec << shm_segment_id_ << "'.";
+					                   << "to clean up this shared memory: " << segment_->CleanupHint() << ".";
 					//exit(-2);
 				}
 				TLOG(TLVL_ATTACH) << "Owner initializing Shared Memory";
+				shm_ptr_->layout_magic = 0;
 				shm_ptr_->next_id = 1;
 				shm_ptr_->next_sequence_id = 0;
 				shm_ptr_->reader_pos = 0;
@@ -226,28 +407,121 @@ bool artdaq::SharedMemoryManager::Attach(size_t timeout_usec)
 				shm_ptr_->buffer_count = requested_shm_parameters_.buffer_count;
 				shm_ptr_->buffer_timeout_us = requested_shm_parameters_.buffer_timeout_us;
 				shm_ptr_->destructive_read_mode = requested_shm_parameters_.destructive_read_mode;
+				shm_ptr_->segment_tag = segment_options_.segment_tag;
+
+				shm_ptr_->size_class_count = requested_size_classes_.size();
+				int first_buffer = 0;
+				for (size_t cls = 0; cls < requested_size_classes_.size(); ++cls)
+				{
+					auto& size_class = shm_ptr_->size_classes[cls];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+					size_class.buffer_size = requested_size_classes_[cls].buffer_size;
+					size_class.buffer_count = requested_size_classes_[cls].buffer_count;
+					size_class.first_buffer = first_buffer;
+					initRing_(&size_class.empty_ring, size_class.buffer_count, first_buffer);
+					first_buffer += size_class.buffer_count;
+				}
+				initRing_(&shm_ptr_->full_ring, shm_ptr_->buffer_count, shm_ptr_->buffer_count);
+				shm_ptr_->sequence_index.lock = 0;
+				shm_ptr_->sequence_index.count = 0;
+				shm_ptr_->sequence_index.capacity = SequenceEntriesPerBuffer * shm_ptr_->buffer_count;
+				shm_ptr_->destination_count = 0;
+				shm_ptr_->assignment_counter = 0;
+				for (auto dest = 0; dest < MaxDestinations; ++dest)
+				{
+					auto& destination = shm_ptr_->destinations[dest];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+					destination.manager_id = -1;
+					destination.owner_pid = 0;
+					destination.weight = 0;
+					initRing_(&destination.full_ring, shm_ptr_->buffer_count, (2 + dest) * shm_ptr_->buffer_count);
+				}
+				shm_ptr_->readable_channel.sequence = 0;
+				shm_ptr_->readable_channel.waiters = 0;
+				shm_ptr_->writable_channel.sequence = 0;
+				shm_ptr_->writable_channel.waiters = 0;
+				shm_ptr_->reaper_active = false;
+				shm_ptr_->reaper_heartbeat_us = 0;
+				shm_ptr_->liveness_check_us = 0;
+				shm_ptr_->unregistered_readers = 0;
+				for (auto& counts : shm_ptr_->state_counts)
+				{
+					for (auto& count : counts.count)
+					{
+						count = 0;
+					}
+				}
+				shm_ptr_->addressed_full = 0;
+				for (auto& cursor : shm_ptr_->reader_cursors)
+				{
+					cursor.manager_id = -1;
+					cursor.owner_pid = 0;
+					cursor.last_seen_id = 0;
+					for (auto& held : cursor.held)
+					{
+						held.buffer = -1;
+						held.sequence_id = 0;
+					}
+				}
 
 				buffer_ptrs_ = std::vector<ShmBuffer*>(shm_ptr_->buffer_count);
-				for (int ii = 0; ii < static_cast<int>(requested_shm_parameters_.buffer_count); ++ii)
+				size_t data_offset = 0;
+				for (int cls = 0; cls < shm_ptr_->size_class_count; ++cls)
 				{
-					buffer_ptrs_[ii] = reinterpret_cast<ShmBuffer*>(reinterpret_cast<uint8_t*>(shm_ptr_ + 1) + ii * sizeof(ShmBuffer));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
-					if (getBufferInfo_(ii) == nullptr)
+					auto& size_class = shm_ptr_->size_classes[cls];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+					shm_ptr_->state_counts[cls].count[static_cast<int>(BufferSemaphoreFlags::Empty)] = size_class.buffer_count;  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+					for (int ii = size_class.first_buffer; ii < size_class.first_buffer + size_class.buffer_count; ++ii)
 					{
-						return false;
+						buffer_ptrs_[ii] = reinterpret_cast<ShmBuffer*>(bufferInfoStart_() + ii * sizeof(ShmBuffer));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+						if (getBufferInfo_(ii) == nullptr)
+						{
+							return false;
+						}
+						getBufferInfo_(ii)->writePos = 0;
+						getBufferInfo_(ii)->readPos = 0;
+						getBufferInfo_(ii)->sem = BufferSemaphoreFlags::Empty;
+						getBufferInfo_(ii)->sem_id = -1;
+						getBufferInfo_(ii)->owner_pid = 0;
+						getBufferInfo_(ii)->last_touch_time = TimeUtils::gettimeofday_us();
+						getBufferInfo_(ii)->queued_empty = true;
+						getBufferInfo_(ii)->queued_full = false;
+						data_offset = alignUp_(data_offset, bufferAlignment_(size_class.buffer_size));
+						getBufferInfo_(ii)->capacity = size_class.buffer_size;
+						getBufferInfo_(ii)->data_offset = data_offset;
+						getBufferInfo_(ii)->size_class = cls;
+						getBufferInfo_(ii)->read_count = 0;
+						data_offset += size_class.buffer_size;
+						pushIndex_(&size_class.empty_ring, ii);
 					}
-					getBufferInfo_(ii)->writePos = 0;
-					getBufferInfo_(ii)->readPos = 0;
-					getBufferInfo_(ii)->sem = BufferSemaphoreFlags::Empty;
-					getBufferInfo_(ii)->sem_id = -1;
-					getBufferInfo_(ii)->last_touch_time = TimeUtils::gettimeofday_us();
 				}
 
-				shm_ptr_->ready_magic = 0xCAFE1111;
+				shm_ptr_->layout_version = LayoutVersion;
+				shm_ptr_->header_size = sizeof(ShmStruct);
+				shm_ptr_->layout_magic = LayoutMagic;
 			}
 			else
 			{
 				TLOG(TLVL_ATTACH) << "Waiting for owner to initalize Shared Memory";
-				while (shm_ptr_->ready_magic != 0xCAFE1111) { usleep(1000); }
+				while (shm_ptr_->layout_magic != LayoutMagic && TimeUtils::GetElapsedTimeMicroseconds(start_time) < timeout_us) { usleep(1000); }
+				if (shm_ptr_->layout_magic != LayoutMagic || shm_ptr_->layout_version != LayoutVersion || shm_ptr_->header_size != sizeof(ShmStruct))
+				{
+					// Either the owner never finished, or the segment was created by a build with a different layout
+					TLOG(TLVL_ERROR) << "Refusing to attach to " << segment_->Describe() << ": expected shared memory layout version " << LayoutVersion
+					                 << " (header size " << sizeof(ShmStruct) << "), found magic 0x" << std::hex << shm_ptr_->layout_magic.load() << std::dec
+					                 << ", version " << shm_ptr_->layout_version << ", header size " << shm_ptr_->header_size;
+					shm_ptr_ = nullptr;
+					segment_->Close();
+					manager_id_ = -1;
+					return false;
+				}
+				if (segment_options_.segment_tag != 0 && shm_ptr_->segment_tag != segment_options_.segment_tag)
+				{
+					// The key is in use by something else, e.g. a shard of another ShardedSharedMemoryManager
+					TLOG(TLVL_ERROR) << "Refusing to attach to " << segment_->Describe() << ": expected segment tag 0x" << std::hex << segment_options_.segment_tag
+					                 << ", found 0x" << shm_ptr_->segment_tag << std::dec;
+					shm_ptr_ = nullptr;
+					segment_->Close();
+					manager_id_ = -1;
+					return false;
+				}
 				TLOG(TLVL_ATTACH) << "Getting ID from Shared Memory";
 				GetNewId();
 				shm_ptr_->lowest_seq_id_read = 0;
@@ -257,23 +531,34 @@ bool artdaq::SharedMemoryManager::Attach(size_t timeout_usec)
 				buffer_ptrs_ = std::vector<ShmBuffer*>(shm_ptr_->buffer_count);
 				for (int ii = 0; ii < shm_ptr_->buffer_count; ++ii)
 				{
-					buffer_ptrs_[ii] = reinterpret_cast<ShmBuffer*>(reinterpret_cast<uint8_t*>(shm_ptr_ + 1) + ii * sizeof(ShmBuffer));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+					buffer_ptrs_[ii] = reinterpret_cast<ShmBuffer*>(bufferInfoStart_() + ii * sizeof(ShmBuffer));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
 				}
 			}
 
+			// Pre-fault after initialization, so that other processes do not wait on the owner's pre-faulting
+			prepareSegment_(manager_id_ == 0);
+
 			//last_seen_id_ = shm_ptr_->next_sequence_id;
 			buffer_mutexes_ = std::vector<std::mutex>(shm_ptr_->buffer_count);
+			broadcast_holds_ = std::vector<BroadcastHold>(shm_ptr_->buffer_count);
 
 			TLOG(TLVL_ATTACH) << "Initialization Complete: "
 			                 << "key: 0x" << std::hex << shm_key_
 			                 << ", manager ID: " << std::dec << manager_id_
 			                 << ", Buffer size: " << shm_ptr_->buffer_size
-			                 << ", Buffer count: " << shm_ptr_->buffer_count;
+			                 << ", Buffer count: " << shm_ptr_->buffer_count
+			                 << ", Size classes: " << shm_ptr_->size_class_count;
+
+			if (manager_id_ == 0 && segment_options_.reaper_thread && shm_ptr_->buffer_timeout_us > 0)
+			{
+				startReaper_();
+			}
 			return true;
 		}
 
-		TLOG(TLVL_ERROR) << "Failed to attach to shared memory segment "
-		                 << shm_segment_id_;
+		TLOG(TLVL_ERROR) << "Failed to attach to " << segment_->Describe()
+		                 << ", errno=" << errno << " (" << strerror(errno) << ")";
+		segment_->Close();
 		return false;
 	}
 
@@ -281,257 +566,253 @@ bool artdaq::SharedMemoryManager::Attach(size_t timeout_usec)
 	                 << ", errno=" << std::dec << errno << " (" << strerror(errno) << ")"
 	                 << ".  Please check "
 	                 << "if a stale shared memory segment needs to "
-	                 << "be cleaned up. (ipcs, ipcrm -m <segId>)";
+	                 << "be cleaned up. (" << segment_->CleanupHint() << ")";
 	return false;
 }
 
-int artdaq::SharedMemoryManager::GetBufferForReading()
+void artdaq::SharedMemoryManager::prepareSegment_(bool owner)
 {
-	TLOG(TLVL_GETBUFFER) << "GetBufferForReading BEGIN";
-
-	std::lock_guard<std::mutex> lk(search_mutex_);
-	//TraceLock lk(search_mutex_, 11, "GetBufferForReadingSearch");
-	auto rp = shm_ptr_->reader_pos.load();
-
-	TLOG(TLVL_GETBUFFER) << "GetBufferForReading lock acquired, scanning " << shm_ptr_->buffer_count << " buffers";
+	if (!segment_options_.prefault && !segment_options_.lock_memory)
+	{
+		return;
+	}
 
-	for (int retry = 0; retry < 5; retry++)
+	size_t size = segment_->Size();
+	if (size == 0)
 	{
-		BufferSemaphoreFlags sem;
-		int16_t sem_id;
-		int buffer_num = -1;
-		ShmBuffer* buffer_ptr = nullptr;
-		uint64_t seqID = -1;
+		TLOG(TLVL_WARNING) << "Could not determine shared memory segment size, errno=" << errno << " (" << strerror(errno) << "), not pre-faulting or locking the segment";
+		return;
+	}
 
-		for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+	if (segment_options_.lock_memory)
+	{
+		// mlock also faults in every page of the mapping
+		if (mlock(shm_ptr_, size) == 0)
 		{
-			auto buffer = (ii + rp) % shm_ptr_->buffer_count;
-
-			TLOG(TLVL_GETBUFFER + 1) << "GetBufferForReading Checking if buffer " << buffer << " is stale. Shm destructive_read_mode=" << shm_ptr_->destructive_read_mode;
-			ResetBuffer(buffer);
+			TLOG(TLVL_ATTACH) << "Locked " << size << " bytes of shared memory";
+			return;
+		}
+		TLOG(TLVL_WARNING) << "Could not lock " << size << " bytes of shared memory, errno=" << errno << " (" << strerror(errno) << "). "
+		                   << "Check RLIMIT_MEMLOCK (ulimit -l).";
+	}
 
-			auto buf = getBufferInfo_(buffer);
-			if (buf == nullptr)
+	if (segment_options_.prefault)
+	{
+		// The owner allocates the pages (write fault), other processes only need them mapped (read fault).
+		// Touching a byte with its own value leaves the contents of an already-initialized segment unchanged.
+		auto start_time = std::chrono::steady_clock::now();
+		auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		auto mem = reinterpret_cast<uint8_t volatile*>(shm_ptr_);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		uint8_t sum = 0;
+		for (size_t off = 0; off < size; off += page_size)
+		{
+			if (owner)
 			{
-				continue;
+				mem[off] = mem[off];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
 			}
-
-			sem = buf->sem.load();
-			sem_id = buf->sem_id.load();
-
-			TLOG(TLVL_GETBUFFER + 1) << "GetBufferForReading: Buffer " << buffer << ": sem=" << FlagToString(sem)
-			         << " (expected " << FlagToString(BufferSemaphoreFlags::Full) << "), sem_id=" << sem_id << ", seq_id=" << buf->sequence_id << " )";
-			if (sem == BufferSemaphoreFlags::Full && (sem_id == -1 || sem_id == manager_id_) && (shm_ptr_->destructive_read_mode || buf->sequence_id > last_seen_id_))
+			else
 			{
-				if (buf->sequence_id < seqID)
-				{
-					buffer_ptr = buf;
-					seqID = buf->sequence_id;
-					buffer_num = buffer;
-					touchBuffer_(buf);
-					if (shm_ptr_->destructive_read_mode || seqID == last_seen_id_ + 1)
-					{
-						break;
-					}
-				}
+				sum += mem[off];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
 			}
 		}
+		TLOG(TLVL_ATTACH) << "Pre-faulted " << size << " bytes of shared memory in " << TimeUtils::GetElapsedTimeMicroseconds(start_time) << " us (checksum " << static_cast<int>(sum) << ")";
+	}
+}
+
+int artdaq::SharedMemoryManager::GetBufferForReading()
+{
+	TLOG(TLVL_GETBUFFER) << "GetBufferForReading BEGIN";
+	reclaimStaleBuffers_();
+	return getBufferForReading_();
+}
 
-		if (buffer_ptr != nullptr)
+std::vector<int> artdaq::SharedMemoryManager::GetBuffersForReading(size_t max_count)
+{
+	TLOG(TLVL_GETBUFFER) << "GetBuffersForReading BEGIN, max_count=" << max_count;
+	std::vector<int> buffers;
+	if (!IsValid())
+	{
+		return buffers;
+	}
+	reclaimStaleBuffers_();
+	buffers.reserve(max_count);
+	while (buffers.size() < max_count)
+	{
+		auto buffer = getBufferForReading_();
+		if (buffer == -1)
 		{
-			sem = buffer_ptr->sem.load();
-			sem_id = buffer_ptr->sem_id.load();
+			break;
 		}
+		buffers.push_back(buffer);
+	}
+	TLOG(TLVL_GETBUFFER) << "GetBuffersForReading returning " << buffers.size() << " buffers";
+	return buffers;
+}
 
-		if ((buffer_ptr == nullptr) || (sem_id != -1 && sem_id != manager_id_) || sem != BufferSemaphoreFlags::Full)
+int artdaq::SharedMemoryManager::getBufferForReading_()
+{
+	if (shm_ptr_->destructive_read_mode)
+	{
+		// Buffers queued for this manager as a destination come first, then the shared Full ring
+		int buffer_num = -1;
+		if (destination_slot_ != -1)
 		{
-			continue;
+			buffer_num = acquireFromRing_(&shm_ptr_->destinations[destination_slot_].full_ring);  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
 		}
-
-		if (buffer_num >= 0)
+		if (buffer_num == -1)
+		{
+			buffer_num = acquireFromRing_(&shm_ptr_->full_ring);
+		}
+		if (buffer_num != -1)
 		{
-			TLOG(TLVL_GETBUFFER) << "GetBufferForReading Found buffer " << buffer_num;
-			touchBuffer_(buffer_ptr);
-			if (!buffer_ptr->sem_id.compare_exchange_strong(sem_id, manager_id_))
-			{
-				continue;
-			}
-			if (!buffer_ptr->sem.compare_exchange_strong(sem, BufferSemaphoreFlags::Reading))
-			{
-				continue;
-			}
-			if (!checkBuffer_(buffer_ptr, BufferSemaphoreFlags::Reading, false))
-			{
-				TLOG(TLVL_GETBUFFER) << "GetBufferForReading: Failed to acquire buffer " << buffer_num << " (someone else changed manager ID while I was changing sem)";
-				continue;
-			}
-			buffer_ptr->readPos = 0;
-			touchBuffer_(buffer_ptr);
-			if (!checkBuffer_(buffer_ptr, BufferSemaphoreFlags::Reading, false))
-			{
-				TLOG(TLVL_GETBUFFER) << "GetBufferForReading: Failed to acquire buffer " << buffer_num << " (someone else changed manager ID while I was touching buffer SHOULD NOT HAPPEN!)";
-				continue;
-			}
-			if (shm_ptr_->destructive_read_mode && shm_ptr_->lowest_seq_id_read == last_seen_id_)
-			{
-				shm_ptr_->lowest_seq_id_read = seqID;
-			}
-			last_seen_id_ = seqID;
-			if (shm_ptr_->destructive_read_mode)
-			{
-				shm_ptr_->reader_pos = (buffer_num + 1) % shm_ptr_->buffer_count;
-			}
-
 			TLOG(TLVL_GETBUFFER) << "GetBufferForReading returning " << buffer_num;
 			return buffer_num;
 		}
-		retry = 5;
+
+		TLOG(TLVL_GETBUFFER) << "GetBufferForReading returning -1 because no buffers are ready";
+		return -1;
+	}
+
+	// Broadcast mode: every reader sees every buffer, so buffers stay Full while they are read, and
+	// each reader looks up the lowest sequence ID it has not yet seen in the sequence index.
+	std::lock_guard<std::mutex> lk(search_mutex_);
+	//TraceLock lk(search_mutex_, 11, "GetBufferForReadingSearch");
+	registerReader_();
+
+	auto buffer_num = holdNextSequence_();
+	if (buffer_num != -1)
+	{
+		TLOG(TLVL_GETBUFFER) << "GetBufferForReading returning " << buffer_num;
+		return buffer_num;
 	}
 
 	TLOG(TLVL_GETBUFFER) << "GetBufferForReading returning -1 because no buffers are ready";
 	return -1;
 }
 
-int artdaq::SharedMemoryManager::GetBufferForWriting(bool overwrite)
+int artdaq::SharedMemoryManager::GetBufferForWriting(bool overwrite, size_t size_hint)
 {
-	TLOG(TLVL_GETBUFFER + 1) << "GetBufferForWriting BEGIN, overwrite=" << (overwrite ? "true" : "false");
-
-	std::lock_guard<std::mutex> lk(search_mutex_);
-	//TraceLock lk(search_mutex_, 12, "GetBufferForWritingSearch");
-	auto wp = shm_ptr_->writer_pos.load();
-
-	TLOG(TLVL_GETBUFFER) << "GetBufferForWriting lock acquired, scanning " << shm_ptr_->buffer_count << " buffers";
+	TLOG(TLVL_GETBUFFER + 1) << "GetBufferForWriting BEGIN, overwrite=" << (overwrite ? "true" : "false") << ", size_hint=" << size_hint;
+	reclaimStaleBuffers_();
+	return getBufferForWriting_(overwrite, size_hint);
+}
 
-	// First, only look for "Empty" buffers
-	for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+std::vector<int> artdaq::SharedMemoryManager::GetBuffersForWriting(size_t count, bool overwrite, size_t size_hint)
+{
+	TLOG(TLVL_GETBUFFER + 1) << "GetBuffersForWriting BEGIN, count=" << count << ", overwrite=" << (overwrite ? "true" : "false") << ", size_hint=" << size_hint;
+	std::vector<int> buffers;
+	if (!IsValid())
+	{
+		return buffers;
+	}
+	reclaimStaleBuffers_();
+	buffers.reserve(count);
+	while (buffers.size() < count)
 	{
-		auto buffer = (ii + wp) % shm_ptr_->buffer_count;
+		auto buffer = getBufferForWriting_(overwrite, size_hint);
+		if (buffer == -1)
+		{
+			break;
+		}
+		buffers.push_back(buffer);
+	}
+	TLOG(TLVL_GETBUFFER + 1) << "GetBuffersForWriting returning " << buffers.size() << " buffers";
+	return buffers;
+}
 
-		ResetBuffer(buffer);
+int artdaq::SharedMemoryManager::getBufferForWriting_(bool overwrite, size_t size_hint)
+{
+	auto first_class = sizeClassFor_(size_hint);
+	if (first_class == -1)
+	{
+		TLOG(TLVL_WARNING) << "GetBufferForWriting: No buffer can hold " << size_hint << " bytes (largest buffer size is " << shm_ptr_->buffer_size << ")";
+		return -1;
+	}
 
-		auto buf = getBufferInfo_(buffer);
-		if (buf == nullptr)
+	auto setupWriteBuffer = [this](int buffer, ShmBuffer* buf) {
+		shm_ptr_->writer_pos = (buffer + 1) % shm_ptr_->buffer_count;
+		buf->sequence_id = shm_ptr_->next_sequence_id.fetch_add(1) + 1;
+		buf->writePos = 0;
+		buf->read_count = 0;
+		if (!checkBuffer_(buf, BufferSemaphoreFlags::Writing, false))
 		{
-			continue;
+			return false;
 		}
+		touchBuffer_(buf);
+		return true;
+	};
 
-		auto sem = buf->sem.load();
-		auto sem_id = buf->sem_id.load();
-
-		if (sem == BufferSemaphoreFlags::Empty && sem_id == -1)
+	// First, only look for "Empty" buffers, starting with the smallest size class which can hold size_hint bytes
+	for (auto cls = first_class; cls < shm_ptr_->size_class_count; ++cls)
+	{
+		auto ring = &shm_ptr_->size_classes[cls].empty_ring;  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		for (uint64_t ii = 0; ii < ring->capacity; ++ii)
 		{
-			touchBuffer_(buf);
-			if (!buf->sem_id.compare_exchange_strong(sem_id, manager_id_))
+			auto buffer = popIndex_(ring);
+			if (buffer == -1)
 			{
-				continue;
+				break;
 			}
-			if (!buf->sem.compare_exchange_strong(sem, BufferSemaphoreFlags::Writing))
+
+			auto buf = getBufferInfo_(buffer);
+			if (buf == nullptr)
 			{
 				continue;
 			}
-			if (!checkBuffer_(buf, BufferSemaphoreFlags::Writing, false))
+			buf->queued_empty = false;
+
+			if (!acquireBuffer_(buf, BufferSemaphoreFlags::Empty, BufferSemaphoreFlags::Writing))
 			{
+				TLOG(TLVL_GETBUFFER + 1) << "GetBufferForWriting: Discarding stale ring entry for buffer " << buffer << " (sem=" << FlagToString(buf->sem) << ")";
 				continue;
 			}
-			shm_ptr_->writer_pos = (buffer + 1) % shm_ptr_->buffer_count;
-			buf->sequence_id = ++shm_ptr_->next_sequence_id;
-			buf->writePos = 0;
-			if (!checkBuffer_(buf, BufferSemaphoreFlags::Writing, false))
+			if (!setupWriteBuffer(buffer, buf))
 			{
 				continue;
 			}
-			touchBuffer_(buf);
-			TLOG(TLVL_GETBUFFER + 1) << "GetBufferForWriting returning empty buffer " << buffer;
+			TLOG(TLVL_GETBUFFER + 1) << "GetBufferForWriting returning empty buffer " << buffer << " (size " << buf->capacity << ")";
 			return buffer;
 		}
 	}
 
 	if (overwrite)
 	{
-		// Then, look for "Full" buffers
-		for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
-		{
-			auto buffer = (ii + wp) % shm_ptr_->buffer_count;
-
-			ResetBuffer(buffer);
-
-			auto buf = getBufferInfo_(buffer);
-			if (buf == nullptr)
-			{
-				continue;
-			}
-
-			auto sem = buf->sem.load();
-			auto sem_id = buf->sem_id.load();
+		// Non-reliable mode is the exceptional path; fall back to searching for Full buffers, and
+		// if we still haven't found a buffer, we have to clobber a reader...
+		std::lock_guard<std::mutex> lk(search_mutex_);
+		//TraceLock lk(search_mutex_, 12, "GetBufferForWritingSearch");
+		auto wp = shm_ptr_->writer_pos.load();
 
-			if (sem == BufferSemaphoreFlags::Full)
-			{
-				touchBuffer_(buf);
-				if (!buf->sem_id.compare_exchange_strong(sem_id, manager_id_))
-				{
-					continue;
-				}
-				if (!buf->sem.compare_exchange_strong(sem, BufferSemaphoreFlags::Writing))
-				{
-					continue;
-				}
-				if (!checkBuffer_(buf, BufferSemaphoreFlags::Writing, false))
-				{
-					continue;
-				}
-				shm_ptr_->writer_pos = (buffer + 1) % shm_ptr_->buffer_count;
-				buf->sequence_id = ++shm_ptr_->next_sequence_id;
-				buf->writePos = 0;
-				if (!checkBuffer_(buf, BufferSemaphoreFlags::Writing, false))
-				{
-					continue;
-				}
-				touchBuffer_(buf);
-				TLOG(TLVL_GETBUFFER + 1) << "GetBufferForWriting returning full buffer (overwrite mode) " << buffer;
-				return buffer;
-			}
-		}
+		TLOG(TLVL_GETBUFFER) << "GetBufferForWriting lock acquired, scanning " << shm_ptr_->buffer_count << " buffers";
 
-		// Finally, if we still haven't found a buffer, we have to clobber a reader...
-		for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+		for (auto state : {BufferSemaphoreFlags::Full, BufferSemaphoreFlags::Reading})
 		{
-			auto buffer = (ii + wp) % shm_ptr_->buffer_count;
-
-			ResetBuffer(buffer);
-
-			auto buf = getBufferInfo_(buffer);
-			if (buf == nullptr)
+			for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
 			{
-				continue;
-			}
-
-			auto sem = buf->sem.load();
-			auto sem_id = buf->sem_id.load();
+				auto buffer = (ii + wp) % shm_ptr_->buffer_count;
 
-			if (sem == BufferSemaphoreFlags::Reading)
-			{
-				touchBuffer_(buf);
-				if (!buf->sem_id.compare_exchange_strong(sem_id, manager_id_))
+				auto buf = getBufferInfo_(buffer);
+				if (buf == nullptr || buf->capacity < size_hint)
 				{
 					continue;
 				}
-				if (!buf->sem.compare_exchange_strong(sem, BufferSemaphoreFlags::Writing))
+				// Broadcast buffers being read stay Full; like Reading buffers, they are only clobbered as a last resort
+				auto sem = buf->sem.load();
+				bool held = sem == BufferSemaphoreFlags::Full && buf->read_count > 0 && !shm_ptr_->destructive_read_mode;
+				if ((held ? BufferSemaphoreFlags::Reading : sem) != state)
 				{
 					continue;
 				}
-				if (!checkBuffer_(buf, BufferSemaphoreFlags::Writing, false))
+
+				if (!acquireBuffer_(buf, sem, BufferSemaphoreFlags::Writing))
 				{
 					continue;
 				}
-				shm_ptr_->writer_pos = (buffer + 1) % shm_ptr_->buffer_count;
-				buf->sequence_id = ++shm_ptr_->next_sequence_id;
-				buf->writePos = 0;
-				if (!checkBuffer_(buf, BufferSemaphoreFlags::Writing, false))
+				if (!setupWriteBuffer(buffer, buf))
 				{
 					continue;
 				}
-				touchBuffer_(buf);
-				TLOG(TLVL_GETBUFFER + 1) << "GetBufferForWriting clobbering reader on buffer " << buffer << " (overwrite mode)";
+				TLOG(TLVL_GETBUFFER + 1) << "GetBufferForWriting returning " << FlagToString(state) << " buffer " << buffer << " (overwrite mode)";
 				return buffer;
 			}
 		}
@@ -540,78 +821,151 @@ int artdaq::SharedMemoryManager::GetBufferForWriting(bool overwrite)
 	return -1;
 }
 
-size_t artdaq::SharedMemoryManager::ReadReadyCount()
+artdaq::SharedMemoryManager::WriteTransaction artdaq::SharedMemoryManager::BeginWrite(bool overwrite, size_t size_hint)
+{
+	auto buffer = GetBufferForWriting(overwrite, size_hint);
+	if (buffer == -1)
+	{
+		return WriteTransaction();
+	}
+	TLOG(TLVL_WRITE) << "BeginWrite: Reserved buffer " << buffer;
+	return WriteTransaction(this, buffer);
+}
+
+bool artdaq::SharedMemoryManager::WriteTransaction::Commit(size_t bytes, int destination)
 {
 	if (!IsValid())
 	{
-		return 0;
+		return false;
 	}
-	TLOG(TLVL_READREADY) << "0x" << std::hex << shm_key_ << " ReadReadyCount BEGIN" << std::dec;
-	std::unique_lock<std::mutex> lk(search_mutex_);
-	TLOG(TLVL_READREADY) << "ReadReadyCount lock acquired, scanning " << shm_ptr_->buffer_count << " buffers";
-	//TraceLock lk(search_mutex_, 14, "ReadReadyCountSearch");
-	size_t count = 0;
-	for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+	if (bytes > 0 && !manager_->IncrementWritePos(buffer_, bytes))
 	{
-#ifndef __OPTIMIZE__
-		TLOG(TLVL_READREADY + 1) << "0x" << std::hex << shm_key_ << std::dec << " ReadReadyCount: Checking if buffer " << ii << " is stale.";
-#endif
-		ResetBuffer(ii);
-		auto buf = getBufferInfo_(ii);
-		if (buf == nullptr)
-		{
-			continue;
-		}
-
-#ifndef __OPTIMIZE__
-		TLOG(TLVL_READREADY + 2) << "0x" << std::hex << shm_key_ << std::dec << " ReadReadyCount: Buffer " << ii << ": sem=" << FlagToString(buf->sem) << " (expected " << FlagToString(BufferSemaphoreFlags::Full) << "), sem_id=" << buf->sem_id << " )";
-#endif
-		if (buf->sem == BufferSemaphoreFlags::Full && (buf->sem_id == -1 || buf->sem_id == manager_id_) && (shm_ptr_->destructive_read_mode || buf->sequence_id > last_seen_id_))
-		{
-#ifndef __OPTIMIZE__
-			TLOG(TLVL_READREADY + 3) << "0x" << std::hex << shm_key_ << std::dec << " ReadReadyCount: Buffer " << ii << " is either unowned or owned by this manager, and is marked full.";
-#endif
-			touchBuffer_(buf);
-			++count;
-		}
+		TLOG(TLVL_ERROR) << "WriteTransaction::Commit: Could not commit " << bytes << " bytes to buffer " << buffer_ << ", abandoning transaction";
+		Abandon();
+		return false;
 	}
-	return count;
+	manager_->updateLastSeenId_(manager_->getBufferInfo_(buffer_));
+	manager_->MarkBufferFull(buffer_, destination);
+	TLOG(TLVL_WRITE) << "WriteTransaction::Commit: Committed " << bytes << " bytes to buffer " << buffer_;
+	buffer_ = -1;
+	return true;
 }
 
-size_t artdaq::SharedMemoryManager::WriteReadyCount(bool overwrite)
+void artdaq::SharedMemoryManager::WriteTransaction::Abandon()
+{
+	if (!IsValid())
+	{
+		return;
+	}
+	TLOG(TLVL_WRITE) << "WriteTransaction::Abandon: Releasing buffer " << buffer_;
+	auto buffer = buffer_;
+	buffer_ = -1;
+	if (manager_->IsValid() && manager_->CheckBuffer(buffer, BufferSemaphoreFlags::Writing))
+	{
+		manager_->MarkBufferEmpty(buffer, true);
+	}
+}
+
+bool artdaq::SharedMemoryManager::WaitForReadable(size_t timeout_us)
+{
+	if (!IsValid())
+	{
+		return false;
+	}
+	return waitForChannel_(&shm_ptr_->readable_channel, timeout_us, [this]() { return ReadyForRead(); });
+}
+
+bool artdaq::SharedMemoryManager::WaitForWritable(size_t timeout_us, bool overwrite, size_t size_hint)
+{
+	if (!IsValid())
+	{
+		return false;
+	}
+	// Call the base-class implementation explicitly, derived classes may reserve a buffer in ReadyForWrite.
+	// Buffers becoming Full do not signal the writable channel, so overwrite mode re-checks every millisecond.
+	return waitForChannel_(
+	    &shm_ptr_->writable_channel, timeout_us, [this, overwrite, size_hint]() { return SharedMemoryManager::ReadyForWrite(overwrite, size_hint); }, overwrite ? 1000 : 0);
+}
+
+bool artdaq::SharedMemoryManager::WaitForReadable(size_t timeout_us, std::function<bool()> const& ready)
+{
+	if (!IsValid())
+	{
+		return false;
+	}
+	return waitForChannel_(&shm_ptr_->readable_channel, timeout_us, ready);
+}
+
+bool artdaq::SharedMemoryManager::WaitForWritable(size_t timeout_us, std::function<bool()> const& ready, size_t max_slice_us)
+{
+	if (!IsValid())
+	{
+		return false;
+	}
+	return waitForChannel_(&shm_ptr_->writable_channel, timeout_us, ready, max_slice_us);
+}
+
+size_t artdaq::SharedMemoryManager::ReadReadyCount()
 {
 	if (!IsValid())
 	{
 		return 0;
 	}
-	TLOG(TLVL_WRITEREADY) << "0x" << std::hex << shm_key_ << " ReadReadyCount BEGIN" << std::dec;
-	std::unique_lock<std::mutex> lk(search_mutex_);
-	//TraceLock lk(search_mutex_, 15, "WriteReadyCountSearch");
-	TLOG(TLVL_WRITEREADY) << "WriteReadyCount(" << overwrite << ") lock acquired, scanning " << shm_ptr_->buffer_count << " buffers";
-	size_t count = 0;
-	for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+	TLOG(TLVL_READREADY) << "0x" << std::hex << shm_key_ << " ReadReadyCount BEGIN" << std::dec;
+	reclaimStaleBuffers_();
+
+	auto full = GetBufferStateCounts().full;
+	if (full == 0)
 	{
-		// ELF, 3/19/2019: This TRACE call is a major performance hit with many buffers
-#ifndef __OPTIMIZE__
-		TLOG(TLVL_WRITEREADY + 1) << "0x" << std::hex << shm_key_ << std::dec << " WriteReadyCount: Checking if buffer " << ii << " is stale.";
-#endif
-		ResetBuffer(ii);
-		auto buf = getBufferInfo_(ii);
-		if (buf == nullptr)
+		// A broadcast reader registers its cursor on its first read-side call, even if there is nothing to read yet
+		if (!shm_ptr_->destructive_read_mode)
 		{
-			continue;
+			std::unique_lock<std::mutex> lk(search_mutex_);
+			registerReader_();
 		}
-		if ((buf->sem == BufferSemaphoreFlags::Empty && buf->sem_id == -1) || (overwrite && buf->sem != BufferSemaphoreFlags::Writing))
+		return 0;
+	}
+	if (shm_ptr_->destructive_read_mode)
+	{
+		// Every Full buffer can be read by any reader unless some are queued for destinations or addressed to one reader
+		if (shm_ptr_->destination_count == 0 && shm_ptr_->addressed_full == 0)
 		{
-#ifndef __OPTIMIZE__
-			TLOG(TLVL_WRITEREADY + 1) << "0x" << std::hex << shm_key_ << std::dec << " WriteReadyCount: Buffer " << ii << " is either empty or is available for overwrite.";
-#endif
-			++count;
+			return full;
+		}
+		size_t count = 0;
+		if (destination_slot_ != -1)
+		{
+			count += countQueued_(&shm_ptr_->destinations[destination_slot_].full_ring, BufferSemaphoreFlags::Full, false);  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
 		}
+		return count + countQueued_(&shm_ptr_->full_ring, BufferSemaphoreFlags::Full, false);
 	}
+
+	std::unique_lock<std::mutex> lk(search_mutex_);
+	//TraceLock lk(search_mutex_, 14, "ReadReadyCountSearch");
+	registerReader_();
+	size_t seqID = 0;
+	size_t count = 0;
+	findSequence_(last_seen_id_, &seqID, &count);
 	return count;
 }
 
+size_t artdaq::SharedMemoryManager::WriteReadyCount(bool overwrite, size_t size_hint)
+{
+	if (!IsValid())
+	{
+		return 0;
+	}
+	TLOG(TLVL_WRITEREADY) << "0x" << std::hex << shm_key_ << " WriteReadyCount BEGIN" << std::dec;
+	reclaimStaleBuffers_();
+
+	auto counts = GetBufferStateCounts(size_hint);
+	if (!overwrite)
+	{
+		return counts.empty;
+	}
+	return counts.empty + counts.full + counts.reading;
+}
+
 bool artdaq::SharedMemoryManager::ReadyForRead()
 {
 	if (!IsValid())
@@ -619,72 +973,58 @@ bool artdaq::SharedMemoryManager::ReadyForRead()
 		return false;
 	}
 	TLOG(TLVL_READREADY) << "0x" << std::hex << shm_key_ << " ReadyForRead BEGIN" << std::dec;
-	std::unique_lock<std::mutex> lk(search_mutex_);
-	//TraceLock lk(search_mutex_, 14, "ReadyForReadSearch");
-
-	auto rp = shm_ptr_->reader_pos.load();
+	reclaimStaleBuffers_();
 
-	TLOG(TLVL_READREADY) << "ReadyForRead lock acquired, scanning " << shm_ptr_->buffer_count << " buffers";
-
-	for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+	if (shm_ptr_->destructive_read_mode)
 	{
-		auto buffer = (rp + ii) % shm_ptr_->buffer_count;
-
-#ifndef __OPTIMIZE__
-		TLOG(TLVL_READREADY + 1) << "0x" << std::hex << shm_key_ << std::dec << " ReadyForRead: Checking if buffer " << buffer << " is stale.";
-#endif
-		ResetBuffer(buffer);
-		auto buf = getBufferInfo_(buffer);
-		if (buf == nullptr)
+		if (destination_slot_ != -1 && countQueued_(&shm_ptr_->destinations[destination_slot_].full_ring, BufferSemaphoreFlags::Full, true) > 0)  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
 		{
-			continue;
+			return true;
 		}
+		return countQueued_(&shm_ptr_->full_ring, BufferSemaphoreFlags::Full, true) > 0;
+	}
 
-#ifndef __OPTIMIZE__
-		TLOG(TLVL_READREADY + 2) << "0x" << std::hex << shm_key_ << std::dec << " ReadyForRead: Buffer " << buffer << ": sem=" << FlagToString(buf->sem) << " (expected " << FlagToString(BufferSemaphoreFlags::Full) << "), sem_id=" << buf->sem_id << " )"
-		         << " seq_id=" << buf->sequence_id << " >? " << last_seen_id_;
-#endif
+	std::unique_lock<std::mutex> lk(search_mutex_);
+	//TraceLock lk(search_mutex_, 14, "ReadyForReadSearch");
+	registerReader_();
 
-		if (buf->sem == BufferSemaphoreFlags::Full && (buf->sem_id == -1 || buf->sem_id == manager_id_) && (shm_ptr_->destructive_read_mode || buf->sequence_id > last_seen_id_))
-		{
-			TLOG(TLVL_READREADY + 3) << "0x" << std::hex << shm_key_ << std::dec << " ReadyForRead: Buffer " << buffer << " is either unowned or owned by this manager, and is marked full.";
-			touchBuffer_(buf);
-			return true;
-		}
+	size_t seqID = 0;
+	auto buffer = findSequence_(last_seen_id_, &seqID, nullptr);
+	if (buffer != -1)
+	{
+		TLOG(TLVL_READREADY + 3) << "0x" << std::hex << shm_key_ << std::dec << " ReadyForRead: Buffer " << buffer << " (seq_id=" << seqID << ") is either unowned or owned by this manager, and is marked full.";
+		touchBuffer_(getBufferInfo_(buffer));
+		return true;
 	}
 	return false;
 }
 
-bool artdaq::SharedMemoryManager::ReadyForWrite(bool overwrite)
+bool artdaq::SharedMemoryManager::ReadyForWrite(bool overwrite, size_t size_hint)
 {
 	if (!IsValid())
 	{
 		return false;
 	}
 	TLOG(TLVL_WRITEREADY) << "0x" << std::hex << shm_key_ << " ReadyForWrite BEGIN" << std::dec;
+	reclaimStaleBuffers_();
 
-	std::lock_guard<std::mutex> lk(search_mutex_);
-	//TraceLock lk(search_mutex_, 15, "ReadyForWriteSearch");
+	if (countEmpty_(size_hint, true) > 0)
+	{
+		return true;
+	}
+	if (!overwrite)
+	{
+		return false;
+	}
 
 	auto wp = shm_ptr_->writer_pos.load();
-
-	TLOG(TLVL_WRITEREADY) << "ReadyForWrite lock acquired, scanning " << shm_ptr_->buffer_count << " buffers";
-
 	for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
 	{
 		auto buffer = (wp + ii) % shm_ptr_->buffer_count;
-		TLOG(TLVL_WRITEREADY+ 1) << "0x" << std::hex << shm_key_ << std::dec << " ReadyForWrite: Checking if buffer " << buffer << " is stale.";
-		ResetBuffer(buffer);
 		auto buf = getBufferInfo_(buffer);
-		if (buf == nullptr)
-		{
-			continue;
-		}
-		if ((buf->sem == BufferSemaphoreFlags::Empty && buf->sem_id == -1) || (overwrite && buf->sem != BufferSemaphoreFlags::Writing))
+		if (buf != nullptr && buf->sem != BufferSemaphoreFlags::Writing && buf->capacity >= size_hint)
 		{
-			TLOG(TLVL_WRITEREADY+1) << "0x" << std::hex << shm_key_
-			         << std::dec
-			         << " WriteReadyCount: Buffer " << ii << " is either empty or available for overwrite.";
+			TLOG(TLVL_WRITEREADY + 1) << "0x" << std::hex << shm_key_ << std::dec << " ReadyForWrite: Buffer " << buffer << " is available for overwrite.";
 			return true;
 		}
 	}
@@ -713,7 +1053,7 @@ std::deque<int> artdaq::SharedMemoryManager::GetBuffersOwnedByManager(bool locke
 			{
 				continue;
 			}
-			if (buf->sem_id == manager_id_)
+			if (buf->sem_id == manager_id_ || holdsForReading_(ii, buf))
 			{
 				output.push_back(ii);
 			}
@@ -728,7 +1068,7 @@ std::deque<int> artdaq::SharedMemoryManager::GetBuffersOwnedByManager(bool locke
 			{
 				continue;
 			}
-			if (buf->sem_id == manager_id_)
+			if (buf->sem_id == manager_id_ || holdsForReading_(ii, buf))
 			{
 				output.push_back(ii);
 			}
@@ -779,12 +1119,12 @@ void artdaq::SharedMemoryManager::ResetReadPos(int buffer)
 
 	//TraceLock lk(buffer_mutexes_[buffer], 18, "ResetReadPosBuffer" + std::to_string(buffer));
 	auto buf = getBufferInfo_(buffer);
-	if ((buf == nullptr) || buf->sem_id != manager_id_)
+	if ((buf == nullptr) || !holdsForReading_(buffer, buf))
 	{
 		return;
 	}
 	touchBuffer_(buf);
-	buf->readPos = 0;
+	readPos_(buffer, buf) = 0;
 
 	TLOG(TLVL_POS) << "ResetReadPos(" << buffer << ") ended.";
 }
@@ -829,17 +1169,18 @@ void artdaq::SharedMemoryManager::IncrementReadPos(int buffer, size_t read)
 	TLOG(TLVL_BUFLCK) << "IncrementReadPos obtained buffer_mutex for buffer " << buffer;
 	//TraceLock lk(buffer_mutexes_[buffer], 19, "IncReadPosBuffer" + std::to_string(buffer));
 	auto buf = getBufferInfo_(buffer);
-	if ((buf == nullptr) || buf->sem_id != manager_id_)
+	if ((buf == nullptr) || !holdsForReading_(buffer, buf))
 	{
 		return;
 	}
 	touchBuffer_(buf);
-	TLOG(TLVL_POS) << "IncrementReadPos: buffer= " << buffer << ", readPos=" << buf->readPos << ", bytes read=" << read;
-	buf->readPos = buf->readPos + read;
-	TLOG(TLVL_POS) << "IncrementReadPos: buffer= " << buffer << ", New readPos is " << buf->readPos;
+	auto& readPos = readPos_(buffer, buf);
+	TLOG(TLVL_POS) << "IncrementReadPos: buffer= " << buffer << ", readPos=" << readPos << ", bytes read=" << read;
+	readPos = readPos + read;
+	TLOG(TLVL_POS) << "IncrementReadPos: buffer= " << buffer << ", New readPos is " << readPos;
 	if (read == 0)
 	{
-		Detach(true, "LogicError", "Cannot increment Read pos by 0! (buffer=" + std::to_string(buffer) + ", readPos=" + std::to_string(buf->readPos) + ", writePos=" + std::to_string(buf->writePos) + ")");
+		Detach(true, "LogicError", "Cannot increment Read pos by 0! (buffer=" + std::to_string(buffer) + ", readPos=" + std::to_string(readPos) + ", writePos=" + std::to_string(buf->writePos) + ")");
 	}
 }
 
@@ -863,9 +1204,9 @@ bool artdaq::SharedMemoryManager::IncrementWritePos(int buffer, size_t written)
 	}
 	checkBuffer_(buf, BufferSemaphoreFlags::Writing);
 	touchBuffer_(buf);
-	if (buf->writePos + written > shm_ptr_->buffer_size)
+	if (buf->writePos + written > buf->capacity)
 	{
-		TLOG(TLVL_ERROR) << "Requested write size is larger than the buffer size! (sz=" << std::hex << shm_ptr_->buffer_size << ", cur + req=" << std::dec << buf->writePos + written << ")";
+		TLOG(TLVL_ERROR) << "Requested write size is larger than the buffer size! (sz=" << std::hex << buf->capacity << ", cur + req=" << std::dec << buf->writePos + written << ")";
 		return false;
 	}
 	TLOG(TLVL_POS+ 1) << "IncrementWritePos: buffer= " << buffer << ", writePos=" << buf->writePos << ", bytes written=" << written;
@@ -897,8 +1238,9 @@ bool artdaq::SharedMemoryManager::MoreDataInBuffer(int buffer)
 	{
 		return false;
 	}
-	TLOG(TLVL_POS + 2) << "MoreDataInBuffer: buffer= " << buffer << ", readPos=" << std::to_string(buf->readPos) << ", writePos=" << buf->writePos;
-	return buf->readPos < buf->writePos;
+	auto readPos = readPos_(buffer, buf);
+	TLOG(TLVL_POS + 2) << "MoreDataInBuffer: buffer= " << buffer << ", readPos=" << std::to_string(readPos) << ", writePos=" << buf->writePos;
+	return readPos < buf->writePos;
 }
 
 bool artdaq::SharedMemoryManager::CheckBuffer(int buffer, BufferSemaphoreFlags flags)
@@ -912,6 +1254,10 @@ bool artdaq::SharedMemoryManager::CheckBuffer(int buffer, BufferSemaphoreFlags f
 	std::lock_guard<std::mutex> lk(buffer_mutexes_[buffer]);
 	TLOG(TLVL_BUFLCK) << "CheckBuffer obtained buffer_mutex for buffer " << buffer;
 	//TraceLock lk(buffer_mutexes_[buffer], 22, "CheckBuffer" + std::to_string(buffer));
+	if (flags == BufferSemaphoreFlags::Reading)
+	{
+		return checkReading_(buffer, getBufferInfo_(buffer), false);
+	}
 	return checkBuffer_(getBufferInfo_(buffer), flags, false);
 }
 
@@ -935,13 +1281,75 @@ void artdaq::SharedMemoryManager::MarkBufferFull(int buffer, int destination)
 	touchBuffer_(shmBuf);
 	if (shmBuf->sem_id == manager_id_)
 	{
-		if (shmBuf->sem != BufferSemaphoreFlags::Full)
+		// A Full buffer held by this manager was addressed to it
+		bool was_addressed = shmBuf->sem == BufferSemaphoreFlags::Full;
+		if (destination != -1)
+		{
+			shm_ptr_->addressed_full.fetch_add(1);
+		}
+		if (shm_ptr_->destructive_read_mode)
+		{
+			setBufferState_(shmBuf, BufferSemaphoreFlags::Full);
+			shmBuf->sem_id = destination;
+		}
+		else
+		{
+			// A broadcast buffer becomes Full and enters the sequence index under the index lock, so that readers and
+			// recycleBroadcastBuffer_ never see it Full with a sequence ID which a reader has already passed
+			ShmSpinLock lk(&shm_ptr_->sequence_index.lock);
+			renumberPassedBuffer_(buffer, shmBuf);
+			setBufferState_(shmBuf, BufferSemaphoreFlags::Full);
+			shmBuf->sem_id = destination;
+			insertSequence_(buffer, shmBuf->sequence_id);
+		}
+		if (was_addressed)
+		{
+			shm_ptr_->addressed_full.fetch_sub(1);
+		}
+		queueBuffer_(buffer, BufferSemaphoreFlags::Full);
+	}
+}
+
+void artdaq::SharedMemoryManager::MarkBuffersFull(std::vector<int> const& buffers, int destination)
+{
+	// Readers are woken once, after the whole batch is queued
+	notify_deferral_.fetch_add(1);
+	try
+	{
+		for (auto buffer : buffers)
 		{
-			shmBuf->sem = BufferSemaphoreFlags::Full;
+			MarkBufferFull(buffer, destination);
 		}
+	}
+	catch (...)
+	{
+		notify_deferral_.fetch_sub(1);
+		flushNotifications_();
+		throw;
+	}
+	notify_deferral_.fetch_sub(1);
+	flushNotifications_();
+}
 
-		shmBuf->sem_id = destination;
+void artdaq::SharedMemoryManager::MarkBuffersEmpty(std::vector<int> const& buffers, bool force)
+{
+	// Writers are woken once, after the whole batch is queued
+	notify_deferral_.fetch_add(1);
+	try
+	{
+		for (auto buffer : buffers)
+		{
+			MarkBufferEmpty(buffer, force);
+		}
+	}
+	catch (...)
+	{
+		notify_deferral_.fetch_sub(1);
+		flushNotifications_();
+		throw;
 	}
+	notify_deferral_.fetch_sub(1);
+	flushNotifications_();
 }
 
 void artdaq::SharedMemoryManager::MarkBufferEmpty(int buffer, bool force, bool detachOnException)
@@ -960,28 +1368,105 @@ void artdaq::SharedMemoryManager::MarkBufferEmpty(int buffer, bool force, bool d
 	}
 	if (!force)
 	{
-		auto ret = checkBuffer_(shmBuf, BufferSemaphoreFlags::Reading, detachOnException);
+		auto ret = checkReading_(buffer, shmBuf, detachOnException);
 		if (!ret) return;
 	}
 	touchBuffer_(shmBuf);
 
+	bool held = !shm_ptr_->destructive_read_mode && holdsForReading_(buffer, shmBuf);
+	if (held)
+	{
+		endBroadcastHold_(buffer);
+		if (!force)
+		{
+			// Other readers may still hold the buffer; it stays Full until every reader has passed and released it
+			TLOG(TLVL_POS + 3) << "MarkBufferEmpty releasing broadcast buffer " << buffer << " (seqid=" << shmBuf->sequence_id << ")";
+			releaseBroadcastHold_(buffer, shmBuf);
+			return;
+		}
+	}
+
 	shmBuf->readPos = 0;
-	shmBuf->sem = BufferSemaphoreFlags::Full;
+	auto state = BufferSemaphoreFlags::Full;
+	bool was_addressed = shmBuf->sem == BufferSemaphoreFlags::Full && shmBuf->sem_id != -1;
 
-	if ((force && (manager_id_ == 0 || manager_id_ == shmBuf->sem_id)) || (!force && shm_ptr_->destructive_read_mode))
+	if ((force && (manager_id_ == 0 || manager_id_ == shmBuf->sem_id || held)) || (!force && shm_ptr_->destructive_read_mode))
 	{
 		TLOG(TLVL_POS + 3) << "MarkBufferEmpty Resetting buffer " << buffer << " to Empty state";
 		shmBuf->writePos = 0;
-		shmBuf->sem = BufferSemaphoreFlags::Empty;
+		state = BufferSemaphoreFlags::Empty;
 		if (shm_ptr_->reader_pos == static_cast<unsigned>(buffer) && !shm_ptr_->destructive_read_mode)
 		{
 			TLOG(TLVL_POS+3) << "MarkBufferEmpty Broadcast mode; incrementing reader_pos from " << shm_ptr_->reader_pos << " to " << (buffer + 1) % shm_ptr_->buffer_count;
 			shm_ptr_->reader_pos = (buffer + 1) % shm_ptr_->buffer_count;
 		}
 	}
+	setBufferState_(shmBuf, state);
+	shmBuf->sem_id = -1;
+	if (was_addressed)
+	{
+		shm_ptr_->addressed_full.fetch_sub(1);
+	}
+	queueBuffer_(buffer, shmBuf->sem);
+	TLOG(TLVL_POS + 3) << "MarkBufferEmpty END, buffer=" << buffer << ", force=" << force;
+}
+
+void artdaq::SharedMemoryManager::ReturnBufferUnread(int buffer)
+{
+	if (buffer >= shm_ptr_->buffer_count)
+	{
+		Detach(true, "ArgumentOutOfRange", "The specified buffer does not exist!");
+	}
+	std::lock_guard<std::mutex> lk(buffer_mutexes_[buffer]);
+	auto shmBuf = getBufferInfo_(buffer);
+	if (shmBuf == nullptr || !checkReading_(buffer, shmBuf, false))
+	{
+		return;
+	}
+	touchBuffer_(shmBuf);
+	if (!shm_ptr_->destructive_read_mode)
+	{
+		// Step back the cursor if this was the last buffer acquired, so that this reader finds the buffer again
+		auto seqID = broadcast_holds_[buffer].sequence_id;
+		TLOG(TLVL_POS + 3) << "ReturnBufferUnread: Returning broadcast buffer " << buffer << " (seqid=" << seqID << ")";
+		if (last_seen_id_.compare_exchange_strong(seqID, seqID - 1) && reader_slot_ != -1)
+		{
+			shm_ptr_->reader_cursors[reader_slot_].last_seen_id = seqID - 1;  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		}
+		endBroadcastHold_(buffer);
+		releaseBroadcastHold_(buffer, shmBuf);
+		return;
+	}
+	TLOG(TLVL_POS + 3) << "ReturnBufferUnread: Returning buffer " << buffer << " (seqid=" << shmBuf->sequence_id << "). State: Reading-->Full";
+	shmBuf->readPos = 0;
+	setBufferState_(shmBuf, BufferSemaphoreFlags::Full);
 	shmBuf->sem_id = -1;
-	TLOG(TLVL_POS+3) << "MarkBufferEmpty END, buffer=" << buffer << ", force=" << force;
-	
+	queueBuffer_(buffer, BufferSemaphoreFlags::Full);
+}
+
+void artdaq::SharedMemoryManager::PrefetchBuffer(int buffer, size_t bytes)
+{
+	auto shmBuf = getBufferInfo_(buffer);
+	if (shmBuf == nullptr)
+	{
+		return;
+	}
+	if (bytes == 0 || bytes > shmBuf->capacity)
+	{
+		bytes = bytes == 0 ? shmBuf->writePos : shmBuf->capacity;
+	}
+	if (bytes == 0)
+	{
+		return;
+	}
+	// madvise needs a page-aligned start; buffers smaller than DataAlignment are only cache line aligned
+	static auto page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+	auto start = reinterpret_cast<uintptr_t>(bufferStart_(buffer));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+	auto first = start / page_size * page_size;
+	if (madvise(reinterpret_cast<void*>(first), start + bytes - first, MADV_WILLNEED) != 0)  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,performance-no-int-to-ptr)
+	{
+		TLOG(TLVL_READ) << "PrefetchBuffer: madvise failed for buffer " << buffer << ", errno=" << errno << " (" << strerror(errno) << ")";
+	}
 }
 
 bool artdaq::SharedMemoryManager::ResetBuffer(int buffer)
@@ -1034,12 +1519,16 @@ bool artdaq::SharedMemoryManager::ResetBuffer(int buffer)
 	{
 		TLOG(TLVL_RESET) << "Resetting old broadcast mode buffer " << buffer << " (seqid=" << shmBuf->sequence_id << "). State: Full-->Empty";
 		shmBuf->writePos = 0;
-		shmBuf->sem = BufferSemaphoreFlags::Empty;
-		shmBuf->sem_id = -1;
+		setBufferState_(shmBuf, BufferSemaphoreFlags::Empty);
+		if (shmBuf->sem_id.exchange(-1) != -1)
+		{
+			shm_ptr_->addressed_full.fetch_sub(1);
+		}
 		if (shm_ptr_->reader_pos == static_cast<unsigned>(buffer))
 		{
 			shm_ptr_->reader_pos = (buffer + 1) % shm_ptr_->buffer_count;
 		}
+		queueBuffer_(buffer, BufferSemaphoreFlags::Empty);
 		return true;
 	}
 
@@ -1055,8 +1544,9 @@ bool artdaq::SharedMemoryManager::ResetBuffer(int buffer)
 		                   << " ( " << delta << " / " << shm_ptr_->buffer_timeout_us << " us ) detected! (seqid="
 		                   << shmBuf->sequence_id << ") Resetting... Reading-->Full";
 		shmBuf->readPos = 0;
-		shmBuf->sem = BufferSemaphoreFlags::Full;
+		setBufferState_(shmBuf, BufferSemaphoreFlags::Full);
 		shmBuf->sem_id = -1;
+		queueBuffer_(buffer, BufferSemaphoreFlags::Full);
 		return true;
 	}
 	return false;
@@ -1069,15 +1559,7 @@ bool artdaq::SharedMemoryManager::IsEndOfData() const
 		return true;
 	}
 
-	struct shmid_ds info;
-	auto sts = shmctl(shm_segment_id_, IPC_STAT, &info);
-	if (sts < 0)
-	{
-		TLOG(TLVL_BUFINFO) << "Error accessing Shared Memory info: " << errno << " (" << strerror(errno) << ").";
-		return true;
-	}
-
-	if ((info.shm_perm.mode & SHM_DEST) != 0)
+	if (segment_->IsRemoved())
 	{
 		TLOG(TLVL_INFO) << "Shared Memory marked for destruction. Probably an end-of-data condition!";
 		return true;
@@ -1093,20 +1575,18 @@ uint16_t artdaq::SharedMemoryManager::GetAttachedCount() const
 		return 0;
 	}
 
-	struct shmid_ds info;
-	auto sts = shmctl(shm_segment_id_, IPC_STAT, &info);
-	if (sts < 0)
-	{
-		TLOG(TLVL_BUFINFO) << "Error accessing Shared Memory info: " << errno << " (" << strerror(errno) << ").";
-		return 0;
-	}
-
-	return info.shm_nattch;
+	return segment_->AttachedCount();
 }
 
 size_t artdaq::SharedMemoryManager::Write(int buffer, void* data, size_t size)
 {
-	TLOG(TLVL_WRITE) << "Write BEGIN";
+	WriteSegment segment{data, size};
+	return WriteV(buffer, &segment, 1);
+}
+
+size_t artdaq::SharedMemoryManager::WriteV(int buffer, WriteSegment const* segments, size_t count)
+{
+	TLOG(TLVL_WRITE) << "WriteV BEGIN, " << count << " segments";
 	if (buffer >= shm_ptr_->buffer_count)
 	{
 		Detach(true, "ArgumentOutOfRange", "The specified buffer does not exist!");
@@ -1120,23 +1600,48 @@ size_t artdaq::SharedMemoryManager::Write(int buffer, void* data, size_t size)
 	}
 	checkBuffer_(shmBuf, BufferSemaphoreFlags::Writing);
 	touchBuffer_(shmBuf);
+	size_t size = 0;
+	for (size_t ii = 0; ii < count; ++ii)
+	{
+		size += segments[ii].size;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
 	TLOG(TLVL_WRITE) << "Buffer Write Pos is " << std::hex << std::showbase << shmBuf->writePos << ", write size is " << size;
-	if (shmBuf->writePos + size > shm_ptr_->buffer_size)
+	if (shmBuf->writePos + size > shmBuf->capacity)
 	{
-		TLOG(TLVL_ERROR) << "Attempted to write more data than fits into Shared Memory, bufferSize=" << std::hex << std::showbase << shm_ptr_->buffer_size
+		TLOG(TLVL_ERROR) << "Attempted to write more data than fits into Shared Memory, bufferSize=" << std::hex << std::showbase << shmBuf->capacity
 		                 << ",writePos=" << shmBuf->writePos << ",writeSize=" << size;
 		Detach(true, "SharedMemoryWrite", "Attempted to write more data than fits into Shared Memory! \nRe-run with a larger buffer size!");
 	}
 
-	auto pos = GetWritePos(buffer);
-	memcpy(pos, data, size);
+	auto pos = bufferStart_(buffer) + shmBuf->writePos;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	bool streamed = false;
+	for (size_t ii = 0; ii < count; ++ii)
+	{
+		auto const& segment = segments[ii];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		if (segment.size == 0)
+		{
+			continue;
+		}
+		if (segment.size >= non_temporal_copy_threshold)
+		{
+			streamed = copy_non_temporal(pos, static_cast<uint8_t const*>(segment.data), segment.size) || streamed;
+		}
+		else
+		{
+			memcpy(pos, segment.data, segment.size);
+		}
+		pos += segment.size;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+	if (streamed)
+	{
+		store_fence();
+	}
 	touchBuffer_(shmBuf);
 	shmBuf->writePos = shmBuf->writePos + size;
 
-	auto last_seen = last_seen_id_.load();
-	while (last_seen < shmBuf->sequence_id && !last_seen_id_.compare_exchange_weak(last_seen, shmBuf->sequence_id)) {}
+	updateLastSeenId_(shmBuf);
 
-	TLOG(TLVL_WRITE) << "Write END";
+	TLOG(TLVL_WRITE) << "WriteV END";
 	return size;
 }
 
@@ -1153,12 +1658,13 @@ bool artdaq::SharedMemoryManager::Read(int buffer, void* data, size_t size)
 	{
 		return false;
 	}
-	checkBuffer_(shmBuf, BufferSemaphoreFlags::Reading);
+	checkReading_(buffer, shmBuf, true);
 	touchBuffer_(shmBuf);
-	if (shmBuf->readPos + size > shm_ptr_->buffer_size)
+	auto& readPos = readPos_(buffer, shmBuf);
+	if (readPos + size > shmBuf->capacity)
 	{
-		TLOG(TLVL_ERROR) << "Attempted to read more data than fits into Shared Memory, bufferSize=" << shm_ptr_->buffer_size
-		                 << ",readPos=" << shmBuf->readPos << ",readSize=" << size;
+		TLOG(TLVL_ERROR) << "Attempted to read more data than fits into Shared Memory, bufferSize=" << shmBuf->capacity
+		                 << ",readPos=" << readPos << ",readSize=" << size;
 		Detach(true, "SharedMemoryRead", "Attempted to read more data than exists in Shared Memory!");
 	}
 
@@ -1166,10 +1672,10 @@ bool artdaq::SharedMemoryManager::Read(int buffer, void* data, size_t size)
 	TLOG(TLVL_READ) << "Before memcpy in Read(), size is " << size;
 	memcpy(data, pos, size);
 	TLOG(TLVL_READ) << "After memcpy in Read()";
-	auto sts = checkBuffer_(shmBuf, BufferSemaphoreFlags::Reading, false);
+	auto sts = checkReading_(buffer, shmBuf, false);
 	if (sts)
 	{
-		shmBuf->readPos += size;
+		readPos += size;
 		touchBuffer_(shmBuf);
 		return true;
 	}
@@ -1185,10 +1691,28 @@ std::string artdaq::SharedMemoryManager::toString()
 	     << "Next ID Number: " << shm_ptr_->next_id << std::endl
 	     << "Buffer Count: " << shm_ptr_->buffer_count << std::endl
 	     << "Buffer Size: " << std::to_string(shm_ptr_->buffer_size) << " bytes" << std::endl
-	     << "Buffers Written: " << std::to_string(shm_ptr_->next_sequence_id) << std::endl
+	     << "Buffers Written: " << std::to_string(shm_ptr_->next_sequence_id.load()) << std::endl
 	     << "Rank of Writer: " << shm_ptr_->rank << std::endl
-	     << "Ready Magic Bytes: 0x" << std::hex << shm_ptr_->ready_magic << std::dec << std::endl
-	     << std::endl;
+	     << "Layout Magic Bytes: 0x" << std::hex << shm_ptr_->layout_magic << std::dec << ", Version: " << shm_ptr_->layout_version << std::endl
+	     << "Full Ring Head/Tail: " << shm_ptr_->full_ring.head << "/" << shm_ptr_->full_ring.tail << std::endl;
+	auto counts = GetBufferStateCounts();
+	ostr << "Buffer States: " << counts.empty << " Empty, " << counts.writing << " Writing, " << counts.full << " Full (" << shm_ptr_->addressed_full << " addressed), " << counts.reading << " Reading" << std::endl;
+	for (auto cls = 0; cls < shm_ptr_->size_class_count; ++cls)
+	{
+		auto& size_class = shm_ptr_->size_classes[cls];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		ostr << "Size Class " << cls << ": " << size_class.buffer_count << " buffers of " << size_class.buffer_size << " bytes, starting at buffer " << size_class.first_buffer
+		     << ", Empty Ring Head/Tail: " << size_class.empty_ring.head << "/" << size_class.empty_ring.tail << std::endl;
+	}
+	for (auto dest = 0; dest < MaxDestinations; ++dest)
+	{
+		auto& destination = shm_ptr_->destinations[dest];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		if (destination.manager_id != -1)
+		{
+			ostr << "Destination " << dest << ": manager " << destination.manager_id << ", weight " << destination.weight
+			     << ", Full Ring Head/Tail: " << destination.full_ring.head << "/" << destination.full_ring.tail << std::endl;
+		}
+	}
+	ostr << std::endl;
 
 	for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
 	{
@@ -1218,7 +1742,7 @@ void* artdaq::SharedMemoryManager::GetReadPos(int buffer)
 	{
 		return nullptr;
 	}
-	return bufferStart_(buffer) + buf->readPos;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	return bufferStart_(buffer) + readPos_(buffer, buf);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
 }
 void* artdaq::SharedMemoryManager::GetWritePos(int buffer)
 {
@@ -1235,6 +1759,31 @@ void* artdaq::SharedMemoryManager::GetBufferStart(int buffer)
 	return bufferStart_(buffer);
 }
 
+artdaq::SharedMemoryManager::BufferStateCounts artdaq::SharedMemoryManager::GetBufferStateCounts(size_t size_hint) const
+{
+	BufferStateCounts output{0, 0, 0, 0};
+	if (!IsValid())
+	{
+		return output;
+	}
+	auto first_class = sizeClassFor_(size_hint);
+	if (first_class == -1)
+	{
+		return output;
+	}
+	// A count can be briefly negative while another process is between its decrement and increment
+	auto load = [](std::atomic<int32_t> const& count) { return static_cast<size_t>(std::max(0, count.load(std::memory_order_relaxed))); };
+	for (auto cls = first_class; cls < shm_ptr_->size_class_count; ++cls)
+	{
+		auto const& counts = shm_ptr_->state_counts[cls].count;          // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		output.empty += load(counts[static_cast<int>(BufferSemaphoreFlags::Empty)]);      // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		output.writing += load(counts[static_cast<int>(BufferSemaphoreFlags::Writing)]);  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		output.full += load(counts[static_cast<int>(BufferSemaphoreFlags::Full)]);        // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		output.reading += load(counts[static_cast<int>(BufferSemaphoreFlags::Reading)]);  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+	}
+	return output;
+}
+
 std::vector<std::pair<int, artdaq::SharedMemoryManager::BufferSemaphoreFlags>> artdaq::SharedMemoryManager::GetBufferReport()
 {
 	auto output = std::vector<std::pair<int, BufferSemaphoreFlags>>(size());
@@ -1290,45 +1839,1272 @@ void artdaq::SharedMemoryManager::touchBuffer_(ShmBuffer* buffer)
 	buffer->last_touch_time = TimeUtils::gettimeofday_us();
 }
 
-void artdaq::SharedMemoryManager::Detach(bool throwException, const std::string& category, const std::string& message, bool force)
+void artdaq::SharedMemoryManager::initRing_(ShmIndexRing* ring, uint64_t capacity, uint64_t cell_offset)
 {
-	TLOG(TLVL_DETACH) << "Detach BEGIN: throwException: " << std::boolalpha << throwException << ", force: " << force;
-	if (IsValid())
+	ring->capacity = capacity;
+	ring->cell_offset = cell_offset;
+	auto cells = ringCells_(ring);
+	for (uint64_t ii = 0; ii < capacity; ++ii)
 	{
-		TLOG(TLVL_DETACH) << "Detach: Resetting owned buffers";
-		auto bufs = GetBuffersOwnedByManager(false);
-		for (auto buf : bufs)
+		cells[ii].sequence = ii;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		cells[ii].buffer = -1;    // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+	ring->head = 0;
+	ring->tail = 0;
+}
+
+bool artdaq::SharedMemoryManager::pushIndex_(ShmIndexRing* ring, int buffer)
+{
+	auto cells = ringCells_(ring);
+	uint64_t capacity = ring->capacity;
+	auto pos = ring->tail.load(std::memory_order_relaxed);
+	ShmRingCell* cell = nullptr;
+	while (true)
+	{
+		cell = &cells[pos % capacity];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		auto seq = cell->sequence.load(std::memory_order_acquire);
+		auto diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+		if (diff == 0)
 		{
-			auto shmBuf = getBufferInfo_(buf);
-			if (shmBuf == nullptr)
-			{
-				continue;
-			}
-			if (shmBuf->sem == BufferSemaphoreFlags::Writing)
+			if (ring->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
 			{
-				shmBuf->sem = BufferSemaphoreFlags::Empty;
+				break;
 			}
-			else if (shmBuf->sem == BufferSemaphoreFlags::Reading)
+		}
+		else if (diff < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = ring->tail.load(std::memory_order_relaxed);
+		}
+	}
+	cell->buffer.store(buffer, std::memory_order_relaxed);
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+int artdaq::SharedMemoryManager::popIndex_(ShmIndexRing* ring)
+{
+	auto cells = ringCells_(ring);
+	uint64_t capacity = ring->capacity;
+	auto pos = ring->head.load(std::memory_order_relaxed);
+	ShmRingCell* cell = nullptr;
+	while (true)
+	{
+		cell = &cells[pos % capacity];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		auto seq = cell->sequence.load(std::memory_order_acquire);
+		auto diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos + 1);
+		if (diff == 0)
+		{
+			if (ring->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
 			{
-				shmBuf->sem = BufferSemaphoreFlags::Full;
+				break;
 			}
-			shmBuf->sem_id = -1;
+		}
+		else if (diff < 0)
+		{
+			return -1;
+		}
+		else
+		{
+			pos = ring->head.load(std::memory_order_relaxed);
 		}
 	}
+	auto buffer = cell->buffer.load(std::memory_order_relaxed);
+	cell->sequence.store(pos + capacity, std::memory_order_release);
+	return buffer;
+}
+
+size_t artdaq::SharedMemoryManager::countQueued_(ShmIndexRing* ring, BufferSemaphoreFlags flags, bool stopAtFirst)
+{
+	// Non-destructive walk over the queued entries. Entries which are being pushed or popped
+	// concurrently are skipped, so the result is a snapshot, like the scans it replaces.
+	auto cells = ringCells_(ring);
+	uint64_t capacity = ring->capacity;
+	auto head = ring->head.load();
+	auto tail = ring->tail.load();
+	if (tail <= head)
+	{
+		return 0;
+	}
+	if (tail - head > capacity)
+	{
+		head = tail - capacity;
+	}
+
+	size_t count = 0;
+	for (auto pos = head; pos < tail; ++pos)
+	{
+		auto cell = &cells[pos % capacity];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		if (cell->sequence.load(std::memory_order_acquire) != pos + 1)
+		{
+			continue;
+		}
+		auto buffer = cell->buffer.load(std::memory_order_relaxed);
+		if (buffer < 0 || buffer >= shm_ptr_->buffer_count)
+		{
+			continue;
+		}
+		if (bufferAvailable_(buffer_ptrs_[buffer], flags))
+		{
+			++count;
+			if (stopAtFirst)
+			{
+				break;
+			}
+		}
+	}
+	return count;
+}
+
+size_t artdaq::SharedMemoryManager::countEmpty_(size_t size_hint, bool stopAtFirst)
+{
+	auto first_class = sizeClassFor_(size_hint);
+	if (first_class == -1)
+	{
+		return 0;
+	}
+	size_t count = 0;
+	for (auto cls = first_class; cls < shm_ptr_->size_class_count; ++cls)
+	{
+		count += countQueued_(&shm_ptr_->size_classes[cls].empty_ring, BufferSemaphoreFlags::Empty, stopAtFirst);  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		if (stopAtFirst && count > 0)
+		{
+			break;
+		}
+	}
+	return count;
+}
+
+int artdaq::SharedMemoryManager::sizeClassFor_(size_t size_hint) const
+{
+	// Size classes are ordered by increasing buffer size
+	for (auto cls = 0; cls < shm_ptr_->size_class_count; ++cls)
+	{
+		if (shm_ptr_->size_classes[cls].buffer_size >= size_hint)  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		{
+			return cls;
+		}
+	}
+	return -1;
+}
+
+void artdaq::SharedMemoryManager::queueBuffer_(int buffer, BufferSemaphoreFlags flags)
+{
+	// The queued flags guarantee that each buffer appears in each ring at most once, so a push
+	// can never find the ring full. Consumers clear the flag before re-checking the buffer state,
+	// and producers set it after changing the state, so no transition is lost.
+	auto buf = getBufferInfo_(buffer);
+	if (buf == nullptr)
+	{
+		return;
+	}
+	bool pushed = true;
+	if (flags == BufferSemaphoreFlags::Empty)
+	{
+		if (!buf->queued_empty.exchange(true))
+		{
+			pushed = buf->size_class >= 0 && buf->size_class < shm_ptr_->size_class_count && pushIndex_(&shm_ptr_->size_classes[buf->size_class].empty_ring, buffer);  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+			if (!pushed) buf->queued_empty = false;
+		}
+		notifyChannel_(&shm_ptr_->writable_channel);
+	}
+	else if (flags == BufferSemaphoreFlags::Full)
+	{
+		if (shm_ptr_->destructive_read_mode && !buf->queued_full.exchange(true))
+		{
+			auto destination = destinationFor_(buf);
+			pushed = pushIndex_(destination != nullptr ? &destination->full_ring : &shm_ptr_->full_ring, buffer);
+			if (!pushed)
+			{
+				buf->queued_full = false;
+			}
+			else if (destination != nullptr && destination->manager_id == -1)
+			{
+				// The destination unregistered while the buffer was being queued
+				requeueDestination_(destination);
+			}
+		}
+		notifyChannel_(&shm_ptr_->readable_channel);
+	}
+	if (!pushed)
+	{
+		TLOG(TLVL_WARNING) << "queueBuffer_: Could not queue buffer " << buffer << " in the " << FlagToString(flags) << " ring, ring is full!";
+	}
+}
+
+bool artdaq::SharedMemoryManager::bufferAvailable_(ShmBuffer* buffer, BufferSemaphoreFlags flags) const
+{
+	if (buffer == nullptr || buffer->sem != flags)
+	{
+		return false;
+	}
+	auto sem_id = buffer->sem_id.load();
+	if (flags == BufferSemaphoreFlags::Full)
+	{
+		return sem_id == -1 || sem_id == manager_id_;
+	}
+	return sem_id == -1;
+}
+
+bool artdaq::SharedMemoryManager::acquireBuffer_(ShmBuffer* buffer, BufferSemaphoreFlags from, BufferSemaphoreFlags to)
+{
+	auto sem_id = buffer->sem_id.load();
+	if (from == BufferSemaphoreFlags::Empty || from == BufferSemaphoreFlags::Full)
+	{
+		if (!bufferAvailable_(buffer, from))
+		{
+			return false;
+		}
+	}
+	touchBuffer_(buffer);
+	// Record the holder before claiming the buffer: a liveness check which sees this manager as the holder must also
+	// see its PID, not the PID of a previous, dead holder. If the claim fails, the PID is left for the winner to replace.
+	buffer->owner_pid = getpid();
+	if (!buffer->sem_id.compare_exchange_strong(sem_id, manager_id_))
+	{
+		return false;
+	}
+	if (!compareExchangeBufferState_(buffer, from, to))
+	{
+		int16_t mine = manager_id_;
+		buffer->sem_id.compare_exchange_strong(mine, sem_id);
+		return false;
+	}
+	if (from == BufferSemaphoreFlags::Full && sem_id != -1)
+	{
+		shm_ptr_->addressed_full.fetch_sub(1);
+	}
+	return checkBuffer_(buffer, to, false);
+}
+
+void artdaq::SharedMemoryManager::setBufferState_(ShmBuffer* buffer, BufferSemaphoreFlags state)
+{
+	countStateChange_(buffer, buffer->sem.exchange(state), state);
+}
+
+bool artdaq::SharedMemoryManager::compareExchangeBufferState_(ShmBuffer* buffer, BufferSemaphoreFlags from, BufferSemaphoreFlags to)
+{
+	auto sem = from;
+	if (!buffer->sem.compare_exchange_strong(sem, to))
+	{
+		return false;
+	}
+	countStateChange_(buffer, from, to);
+	return true;
+}
+
+void artdaq::SharedMemoryManager::countStateChange_(ShmBuffer* buffer, BufferSemaphoreFlags from, BufferSemaphoreFlags to)
+{
+	// Every state change goes through here, so that the per-state counts never need a scan
+	if (from == to || buffer->size_class < 0 || buffer->size_class >= shm_ptr_->size_class_count)
+	{
+		return;
+	}
+	auto& counts = shm_ptr_->state_counts[buffer->size_class].count;  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+	counts[static_cast<int>(from)].fetch_sub(1);                       // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+	counts[static_cast<int>(to)].fetch_add(1);                         // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+}
+
+void artdaq::SharedMemoryManager::reclaimStaleBuffers_()
+{
+	// While the reaper thread is running, it does both the liveness check and stale-buffer detection
+	if (!IsValid() || shm_ptr_->reaper_active.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+	reclaimDeadHolders_();
+
+	// Stale-buffer detection used to run on every buffer during every scan. It only needs to
+	// run often enough to honor buffer_timeout_us, so rate-limit it to a fraction of the timeout.
+	if (shm_ptr_->buffer_timeout_us == 0)
+	{
+		return;
+	}
+	auto now = TimeUtils::gettimeofday_us();
+	auto last = last_reclaim_time_.load();
+	if (now - last < shm_ptr_->buffer_timeout_us / 10 || !last_reclaim_time_.compare_exchange_strong(last, now))
+	{
+		return;
+	}
+	for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+	{
+		ResetBuffer(ii);
+	}
+}
+
+void artdaq::SharedMemoryManager::reclaimDeadHolders_()
+{
+	// A process which crashed keeps its buffers, reader cursor and destination slot until they time out. Checking
+	// whether the holders still exist is cheap, so it is done much more often than the timeout, by one process at a time.
+	auto now = TimeUtils::gettimeofday_us();
+	auto last = shm_ptr_->liveness_check_us.load(std::memory_order_relaxed);
+	if (now - last < liveness_check_interval_us || !shm_ptr_->liveness_check_us.compare_exchange_strong(last, now))
+	{
+		return;
+	}
+
+	for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+	{
+		auto shmBuf = getBufferInfo_(ii);
+		auto sem = shmBuf->sem.load();
+		if (sem != BufferSemaphoreFlags::Writing && sem != BufferSemaphoreFlags::Reading)
+		{
+			continue;
+		}
+		auto holder = shmBuf->sem_id.load();
+		auto pid = shmBuf->owner_pid.load();
+		if (holder == -1 || holder == manager_id_ || !process_exited(pid))
+		{
+			continue;
+		}
+		// Manager IDs are not reused, so if the holder is unchanged the buffer is still the dead process's
+		if (!shmBuf->sem_id.compare_exchange_strong(holder, -1))
+		{
+			continue;
+		}
+		// The state read above may be stale, so it is only changed if it is still the one the dead holder left
+		auto target = sem == BufferSemaphoreFlags::Writing ? BufferSemaphoreFlags::Empty : BufferSemaphoreFlags::Full;
+		if (!compareExchangeBufferState_(shmBuf, sem, target))
+		{
+			continue;
+		}
+		if (sem == BufferSemaphoreFlags::Writing)
+		{
+			TLOG(TLVL_WARNING) << "Buffer " << ii << " was being written by process " << pid << " (manager " << holder << "), which has exited. Reset Writing-->Empty";
+			shmBuf->writePos = 0;
+		}
+		else
+		{
+			TLOG(TLVL_WARNING) << "Buffer " << ii << " was being read by process " << pid << " (manager " << holder << "), which has exited. Reset Reading-->Full";
+			shmBuf->readPos = 0;
+		}
+		queueBuffer_(ii, target);
+	}
+
+	for (auto ii = 0; ii < MaxBroadcastReaders; ++ii)
+	{
+		auto& cursor = shm_ptr_->reader_cursors[ii];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		auto pid = cursor.owner_pid.load();
+		if (cursor.manager_id == -1 || !process_exited(pid) || !cursor.owner_pid.compare_exchange_strong(pid, 0))
+		{
+			continue;
+		}
+		TLOG(TLVL_WARNING) << "Broadcast reader " << cursor.manager_id << " (process " << pid << ") has exited, releasing its cursor";
+		releaseCursorHolds_(&cursor);
+		cursor.last_seen_id = 0;
+		cursor.manager_id = -1;
+		recycleBroadcastBuffers_();
+	}
+
+	for (auto ii = 0; ii < MaxDestinations; ++ii)
+	{
+		auto& destination = shm_ptr_->destinations[ii];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		auto pid = destination.owner_pid.load();
+		if (destination.manager_id == -1 || !process_exited(pid) || !destination.owner_pid.compare_exchange_strong(pid, 0))
+		{
+			continue;
+		}
+		TLOG(TLVL_WARNING) << "Destination " << ii << " (manager " << destination.manager_id << ", process " << pid << ") has exited, releasing it";
+		destination.weight = 0;
+		destination.manager_id = -1;
+		shm_ptr_->destination_count.fetch_sub(1);
+		requeueDestination_(&destination);
+	}
+}
+
+void artdaq::SharedMemoryManager::checkReaper_()
+{
+	// If the creator went away without stopping its reaper, fall back to detecting stale buffers during scans
+	if (!IsValid() || !shm_ptr_->reaper_active.load(std::memory_order_relaxed) || reaper_thread_.joinable())
+	{
+		return;
+	}
+	auto now = TimeUtils::gettimeofday_us();
+	auto heartbeat = shm_ptr_->reaper_heartbeat_us.load();
+	if (now > heartbeat && now - heartbeat > shm_ptr_->buffer_timeout_us)
+	{
+		TLOG(TLVL_WARNING) << "Reaper thread has not run for " << (now - heartbeat) << " us, resuming stale buffer detection in this process";
+		shm_ptr_->reaper_active = false;
+	}
+}
+
+void artdaq::SharedMemoryManager::startReaper_()
+{
+	stopReaper_();
+	reaper_stop_ = false;
+	shm_ptr_->reaper_heartbeat_us = TimeUtils::gettimeofday_us();
+	shm_ptr_->reaper_active = true;
+	TLOG(TLVL_REAPER) << "Starting reaper thread, buffer timeout " << shm_ptr_->buffer_timeout_us << " us";
+	reaper_thread_ = std::thread([this] { reaperLoop_(); });
+}
+
+void artdaq::SharedMemoryManager::stopReaper_()
+{
+	if (!reaper_thread_.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lk(reaper_mutex_);
+		reaper_stop_ = true;
+	}
+	reaper_cv_.notify_all();
+	if (reaper_thread_.get_id() == std::this_thread::get_id())
+	{
+		// Detach was called by the reaper itself; it exits once it notices reaper_stop_
+		reaper_thread_.detach();
+	}
+	else
+	{
+		reaper_thread_.join();
+	}
+	if (shm_ptr_ != nullptr)
+	{
+		shm_ptr_->reaper_active = false;
+	}
+	TLOG(TLVL_REAPER) << "Reaper thread stopped";
+}
+
+void artdaq::SharedMemoryManager::reaperLoop_()
+{
+	// Each buffer sits in the wheel slot of its deadline (last_touch_time + buffer_timeout_us), so that it is only
+	// examined about once per timeout. Buffers touched since they were scheduled are moved to their new deadline.
+	// The reaper also checks that buffer holders are still running, which the hot paths skip while it is active.
+	auto timeout_us = shm_ptr_->buffer_timeout_us;
+	auto tick_us = std::max(timeout_us / reaper_ticks_per_timeout, static_cast<uint64_t>(1000));
+	auto wait_us = std::min(tick_us, liveness_check_interval_us);
+	std::vector<std::vector<int>> wheel(reaper_wheel_slots);
+	auto now = TimeUtils::gettimeofday_us();
+	auto current_tick = now / tick_us;
+
+	auto schedule = [&](int buffer, uint64_t deadline) {
+		auto tick = std::min(std::max(deadline / tick_us, current_tick + 1), current_tick + reaper_wheel_slots - 1);
+		wheel[tick % reaper_wheel_slots].push_back(buffer);
+	};
+
+	try
+	{
+		for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+		{
+			schedule(ii, getBufferInfo_(ii)->last_touch_time + timeout_us);
+		}
+
+		std::vector<int> due;
+		while (!reaper_stop_)
+		{
+			{
+				std::unique_lock<std::mutex> lk(reaper_mutex_);
+				reaper_cv_.wait_for(lk, std::chrono::microseconds(wait_us), [this] { return reaper_stop_.load(); });
+			}
+			if (reaper_stop_ || !IsValid())
+			{
+				break;
+			}
+
+			now = TimeUtils::gettimeofday_us();
+			shm_ptr_->reaper_heartbeat_us = now;
+			reclaimDeadHolders_();
+			auto target_tick = now / tick_us;
+			// After a long stall, every slot is due; visit each of them once
+			if (target_tick > current_tick + reaper_wheel_slots)
+			{
+				current_tick = target_tick - reaper_wheel_slots;
+			}
+			while (current_tick < target_tick)
+			{
+				++current_tick;
+				due.clear();
+				due.swap(wheel[current_tick % reaper_wheel_slots]);
+				for (auto buffer : due)
+				{
+					auto shmBuf = getBufferInfo_(buffer);
+					uint64_t deadline = shmBuf->last_touch_time + timeout_us;
+					if (deadline < now && shmBuf->sem != BufferSemaphoreFlags::Empty)
+					{
+						TLOG(TLVL_REAPER) << "Buffer " << buffer << " passed its deadline, checking for staleness";
+						ResetBuffer(buffer);
+					}
+					if (deadline < now)
+					{
+						deadline = now + timeout_us;
+					}
+					schedule(buffer, deadline);
+				}
+			}
+		}
+	}
+	catch (cet::exception const& ex)
+	{
+		TLOG(TLVL_ERROR) << "Reaper thread caught exception, stopping: " << ex.explain_self();
+	}
+	TLOG(TLVL_REAPER) << "Reaper thread exiting";
+}
+
+bool artdaq::SharedMemoryManager::RegisterDestination(uint32_t weight)
+{
+	if (!IsValid() || !shm_ptr_->destructive_read_mode || manager_id_ < 0)
+	{
+		return false;
+	}
+	if (destination_slot_ != -1)
+	{
+		shm_ptr_->destinations[destination_slot_].weight = weight;  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		return true;
+	}
+
+	for (auto ii = 0; ii < MaxDestinations; ++ii)
+	{
+		auto& destination = shm_ptr_->destinations[ii];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		int free_slot = -1;
+		if (destination.manager_id.compare_exchange_strong(free_slot, manager_id_))
+		{
+			// Entries left behind by a previous owner of the slot go back to the other rings
+			requeueDestination_(&destination);
+			destination.owner_pid = getpid();
+			destination.weight = weight;
+			destination_slot_ = ii;
+			shm_ptr_->destination_count.fetch_add(1);
+			TLOG(TLVL_ATTACH) << "Registered manager " << manager_id_ << " as destination " << ii << " with weight " << weight;
+			return true;
+		}
+	}
+	TLOG(TLVL_WARNING) << "No free destination slot for manager " << manager_id_ << " (maximum " << MaxDestinations << "), reading from the shared Full ring";
+	return false;
+}
+
+void artdaq::SharedMemoryManager::UnregisterDestination()
+{
+	if (destination_slot_ == -1)
+	{
+		return;
+	}
+	auto slot = destination_slot_;
+	destination_slot_ = -1;
+	if (!IsValid())
+	{
+		return;
+	}
+	auto& destination = shm_ptr_->destinations[slot];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+	destination.weight = 0;
+	destination.owner_pid = 0;
+	destination.manager_id = -1;
+	shm_ptr_->destination_count.fetch_sub(1);
+	requeueDestination_(&destination);
+	TLOG(TLVL_DETACH) << "Unregistered manager " << manager_id_ << " as destination " << slot;
+}
+
+void artdaq::SharedMemoryManager::requeueDestination_(ShmDestination* destination)
+{
+	for (uint64_t ii = 0; ii < destination->full_ring.capacity; ++ii)
+	{
+		auto buffer = popIndex_(&destination->full_ring);
+		if (buffer == -1)
+		{
+			break;
+		}
+		auto buf = getBufferInfo_(buffer);
+		if (buf == nullptr)
+		{
+			continue;
+		}
+		buf->queued_full = false;
+		if (buf->sem == BufferSemaphoreFlags::Full)
+		{
+			queueBuffer_(buffer, BufferSemaphoreFlags::Full);
+		}
+	}
+}
+
+artdaq::SharedMemoryManager::ShmDestination* artdaq::SharedMemoryManager::destinationFor_(ShmBuffer* buffer)
+{
+	if (shm_ptr_->destination_count.load(std::memory_order_relaxed) == 0)
+	{
+		return nullptr;
+	}
+
+	// Addressed buffers go to their destination, if it is registered. nullptr selects the shared Full ring.
+	auto sem_id = buffer->sem_id.load();
+	if (sem_id != -1)
+	{
+		for (auto& destination : shm_ptr_->destinations)
+		{
+			if (destination.manager_id == sem_id)
+			{
+				return &destination;
+			}
+		}
+		return nullptr;
+	}
+
+	// Unaddressed buffers are dealt out in weighted round-robin order
+	uint64_t total_weight = 0;
+	for (auto& destination : shm_ptr_->destinations)
+	{
+		if (destination.manager_id != -1)
+		{
+			total_weight += destination.weight;
+		}
+	}
+	if (total_weight == 0)
+	{
+		return nullptr;
+	}
+	auto ticket = shm_ptr_->assignment_counter.fetch_add(1) % total_weight;
+	for (auto& destination : shm_ptr_->destinations)
+	{
+		if (destination.manager_id == -1)
+		{
+			continue;
+		}
+		if (ticket < destination.weight)
+		{
+			return &destination;
+		}
+		ticket -= destination.weight;
+	}
+	return nullptr;
+}
+
+void artdaq::SharedMemoryManager::renumberPassedBuffer_(int buffer, ShmBuffer* shmBuf)
+{
+	// Writers may mark buffers Full out of sequence ID order, and reader cursors only move forward. A buffer whose
+	// sequence ID another registered reader has already passed would never be delivered to it, so it takes the next
+	// sequence ID instead. This manager's own cursor is not considered: a writer moves it past the buffers it writes.
+	// The caller holds the index lock.
+	auto seqID = shmBuf->sequence_id.load();
+	for (auto const& cursor : shm_ptr_->reader_cursors)
+	{
+		if (cursor.manager_id != -1 && cursor.manager_id != manager_id_ && cursor.last_seen_id >= seqID)
+		{
+			shmBuf->sequence_id = shm_ptr_->next_sequence_id.fetch_add(1) + 1;
+			TLOG(TLVL_BUFFER) << "MarkBufferFull: Broadcast reader " << cursor.manager_id << " has passed buffer " << buffer << " (seqid=" << seqID
+			                  << "), delivering it as seqid " << shmBuf->sequence_id;
+			return;
+		}
+	}
+}
+
+void artdaq::SharedMemoryManager::insertSequence_(int buffer, size_t sequence_id)
+{
+	// The caller holds the index lock
+	auto index = &shm_ptr_->sequence_index;
+	auto entries = sequenceEntries_();
+
+	if (index->count == index->capacity)
+	{
+		// Drop entries for buffers which have been reused or emptied since they were marked Full.
+		// At most buffer_count entries are live, so this frees at least half of the index.
+		uint64_t kept = 0;
+		for (uint64_t ii = 0; ii < index->count; ++ii)
+		{
+			auto& entry = entries[ii];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			auto buf = buffer_ptrs_[entry.buffer];
+			auto sem = buf->sem.load();
+			if (buf->sequence_id == entry.sequence_id && (sem == BufferSemaphoreFlags::Full || sem == BufferSemaphoreFlags::Reading))
+			{
+				entries[kept++] = entry;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			}
+		}
+		TLOG(TLVL_BUFFER) << "insertSequence_: Compacted sequence index from " << index->count << " to " << kept << " entries";
+		index->count = kept;
+		if (kept == index->capacity)
+		{
+			TLOG(TLVL_WARNING) << "insertSequence_: Sequence index is full, buffer " << buffer << " (seqid=" << sequence_id << ") will not be delivered in order";
+			return;
+		}
+	}
+
+	// Sequence IDs are handed out in increasing order, so the new entry almost always goes at the end
+	auto end = entries + index->count;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	auto pos = std::upper_bound(entries, end, sequence_id, [](size_t id, ShmSequenceEntry const& entry) { return id < entry.sequence_id; });
+	if (pos != entries && (pos - 1)->sequence_id == sequence_id && (pos - 1)->buffer == buffer)  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	{
+		return;
+	}
+	std::move_backward(pos, end, end + 1);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	pos->sequence_id = sequence_id;
+	pos->buffer = buffer;
+	++index->count;
+}
+
+int artdaq::SharedMemoryManager::findSequence_(size_t after_id, size_t* sequence_id, size_t* count)
+{
+	ShmSpinLock lk(&shm_ptr_->sequence_index.lock);
+	return scanSequence_(after_id, sequence_id, count);
+}
+
+int artdaq::SharedMemoryManager::scanSequence_(size_t after_id, size_t* sequence_id, size_t* count)
+{
+	// Binary search for the first entry after after_id, then skip entries which are stale or not available to this manager.
+	// If count is given, every available entry after after_id is counted; otherwise the search stops at the first one.
+	// Buffers held by other readers are still Full, and are found like any other. The caller holds the index lock.
+	auto index = &shm_ptr_->sequence_index;
+	auto entries = sequenceEntries_();
+	auto end = entries + index->count;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	int found = -1;
+	for (auto pos = std::upper_bound(entries, end, after_id, [](size_t id, ShmSequenceEntry const& entry) { return id < entry.sequence_id; }); pos != end; ++pos)  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	{
+		auto buf = buffer_ptrs_[pos->buffer];
+		if (buf->sequence_id != pos->sequence_id || !bufferAvailable_(buf, BufferSemaphoreFlags::Full))
+		{
+			continue;
+		}
+		if (found == -1)
+		{
+			found = pos->buffer;
+			*sequence_id = pos->sequence_id;
+		}
+		if (count == nullptr)
+		{
+			break;
+		}
+		++*count;
+	}
+	return found;
+}
+
+int artdaq::SharedMemoryManager::holdNextSequence_()
+{
+	// Broadcast readers do not take buffers over: any number of them hold a buffer at once, counted in read_count,
+	// while it stays Full. The lookup, the hold and the cursor update are done under the sequence index lock, which
+	// recycleBroadcastBuffer_ also takes, so a buffer cannot be recycled between being found and being held.
+	ShmSpinLock lk(&shm_ptr_->sequence_index.lock);
+	size_t seqID = 0;
+	auto buffer = scanSequence_(last_seen_id_, &seqID, nullptr);
+	if (buffer == -1)
+	{
+		return -1;
+	}
+	auto buf = getBufferInfo_(buffer);
+	buf->read_count.fetch_add(1);
+	int16_t mine = manager_id_;
+	if (buf->sem_id.compare_exchange_strong(mine, -1))
+	{
+		// A buffer addressed to this reader is open to every reader once it has been acquired
+		shm_ptr_->addressed_full.fetch_sub(1);
+	}
+	broadcast_holds_[buffer] = BroadcastHold{seqID, 0};
+	last_seen_id_ = seqID;
+	if (reader_slot_ != -1)
+	{
+		auto& cursor = shm_ptr_->reader_cursors[reader_slot_];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		cursor.last_seen_id = seqID;
+		for (auto& held : cursor.held)
+		{
+			if (held.buffer == -1)
+			{
+				held.sequence_id = seqID;
+				held.buffer = buffer;
+				break;
+			}
+		}
+	}
+	touchBuffer_(buf);
+	TLOG(TLVL_GETBUFFER) << "GetBufferForReading: Holding broadcast buffer " << buffer << " (seqid=" << seqID << ", " << buf->read_count << " readers)";
+	return buffer;
+}
+
+void artdaq::SharedMemoryManager::endBroadcastHold_(int buffer)
+{
+	auto& hold = broadcast_holds_[buffer];
+	if (reader_slot_ != -1)
+	{
+		for (auto& held : shm_ptr_->reader_cursors[reader_slot_].held)  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		{
+			if (held.buffer == buffer && held.sequence_id == hold.sequence_id)
+			{
+				held.buffer = -1;
+				break;
+			}
+		}
+	}
+	hold = BroadcastHold{};
+}
+
+void artdaq::SharedMemoryManager::releaseCursorHolds_(ShmReaderCursor* cursor)
+{
+	// Release the holds of a reader which has exited, unless the buffer has since been reused
+	for (auto& held : cursor->held)
+	{
+		auto buffer = held.buffer.exchange(-1);
+		auto buf = buffer != -1 ? getBufferInfo_(buffer) : nullptr;
+		if (buf == nullptr || buf->sequence_id != held.sequence_id)
+		{
+			continue;
+		}
+		auto holders = buf->read_count.load();
+		while (holders > 0 && !buf->read_count.compare_exchange_weak(holders, holders - 1)) {}
+	}
+}
+
+bool artdaq::SharedMemoryManager::holdsForReading_(int buffer, ShmBuffer* buf) const
+{
+	if (shm_ptr_->destructive_read_mode)
+	{
+		return buf->sem_id == manager_id_;
+	}
+	auto seqID = broadcast_holds_[buffer].sequence_id;
+	return seqID != 0 && buf->sequence_id == seqID && buf->sem == BufferSemaphoreFlags::Full;
+}
+
+bool artdaq::SharedMemoryManager::checkReading_(int buffer, ShmBuffer* buf, bool exceptions)
+{
+	if (buf == nullptr || shm_ptr_->destructive_read_mode)
+	{
+		return checkBuffer_(buf, BufferSemaphoreFlags::Reading, exceptions);
+	}
+	if (holdsForReading_(buffer, buf))
+	{
+		return true;
+	}
+	TLOG(TLVL_WARNING) << "CheckBuffer detected issue with broadcast buffer " << buffer << "! It is not held by manager " << manager_id_
+	                   << " (held seqid " << broadcast_holds_[buffer].sequence_id << ", current seqid " << buf->sequence_id << ", Flag: " << FlagToString(buf->sem) << ")";
+	if (exceptions)
+	{
+		Detach(true, "StateAccessViolation", "Shared Memory broadcast buffer is not held by this manager instance!");
+	}
+	return false;
+}
+
+size_t& artdaq::SharedMemoryManager::readPos_(int buffer, ShmBuffer* buf)
+{
+	return shm_ptr_->destructive_read_mode ? buf->readPos : broadcast_holds_[buffer].read_pos;
+}
+
+int artdaq::SharedMemoryManager::acquireFromRing_(ShmIndexRing* ring)
+{
+	// Every Full buffer is in one Full ring at most once; stale entries are discarded and
+	// buffers addressed to other managers are requeued, so at most one lap is needed.
+	for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+	{
+		auto buffer_num = popIndex_(ring);
+		if (buffer_num == -1)
+		{
+			break;
+		}
+
+		auto buffer_ptr = getBufferInfo_(buffer_num);
+		if (buffer_ptr == nullptr)
+		{
+			continue;
+		}
+		buffer_ptr->queued_full = false;
+
+		auto sem_id = buffer_ptr->sem_id.load();
+		if (buffer_ptr->sem == BufferSemaphoreFlags::Full && sem_id != -1 && sem_id != manager_id_)
+		{
+			TLOG(TLVL_GETBUFFER + 1) << "GetBufferForReading: Buffer " << buffer_num << " is addressed to manager " << sem_id << ", requeueing";
+			queueBuffer_(buffer_num, BufferSemaphoreFlags::Full);
+			continue;
+		}
+		if (!acquireBuffer_(buffer_ptr, BufferSemaphoreFlags::Full, BufferSemaphoreFlags::Reading))
+		{
+			TLOG(TLVL_GETBUFFER + 1) << "GetBufferForReading: Discarding stale ring entry for buffer " << buffer_num << " (sem=" << FlagToString(buffer_ptr->sem) << ")";
+			continue;
+		}
+
+		auto seqID = buffer_ptr->sequence_id.load();
+		buffer_ptr->readPos = 0;
+		touchBuffer_(buffer_ptr);
+		if (shm_ptr_->lowest_seq_id_read == last_seen_id_)
+		{
+			shm_ptr_->lowest_seq_id_read = seqID;
+		}
+		last_seen_id_ = seqID;
+		shm_ptr_->reader_pos = (buffer_num + 1) % shm_ptr_->buffer_count;
+		return buffer_num;
+	}
+	return -1;
+}
+
+size_t artdaq::SharedMemoryManager::GetBroadcastReaderCount() const
+{
+	if (!IsValid() || shm_ptr_->destructive_read_mode)
+	{
+		return 0;
+	}
+	size_t count = 0;
+	for (auto const& cursor : shm_ptr_->reader_cursors)
+	{
+		if (cursor.manager_id != -1)
+		{
+			++count;
+		}
+	}
+	return count;
+}
+
+void artdaq::SharedMemoryManager::registerReader_()
+{
+	// Readers register on their first read-side call rather than at attach, so that managers which only write never
+	// hold a cursor. A reader which found the table full retries on every call until a cursor frees up.
+	if (reader_slot_ != -1 || !IsValid() || manager_id_ < 0 || shm_ptr_->destructive_read_mode)
+	{
+		return;
+	}
+	// Free cursors hold last_seen_id 0 (pinning every buffer) until the new reader stores its own position
+	for (auto ii = 0; ii < MaxBroadcastReaders; ++ii)
+	{
+		auto& cursor = shm_ptr_->reader_cursors[ii];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		int free_slot = -1;
+		if (cursor.manager_id == -1 && cursor.manager_id.compare_exchange_strong(free_slot, manager_id_))
+		{
+			cursor.owner_pid = getpid();
+			cursor.last_seen_id = last_seen_id_.load();
+			reader_slot_ = ii;
+			TLOG(TLVL_ATTACH) << "Registered broadcast reader " << manager_id_ << " in cursor slot " << ii;
+			if (reader_overflow_)
+			{
+				reader_overflow_ = false;
+				if (shm_ptr_->unregistered_readers.fetch_sub(1) == 1)
+				{
+					// Every reader has a cursor again; buffers released while one was missing can now be reused
+					recycleBroadcastBuffers_();
+				}
+			}
+			return;
+		}
+	}
+	if (!reader_overflow_)
+	{
+		TLOG(TLVL_WARNING) << "No free broadcast reader cursor for manager " << manager_id_ << " (maximum " << MaxBroadcastReaders
+		                   << " readers), broadcast buffers will only be reused after the buffer timeout until one frees up";
+		reader_overflow_ = true;
+		shm_ptr_->unregistered_readers.fetch_add(1);
+	}
+}
+
+void artdaq::SharedMemoryManager::unregisterReader_()
+{
+	auto slot = reader_slot_;
+	auto overflow = reader_overflow_;
+	reader_slot_ = -1;
+	reader_overflow_ = false;
+	if (!IsValid() || (slot == -1 && !overflow))
+	{
+		return;
+	}
+	if (slot != -1)
+	{
+		auto& cursor = shm_ptr_->reader_cursors[slot];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		releaseCursorHolds_(&cursor);
+		cursor.owner_pid = 0;
+		cursor.last_seen_id = 0;
+		cursor.manager_id = -1;
+	}
+	if (overflow)
+	{
+		shm_ptr_->unregistered_readers.fetch_sub(1);
+	}
+
+	// Buffers which were only waiting for this reader can now be reused
+	recycleBroadcastBuffers_();
+}
+
+void artdaq::SharedMemoryManager::recycleBroadcastBuffers_()
+{
+	for (auto ii = 0; ii < shm_ptr_->buffer_count; ++ii)
+	{
+		auto buf = getBufferInfo_(ii);
+		if (buf != nullptr && buf->sem == BufferSemaphoreFlags::Full)
+		{
+			recycleBroadcastBuffer_(ii, buf);
+		}
+	}
+}
+
+void artdaq::SharedMemoryManager::releaseBroadcastHold_(int buffer, ShmBuffer* shmBuf)
+{
+	// Called when a reader's hold on a broadcast buffer ends. The count is not taken below zero, in case the buffer
+	// was reused by a writer after it timed out.
+	if (shm_ptr_->destructive_read_mode)
+	{
+		return;
+	}
+	auto holders = shmBuf->read_count.load();
+	while (holders > 0 && !shmBuf->read_count.compare_exchange_weak(holders, holders - 1)) {}
+	recycleBroadcastBuffer_(buffer, shmBuf);
+}
+
+bool artdaq::SharedMemoryManager::recycleBroadcastBuffer_(int buffer, ShmBuffer* shmBuf)
+{
+	// A broadcast buffer may be reused once every registered reader has acquired it (its cursor has passed the
+	// buffer's sequence ID) and no reader is still holding it (read_count). With no registered readers, or when a
+	// reader could not register, buffers are left for ResetBuffer to expire.
+	// The checks and the state change are made under the sequence index lock, so that no reader can take a hold in between.
+	if (shm_ptr_->unregistered_readers > 0)
+	{
+		return false;
+	}
+	auto seqID = shmBuf->sequence_id.load();
+	int readers = 0;
+	{
+		ShmSpinLock lk(&shm_ptr_->sequence_index.lock);
+		for (auto const& cursor : shm_ptr_->reader_cursors)
+		{
+			if (cursor.manager_id == -1)
+			{
+				continue;
+			}
+			if (cursor.last_seen_id < seqID)
+			{
+				return false;
+			}
+			++readers;
+		}
+		if (readers == 0 || shmBuf->read_count > 0 || shmBuf->sequence_id != seqID)
+		{
+			return false;
+		}
+
+		if (!compareExchangeBufferState_(shmBuf, BufferSemaphoreFlags::Full, BufferSemaphoreFlags::Empty))
+		{
+			return false;
+		}
+	}
+	TLOG(TLVL_POS + 3) << "Broadcast buffer " << buffer << " (seqid=" << seqID << ") passed and released by all " << readers << " readers. State: Full-->Empty";
+	shmBuf->writePos = 0;
+	if (shmBuf->sem_id.exchange(-1) != -1)
+	{
+		shm_ptr_->addressed_full.fetch_sub(1);
+	}
+	if (shm_ptr_->reader_pos == static_cast<unsigned>(buffer))
+	{
+		shm_ptr_->reader_pos = (buffer + 1) % shm_ptr_->buffer_count;
+	}
+	queueBuffer_(buffer, BufferSemaphoreFlags::Empty);
+	return true;
+}
+
+size_t artdaq::SharedMemoryManager::BufferSize(int buffer)
+{
+	auto buf = getBufferInfo_(buffer);
+	return buf != nullptr ? buf->capacity : 0;
+}
+
+std::vector<artdaq::SharedMemoryManager::SizeClass> artdaq::SharedMemoryManager::GetSizeClasses() const
+{
+	std::vector<SizeClass> output;
+	if (!IsValid())
+	{
+		return output;
+	}
+	for (auto cls = 0; cls < shm_ptr_->size_class_count; ++cls)
+	{
+		auto& size_class = shm_ptr_->size_classes[cls];  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+		output.push_back(SizeClass{size_class.buffer_size, static_cast<size_t>(size_class.buffer_count)});
+	}
+	return output;
+}
+
+size_t artdaq::SharedMemoryManager::bufferFreeSpace_(int buffer)
+{
+	auto buf = getBufferInfo_(buffer);
+	if (buf == nullptr || buf->writePos > buf->capacity)
+	{
+		return 0;
+	}
+	return buf->capacity - buf->writePos;
+}
+
+void artdaq::SharedMemoryManager::updateLastSeenId_(ShmBuffer* buffer)
+{
+	if (buffer == nullptr)
+	{
+		return;
+	}
+	auto last_seen = last_seen_id_.load();
+	while (last_seen < buffer->sequence_id && !last_seen_id_.compare_exchange_weak(last_seen, buffer->sequence_id)) {}
+	// A manager which has read and then writes must not pin the buffers it wrote itself
+	if (reader_slot_ != -1 && last_seen < buffer->sequence_id)
+	{
+		shm_ptr_->reader_cursors[reader_slot_].last_seen_id = buffer->sequence_id.load();  // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+	}
+}
+
+void artdaq::SharedMemoryManager::notifyChannel_(ShmWaitChannel* channel)
+{
+	if (notify_deferral_.load() > 0)
+	{
+		deferred_notifications_.fetch_or(channel == &shm_ptr_->readable_channel ? 1 : 2);
+		return;
+	}
+	channel->sequence.fetch_add(1);
+	if (channel->waiters.load() > 0)
+	{
+		futex_wake_all(&channel->sequence);
+	}
+	if (notify_group_ != nullptr && notify_group_->IsValid())
+	{
+		auto group_shm = notify_group_->shm_ptr_;
+		notify_group_->notifyChannel_(channel == &shm_ptr_->readable_channel ? &group_shm->readable_channel : &group_shm->writable_channel);
+	}
+}
+
+void artdaq::SharedMemoryManager::flushNotifications_()
+{
+	if (notify_deferral_.load() > 0 || !IsValid())
+	{
+		return;
+	}
+	auto pending = deferred_notifications_.exchange(0);
+	if ((pending & 1) != 0)
+	{
+		notifyChannel_(&shm_ptr_->readable_channel);
+	}
+	if ((pending & 2) != 0)
+	{
+		notifyChannel_(&shm_ptr_->writable_channel);
+	}
+}
+
+void artdaq::SharedMemoryManager::SetWaitStrategy(WaitStrategy strategy, size_t spin_us)
+{
+	wait_strategy_ = strategy;
+	spin_us_ = spin_us;
+	adaptive_spin_us_ = spin_us;
+}
+
+bool artdaq::SharedMemoryManager::waitForChannel_(ShmWaitChannel* channel, size_t timeout_us, std::function<bool()> const& ready, size_t max_slice_us)
+{
+	auto start_time = std::chrono::steady_clock::now();
+	auto strategy = wait_strategy_.load();
+	if (strategy != WaitStrategy::Block && IsValid())
+	{
+		size_t spin_limit_us = timeout_us;
+		if (strategy == WaitStrategy::Adaptive) spin_limit_us = adaptive_spin_us_.load();
+		else if (strategy != WaitStrategy::Spin) spin_limit_us = spin_us_.load();
+
+		bool available = false;
+		while (!(available = ready()))
+		{
+			auto elapsed = TimeUtils::GetElapsedTimeMicroseconds(start_time);
+			if (elapsed >= timeout_us)
+			{
+				return false;
+			}
+			if (elapsed >= spin_limit_us)
+			{
+				break;
+			}
+			cpu_relax();
+		}
+		if (available)
+		{
+			// Spinning was enough; an adaptive waiter spins longer next time, up to spin_us
+			if (strategy == WaitStrategy::Adaptive) adaptive_spin_us_ = std::min(std::max(2 * adaptive_spin_us_.load(), static_cast<size_t>(1)), spin_us_.load());
+			return true;
+		}
+		if (strategy == WaitStrategy::Adaptive) adaptive_spin_us_ = adaptive_spin_us_.load() / 2;
+
+		if (strategy == WaitStrategy::SpinYield)
+		{
+			while (!ready())
+			{
+				if (TimeUtils::GetElapsedTimeMicroseconds(start_time) >= timeout_us || !IsValid())
+				{
+					return false;
+				}
+				std::this_thread::yield();
+			}
+			return true;
+		}
+	}
+
+	while (IsValid())
+	{
+		// Register as a waiter and sample the futex word before checking the condition, so that a
+		// state change made after the check is guaranteed to change the word (and wake us).
+		channel->waiters.fetch_add(1);
+		auto seq = channel->sequence.load();
+		if (ready())
+		{
+			channel->waiters.fetch_sub(1);
+			return true;
+		}
+
+		auto elapsed = TimeUtils::GetElapsedTimeMicroseconds(start_time);
+		if (elapsed >= timeout_us)
+		{
+			channel->waiters.fetch_sub(1);
+			return false;
+		}
+
+		// Wake up periodically so that stale buffers, and buffers held by processes which have exited, are still
+		// reclaimed while everybody is waiting
+		checkReaper_();
+		auto wait_us = std::min(timeout_us - elapsed, static_cast<size_t>(10 * liveness_check_interval_us));
+		if (shm_ptr_->buffer_timeout_us > 0) wait_us = std::min(wait_us, std::max(static_cast<size_t>(shm_ptr_->buffer_timeout_us / 10), static_cast<size_t>(1000)));
+		if (max_slice_us > 0) wait_us = std::min(wait_us, max_slice_us);
+		futex_wait(&channel->sequence, seq, wait_us);
+		channel->waiters.fetch_sub(1);
+	}
+	return false;
+}
+
+void artdaq::SharedMemoryManager::Detach(bool throwException, const std::string& category, const std::string& message, bool force)
+{
+	TLOG(TLVL_DETACH) << "Detach BEGIN: throwException: " << std::boolalpha << throwException << ", force: " << force;
+	stopReaper_();
+	UnregisterDestination();
+	if (IsValid())
+	{
+		TLOG(TLVL_DETACH) << "Detach: Resetting owned buffers";
+		auto bufs = GetBuffersOwnedByManager(false);
+		for (auto buf : bufs)
+		{
+			auto shmBuf = getBufferInfo_(buf);
+			if (shmBuf == nullptr)
+			{
+				continue;
+			}
+			if (!shm_ptr_->destructive_read_mode && holdsForReading_(buf, shmBuf))
+			{
+				endBroadcastHold_(buf);
+				releaseBroadcastHold_(buf, shmBuf);
+				continue;
+			}
+			if (shmBuf->sem == BufferSemaphoreFlags::Writing)
+			{
+				setBufferState_(shmBuf, BufferSemaphoreFlags::Empty);
+			}
+			else if (shmBuf->sem == BufferSemaphoreFlags::Reading)
+			{
+				setBufferState_(shmBuf, BufferSemaphoreFlags::Full);
+			}
+			else if (shmBuf->sem == BufferSemaphoreFlags::Full)
+			{
+				// Full buffers owned by this manager were addressed to it
+				shm_ptr_->addressed_full.fetch_sub(1);
+			}
+			shmBuf->sem_id = -1;
+			queueBuffer_(buf, shmBuf->sem);
+		}
+	}
+
+	unregisterReader_();
 
 	if (shm_ptr_ != nullptr)
 	{
-		TLOG(TLVL_DETACH) << "Detach: Detaching shared memory";
-		shmdt(shm_ptr_);
+		if (force || manager_id_ == 0)
+		{
+			// Wake anybody blocked in WaitForReadable/WaitForWritable so that they notice the segment going away
+			notifyChannel_(&shm_ptr_->readable_channel);
+			notifyChannel_(&shm_ptr_->writable_channel);
+		}
 		shm_ptr_ = nullptr;
 	}
 
-	if ((force || manager_id_ == 0) && shm_segment_id_ > -1)
+	if ((force || manager_id_ == 0) && segment_->IsOpen())
 	{
 		TLOG(TLVL_DETACH) << "Detach: Marking Shared memory for removal";
-		shmctl(shm_segment_id_, IPC_RMID, nullptr);
-		shm_segment_id_ = -1;
+		segment_->Remove();
 	}
+	TLOG(TLVL_DETACH) << "Detach: Detaching shared memory";
+	segment_->Close();
 
 	// Reset manager_id_
 	manager_id_ = -1;
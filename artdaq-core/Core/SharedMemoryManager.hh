@@ -2,11 +2,16 @@
 #define artdaq_core_Core_SharedMemoryManager_hh 1
 
 #include <atomic>
+#include <condition_variable>
 #include <deque>
+#include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
+#include "artdaq-core/Core/SharedMemorySegment.hh"
 #include "artdaq-core/Utilities/TimeUtils.hh"
 
 namespace artdaq {
@@ -49,16 +54,270 @@ public:
 		return "Unknown";
 	}
 
+	/**
+		 * \brief The HugePageSize enumeration selects the page size used to back the shared memory segment
+		 */
+	enum class HugePageSize
+	{
+		None,     ///< Use the system default page size
+		Size2MB,  ///< Use 2 MB huge pages (SHM_HUGETLB | SHM_HUGE_2MB)
+		Size1GB   ///< Use 1 GB huge pages (SHM_HUGETLB | SHM_HUGE_1GB)
+	};
+
+	/**
+		 * \brief The WaitStrategy enumeration selects how WaitForReadable and WaitForWritable (and the Fragment and event
+		 * calls built on them) wait for a buffer. Spinning gives the lowest latency at the cost of a busy core.
+		 */
+	enum class WaitStrategy
+	{
+		Block,      ///< Sleep on the segment's futex right away
+		Spin,       ///< Poll until the buffer is available or the timeout expires, never sleeping
+		SpinYield,  ///< Poll for spin_us, then poll with sched_yield between checks
+		SpinBlock,  ///< Poll for spin_us, then sleep on the futex
+		Adaptive    ///< Like SpinBlock, but the spin time (at most spin_us) grows when spinning succeeds and shrinks when the wait ends up sleeping
+	};
+
+	/**
+		 * \brief Options controlling how the shared memory segment is created and mapped
+		 *
+		 * All processes using a segment must use the same backend (and directory). Huge pages only apply when this
+		 * SharedMemoryManager creates the segment. If they cannot be allocated (none reserved, or insufficient privileges),
+		 * the segment is created with normal pages. With the File backend, huge pages are used when the directory is a
+		 * hugetlbfs mount. Pre-faulting and locking apply to this process's mapping, and failures are logged but not fatal.
+		 *
+		 * With reaper_thread, the SharedMemoryManager which creates the segment starts a thread which detects stale buffers
+		 * (see buffer_timeout_us). While it runs, buffer scans in every attached process skip stale-buffer detection.
+		 *
+		 * wait_strategy and spin_us only apply to this SharedMemoryManager; see also SetWaitStrategy.
+		 *
+		 * segment_tag identifies what the segment is used for. The creator records it in the segment, and a manager with a
+		 * non-zero segment_tag refuses to attach to, or to re-initialize, a segment recorded with a different one (see
+		 * ShardedSharedMemoryManager).
+		 */
+	struct SegmentOptions
+	{
+		SharedMemoryBackend backend;  ///< Operating system facility providing the segment
+		std::string directory;        ///< Directory holding the segment file (File backend only, default /dev/shm)
+		HugePageSize huge_pages;      ///< Page size to request when creating the segment
+		bool prefault;                ///< Touch every page of the segment at attach time, so that first use does not take page faults
+		bool lock_memory;             ///< mlock the segment at attach time, so that it cannot be paged out
+		bool reaper_thread;           ///< Detect stale buffers in a background thread owned by the segment creator
+		WaitStrategy wait_strategy;   ///< How this manager waits for buffers
+		size_t spin_us;               ///< Time to spin before yielding or sleeping (SpinYield, SpinBlock and Adaptive)
+		uint64_t segment_tag;         ///< Identifies the user of the segment (0: any)
+
+		/**
+			 * \brief Construct the default SegmentOptions (System V segment, normal pages, no pre-faulting, no locking, no reaper thread, blocking waits)
+			 */
+		SegmentOptions()
+		    : backend(SharedMemoryBackend::SysV), huge_pages(HugePageSize::None), prefault(false), lock_memory(false), reaper_thread(false), wait_strategy(WaitStrategy::Block), spin_us(50), segment_tag(0) {}
+	};
+
+	/**
+		 * \brief The maximum number of buffer size classes in a segment
+		 */
+	static constexpr int MaxSizeClasses = 8;
+
+	/**
+		 * \brief The maximum number of readers tracked by the broadcast-mode reader cursor table
+		 */
+	static constexpr int MaxBroadcastReaders = 64;
+
+	/**
+		 * \brief The maximum number of readers which can register their own Full queue (see RegisterDestination)
+		 */
+	static constexpr int MaxDestinations = 16;
+
+	/**
+		 * \brief Version of the shared memory layout. Attach refuses segments created with a different layout.
+		 */
+	static constexpr uint32_t LayoutVersion = 5;
+
+	/**
+		 * \brief Alignment of buffer descriptors and of frequently-written counters in the segment
+		 */
+	static constexpr size_t CacheLineSize = 64;
+
+	/**
+		 * \brief Alignment of the data region, and of each buffer at least this large
+		 */
+	static constexpr size_t DataAlignment = 4096;
+
+	/**
+		 * \brief A group of equally-sized buffers. A segment may contain several size classes, so that small events
+		 * do not each occupy a buffer sized for the largest event.
+		 */
+	struct SizeClass
+	{
+		size_t buffer_size;   ///< Size of each buffer in the class, in bytes
+		size_t buffer_count;  ///< Number of buffers in the class
+	};
+
+	/**
+		 * \brief Number of buffers in each state, from counters kept up to date by every state change (see GetBufferStateCounts)
+		 */
+	struct BufferStateCounts
+	{
+		size_t empty;    ///< Buffers in the Empty state
+		size_t writing;  ///< Buffers in the Writing state
+		size_t full;     ///< Buffers in the Full state
+		size_t reading;  ///< Buffers in the Reading state
+	};
+
+	/**
+		 * \brief One contiguous source of a scatter-gather write (see WriteV), like a struct iovec
+		 */
+	struct WriteSegment
+	{
+		void const* data;  ///< Start of the data to write
+		size_t size;       ///< Number of bytes to write
+	};
+
+	/**
+		 * \brief A typed pointer/length view of memory inside a shared memory buffer
+		 */
+	template<typename T>
+	struct BufferSpan
+	{
+		T* data;      ///< First element of the view
+		size_t size;  ///< Number of elements in the view
+
+		/**
+			 * \brief Get the first element of the view
+			 * \return Pointer to the first element
+			 */
+		T* begin() const { return data; }
+		/**
+			 * \brief Get one past the last element of the view
+			 * \return Pointer one past the last element
+			 */
+		T* end() const { return data + size; }  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		/**
+			 * \brief Whether the view is empty
+			 * \return True if the view contains no elements
+			 */
+		bool empty() const { return size == 0; }
+	};
+
+	/**
+		 * \brief A WriteTransaction reserves a buffer for writing and lets the caller construct data directly in shared memory.
+		 *
+		 * Commit() advances the buffer's write position and marks it Full. A transaction which is destroyed
+		 * without being committed returns its buffer to the Empty state.
+		 */
+	class WriteTransaction
+	{
+	public:
+		/**
+			 * \brief Construct an invalid (empty) WriteTransaction
+			 */
+		WriteTransaction()
+		    : manager_(nullptr), buffer_(-1) {}
+
+		/**
+			 * \brief WriteTransaction Destructor. Abandons the transaction if it has not been committed.
+			 */
+		~WriteTransaction() { Abandon(); }
+
+		/**
+			 * \brief Move Constructor. The moved-from transaction becomes invalid.
+			 * \param other WriteTransaction to take ownership of the buffer from
+			 */
+		WriteTransaction(WriteTransaction&& other) noexcept
+		    : manager_(other.manager_), buffer_(other.buffer_)
+		{
+			other.buffer_ = -1;
+		}
+
+		/**
+			 * \brief Move Assignment Operator. Abandons any transaction currently held by this object.
+			 * \param other WriteTransaction to take ownership of the buffer from
+			 * \return Reference to this WriteTransaction
+			 */
+		WriteTransaction& operator=(WriteTransaction&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Abandon();
+				manager_ = other.manager_;
+				buffer_ = other.buffer_;
+				other.buffer_ = -1;
+			}
+			return *this;
+		}
+
+		WriteTransaction(WriteTransaction const&) = delete;             ///< Copy Constructor is deleted
+		WriteTransaction& operator=(WriteTransaction const&) = delete;  ///< Copy Assignment Operator is deleted
+
+		/**
+			 * \brief Whether this transaction holds a buffer
+			 * \return True if a buffer is reserved and the transaction has been neither committed nor abandoned
+			 */
+		bool IsValid() const { return manager_ != nullptr && buffer_ != -1; }
+
+		/**
+			 * \brief Get the buffer ID reserved by this transaction
+			 * \return Buffer ID, or -1 if the transaction is not valid
+			 */
+		int GetBuffer() const { return buffer_; }
+
+		/**
+			 * \brief Get a view of the free space in the buffer, starting at its current write position
+			 * \tparam T Element type of the view
+			 * \return BufferSpan covering all complete elements of type T which fit in the remaining space
+			 */
+		template<typename T>
+		BufferSpan<T> Span() const
+		{
+			if (!IsValid()) return BufferSpan<T>{nullptr, 0};
+			return BufferSpan<T>{static_cast<T*>(manager_->GetWritePos(buffer_)), manager_->bufferFreeSpace_(buffer_) / sizeof(T)};
+		}
+
+		/**
+			 * \brief Publish the data written into the buffer
+			 * \param bytes Number of bytes written at the start of the Span
+			 * \param destination If desired, a destination manager ID may be specified for the buffer
+			 * \return Whether the buffer was marked Full. On failure the buffer is released.
+			 */
+		bool Commit(size_t bytes, int destination = -1);
+
+		/**
+			 * \brief Release the reserved buffer back to the Empty state without publishing it
+			 */
+		void Abandon();
+
+	private:
+		friend class SharedMemoryManager;
+		WriteTransaction(SharedMemoryManager* manager, int buffer)
+		    : manager_(manager), buffer_(buffer) {}
+
+		SharedMemoryManager* manager_;
+		int buffer_;
+	};
+
 	/**
 		 * \brief SharedMemoryManager Constructor
 		 * \param shm_key The key to use when attaching/creating the shared memory segment
 		 * \param buffer_count The number of buffers in the shared memory
 		 * \param buffer_size The size of each buffer
 		 * \param buffer_timeout_us The maximum amount of time a buffer can be left untouched by its owner (if 0, buffers do not expire)
-		 * before being returned to its previous state.
+		 * before being returned to its previous state. Buffers held by a process which has exited are reclaimed without waiting for the timeout.
 		 * \param destructive_read_mode Whether a read operation empties the buffer (default: true, false for broadcast mode)
+		 * \param options Huge page, pre-fault and memory locking options for the segment
 		 */
-	SharedMemoryManager(uint32_t shm_key, size_t buffer_count = 0, size_t buffer_size = 0, uint64_t buffer_timeout_us = 100 * 1000000, bool destructive_read_mode = true);
+	SharedMemoryManager(uint32_t shm_key, size_t buffer_count = 0, size_t buffer_size = 0, uint64_t buffer_timeout_us = 100 * 1000000, bool destructive_read_mode = true, SegmentOptions const& options = SegmentOptions());
+
+	/**
+		 * \brief SharedMemoryManager Constructor for a segment with several buffer size classes
+		 * \param shm_key The key to use when attaching/creating the shared memory segment
+		 * \param size_classes The sizes and counts of the buffers in the shared memory (at most MaxSizeClasses).
+		 * Buffers are numbered by increasing size.
+		 * \param buffer_timeout_us The maximum amount of time a buffer can be left untouched by its owner (if 0, buffers do not expire)
+		 * before being returned to its previous state. Buffers held by a process which has exited are reclaimed without waiting for the timeout.
+		 * \param destructive_read_mode Whether a read operation empties the buffer (default: true, false for broadcast mode)
+		 * \param options Huge page, pre-fault and memory locking options for the segment
+		 */
+	SharedMemoryManager(uint32_t shm_key, std::vector<SizeClass> const& size_classes, uint64_t buffer_timeout_us = 100 * 1000000, bool destructive_read_mode = true, SegmentOptions const& options = SegmentOptions());
 
 	/**
 		 * \brief SharedMemoryManager Destructor
@@ -79,9 +338,34 @@ public:
 	/**
 		 * \brief Finds a buffer that is ready to be written to, and reserves it for the calling manager.
 		 * \param overwrite Whether to consider buffers that are in the Full and Reading state as ready for write (non-reliable mode)
+		 * \param size_hint Number of bytes which will be written. The smallest available buffer which can hold them is returned.
 		 * \return The id number of the buffer. -1 indicates no buffers available for write.
 		 */
-	int GetBufferForWriting(bool overwrite);
+	int GetBufferForWriting(bool overwrite, size_t size_hint = 0);
+
+	/**
+		 * \brief Reserve up to count buffers for writing. Stale-buffer checks run once for the whole batch.
+		 * \param count Maximum number of buffers to reserve
+		 * \param overwrite Whether to consider buffers that are in the Full and Reading state as ready for write (non-reliable mode)
+		 * \param size_hint Number of bytes which will be written to each buffer (see GetBufferForWriting)
+		 * \return The reserved buffers, in order of increasing sequence ID. Fewer than count (or none) if not enough buffers are available.
+		 */
+	std::vector<int> GetBuffersForWriting(size_t count, bool overwrite = false, size_t size_hint = 0);
+
+	/**
+		 * \brief Reserve up to max_count buffers for reading. Stale-buffer checks run once for the whole batch.
+		 * \param max_count Maximum number of buffers to reserve
+		 * \return The reserved buffers, in the order GetBufferForReading would have returned them
+		 */
+	std::vector<int> GetBuffersForReading(size_t max_count);
+
+	/**
+		 * \brief Reserve a buffer for zero-copy writing
+		 * \param overwrite Whether to consider buffers that are in the Full and Reading state as ready for write (non-reliable mode)
+		 * \param size_hint Number of bytes which will be written (see GetBufferForWriting)
+		 * \return A WriteTransaction holding the buffer. If no buffer is available, the transaction is not valid.
+		 */
+	WriteTransaction BeginWrite(bool overwrite = false, size_t size_hint = 0);
 
 	/**
 		 * \brief Whether any buffer is ready for read
@@ -92,12 +376,74 @@ public:
 	/**
 		 * \brief Whether any buffer is available for write
 		 * \param overwrite Whether to allow overwriting full buffers
+		 * \param size_hint Only consider buffers which can hold at least this many bytes
+		 * \return True if there is a buffer available
+		 */
+	virtual bool ReadyForWrite(bool overwrite, size_t size_hint = 0);
+
+	/**
+		 * \brief Block until a buffer is ready for read, or until the timeout expires.
+		 * Writers signal a futex in the shared memory segment whenever a buffer is marked Full, so waiting readers wake immediately.
+		 * \param timeout_us Maximum time to wait, in microseconds (0: check once without waiting)
+		 * \return True if there is a buffer available
+		 */
+	bool WaitForReadable(size_t timeout_us);
+
+	/**
+		 * \brief Block until a buffer is ready for write, or until the timeout expires.
+		 * Readers signal a futex in the shared memory segment whenever a buffer is marked Empty, so waiting writers wake immediately.
+		 * \param timeout_us Maximum time to wait, in microseconds (0: check once without waiting)
+		 * \param overwrite Whether to allow overwriting full buffers
+		 * \param size_hint Only consider buffers which can hold at least this many bytes
 		 * \return True if there is a buffer available
 		 */
-	virtual bool ReadyForWrite(bool overwrite);
+	bool WaitForWritable(size_t timeout_us, bool overwrite = false, size_t size_hint = 0);
+
+	/**
+		 * \brief Block on this segment's readable wait channel until a condition holds, or until the timeout expires
+		 * \param timeout_us Maximum time to wait, in microseconds (0: check once without waiting)
+		 * \param ready Condition to wait for, re-checked every time the channel is signaled
+		 * \return True if the condition holds
+		 */
+	bool WaitForReadable(size_t timeout_us, std::function<bool()> const& ready);
+
+	/**
+		 * \brief Block on this segment's writable wait channel until a condition holds, or until the timeout expires
+		 * \param timeout_us Maximum time to wait, in microseconds (0: check once without waiting)
+		 * \param ready Condition to wait for, re-checked every time the channel is signaled
+		 * \param max_slice_us Re-check the condition at least this often, for changes which do not signal the channel (0: no limit)
+		 * \return True if the condition holds
+		 */
+	bool WaitForWritable(size_t timeout_us, std::function<bool()> const& ready, size_t max_slice_us = 0);
+
+	/**
+		 * \brief Also signal another manager's wait channels whenever this manager signals its own
+		 *
+		 * A process waiting on group's channels (with the condition overloads of WaitForReadable and WaitForWritable) is then
+		 * woken by changes which this manager makes to its own segment, so that one waiter can follow several segments.
+		 * \param group Manager whose channels are signaled as well (nullptr: none). It must outlive this manager.
+		 */
+	void SetNotifyGroup(SharedMemoryManager* group) { notify_group_ = group == this ? nullptr : group; }
+
+	/**
+		 * \brief Change how this manager waits for buffers
+		 * \param strategy The WaitStrategy to use
+		 * \param spin_us Time to spin before yielding or sleeping (maximum spin time for WaitStrategy::Adaptive)
+		 */
+	void SetWaitStrategy(WaitStrategy strategy, size_t spin_us);
+
+	/**
+		 * \brief Get the WaitStrategy of this manager
+		 * \return The current WaitStrategy
+		 */
+	WaitStrategy GetWaitStrategy() const { return wait_strategy_.load(); }
 
 	/**
 		 * \brief Count the number of buffers that are ready for reading
+		 *
+		 * In destructive read mode, this is the number of Full buffers, read from the segment's state counters, unless
+		 * readers have registered destinations or buffers are addressed to specific readers; then the queues are walked.
+		 * In broadcast mode, the sequence index is searched when there are Full buffers.
 		 * \return The number of buffers ready for reading
 		 */
 	size_t ReadReadyCount();
@@ -105,9 +451,10 @@ public:
 	/**
 		 * \brief Count the number of buffers that are ready for writing
 		 * \param overwrite Whether to consider buffers that are in the Full and Reading state as ready for write (non-reliable mode)
+		 * \param size_hint Only count buffers which can hold at least this many bytes
 		 * \return The number of buffers ready for writing
 		 */
-	size_t WriteReadyCount(bool overwrite);
+	size_t WriteReadyCount(bool overwrite, size_t size_hint = 0);
 
 	/**
 		 * \brief Get the list of all buffers currently owned by this manager instance.
@@ -125,10 +472,23 @@ public:
 
 	/**
 		 * \brief Get the size of of a single buffer
-		 * \return The configured size of a single buffer, in bytes
+		 * \return The configured size of a single buffer, in bytes (the largest size class, if there are several)
 		 */
 	size_t BufferSize() { return (shm_ptr_ != nullptr ? shm_ptr_->buffer_size : 0); }
 
+	/**
+		 * \brief Get the size of the given buffer
+		 * \param buffer Buffer ID of buffer
+		 * \return The size of the buffer, in bytes
+		 */
+	size_t BufferSize(int buffer);
+
+	/**
+		 * \brief Get the buffer size classes of the segment
+		 * \return The size classes, ordered by increasing buffer size
+		 */
+	std::vector<SizeClass> GetSizeClasses() const;
+
 	/**
 		 * \brief Set the read position of the given buffer to the beginning of the buffer
 		 * \param buffer Buffer ID of buffer
@@ -172,11 +532,43 @@ public:
 
 	/**
 		 * \brief Release a buffer from a writer, marking it Full and ready for a reader
+		 *
+		 * In broadcast mode, readers receive buffers in sequence ID order. A buffer marked Full after a reader has already
+		 * read a buffer with a later sequence ID is given a new sequence ID, so that every reader still receives it.
 		 * \param buffer Buffer ID of buffer
 		 * \param destination If desired, a destination manager ID may be specified for a buffer
 		 */
 	void MarkBufferFull(int buffer, int destination = -1);
 
+	/**
+		 * \brief Release several buffers from a writer, marking them Full. Waiting readers are woken once for the whole batch.
+		 * \param buffers Buffer IDs, in the order they should be read
+		 * \param destination If desired, a destination manager ID may be specified for the buffers
+		 */
+	void MarkBuffersFull(std::vector<int> const& buffers, int destination = -1);
+
+	/**
+		 * \brief Register this manager as a destination with its own queue of Full buffers (destructive read mode only)
+		 *
+		 * Buffers marked Full with this manager's ID as destination are queued directly for it. Buffers marked Full without
+		 * a destination are assigned to the registered destinations in weighted round-robin order (and are queued for all
+		 * readers while no destination is registered). Calling it again changes the weight.
+		 * \param weight Relative share of unaddressed buffers to assign to this manager (0 for addressed buffers only)
+		 * \return Whether the manager is registered. Fails if the segment is in broadcast mode or the table is full.
+		 */
+	bool RegisterDestination(uint32_t weight = 1);
+
+	/**
+		 * \brief Stop receiving buffers in this manager's own queue. Buffers still queued for it are queued again for other readers.
+		 */
+	void UnregisterDestination();
+
+	/**
+		 * \brief Get the number of registered destinations
+		 * \return The number of managers which have called RegisterDestination
+		 */
+	int GetDestinationCount() const { return IsValid() ? shm_ptr_->destination_count.load() : 0; }
+
 	/**
 		 * \brief Release a buffer from a reader, marking it Empty and ready to accept more data
 		 * \param buffer Buffer ID of buffer
@@ -185,6 +577,27 @@ public:
 		 */
 	void MarkBufferEmpty(int buffer, bool force = false, bool detachOnException = true);
 
+	/**
+		 * \brief Release several buffers from a reader, marking them Empty. Waiting writers are woken once for the whole batch.
+		 * \param buffers Buffer IDs
+		 * \param force Force the buffers to empty state (only if manager_id_ == 0)
+		 */
+	void MarkBuffersEmpty(std::vector<int> const& buffers, bool force = false);
+
+	/**
+		 * \brief Give a buffer obtained from GetBufferForReading back to the Full state without reading it, so that
+		 * any reader can take it (destructive read mode). The buffer is queued behind the buffers already Full.
+		 * \param buffer Buffer ID of buffer
+		 */
+	void ReturnBufferUnread(int buffer);
+
+	/**
+		 * \brief Ask the kernel to map the pages of a buffer's data ahead of use (madvise MADV_WILLNEED)
+		 * \param buffer Buffer ID of buffer
+		 * \param bytes Number of bytes from the start of the buffer (0: the data written to the buffer)
+		 */
+	void PrefetchBuffer(int buffer, size_t bytes = 0);
+
 	/**
 		 * \brief Resets the buffer from Reading to Full. This operation will only have an
 		 * effect if performed by the owning manager or if the buffer has timed out.
@@ -262,6 +675,27 @@ public:
 		 */
 	size_t Write(int buffer, void* data, size_t size);
 
+	/**
+		 * \brief Write several blocks of data to a buffer, one after another, under a single lock of the buffer
+		 *
+		 * Either every segment is written or, if they do not all fit, none is. Segments of at least 256 KiB are copied
+		 * with non-temporal (cache-bypassing) stores where the platform supports them, since the data is read by another
+		 * process and would otherwise evict the writer's working set from its cache.
+		 * \param buffer Buffer ID of buffer
+		 * \param segments Segments to write, in order
+		 * \param count Number of segments
+		 * \return Amount of data written, in bytes
+		 */
+	size_t WriteV(int buffer, WriteSegment const* segments, size_t count);
+
+	/**
+		 * \brief Write several blocks of data to a buffer, one after another, under a single lock of the buffer (see WriteV above)
+		 * \param buffer Buffer ID of buffer
+		 * \param segments Segments to write, in order
+		 * \return Amount of data written, in bytes
+		 */
+	size_t WriteV(int buffer, std::vector<WriteSegment> const& segments) { return WriteV(buffer, segments.data(), segments.size()); }
+
 	/**
 		 * \brief Read size bytes of data from buffer into the given pointer
 		 * \param buffer Buffer ID of buffer
@@ -323,7 +757,7 @@ public:
 		 * \brief Gets the number of buffers which have been processed through the Shared Memory
 		 * \return The number of buffers processed by the Shared Memory
 		 */
-	size_t GetBufferCount() const { return IsValid() ? shm_ptr_->next_sequence_id : 0; }
+	size_t GetBufferCount() const { return IsValid() ? shm_ptr_->next_sequence_id.load() : 0; }
 
 	/**
 		 * \brief Gets the highest buffer number either written or read by this SharedMemoryManager
@@ -348,54 +782,282 @@ public:
 		 */
 	std::vector<std::pair<int, BufferSemaphoreFlags>> GetBufferReport();
 
+	/**
+		 * \brief Get the number of buffers in each state, without scanning the buffers or taking any lock
+		 *
+		 * The counts are a snapshot: buffers changing state while they are read may be counted in either state.
+		 * \param size_hint Only count buffers which can hold at least this many bytes
+		 * \return The number of buffers in each state
+		 */
+	BufferStateCounts GetBufferStateCounts(size_t size_hint = 0) const;
+
 	/**
 		 * \brief Touch the given buffer (update its last_touch_time)
 		 */
 	void TouchBuffer(int buffer) { return touchBuffer_(getBufferInfo_(buffer)); }
 
+	/**
+		 * \brief Whether the attached segment is backed by huge pages
+		 * \return True if this manager created the segment with huge pages, or mapped it from a hugetlbfs mount
+		 */
+	bool UsingHugePages() const { return segment_ && segment_->UsingHugePages(); }
+
+	/**
+		 * \brief Whether a reaper thread is detecting stale buffers for the segment
+		 * \return True if the segment creator's reaper thread is running (in any process)
+		 */
+	bool IsReaperActive() const { return IsValid() && shm_ptr_->reaper_active.load(); }
+
+	/**
+		 * \brief Get the number of readers registered in the broadcast-mode reader cursor table. Managers register on their
+		 * first ReadyForRead, ReadReadyCount or GetBufferForReading call, so managers which only write are not counted.
+		 * \return The number of registered readers (0 in destructive read mode)
+		 */
+	size_t GetBroadcastReaderCount() const;
+
 private:
+	friend class SharedMemoryInspector;  // Reads the segment layout through a read-only mapping
+
 	SharedMemoryManager(SharedMemoryManager const&) = delete;
 	SharedMemoryManager(SharedMemoryManager&&) = delete;
 	SharedMemoryManager& operator=(SharedMemoryManager const&) = delete;
 	SharedMemoryManager& operator=(SharedMemoryManager&&) = delete;
 
-	struct ShmBuffer
+	/**
+	 * \brief Descriptor of one buffer. Each descriptor occupies exactly one cache line, so that updates to one buffer's
+	 * state do not invalidate its neighbours' descriptors in other cores' caches.
+	 */
+	struct alignas(CacheLineSize) ShmBuffer
 	{
 		size_t writePos;
-		size_t readPos;
-		std::atomic<BufferSemaphoreFlags> sem;
-		std::atomic<int16_t> sem_id;
+		size_t readPos;                         ///< Read position of the reader holding the buffer (destructive read mode only; broadcast readers keep their own)
 		std::atomic<size_t> sequence_id;
 		std::atomic<uint64_t> last_touch_time;
+		size_t capacity;                        ///< Size of this buffer's data area, in bytes
+		size_t data_offset;                     ///< Offset of this buffer's data area from the start of the data region
+		std::atomic<BufferSemaphoreFlags> sem;
+		std::atomic<int32_t> owner_pid;         ///< PID of the process which last acquired the buffer; checked while the buffer is Writing or Reading
+		std::atomic<int16_t> read_count;        ///< Number of readers currently holding the buffer (broadcast mode only)
+		std::atomic<int16_t> sem_id;
+		int8_t size_class;                      ///< Index of the size class this buffer belongs to
+		std::atomic<bool> queued_empty;         ///< Whether the buffer index is currently in the Empty ring
+		std::atomic<bool> queued_full;          ///< Whether the buffer index is currently in the Full ring
+	};
+
+	/**
+	 * \brief Number of held buffers recorded in each broadcast reader cursor. Holds beyond this are not released
+	 * when the reader exits, and time out instead.
+	 */
+	static constexpr int CursorHeldBuffers = 4;
+
+	/**
+	 * \brief A broadcast buffer held by a registered reader
+	 */
+	struct ShmHeldBuffer
+	{
+		std::atomic<int> buffer;          ///< Index of the buffer, or -1 if the entry is unused
+		std::atomic<size_t> sequence_id;  ///< Sequence ID of the buffer when it was acquired
+	};
+
+	/**
+	 * \brief A registered broadcast-mode reader, the sequence ID of the last buffer it acquired and the buffers it holds
+	 */
+	struct ShmReaderCursor
+	{
+		std::atomic<int> manager_id;      ///< ID of the reader using this cursor, or -1 if the cursor is free
+		std::atomic<int32_t> owner_pid;   ///< PID of the reader process
+		std::atomic<size_t> last_seen_id;
+		ShmHeldBuffer held[CursorHeldBuffers];  // NOLINT(cppcoreguidelines-avoid-c-arrays,hicpp-avoid-c-arrays,modernize-avoid-c-arrays)
+	};
+
+	/**
+	 * \brief A broadcast buffer held by this manager. Broadcast readers share buffers, so each keeps its own read position.
+	 */
+	struct BroadcastHold
+	{
+		size_t sequence_id{0};  ///< Sequence ID of the held buffer (0 if the buffer is not held)
+		size_t read_pos{0};     ///< This reader's read position in the buffer
+	};
+
+	/**
+	 * \brief One slot of a bounded multi-producer/multi-consumer index ring (Vyukov-style).
+	 * The sequence number tells producers and consumers whether the slot is free or holds a value for the current lap.
+	 */
+	struct ShmRingCell
+	{
+		std::atomic<uint64_t> sequence;
+		std::atomic<int> buffer;
+	};
+
+	/**
+	 * \brief Head/tail positions of an index ring. The ring's cells are stored in the segment after the ShmStruct.
+	 * The consumer (head) and producer (tail) positions are on separate cache lines.
+	 */
+	struct ShmIndexRing
+	{
+		uint64_t capacity;     ///< Number of cells in the ring
+		uint64_t cell_offset;  ///< Index of the ring's first cell in the cell array
+		alignas(CacheLineSize) std::atomic<uint64_t> head;
+		alignas(CacheLineSize) std::atomic<uint64_t> tail;
 	};
 
+	/**
+	 * \brief A contiguous range of equally-sized buffers, with its own ring of Empty buffers
+	 */
+	struct ShmSizeClass
+	{
+		size_t buffer_size;
+		int buffer_count;
+		int first_buffer;
+		ShmIndexRing empty_ring;  ///< Indices of buffers in this class which have been marked Empty
+	};
+
+	/**
+	 * \brief A futex word which is incremented on every state change of interest, and a count of processes waiting on it
+	 */
+	struct alignas(CacheLineSize) ShmWaitChannel
+	{
+		std::atomic<uint32_t> sequence;
+		std::atomic<uint32_t> waiters;
+	};
+
+	/**
+	 * \brief Number of buffers of one size class in each BufferSemaphoreFlags state
+	 */
+	struct alignas(CacheLineSize) ShmStateCounts
+	{
+		std::atomic<int32_t> count[4];  // NOLINT(cppcoreguidelines-avoid-c-arrays,hicpp-avoid-c-arrays,modernize-avoid-c-arrays)
+	};
+
+	/**
+	 * \brief A reader registered with RegisterDestination, and the ring of Full buffers queued for it
+	 */
+	struct ShmDestination
+	{
+		std::atomic<int> manager_id;     ///< ID of the registered reader, or -1 if the slot is free
+		std::atomic<int32_t> owner_pid;  ///< PID of the registered reader process
+		std::atomic<uint32_t> weight;    ///< Relative share of unaddressed buffers assigned to this reader
+		ShmIndexRing full_ring;
+	};
+
+	/**
+	 * \brief An entry of the sequence index: a buffer which was marked Full with the given sequence ID.
+	 * The entry is stale once the buffer has been reused (its sequence_id differs).
+	 */
+	struct ShmSequenceEntry
+	{
+		size_t sequence_id;
+		int buffer;
+	};
+
+	/**
+	 * \brief Full buffers ordered by sequence ID (broadcast mode only). The entries are stored in the segment after the ring cells.
+	 */
+	struct alignas(CacheLineSize) ShmSequenceIndex
+	{
+		std::atomic<int> lock;  ///< Spin lock protecting the entries; held only for in-memory operations
+		uint64_t count;         ///< Number of entries, sorted by increasing sequence ID
+		uint64_t capacity;      ///< Number of entries which fit in the index
+	};
+
+	/**
+	 * \brief The segment header. The layout identification comes first, followed by the configuration, which is only
+	 * written by the owner. Counters updated by consumers, by producers and at attach time are on separate cache lines.
+	 */
 	struct ShmStruct
 	{
-		std::atomic<unsigned int> reader_pos;
-		std::atomic<unsigned int> writer_pos;
+		std::atomic<uint64_t> layout_magic;  ///< LayoutMagic once the owner has initialized the segment
+		uint32_t layout_version;             ///< LayoutVersion of the owner
+		uint32_t header_size;                ///< sizeof(ShmStruct) of the owner
+
 		int buffer_count;
 		size_t buffer_size;
 		size_t buffer_timeout_us;
-		size_t next_sequence_id;
-		size_t lowest_seq_id_read;
 		bool destructive_read_mode;
-
-		std::atomic<int> next_id;
 		int rank;
-		unsigned ready_magic;
+		int size_class_count;
+		uint64_t segment_tag;                       ///< SegmentOptions::segment_tag of the owner
+		ShmSizeClass size_classes[MaxSizeClasses];  // NOLINT(cppcoreguidelines-avoid-c-arrays,hicpp-avoid-c-arrays,modernize-avoid-c-arrays)
+
+		alignas(CacheLineSize) std::atomic<unsigned int> reader_pos;  ///< Consumer side
+		size_t lowest_seq_id_read;
+
+		alignas(CacheLineSize) std::atomic<unsigned int> writer_pos;  ///< Producer side
+		std::atomic<size_t> next_sequence_id;
+
+		alignas(CacheLineSize) std::atomic<int> next_id;  ///< Manager IDs, handed out at attach time
+
+		ShmIndexRing full_ring;  ///< Indices of buffers which have been marked Full (destructive read mode only)
+
+		ShmWaitChannel readable_channel;  ///< Signaled when a buffer is marked Full
+		ShmWaitChannel writable_channel;  ///< Signaled when a buffer is marked Empty
+
+		ShmStateCounts state_counts[MaxSizeClasses];                 // NOLINT(cppcoreguidelines-avoid-c-arrays,hicpp-avoid-c-arrays,modernize-avoid-c-arrays)
+		alignas(CacheLineSize) std::atomic<int32_t> addressed_full;  ///< Full buffers marked for one reader (MarkBufferFull with a destination)
+
+		alignas(CacheLineSize) std::atomic<bool> reaper_active;  ///< Whether the creator's reaper thread is detecting stale buffers and buffers held by exited processes
+		std::atomic<uint64_t> reaper_heartbeat_us;               ///< Last time the reaper thread ran (gettimeofday_us)
+		std::atomic<uint64_t> liveness_check_us;                 ///< Last time a process checked that buffer holders are still running
+
+		alignas(CacheLineSize) std::atomic<int> unregistered_readers;  ///< Readers which could not register a cursor; while non-zero, broadcast buffers only expire by timeout
+		ShmReaderCursor reader_cursors[MaxBroadcastReaders];           // NOLINT(cppcoreguidelines-avoid-c-arrays,hicpp-avoid-c-arrays,modernize-avoid-c-arrays)
+
+		alignas(CacheLineSize) std::atomic<int> destination_count;  ///< Number of registered destinations
+		std::atomic<uint64_t> assignment_counter;                   ///< Round-robin position for unaddressed buffers
+		ShmDestination destinations[MaxDestinations];               // NOLINT(cppcoreguidelines-avoid-c-arrays,hicpp-avoid-c-arrays,modernize-avoid-c-arrays)
+
+		ShmSequenceIndex sequence_index;  ///< Full buffers ordered by sequence ID (broadcast mode only)
 	};
 
+	static_assert(sizeof(ShmBuffer) == CacheLineSize, "ShmBuffer must occupy exactly one cache line");
+
+	/*
+	 * Segment layout (version 5):
+	 * | ShmStruct | Empty ring cells (buffer_count) | Full ring cells (buffer_count) | Destination ring cells (MaxDestinations * buffer_count) |
+	 * | Sequence index entries (SequenceEntriesPerBuffer * buffer_count) | (pad to cache line) | ShmBuffer (buffer_count) |
+	 * | (pad to DataAlignment) | data |
+	 * Each size class's Empty ring uses the cells at the positions of its buffers. In the data region, each buffer starts
+	 * on a DataAlignment boundary if its size is at least DataAlignment, and on a cache line boundary otherwise.
+	 */
+	static constexpr size_t RingCellsPerBuffer = 2 + MaxDestinations;
+	static constexpr size_t SequenceEntriesPerBuffer = 2;
+	static constexpr uint64_t LayoutMagic = 0x4152544441515348;  // "ARTDAQSH"
+
+	static constexpr size_t alignUp_(size_t value, size_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+	static constexpr size_t bufferAlignment_(size_t buffer_size) { return buffer_size >= DataAlignment ? DataAlignment : CacheLineSize; }
+	static constexpr size_t sequenceEntriesOffset_(size_t buffer_count) { return sizeof(ShmStruct) + RingCellsPerBuffer * buffer_count * sizeof(ShmRingCell); }
+	static constexpr size_t bufferInfoOffset_(size_t buffer_count) { return alignUp_(sequenceEntriesOffset_(buffer_count) + SequenceEntriesPerBuffer * buffer_count * sizeof(ShmSequenceEntry), CacheLineSize); }
+	static constexpr size_t dataOffset_(size_t buffer_count) { return alignUp_(bufferInfoOffset_(buffer_count) + buffer_count * sizeof(ShmBuffer), DataAlignment); }
+
+	inline ShmRingCell* ringCells_(ShmIndexRing const* ring) const
+	{
+		if (shm_ptr_ == nullptr) return nullptr;
+		return reinterpret_cast<ShmRingCell*>(shm_ptr_ + 1) + ring->cell_offset;  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+
+	inline ShmSequenceEntry* sequenceEntries_() const
+	{
+		if (shm_ptr_ == nullptr) return nullptr;
+		return reinterpret_cast<ShmSequenceEntry*>(reinterpret_cast<uint8_t*>(shm_ptr_) + sequenceEntriesOffset_(shm_ptr_->buffer_count));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+
+	inline uint8_t* bufferInfoStart_() const
+	{
+		if (shm_ptr_ == nullptr) return nullptr;
+		return reinterpret_cast<uint8_t*>(shm_ptr_) + bufferInfoOffset_(shm_ptr_->buffer_count);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+
 	inline uint8_t* dataStart_() const
 	{
 		if (shm_ptr_ == nullptr) return nullptr;
-		return reinterpret_cast<uint8_t*>(shm_ptr_ + 1) + shm_ptr_->buffer_count * sizeof(ShmBuffer);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		return reinterpret_cast<uint8_t*>(shm_ptr_) + dataOffset_(shm_ptr_->buffer_count);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
 	}
 
 	inline uint8_t* bufferStart_(int buffer)
 	{
 		if (shm_ptr_ == nullptr) return nullptr;
 		if (buffer >= requested_shm_parameters_.buffer_count && buffer >= shm_ptr_->buffer_count) Detach(true, "ArgumentOutOfRange", "The specified buffer does not exist!");
-		return dataStart_() + buffer * shm_ptr_->buffer_size;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		return dataStart_() + buffer_ptrs_[buffer]->data_offset;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
 	}
 
 	inline ShmBuffer* getBufferInfo_(int buffer)
@@ -409,18 +1071,83 @@ private:
 	bool checkBuffer_(ShmBuffer* buffer, BufferSemaphoreFlags flags, bool exceptions = true);
 	void touchBuffer_(ShmBuffer* buffer);
 
+	void initRing_(ShmIndexRing* ring, uint64_t capacity, uint64_t cell_offset);
+	bool pushIndex_(ShmIndexRing* ring, int buffer);
+	int popIndex_(ShmIndexRing* ring);
+	size_t countQueued_(ShmIndexRing* ring, BufferSemaphoreFlags flags, bool stopAtFirst);
+	size_t countEmpty_(size_t size_hint, bool stopAtFirst);
+	int sizeClassFor_(size_t size_hint) const;
+	void queueBuffer_(int buffer, BufferSemaphoreFlags flags);
+	bool bufferAvailable_(ShmBuffer* buffer, BufferSemaphoreFlags flags) const;
+	bool acquireBuffer_(ShmBuffer* buffer, BufferSemaphoreFlags from, BufferSemaphoreFlags to);
+	void setBufferState_(ShmBuffer* buffer, BufferSemaphoreFlags state);
+	bool compareExchangeBufferState_(ShmBuffer* buffer, BufferSemaphoreFlags from, BufferSemaphoreFlags to);
+	void countStateChange_(ShmBuffer* buffer, BufferSemaphoreFlags from, BufferSemaphoreFlags to);
+	void reclaimStaleBuffers_();
+	void reclaimDeadHolders_();
+	void checkReaper_();
+	void startReaper_();
+	void stopReaper_();
+	void reaperLoop_();
+	void registerReader_();
+	void unregisterReader_();
+	void recycleBroadcastBuffers_();
+	void releaseBroadcastHold_(int buffer, ShmBuffer* shmBuf);
+	bool recycleBroadcastBuffer_(int buffer, ShmBuffer* shmBuf);
+	ShmDestination* destinationFor_(ShmBuffer* buffer);
+	int acquireFromRing_(ShmIndexRing* ring);
+	void requeueDestination_(ShmDestination* destination);
+	void renumberPassedBuffer_(int buffer, ShmBuffer* shmBuf);
+	void insertSequence_(int buffer, size_t sequence_id);
+	int findSequence_(size_t after_id, size_t* sequence_id, size_t* count);
+	int scanSequence_(size_t after_id, size_t* sequence_id, size_t* count);
+	int holdNextSequence_();
+	void endBroadcastHold_(int buffer);
+	void releaseCursorHolds_(ShmReaderCursor* cursor);
+	bool holdsForReading_(int buffer, ShmBuffer* buf) const;
+	bool checkReading_(int buffer, ShmBuffer* buf, bool exceptions);
+	size_t& readPos_(int buffer, ShmBuffer* buf);
+	void prepareSegment_(bool owner);
+	size_t bufferFreeSpace_(int buffer);
+	void updateLastSeenId_(ShmBuffer* buffer);
+	void notifyChannel_(ShmWaitChannel* channel);
+	void flushNotifications_();
+	int getBufferForReading_();
+	int getBufferForWriting_(bool overwrite, size_t size_hint);
+	bool waitForChannel_(ShmWaitChannel* channel, size_t timeout_us, std::function<bool()> const& ready, size_t max_slice_us = 0);
+
 	ShmStruct requested_shm_parameters_;
+	std::vector<SizeClass> requested_size_classes_;
 
-	int shm_segment_id_;
+	std::unique_ptr<SharedMemorySegment> segment_;
 	ShmStruct* shm_ptr_;
 	uint32_t shm_key_;
 	int manager_id_;
 	std::vector<ShmBuffer*> buffer_ptrs_;
 	mutable std::vector<std::mutex> buffer_mutexes_;
+	std::vector<BroadcastHold> broadcast_holds_;
 	mutable std::mutex search_mutex_;
 
 	std::atomic<size_t> last_seen_id_;
+	int reader_slot_;
+	bool reader_overflow_;  ///< Whether this manager is counted in unregistered_readers
+	int destination_slot_;
 	size_t min_write_size_;
+	std::atomic<uint64_t> last_reclaim_time_;
+	SegmentOptions segment_options_;
+
+	std::atomic<WaitStrategy> wait_strategy_;
+	std::atomic<size_t> spin_us_;
+	std::atomic<size_t> adaptive_spin_us_;  ///< Current spin time of WaitStrategy::Adaptive
+
+	std::atomic<int> notify_deferral_;             ///< Number of batch operations in progress; while non-zero, channel notifications are held back
+	std::atomic<unsigned> deferred_notifications_;  ///< Channels to notify when the last batch operation finishes (1: readable, 2: writable)
+	SharedMemoryManager* notify_group_;            ///< Manager whose channels are signaled along with this one's (see SetNotifyGroup)
+
+	std::thread reaper_thread_;
+	std::atomic<bool> reaper_stop_;
+	std::mutex reaper_mutex_;
+	std::condition_variable reaper_cv_;
 };
 
 }  // namespace artdaq
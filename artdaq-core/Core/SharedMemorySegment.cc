@@ -0,0 +1,437 @@
+#define TRACE_NAME "SharedMemorySegment"
+#include "artdaq-core/Core/SharedMemorySegment.hh"
+
+#include <fcntl.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#ifndef SHM_DEST  // Lynn reports that this is missing on Mac OS X?!?
+#define SHM_DEST 01000
+#endif
+#ifdef __linux__
+// Older glibc headers do not define the explicit huge page size flags
+#ifndef SHM_HUGE_SHIFT
+#define SHM_HUGE_SHIFT 26
+#endif
+#ifndef SHM_HUGE_2MB
+#define SHM_HUGE_2MB (21 << SHM_HUGE_SHIFT)
+#endif
+#ifndef SHM_HUGE_1GB
+#define SHM_HUGE_1GB (30 << SHM_HUGE_SHIFT)
+#endif
+#ifndef HUGETLBFS_MAGIC
+#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+#endif
+#include "TRACE/tracemf.h"
+
+#define TLVL_SEGMENT 36
+
+namespace {
+// Attach slots are single-byte open file description locks far beyond the end of any segment
+constexpr off_t kSlotBase = static_cast<off_t>(1) << 40;
+constexpr off_t kSlotCount = 4096;
+
+std::string segmentName(uint32_t key)
+{
+	std::ostringstream name;
+	name << "artdaq_shm_" << std::hex << std::setw(8) << std::setfill('0') << key;
+	return name.str();
+}
+
+#ifdef F_OFD_GETLK
+// Count the slot locks in [start, end) held by other open file descriptions
+uint16_t countSlots(int fd, off_t start, off_t end)
+{
+	if (start >= end)
+	{
+		return 0;
+	}
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = start;
+	fl.l_len = end - start;
+	if (fcntl(fd, F_OFD_GETLK, &fl) != 0 || fl.l_type == F_UNLCK)
+	{
+		return 0;
+	}
+	// The kernel reports any one conflicting lock, so count on both sides of it
+	return 1 + countSlots(fd, start, fl.l_start) + countSlots(fd, fl.l_start + 1, end);
+}
+#endif
+}  // namespace
+
+std::unique_ptr<artdaq::SharedMemorySegment> artdaq::SharedMemorySegment::Make(SharedMemoryBackend backend, uint32_t key, std::string const& directory, bool read_only)
+{
+	switch (backend)
+	{
+		case SharedMemoryBackend::Posix:
+			return std::make_unique<MappedSharedMemorySegment>(key, "", read_only);
+		case SharedMemoryBackend::File:
+			return std::make_unique<MappedSharedMemorySegment>(key, directory.empty() ? "/dev/shm" : directory, read_only);
+		case SharedMemoryBackend::SysV:
+			break;
+	}
+	return std::make_unique<SysVSharedMemorySegment>(key, read_only);
+}
+
+artdaq::SysVSharedMemorySegment::SysVSharedMemorySegment(uint32_t key, bool read_only)
+    : key_(key)
+    , read_only_(read_only)
+    , segment_id_(-1)
+    , address_(nullptr)
+    , huge_pages_(false)
+{}
+
+artdaq::SysVSharedMemorySegment::~SysVSharedMemorySegment()
+{
+	Close();
+}
+
+bool artdaq::SysVSharedMemorySegment::Open(size_t min_size)
+{
+	// The permission bits of an existing segment are checked against the requested access
+	segment_id_ = shmget(key_, min_size, read_only_ ? 0444 : 0666);
+	return segment_id_ != -1;
+}
+
+bool artdaq::SysVSharedMemorySegment::Create(size_t size, size_t huge_page_size)
+{
+	huge_pages_ = false;
+	if (read_only_)
+	{
+		errno = EROFS;
+		return false;
+	}
+#ifdef __linux__
+	if (huge_page_size > 0)
+	{
+		int page_flag = huge_page_size >= 0x40000000 ? SHM_HUGE_1GB : SHM_HUGE_2MB;
+
+		// Huge page segments must be a whole number of pages
+		size_t huge_size = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+		TLOG(TLVL_SEGMENT) << "Creating huge page shared memory segment with key 0x" << std::hex << key_ << " and size " << std::dec << huge_size << " (page size " << huge_page_size << ")";
+		segment_id_ = shmget(key_, huge_size, IPC_CREAT | SHM_HUGETLB | page_flag | 0666);
+		if (segment_id_ != -1)
+		{
+			huge_pages_ = true;
+			return true;
+		}
+		TLOG(TLVL_WARNING) << "Could not create huge page shared memory segment with key 0x" << std::hex << key_
+		                   << ", errno=" << std::dec << errno << " (" << strerror(errno) << "). "
+		                   << "Check /proc/sys/vm/nr_hugepages and the hugetlb_shm_group setting. Falling back to normal pages.";
+	}
+#else
+	if (huge_page_size > 0)
+	{
+		TLOG(TLVL_WARNING) << "Huge page shared memory is not supported on this platform, using normal pages";
+	}
+#endif
+
+	TLOG(TLVL_SEGMENT) << "Creating shared memory segment with key 0x" << std::hex << key_ << " and size " << std::dec << size;
+	segment_id_ = shmget(key_, size, IPC_CREAT | 0666);
+	return segment_id_ != -1;
+}
+
+void* artdaq::SysVSharedMemorySegment::Map()
+{
+	auto addr = shmat(segment_id_, nullptr, read_only_ ? SHM_RDONLY : 0);
+	if (addr == reinterpret_cast<void*>(-1))  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+	{
+		return nullptr;
+	}
+	address_ = addr;
+	return address_;
+}
+
+void artdaq::SysVSharedMemorySegment::Close()
+{
+	if (address_ != nullptr)
+	{
+		shmdt(address_);
+		address_ = nullptr;
+	}
+	segment_id_ = -1;
+	huge_pages_ = false;
+}
+
+void artdaq::SysVSharedMemorySegment::Remove()
+{
+	if (segment_id_ != -1 && !read_only_)
+	{
+		shmctl(segment_id_, IPC_RMID, nullptr);
+	}
+}
+
+bool artdaq::SysVSharedMemorySegment::IsRemoved() const
+{
+	struct shmid_ds info;
+	if (shmctl(segment_id_, IPC_STAT, &info) < 0)
+	{
+		TLOG(TLVL_DEBUG + 32) << "Error accessing Shared Memory info: " << errno << " (" << strerror(errno) << ").";
+		return true;
+	}
+	return (info.shm_perm.mode & SHM_DEST) != 0;
+}
+
+size_t artdaq::SysVSharedMemorySegment::Size() const
+{
+	struct shmid_ds info;
+	if (shmctl(segment_id_, IPC_STAT, &info) < 0)
+	{
+		return 0;
+	}
+	return info.shm_segsz;
+}
+
+uint16_t artdaq::SysVSharedMemorySegment::AttachedCount() const
+{
+	struct shmid_ds info;
+	if (shmctl(segment_id_, IPC_STAT, &info) < 0)
+	{
+		TLOG(TLVL_DEBUG + 32) << "Error accessing Shared Memory info: " << errno << " (" << strerror(errno) << ").";
+		return 0;
+	}
+	return info.shm_nattch;
+}
+
+std::string artdaq::SysVSharedMemorySegment::Describe() const
+{
+	std::ostringstream ostr;
+	ostr << "System V shared memory segment with key 0x" << std::hex << key_ << std::dec << " (ID " << segment_id_ << ")";
+	return ostr.str();
+}
+
+std::string artdaq::SysVSharedMemorySegment::CleanupHint() const
+{
+	std::ostringstream ostr;
+	ostr << "'ipcrm -M 0x" << std::hex << key_ << "' or 'ipcrm -m " << std::dec << segment_id_ << "'";
+	return ostr.str();
+}
+
+artdaq::MappedSharedMemorySegment::MappedSharedMemorySegment(uint32_t key, std::string const& directory, bool read_only)
+    : name_(directory.empty() ? "/" + segmentName(key) : directory + "/" + segmentName(key))
+    , posix_(directory.empty())
+    , read_only_(read_only)
+    , fd_(-1)
+    , address_(nullptr)
+    , mapped_size_(0)
+    , huge_pages_(false)
+    , slot_held_(false)
+{}
+
+artdaq::MappedSharedMemorySegment::~MappedSharedMemorySegment()
+{
+	Close();
+}
+
+int artdaq::MappedSharedMemorySegment::openFd_(int flags)
+{
+	if (posix_)
+	{
+		return shm_open(name_.c_str(), flags, 0666);
+	}
+	return open(name_.c_str(), flags | O_CLOEXEC, 0666);  // NOLINT(cppcoreguidelines-pro-type-vararg)
+}
+
+bool artdaq::MappedSharedMemorySegment::claimSlot_()
+{
+#ifdef F_OFD_SETLK
+	for (off_t slot = 0; slot < kSlotCount; ++slot)
+	{
+		struct flock fl;
+		memset(&fl, 0, sizeof(fl));
+		fl.l_type = F_WRLCK;
+		fl.l_whence = SEEK_SET;
+		fl.l_start = kSlotBase + slot;
+		fl.l_len = 1;
+		if (fcntl(fd_, F_OFD_SETLK, &fl) == 0)  // NOLINT(cppcoreguidelines-pro-type-vararg)
+		{
+			return true;
+		}
+		if (errno != EAGAIN && errno != EACCES)
+		{
+			break;
+		}
+	}
+	TLOG(TLVL_DEBUG + 32) << "Could not claim an attach slot in " << name_ << ", errno=" << errno << " (" << strerror(errno) << "). The attached count will not include this process.";
+#endif
+	return false;
+}
+
+bool artdaq::MappedSharedMemorySegment::Open(size_t min_size)
+{
+	fd_ = openFd_(read_only_ ? O_RDONLY : O_RDWR);
+	if (fd_ == -1)
+	{
+		return false;
+	}
+
+	// The creator may not have sized the segment yet
+	if (Size() < min_size)
+	{
+		close(fd_);
+		fd_ = -1;
+		errno = EAGAIN;
+		return false;
+	}
+
+#ifdef __linux__
+	struct statfs fs;
+	huge_pages_ = fstatfs(fd_, &fs) == 0 && static_cast<uint32_t>(fs.f_type) == static_cast<uint32_t>(HUGETLBFS_MAGIC);
+#endif
+	// Read-only observers are not counted as attached, so that they never keep a segment alive
+	if (!read_only_)
+	{
+		slot_held_ = claimSlot_();
+	}
+	return true;
+}
+
+bool artdaq::MappedSharedMemorySegment::Create(size_t size, size_t huge_page_size)
+{
+	if (read_only_)
+	{
+		errno = EROFS;
+		return false;
+	}
+	fd_ = openFd_(O_RDWR | O_CREAT);
+	if (fd_ == -1)
+	{
+		TLOG(TLVL_ERROR) << "Error creating " << Describe() << ", errno=" << errno << " (" << strerror(errno) << ")";
+		return false;
+	}
+
+	huge_pages_ = false;
+#ifdef __linux__
+	struct statfs fs;
+	if (fstatfs(fd_, &fs) == 0 && static_cast<uint32_t>(fs.f_type) == static_cast<uint32_t>(HUGETLBFS_MAGIC))
+	{
+		// Files on hugetlbfs must be a whole number of the mount's pages
+		huge_pages_ = true;
+		auto page_size = static_cast<size_t>(fs.f_bsize);
+		size = (size + page_size - 1) / page_size * page_size;
+	}
+#endif
+	if (huge_page_size > 0 && !huge_pages_)
+	{
+		TLOG(TLVL_WARNING) << "Huge pages were requested, but " << name_ << " is not on a hugetlbfs mount. "
+		                   << "Use the File backend with a hugetlbfs directory for huge pages. Using normal pages.";
+	}
+
+	if (Size() < size)
+	{
+		TLOG(TLVL_SEGMENT) << "Creating " << Describe() << " with size " << size;
+		if (ftruncate(fd_, static_cast<off_t>(size)) != 0)
+		{
+			auto err = errno;
+			TLOG(TLVL_ERROR) << "Error sizing " << Describe() << " to " << size << " bytes, errno=" << err << " (" << strerror(err) << ")";
+			close(fd_);
+			fd_ = -1;
+			errno = err;
+			return false;
+		}
+	}
+	slot_held_ = claimSlot_();
+	return true;
+}
+
+void* artdaq::MappedSharedMemorySegment::Map()
+{
+	auto size = Size();
+	auto addr = mmap(nullptr, size, read_only_ ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (addr == MAP_FAILED)  // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+	{
+		return nullptr;
+	}
+	address_ = addr;
+	mapped_size_ = size;
+	return address_;
+}
+
+void artdaq::MappedSharedMemorySegment::Close()
+{
+	if (address_ != nullptr)
+	{
+		munmap(address_, mapped_size_);
+		address_ = nullptr;
+		mapped_size_ = 0;
+	}
+	if (fd_ != -1)
+	{
+		close(fd_);  // Also releases the attach slot
+		fd_ = -1;
+	}
+	huge_pages_ = false;
+	slot_held_ = false;
+}
+
+void artdaq::MappedSharedMemorySegment::Remove()
+{
+	if (read_only_)
+	{
+		return;
+	}
+	auto sts = posix_ ? shm_unlink(name_.c_str()) : unlink(name_.c_str());
+	if (sts != 0 && errno != ENOENT)
+	{
+		TLOG(TLVL_WARNING) << "Error removing " << Describe() << ", errno=" << errno << " (" << strerror(errno) << ")";
+	}
+}
+
+bool artdaq::MappedSharedMemorySegment::IsRemoved() const
+{
+	struct stat info;
+	if (fd_ == -1 || fstat(fd_, &info) != 0)
+	{
+		return true;
+	}
+	// Once the name has been removed, the object lives on only through open descriptors
+	return info.st_nlink == 0;
+}
+
+size_t artdaq::MappedSharedMemorySegment::Size() const
+{
+	struct stat info;
+	if (fd_ == -1 || fstat(fd_, &info) != 0)
+	{
+		return 0;
+	}
+	return static_cast<size_t>(info.st_size);
+}
+
+uint16_t artdaq::MappedSharedMemorySegment::AttachedCount() const
+{
+	if (fd_ == -1)
+	{
+		return 0;
+	}
+#ifdef F_OFD_GETLK
+	// Our own slot does not conflict with our lock probes, so it is counted separately. Read-only instances, and
+	// instances which could not claim a slot, hold none.
+	return (slot_held_ ? 1 : 0) + countSlots(fd_, kSlotBase, kSlotBase + kSlotCount);
+#else
+	return 1;
+#endif
+}
+
+std::string artdaq::MappedSharedMemorySegment::Describe() const
+{
+	return (posix_ ? "POSIX shared memory object " : "shared memory file ") + name_;
+}
+
+std::string artdaq::MappedSharedMemorySegment::CleanupHint() const
+{
+	return "'rm " + (posix_ ? "/dev/shm" + name_ : name_) + "'";
+}
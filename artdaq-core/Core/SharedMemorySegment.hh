@@ -0,0 +1,209 @@
+#ifndef artdaq_core_Core_SharedMemorySegment_hh
+#define artdaq_core_Core_SharedMemorySegment_hh 1
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace artdaq {
+/**
+	 * \brief The SharedMemoryBackend enumeration selects the operating system facility which provides a shared memory segment
+	 */
+enum class SharedMemoryBackend
+{
+	SysV,   ///< System V shared memory (shmget/shmat), identified by the key
+	Posix,  ///< POSIX shared memory (shm_open/mmap), named /artdaq_shm_<key> in /dev/shm
+	File    ///< A regular file (open/mmap) named artdaq_shm_<key> in a given directory, e.g. a tmpfs or hugetlbfs mount
+};
+
+/**
+	 * \brief A SharedMemorySegment creates, maps and removes the memory underlying a SharedMemoryManager.
+	 *
+	 * The SharedMemoryManager layout (ShmStruct, buffer descriptors and buffer data) does not depend on the provider,
+	 * only on the address returned by Map().
+	 */
+class SharedMemorySegment
+{
+public:
+	/**
+		 * \brief Create a SharedMemorySegment for the given backend
+		 * \param backend Operating system facility to use
+		 * \param key Key identifying the segment
+		 * \param directory Directory holding the segment file (File backend only)
+		 * \param read_only Open and map the segment without write access (SHM_RDONLY or PROT_READ). Create fails on a read-only segment.
+		 * \return std::unique_ptr to the new SharedMemorySegment
+		 */
+	static std::unique_ptr<SharedMemorySegment> Make(SharedMemoryBackend backend, uint32_t key, std::string const& directory = "", bool read_only = false);
+
+	/**
+		 * \brief SharedMemorySegment Destructor
+		 */
+	virtual ~SharedMemorySegment() = default;
+
+	/**
+		 * \brief Open an existing segment
+		 * \param min_size The segment must be at least this large to be considered available
+		 * \return Whether the segment was opened. errno is set on failure.
+		 */
+	virtual bool Open(size_t min_size) = 0;
+
+	/**
+		 * \brief Create the segment (or open it, if it already exists)
+		 * \param size Size of the segment, in bytes. It may be rounded up to a whole number of pages.
+		 * \param huge_page_size Size of the huge pages to request (0 for the default page size). Unsupported requests fall back to normal pages.
+		 * \return Whether the segment was created. errno is set on failure.
+		 */
+	virtual bool Create(size_t size, size_t huge_page_size) = 0;
+
+	/**
+		 * \brief Map the open segment into this process
+		 * \return Address of the mapping, or nullptr on failure
+		 */
+	virtual void* Map() = 0;
+
+	/**
+		 * \brief Unmap the segment from this process and close it
+		 */
+	virtual void Close() = 0;
+
+	/**
+		 * \brief Mark the segment for removal. It is destroyed once every process has closed it. Does nothing on a read-only segment.
+		 */
+	virtual void Remove() = 0;
+
+	/**
+		 * \brief Whether the segment is open
+		 * \return True if Open or Create succeeded and Close has not been called
+		 */
+	virtual bool IsOpen() const = 0;
+
+	/**
+		 * \brief Whether the segment has been marked for removal (by any process)
+		 * \return True if the segment is marked for removal, or its status cannot be determined
+		 */
+	virtual bool IsRemoved() const = 0;
+
+	/**
+		 * \brief Get the size of the segment
+		 * \return Size of the segment, in bytes (0 if unknown)
+		 */
+	virtual size_t Size() const = 0;
+
+	/**
+		 * \brief Get the number of processes (or SharedMemoryManager instances) which have the segment mapped
+		 * \return The attached count, or 0 if it cannot be determined
+		 */
+	virtual uint16_t AttachedCount() const = 0;
+
+	/**
+		 * \brief Whether the segment is backed by huge pages
+		 * \return True if the segment was created with (or lives on a filesystem providing) huge pages
+		 */
+	virtual bool UsingHugePages() const = 0;
+
+	/**
+		 * \brief Describe the segment for log messages
+		 * \return A human-readable description of the segment
+		 */
+	virtual std::string Describe() const = 0;
+
+	/**
+		 * \brief Describe how to remove a stale segment by hand
+		 * \return Shell command(s) which remove the segment
+		 */
+	virtual std::string CleanupHint() const = 0;
+};
+
+/**
+	 * \brief A SharedMemorySegment using System V shared memory (shmget/shmat)
+	 */
+class SysVSharedMemorySegment : public SharedMemorySegment
+{
+public:
+	/**
+		 * \brief SysVSharedMemorySegment Constructor
+		 * \param key Key of the System V segment
+		 * \param read_only Attach with SHM_RDONLY
+		 */
+	explicit SysVSharedMemorySegment(uint32_t key, bool read_only = false);
+	~SysVSharedMemorySegment() override;
+
+	bool Open(size_t min_size) override;                       ///< \copydoc SharedMemorySegment::Open
+	bool Create(size_t size, size_t huge_page_size) override;  ///< \copydoc SharedMemorySegment::Create
+	void* Map() override;                                      ///< \copydoc SharedMemorySegment::Map
+	void Close() override;                                     ///< \copydoc SharedMemorySegment::Close
+	void Remove() override;                                    ///< \copydoc SharedMemorySegment::Remove
+	bool IsOpen() const override { return segment_id_ != -1; }  ///< \copydoc SharedMemorySegment::IsOpen
+	bool IsRemoved() const override;                           ///< \copydoc SharedMemorySegment::IsRemoved
+	size_t Size() const override;                              ///< \copydoc SharedMemorySegment::Size
+	uint16_t AttachedCount() const override;                   ///< \copydoc SharedMemorySegment::AttachedCount
+	bool UsingHugePages() const override { return huge_pages_; }  ///< \copydoc SharedMemorySegment::UsingHugePages
+	std::string Describe() const override;                     ///< \copydoc SharedMemorySegment::Describe
+	std::string CleanupHint() const override;                  ///< \copydoc SharedMemorySegment::CleanupHint
+
+private:
+	SysVSharedMemorySegment(SysVSharedMemorySegment const&) = delete;
+	SysVSharedMemorySegment(SysVSharedMemorySegment&&) = delete;
+	SysVSharedMemorySegment& operator=(SysVSharedMemorySegment const&) = delete;
+	SysVSharedMemorySegment& operator=(SysVSharedMemorySegment&&) = delete;
+
+	uint32_t key_;
+	bool read_only_;
+	int segment_id_;
+	void* address_;
+	bool huge_pages_;
+};
+
+/**
+	 * \brief A SharedMemorySegment backed by a file descriptor which is mapped with mmap: either a POSIX shared memory object or a regular file
+	 *
+	 * Each instance holds an open file description lock on one "slot" byte of the file while it is open, so that the
+	 * number of attached instances can be counted, and slots held by crashed processes are released by the kernel.
+	 */
+class MappedSharedMemorySegment : public SharedMemorySegment
+{
+public:
+	/**
+		 * \brief MappedSharedMemorySegment Constructor
+		 * \param key Key of the segment, used to build its name
+		 * \param directory Directory holding the segment file. If empty, a POSIX shared memory object is used.
+		 * \param read_only Open the segment with O_RDONLY and map it with PROT_READ. A read-only segment does not claim an attach slot.
+		 */
+	MappedSharedMemorySegment(uint32_t key, std::string const& directory, bool read_only = false);
+	~MappedSharedMemorySegment() override;
+
+	bool Open(size_t min_size) override;                       ///< \copydoc SharedMemorySegment::Open
+	bool Create(size_t size, size_t huge_page_size) override;  ///< \copydoc SharedMemorySegment::Create
+	void* Map() override;                                      ///< \copydoc SharedMemorySegment::Map
+	void Close() override;                                     ///< \copydoc SharedMemorySegment::Close
+	void Remove() override;                                    ///< \copydoc SharedMemorySegment::Remove
+	bool IsOpen() const override { return fd_ != -1; }        ///< \copydoc SharedMemorySegment::IsOpen
+	bool IsRemoved() const override;                           ///< \copydoc SharedMemorySegment::IsRemoved
+	size_t Size() const override;                              ///< \copydoc SharedMemorySegment::Size
+	uint16_t AttachedCount() const override;                   ///< \copydoc SharedMemorySegment::AttachedCount
+	bool UsingHugePages() const override { return huge_pages_; }  ///< \copydoc SharedMemorySegment::UsingHugePages
+	std::string Describe() const override;                     ///< \copydoc SharedMemorySegment::Describe
+	std::string CleanupHint() const override;                  ///< \copydoc SharedMemorySegment::CleanupHint
+
+private:
+	MappedSharedMemorySegment(MappedSharedMemorySegment const&) = delete;
+	MappedSharedMemorySegment(MappedSharedMemorySegment&&) = delete;
+	MappedSharedMemorySegment& operator=(MappedSharedMemorySegment const&) = delete;
+	MappedSharedMemorySegment& operator=(MappedSharedMemorySegment&&) = delete;
+
+	int openFd_(int flags);
+	bool claimSlot_();
+
+	std::string name_;
+	bool posix_;
+	bool read_only_;
+	int fd_;
+	void* address_;
+	size_t mapped_size_;
+	bool huge_pages_;
+	bool slot_held_;
+};
+}  // namespace artdaq
+
+#endif  // artdaq_core_Core_SharedMemorySegment_hh
@@ -0,0 +1,212 @@
+#define TRACE_NAME "shared_memory_inspector"
+
+// Read-only, top-like view of a SharedMemoryManager segment, for diagnosing backpressure on a running system.
+//
+// The segment is attached with SHM_RDONLY (or mapped PROT_READ for the POSIX and File backends) and inspected with
+// SharedMemoryInspector, which takes no locks and writes nothing, so readers and writers of the segment are not
+// disturbed. Every interval, the buffer states, sequence IDs, fill levels and a summary of the Fragments in each
+// buffer are printed; on a terminal the screen is redrawn in place. The inspector exits when the segment is marked
+// for removal, so that it does not keep the segment's memory alive.
+//
+// Usage: shared_memory_inspector --key K [--backend sysv|posix|file] [--directory dir] [--interval seconds]
+//                                [--iterations N] [--once] [--contents auto|fragments|events] [--no-contents]
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "artdaq-core/Core/SharedMemoryInspector.hh"
+#include "artdaq-core/Utilities/configureMessageFacility.hh"
+
+namespace {
+using BufferContents = artdaq::SharedMemoryInspector::BufferContents;
+
+/**
+	 * \brief Inspector parameters, from the command line
+	 */
+struct InspectorOptions
+{
+	uint32_t key = 0;                                                         ///< Key of the segment
+	bool have_key = false;                                                    ///< Whether --key was given
+	artdaq::SharedMemoryBackend backend = artdaq::SharedMemoryBackend::SysV;  ///< Operating system facility holding the segment
+	std::string directory;                                                    ///< Directory of the segment file (File backend)
+	double interval_s = 1.0;                                                  ///< Time between snapshots
+	size_t iterations = 0;                                                    ///< Number of snapshots to print (0: until interrupted)
+	BufferContents contents = BufferContents::Auto;                           ///< Layout of the buffer data
+	bool summarize_contents = true;                                           ///< Whether to walk the Fragments in each buffer
+};
+
+volatile sig_atomic_t stop_requested = 0;
+
+void handle_signal(int /*signal*/)
+{
+	stop_requested = 1;
+}
+
+void usage(char const* name)
+{
+	std::cerr << "Usage: " << name << " --key K [--backend sysv|posix|file] [--directory dir] [--interval seconds]" << std::endl
+	          << "       [--iterations N] [--once] [--contents auto|fragments|events] [--no-contents]" << std::endl;
+}
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+	InspectorOptions opts;
+	try
+	{
+		for (int ii = 1; ii < argc; ++ii)
+		{
+			std::string arg = argv[ii];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			auto next = [&]() -> std::string {
+				if (ii + 1 >= argc)
+				{
+					throw std::invalid_argument(arg + " requires a value");
+				}
+				return argv[++ii];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			};
+			if (arg == "--key")
+			{
+				// Accept keys in hexadecimal (0x...), as printed by ipcs
+				opts.key = static_cast<uint32_t>(std::stoul(next(), nullptr, 0));
+				opts.have_key = true;
+			}
+			else if (arg == "--backend")
+			{
+				auto backend = next();
+				if (backend == "sysv")
+				{
+					opts.backend = artdaq::SharedMemoryBackend::SysV;
+				}
+				else if (backend == "posix")
+				{
+					opts.backend = artdaq::SharedMemoryBackend::Posix;
+				}
+				else if (backend == "file")
+				{
+					opts.backend = artdaq::SharedMemoryBackend::File;
+				}
+				else
+				{
+					throw std::invalid_argument("unknown backend " + backend);
+				}
+			}
+			else if (arg == "--directory")
+			{
+				opts.directory = next();
+			}
+			else if (arg == "--interval")
+			{
+				opts.interval_s = std::stod(next());
+			}
+			else if (arg == "--iterations")
+			{
+				opts.iterations = std::stoul(next());
+			}
+			else if (arg == "--once")
+			{
+				opts.iterations = 1;
+			}
+			else if (arg == "--contents")
+			{
+				auto contents = next();
+				if (contents == "auto")
+				{
+					opts.contents = BufferContents::Auto;
+				}
+				else if (contents == "fragments")
+				{
+					opts.contents = BufferContents::Fragments;
+				}
+				else if (contents == "events")
+				{
+					opts.contents = BufferContents::Events;
+				}
+				else
+				{
+					throw std::invalid_argument("unknown contents " + contents);
+				}
+			}
+			else if (arg == "--no-contents")
+			{
+				opts.summarize_contents = false;
+			}
+			else
+			{
+				throw std::invalid_argument("unknown option " + arg);
+			}
+		}
+	}
+	catch (std::exception const& e)
+	{
+		std::cerr << e.what() << std::endl;
+		usage(argv[0]);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		return 2;
+	}
+	if (!opts.have_key || opts.interval_s <= 0.0)
+	{
+		usage(argv[0]);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		return 2;
+	}
+
+	artdaq::configureMessageFacility("shared_memory_inspector", true, false);
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	artdaq::SharedMemoryInspector inspector(opts.key, opts.backend, opts.directory);
+	if (!inspector.Attach())
+	{
+		std::cerr << "Could not attach to shared memory segment with key 0x" << std::hex << opts.key << std::dec << std::endl;
+		return 1;
+	}
+
+	bool redraw = isatty(STDOUT_FILENO) != 0 && opts.iterations != 1;
+	auto interval = std::chrono::microseconds(static_cast<int64_t>(opts.interval_s * 1000000));
+	artdaq::SharedMemoryInspector::SegmentSnapshot previous;
+	bool have_previous = false;
+	for (size_t iteration = 0; (opts.iterations == 0 || iteration < opts.iterations) && stop_requested == 0; ++iteration)
+	{
+		if (iteration > 0)
+		{
+			// Sleep in short steps, so that Ctrl-C is handled promptly
+			auto wake = std::chrono::steady_clock::now() + interval;
+			while (stop_requested == 0 && std::chrono::steady_clock::now() < wake)
+			{
+				std::this_thread::sleep_for(std::min(std::chrono::microseconds(10000), std::chrono::duration_cast<std::chrono::microseconds>(wake - std::chrono::steady_clock::now())));
+			}
+			if (stop_requested != 0)
+			{
+				break;
+			}
+		}
+
+		auto snapshot = inspector.Snapshot(opts.contents, opts.summarize_contents);
+		if (redraw)
+		{
+			std::cout << "\033[H\033[2J";
+		}
+		std::cout << artdaq::SharedMemoryInspector::Format(snapshot, have_previous ? &previous : nullptr);
+		if (!redraw)
+		{
+			std::cout << std::endl;
+		}
+		std::cout << std::flush;
+
+		if (snapshot.removed)
+		{
+			std::cout << "Segment has been marked for removal, detaching" << std::endl;
+			break;
+		}
+		previous = std::move(snapshot);
+		have_previous = true;
+	}
+
+	inspector.Detach();
+	return 0;
+}
@@ -89,6 +89,90 @@ inline std::ostream& operator<<(std::ostream& os, RawEventHeader const& evh)
 }
 
 #endif
+
+/**
+	 * \brief One entry of a RawEventTOC: where a Fragment is in the event buffer, and what it is
+	 */
+struct RawEventTOCEntry
+{
+	uint64_t offset;       ///< Offset of the Fragment's RawFragmentHeader from the start of the buffer (i.e. of the RawEventHeader), in bytes
+	uint32_t word_count;   ///< Size of the Fragment, in RawDataType words
+	uint16_t fragment_id;  ///< Fragment ID of the Fragment
+	uint8_t type;          ///< Type of the Fragment
+	uint8_t reserved;      ///< Unused, always 0
+};
+
+/**
+	 * \brief Optional table of contents of an event buffer, written directly after the RawEventHeader
+	 *
+	 * The TOC lets readers find Fragments (or just list their types) without walking the whole payload. The writer
+	 * reserves room for a number of entries up front, then fills one entry per Fragment as it appends the Fragments
+	 * after the reserved entries:
+	 *
+	 *   RawEventHeader | RawEventTOC | capacity x RawEventTOCEntry | Fragment | Fragment | ...
+	 *
+	 * Events without a TOC have their first RawFragmentHeader directly after the RawEventHeader. Since the first
+	 * word of a RawFragmentHeader holds its non-zero word_count, the zero and magic words tell the two layouts apart.
+	 */
+struct RawEventTOC
+{
+	static constexpr uint32_t MAGIC = 0x21434f54;  ///< "TOC!"
+
+	uint32_t zero;         ///< Always 0, where a RawFragmentHeader would hold its word_count
+	uint32_t magic;        ///< Always MAGIC
+	uint32_t capacity;     ///< Number of entries reserved after the TOC
+	uint32_t entry_count;  ///< Number of entries filled in
+
+	/**
+		 * \brief Construct an empty RawEventTOC
+		 * \param cap Number of entries to reserve
+		 */
+	explicit RawEventTOC(uint32_t cap = 0)
+	    : zero(0), magic(MAGIC), capacity(cap), entry_count(0) {}
+
+	/**
+		 * \brief Get the space taken by a TOC and its entries
+		 * \param cap Number of entries reserved
+		 * \return Size of the TOC with cap entries, in bytes. The first Fragment starts this many bytes after the RawEventHeader.
+		 */
+	static constexpr size_t SizeBytes(uint32_t cap) { return sizeof(RawEventTOC) + cap * sizeof(RawEventTOCEntry); }
+
+	/**
+		 * \brief Whether this TOC is intact
+		 * \return True if the zero and magic words are set and no more entries are filled than reserved
+		 */
+	bool valid() const { return zero == 0 && magic == MAGIC && entry_count <= capacity; }
+
+	/**
+		 * \brief Get the entries following this TOC (a TOC is only meaningful in place, in the event buffer)
+		 * \return Pointer to the first entry
+		 */
+	RawEventTOCEntry* entries() { return reinterpret_cast<RawEventTOCEntry*>(this + 1); }  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+	/**
+		 * \brief Get the entries following this TOC (a TOC is only meaningful in place, in the event buffer)
+		 * \return Pointer to the first entry
+		 */
+	RawEventTOCEntry const* entries() const { return reinterpret_cast<RawEventTOCEntry const*>(this + 1); }  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+	/**
+		 * \brief Record a Fragment in the next free entry
+		 * \param offset Offset at which the Fragment is written, from the start of the buffer, in bytes
+		 * \param hdr Header of the Fragment
+		 * \return False if every reserved entry is already used. The Fragment can still be written, but readers will not see it.
+		 */
+	bool add(uint64_t offset, RawFragmentHeader const& hdr)
+	{
+		if (entry_count >= capacity)
+		{
+			return false;
+		}
+		entries()[entry_count] = RawEventTOCEntry{offset, static_cast<uint32_t>(hdr.word_count), static_cast<uint16_t>(hdr.fragment_id), static_cast<uint8_t>(hdr.type), 0};  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		++entry_count;
+		return true;
+	}
+};
+static_assert(sizeof(RawEventTOC) == 16 && sizeof(RawEventTOCEntry) == 16, "RawEventTOC layout is part of the shared memory event format");
 }  // namespace detail
 /**
 	 * \brief RawEvent is the artdaq view of a generic event, containing a header and zero or more Fragments.
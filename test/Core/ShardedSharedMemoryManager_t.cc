@@ -0,0 +1,208 @@
+#include <chrono>
+#include <set>
+#include <thread>
+#include <vector>
+#include "artdaq-core/Core/ShardedSharedMemoryManager.hh"
+#include "artdaq-core/Utilities/configureMessageFacility.hh"
+
+#define BOOST_TEST_MODULE ShardedSharedMemoryManager_t
+#include "cetlib/quiet_unit_test.hpp"
+#include "cetlib_except/exception.h"
+
+#define TRACE_NAME "ShardedSharedMemoryManager_t"
+#include "SharedMemoryTestShims.hh"
+#include "TRACE/tracemf.h"
+
+BOOST_AUTO_TEST_SUITE(ShardedSharedMemoryManager_test)
+
+BOOST_AUTO_TEST_CASE(Construct)
+{
+	artdaq::configureMessageFacility("ShardedSharedMemoryManager_t", true, true);
+	TLOG(TLVL_DEBUG) << "BEGIN TEST Construct";
+	uint32_t key = GetRandomKey(0x5A4D);
+	artdaq::ShardedSharedMemoryManager man(key, 4, 8, 0x1000);
+	BOOST_REQUIRE_EQUAL(man.IsValid(), true);
+	BOOST_REQUIRE_EQUAL(man.GetShardCount(), 4);
+	BOOST_REQUIRE_EQUAL(man.ShardSize(), 8);
+	BOOST_REQUIRE_EQUAL(man.size(), 32);
+	BOOST_REQUIRE_EQUAL(man.GetShard(2).GetKey(), key + 2 * artdaq::ShardedSharedMemoryManager::DefaultKeyStride);
+
+	artdaq::ShardedSharedMemoryManager man2(key, 4);
+	BOOST_REQUIRE_EQUAL(man2.IsValid(), true);
+	BOOST_REQUIRE_EQUAL(man2.size(), 32);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 32);
+	TLOG(TLVL_DEBUG) << "END TEST Construct";
+}
+
+BOOST_AUTO_TEST_CASE(RoundRobinAndSteal)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST RoundRobinAndSteal";
+	uint32_t key = GetRandomKey(0x5A4D);
+	artdaq::ShardedSharedMemoryManager man(key, 4, 2, 0x1000);
+	artdaq::ShardedSharedMemoryManager man2(key, 4);
+
+	// Round-robin writes use every shard, and keep going until every shard is full
+	std::set<size_t> shards;
+	for (int ii = 0; ii < 8; ++ii)
+	{
+		auto buf = man.GetBufferForWriting(false);
+		BOOST_REQUIRE(buf != -1);
+		shards.insert(man.ShardOf(buf));
+		man.Write(buf, &ii, sizeof(ii));
+		man.MarkBufferFull(buf);
+	}
+	BOOST_REQUIRE_EQUAL(shards.size(), 4);
+	BOOST_REQUIRE_EQUAL(man.GetBufferForWriting(false), -1);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 8);
+
+	// The reader drains its own shard, then steals from the others
+	std::set<int> values;
+	for (int ii = 0; ii < 8; ++ii)
+	{
+		BOOST_REQUIRE_EQUAL(man2.WaitForReadable(100000), true);
+		auto buf = man2.GetBufferForReading();
+		BOOST_REQUIRE(buf != -1);
+		int value = -1;
+		BOOST_REQUIRE_EQUAL(man2.Read(buf, &value, sizeof(value)), true);
+		values.insert(value);
+		man2.MarkBufferEmpty(buf);
+	}
+	BOOST_REQUIRE_EQUAL(values.size(), 8);
+	BOOST_REQUIRE_EQUAL(man2.ReadyForRead(), false);
+	BOOST_REQUIRE_EQUAL(man2.WaitForReadable(10000), false);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 8);
+	TLOG(TLVL_DEBUG) << "END TEST RoundRobinAndSteal";
+}
+
+BOOST_AUTO_TEST_CASE(KeyedOrdering)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST KeyedOrdering";
+	uint32_t key = GetRandomKey(0x5A4D);
+	artdaq::ShardedSharedMemoryManager man(key, 3, 8, 0x1000);
+	artdaq::ShardedSharedMemoryManager man2(key, 3);
+
+	// Everything written with one key goes to one shard, and is read back from it in order
+	size_t shard = 0;
+	for (int ii = 0; ii < 5; ++ii)
+	{
+		auto buf = man.GetBufferForWritingByKey(42, false);
+		BOOST_REQUIRE(buf != -1);
+		if (ii == 0) shard = man.ShardOf(buf);
+		BOOST_REQUIRE_EQUAL(man.ShardOf(buf), shard);
+		man.Write(buf, &ii, sizeof(ii));
+		man.MarkBufferFull(buf);
+	}
+	for (int ii = 0; ii < 5; ++ii)
+	{
+		auto buf = man2.GetBufferForReadingFromShard(shard);
+		BOOST_REQUIRE(buf != -1);
+		int value = -1;
+		man2.Read(buf, &value, sizeof(value));
+		BOOST_REQUIRE_EQUAL(value, ii);
+		man2.MarkBufferEmpty(buf);
+	}
+	BOOST_REQUIRE_EQUAL(man2.GetBufferForReadingFromShard(shard), -1);
+	BOOST_REQUIRE_THROW(man2.GetBufferForReadingFromShard(3), cet::exception);
+	BOOST_REQUIRE_THROW(man.Write(24, nullptr, 0), cet::exception);
+	TLOG(TLVL_DEBUG) << "END TEST KeyedOrdering";
+}
+
+BOOST_AUTO_TEST_CASE(KeyOverlap)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST KeyOverlap";
+	uint32_t key = GetRandomKey(0x5A4D);
+	artdaq::ShardedSharedMemoryManager man(key, 4, 2, 0x1000);
+	BOOST_REQUIRE_EQUAL(man.IsValid(), true);
+
+	// The queue of the neighbouring rank does not share any shard
+	artdaq::ShardedSharedMemoryManager neighbour(key + 1, 4, 2, 0x1000);
+	BOOST_REQUIRE_EQUAL(neighbour.IsValid(), true);
+	auto buf = man.GetBufferForWriting(false);
+	man.MarkBufferFull(buf);
+	BOOST_REQUIRE_EQUAL(neighbour.ReadReadyCount(), 0);
+	BOOST_REQUIRE_EQUAL(man.ReadReadyCount(), 1);
+
+	// A queue whose keys run into another queue's shards is refused, as is a different shard count for the same keys
+	artdaq::ShardedSharedMemoryManager overlapping(key + artdaq::ShardedSharedMemoryManager::DefaultKeyStride, 2);
+	BOOST_REQUIRE_EQUAL(overlapping.IsValid(), false);
+	artdaq::ShardedSharedMemoryManager fewer(key, 2);
+	BOOST_REQUIRE_EQUAL(fewer.IsValid(), false);
+	BOOST_REQUIRE_EQUAL(man.ReadReadyCount(), 1);
+
+	// Creating such a queue is refused too, rather than re-initializing the other queue's shards
+	artdaq::ShardedSharedMemoryManager overlapping_owner(key + artdaq::ShardedSharedMemoryManager::DefaultKeyStride, 2, 2, 0x1000);
+	BOOST_REQUIRE_EQUAL(overlapping_owner.IsValid(), false);
+	artdaq::ShardedSharedMemoryManager fewer_owner(key, 2, 2, 0x1000);
+	BOOST_REQUIRE_EQUAL(fewer_owner.IsValid(), false);
+	BOOST_REQUIRE_EQUAL(man.IsValid(), true);
+	BOOST_REQUIRE_EQUAL(man.ReadReadyCount(), 1);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 7);
+
+	// Explicit keys must be distinct
+	BOOST_REQUIRE_THROW(artdaq::ShardedSharedMemoryManager(std::vector<uint32_t>{key + 2, key + 2}, 2, 0x1000), cet::exception);
+	artdaq::ShardedSharedMemoryManager listed(artdaq::ShardedSharedMemoryManager::ShardKeys(key + 2, 3, 0x100), 2, 0x1000);
+	BOOST_REQUIRE_EQUAL(listed.IsValid(), true);
+	BOOST_REQUIRE_EQUAL(listed.GetShard(1).GetKey(), key + 0x102);
+
+	// Keys which wrap around past 32 bits, or land on 0 (IPC_PRIVATE), are refused
+	BOOST_REQUIRE_THROW(artdaq::ShardedSharedMemoryManager::ShardKeys(0xFFFFF000, 2, 0x1000), cet::exception);
+	BOOST_REQUIRE_THROW(artdaq::ShardedSharedMemoryManager::ShardKeys(0xFFFFF000, 3, 0x1000), cet::exception);
+	BOOST_REQUIRE_THROW(artdaq::ShardedSharedMemoryManager(0xFFFFF000, 2, 2, 0x1000), cet::exception);
+	BOOST_REQUIRE_THROW(artdaq::ShardedSharedMemoryManager(std::vector<uint32_t>{key + 2, 0}, 2, 0x1000), cet::exception);
+	BOOST_REQUIRE_EQUAL(artdaq::ShardedSharedMemoryManager::ShardKeys(0xFFFFE000, 2, 0x1000).back(), 0xFFFFF000);
+	TLOG(TLVL_DEBUG) << "END TEST KeyOverlap";
+}
+
+BOOST_AUTO_TEST_CASE(WaitAcrossShards)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST WaitAcrossShards";
+	uint32_t key = GetRandomKey(0x5A4D);
+	artdaq::ShardedSharedMemoryManager man(key, 4, 1, 0x1000);
+	artdaq::ShardedSharedMemoryManager man2(key, 4);
+
+	// A reader is woken by a buffer in any shard, not only its home shard
+	for (size_t shard = 0; shard < 4; ++shard)
+	{
+		// Boost.Test assertions are not thread-safe, so the reader's results are checked after joining
+		bool readable = false;
+		size_t waited_us = 0;
+		std::thread reader([&man2, &readable, &waited_us] {
+			auto start = std::chrono::steady_clock::now();
+			readable = man2.WaitForReadable(2000000);
+			waited_us = artdaq::TimeUtils::GetElapsedTimeMicroseconds(start);
+		});
+		usleep(20000);
+		auto buf = -1;
+		while (buf == -1 || man.ShardOf(buf) != shard)
+		{
+			if (buf != -1) man.MarkBufferEmpty(buf, true);
+			buf = man.GetBufferForWriting(false);
+		}
+		man.MarkBufferFull(buf);
+		reader.join();
+		BOOST_REQUIRE_EQUAL(readable, true);
+		BOOST_REQUIRE_LT(waited_us, 1000000);
+		BOOST_REQUIRE_EQUAL(man2.GetBufferForReading(), buf);
+		man2.MarkBufferEmpty(buf);
+	}
+
+	// A writer is woken when a buffer is released in any shard
+	std::vector<int> bufs;
+	for (int ii = 0; ii < 4; ++ii)
+	{
+		bufs.push_back(man.GetBufferForWriting(false));
+		man.MarkBufferFull(bufs.back());
+	}
+	BOOST_REQUIRE_EQUAL(man.WaitForWritable(0), false);
+	bool writable = false;
+	std::thread writer([&man, &writable] { writable = man.WaitForWritable(2000000); });
+	usleep(20000);
+	auto buf = man2.GetBufferForReadingFromShard(3);
+	BOOST_REQUIRE_EQUAL(man2.ShardOf(buf), 3);
+	man2.MarkBufferEmpty(buf);
+	writer.join();
+	BOOST_REQUIRE_EQUAL(writable, true);
+	TLOG(TLVL_DEBUG) << "END TEST WaitAcrossShards";
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,581 @@
+#define TRACE_NAME "SharedMemoryBenchmark"
+
+// Multi-process throughput and latency benchmark for the shared memory transport.
+//
+// For every combination of buffer count, buffer size and read mode, the parent process creates the shared memory
+// segment and forks N writer and M reader processes which attach to it. Writers stamp each buffer with the
+// CLOCK_MONOTONIC time just before marking it Full; readers record the time between that stamp and acquiring the
+// buffer (the handoff latency). With --fragments, SharedMemoryFragmentManager is used (destructive mode only) and the
+// stamp is the Fragment timestamp, set before WriteFragment, so the latency includes the copy into the buffer.
+// A JSON array with one object per configuration is printed on stdout.
+//
+// Usage: SharedMemoryBenchmark_t [--writers N] [--readers M] [--events E] [--counts c1,c2,...] [--sizes s1,s2,...]
+//                                [--modes destructive,broadcast] [--fragments] [--timeout seconds] [--buffer-timeout-ms ms] [--quick]
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "artdaq-core/Core/SharedMemoryFragmentManager.hh"
+#include "artdaq-core/Core/SharedMemoryManager.hh"
+#include "artdaq-core/Data/Fragment.hh"
+#include "artdaq-core/Utilities/configureMessageFacility.hh"
+#include "TRACE/tracemf.h"
+
+namespace {
+/**
+	 * \brief Benchmark parameters, from the command line
+	 */
+struct BenchmarkOptions
+{
+	int writers = 1;                                 ///< Number of writer processes
+	int readers = 1;                                 ///< Number of reader processes
+	size_t events = 10000;                           ///< Number of events written per configuration (by all writers together)
+	std::vector<size_t> counts = {4, 16, 64};        ///< Buffer counts to sweep
+	std::vector<size_t> sizes = {0x1000, 0x100000};  ///< Buffer sizes to sweep, in bytes
+	std::vector<bool> broadcast = {false, true};     ///< Read modes to sweep (true for broadcast)
+	bool fragments = false;                          ///< Use SharedMemoryFragmentManager instead of SharedMemoryManager
+	size_t timeout_s = 60;                           ///< Time limit for each configuration
+	size_t buffer_timeout_ms = 1000;                 ///< Buffer timeout of the segment; broadcast buffers which a reader skipped expire after it
+};
+
+/**
+	 * \brief Process-shared state for one configuration, placed at the start of an anonymous shared mapping.
+	 * For each reader, its event count and then its latency samples (events + 1 entries) follow it.
+	 */
+struct BenchmarkControl
+{
+	std::atomic<int> ready;          ///< Number of children which have attached to the segment
+	std::atomic<bool> go;            ///< Set by the parent once every child is ready
+	std::atomic<bool> abort;         ///< Set by the parent when the time limit is reached
+	std::atomic<int> failures;       ///< Number of children which could not attach or gave up
+	std::atomic<uint64_t> start_ns;  ///< Time at which the parent set go
+	std::atomic<uint64_t> end_ns;    ///< Time at which the last reader finished
+	std::atomic<size_t> consumed;    ///< Number of events read by all readers (destructive mode)
+	std::atomic<int> writers_done;   ///< Number of writers which have written their share
+};
+
+uint64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::vector<size_t> parse_list(std::string const& arg)
+{
+	std::vector<size_t> out;
+	std::istringstream ss(arg);
+	std::string item;
+	while (std::getline(ss, item, ','))
+	{
+		out.push_back(std::stoul(item, nullptr, 0));
+	}
+	return out;
+}
+
+void usage(char const* name)
+{
+	std::cerr << "Usage: " << name << " [--writers N] [--readers M] [--events E] [--counts c1,c2,...] [--sizes s1,s2,...]" << std::endl
+	          << "       [--modes destructive,broadcast] [--fragments] [--timeout seconds] [--buffer-timeout-ms ms] [--quick]" << std::endl;
+}
+
+/**
+	 * \brief Per-configuration results, as seen by the parent
+	 */
+struct BenchmarkResult
+{
+	bool ok = false;
+	double elapsed_s = 0.0;
+	size_t expected = 0;
+	size_t delivered = 0;
+	size_t lost = 0;
+	std::vector<uint64_t> latencies_ns;
+};
+
+class Benchmark
+{
+public:
+	Benchmark(BenchmarkOptions opts, size_t count, size_t size, bool broadcast)
+	    : opts_(std::move(opts)), count_(count), size_(size), broadcast_(broadcast), ctrl_(nullptr), mapping_size_(0)
+	{
+		std::mt19937 rng(now_ns());
+		key_ = 0xBE000000 + ((getpid() & 0xFFF) << 12) + (rng() & 0xFFF);
+	}
+
+	BenchmarkResult Run();
+
+private:
+	uint64_t* samples_(int reader) const
+	{
+		auto samples_start = reinterpret_cast<uint8_t*>(ctrl_) + sizeof(BenchmarkControl);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		return reinterpret_cast<uint64_t*>(samples_start) + reader * (opts_.events + 1);      // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+
+	size_t writerShare_(int writer) const
+	{
+		return opts_.events / opts_.writers + (static_cast<size_t>(writer) < opts_.events % opts_.writers ? 1 : 0);
+	}
+
+	bool readerDone_(size_t seen) const
+	{
+		return broadcast_ ? seen >= opts_.events : ctrl_->consumed.load() >= opts_.events;
+	}
+
+	// A reader which missed events (e.g. broadcast buffers which expired before it read them) would wait for them until
+	// the time limit, so it also stops once the writers are finished and nothing is left to read. The missing events are
+	// reported as lost.
+	bool readerDrained_() const
+	{
+		return ctrl_->writers_done.load() == opts_.writers;
+	}
+
+	void waitForGo_()
+	{
+		ctrl_->ready.fetch_add(1);
+		while (!ctrl_->go && !ctrl_->abort)
+		{
+			usleep(100);
+		}
+	}
+
+	int writeBuffers_(int writer);
+	int readBuffers_(int reader);
+	int writeFragments_(int writer);
+	int readFragments_(int reader);
+	void recordLatency_(int reader, size_t& seen, uint64_t stamp);
+
+	BenchmarkOptions opts_;
+	size_t count_;
+	size_t size_;
+	bool broadcast_;
+	uint32_t key_;
+	BenchmarkControl* ctrl_;
+	size_t mapping_size_;
+};
+
+void Benchmark::recordLatency_(int reader, size_t& seen, uint64_t stamp)
+{
+	auto now = now_ns();
+	if (seen < opts_.events)
+	{
+		samples_(reader)[seen + 1] = now > stamp ? now - stamp : 0;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+	++seen;
+	samples_(reader)[0] = seen;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	if (!broadcast_)
+	{
+		ctrl_->consumed.fetch_add(1);
+	}
+	// Every reader stores its finishing time; the parent uses the latest
+	uint64_t end = ctrl_->end_ns.load();
+	while (end < now && !ctrl_->end_ns.compare_exchange_weak(end, now))
+	{
+	}
+}
+
+int Benchmark::writeBuffers_(int writer)
+{
+	artdaq::SharedMemoryManager man(key_);
+	if (!man.IsValid())
+	{
+		return 1;
+	}
+	std::vector<uint8_t> payload(size_, static_cast<uint8_t>(writer));
+	waitForGo_();
+
+	for (size_t ii = 0; ii < writerShare_(writer) && !ctrl_->abort;)
+	{
+		if (!man.WaitForWritable(100000))
+		{
+			continue;
+		}
+		auto buf = man.GetBufferForWriting(false);
+		if (buf == -1)
+		{
+			continue;
+		}
+		man.Write(buf, payload.data(), payload.size());
+		auto stamp = now_ns();
+		memcpy(man.GetBufferStart(buf), &stamp, sizeof(stamp));
+		man.MarkBufferFull(buf);
+		++ii;
+	}
+	ctrl_->writers_done.fetch_add(1);
+	return ctrl_->abort ? 1 : 0;
+}
+
+int Benchmark::readBuffers_(int reader)
+{
+	artdaq::SharedMemoryManager man(key_);
+	if (!man.IsValid())
+	{
+		return 1;
+	}
+	std::vector<uint8_t> scratch(size_);
+	size_t seen = 0;
+	// Broadcast readers register their cursor on their first read-side call; until then, buffers are not kept for them
+	man.ReadyForRead();
+	waitForGo_();
+
+	while (!readerDone_(seen) && !ctrl_->abort)
+	{
+		if (!man.WaitForReadable(10000))
+		{
+			if (readerDrained_())
+			{
+				break;
+			}
+			continue;
+		}
+		auto buf = man.GetBufferForReading();
+		if (buf == -1)
+		{
+			continue;
+		}
+		uint64_t stamp;
+		memcpy(&stamp, man.GetBufferStart(buf), sizeof(stamp));
+		recordLatency_(reader, seen, stamp);
+		man.Read(buf, scratch.data(), std::min(scratch.size(), man.BufferDataSize(buf)));
+		man.MarkBufferEmpty(buf);
+	}
+	return ctrl_->abort ? 1 : 0;
+}
+
+int Benchmark::writeFragments_(int writer)
+{
+	artdaq::SharedMemoryFragmentManager man(key_);
+	if (!man.IsValid())
+	{
+		return 1;
+	}
+	auto payload_bytes = size_ - artdaq::detail::RawFragmentHeader::num_words() * sizeof(artdaq::RawDataType);
+	waitForGo_();
+
+	for (size_t ii = 0; ii < writerShare_(writer) && !ctrl_->abort; ++ii)
+	{
+		auto frag = artdaq::Fragment::FragmentBytes(payload_bytes);
+		frag->setSequenceID(ii * opts_.writers + writer + 1);
+		frag->setFragmentID(writer);
+		frag->setTimestamp(now_ns());
+		if (man.WriteFragment(std::move(*frag), false, 0) != 0)
+		{
+			return 1;
+		}
+	}
+	ctrl_->writers_done.fetch_add(1);
+	return ctrl_->abort ? 1 : 0;
+}
+
+int Benchmark::readFragments_(int reader)
+{
+	artdaq::SharedMemoryFragmentManager man(key_);
+	if (!man.IsValid())
+	{
+		return 1;
+	}
+	std::vector<artdaq::RawDataType> scratch(size_ / sizeof(artdaq::RawDataType));
+	size_t seen = 0;
+	waitForGo_();
+
+	while (!readerDone_(seen) && !ctrl_->abort)
+	{
+		if (!man.WaitForReadable(10000))
+		{
+			if (readerDrained_())
+			{
+				break;
+			}
+			continue;
+		}
+		artdaq::detail::RawFragmentHeader hdr;
+		if (man.ReadFragmentHeader(hdr) != 0)
+		{
+			continue;
+		}
+		recordLatency_(reader, seen, hdr.timestamp);
+		man.ReadFragmentData(scratch.data(), hdr.word_count - hdr.num_words());
+	}
+	return ctrl_->abort ? 1 : 0;
+}
+
+BenchmarkResult Benchmark::Run()
+{
+	BenchmarkResult result;
+	mapping_size_ = sizeof(BenchmarkControl) + opts_.readers * (opts_.events + 1) * sizeof(uint64_t);
+	auto mapping = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED)
+	{
+		TLOG(TLVL_ERROR) << "Could not map the benchmark control area: " << strerror(errno);
+		return result;
+	}
+	ctrl_ = new (mapping) BenchmarkControl();
+	memset(samples_(0), 0, opts_.readers * (opts_.events + 1) * sizeof(uint64_t));
+
+	std::unique_ptr<artdaq::SharedMemoryManager> owner;
+	if (opts_.fragments)
+	{
+		owner = std::make_unique<artdaq::SharedMemoryFragmentManager>(key_, count_, size_, opts_.buffer_timeout_ms * 1000);
+	}
+	else
+	{
+		owner = std::make_unique<artdaq::SharedMemoryManager>(key_, count_, size_, opts_.buffer_timeout_ms * 1000, !broadcast_);
+	}
+	if (!owner->IsValid())
+	{
+		TLOG(TLVL_ERROR) << "Could not create the shared memory segment 0x" << std::hex << key_;
+		munmap(mapping, mapping_size_);
+		return result;
+	}
+
+	// Children must not run the destructors of the parent's objects (the owner would remove the segment), so they
+	// leave with _exit
+	std::vector<pid_t> children;
+	for (int ii = 0; ii < opts_.writers + opts_.readers; ++ii)
+	{
+		auto pid = fork();
+		if (pid == 0)
+		{
+			int sts = 1;
+			try
+			{
+				if (ii < opts_.writers)
+				{
+					sts = opts_.fragments ? writeFragments_(ii) : writeBuffers_(ii);
+				}
+				else
+				{
+					sts = opts_.fragments ? readFragments_(ii - opts_.writers) : readBuffers_(ii - opts_.writers);
+				}
+			}
+			catch (...)
+			{
+				sts = 1;
+			}
+			if (sts != 0)
+			{
+				ctrl_->failures.fetch_add(1);
+				ctrl_->ready.fetch_add(1);
+			}
+			_exit(sts);
+		}
+		if (pid < 0)
+		{
+			TLOG(TLVL_ERROR) << "fork failed: " << strerror(errno);
+			ctrl_->abort = true;
+			break;
+		}
+		children.push_back(pid);
+	}
+
+	auto deadline = now_ns() + opts_.timeout_s * 1000000000ULL;
+	while (ctrl_->ready < static_cast<int>(children.size()) && now_ns() < deadline && !ctrl_->abort)
+	{
+		usleep(1000);
+	}
+	ctrl_->start_ns = now_ns();
+	ctrl_->go = true;
+
+	size_t running = children.size();
+	while (running > 0)
+	{
+		int status = 0;
+		auto pid = waitpid(-1, &status, WNOHANG);
+		if (pid > 0)
+		{
+			--running;
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			{
+				ctrl_->abort = true;
+			}
+			continue;
+		}
+		if (now_ns() > deadline && !ctrl_->abort)
+		{
+			TLOG(TLVL_WARNING) << "Configuration did not finish within " << opts_.timeout_s << " s, stopping it";
+			ctrl_->abort = true;
+		}
+		if (now_ns() > deadline + 5000000000ULL)
+		{
+			for (auto child : children)
+			{
+				kill(child, SIGKILL);
+			}
+		}
+		usleep(1000);
+	}
+
+	result.elapsed_s = ctrl_->end_ns > ctrl_->start_ns ? (ctrl_->end_ns - ctrl_->start_ns) / 1e9 : 0.0;
+	for (int rr = 0; rr < opts_.readers; ++rr)
+	{
+		auto samples = samples_(rr);
+		auto seen = std::min(static_cast<size_t>(samples[0]), opts_.events);
+		result.delivered += samples[0];
+		result.latencies_ns.insert(result.latencies_ns.end(), samples + 1, samples + 1 + seen);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+	// Every broadcast reader sees every event; destructive readers share them
+	result.expected = broadcast_ ? opts_.readers * opts_.events : opts_.events;
+	result.lost = result.expected > result.delivered ? result.expected - result.delivered : 0;
+	result.ok = !ctrl_->abort && ctrl_->failures == 0 && result.delivered == result.expected;
+
+	owner.reset();
+	munmap(mapping, mapping_size_);
+	ctrl_ = nullptr;
+	return result;
+}
+
+double percentile_us(std::vector<uint64_t> const& sorted, double fraction)
+{
+	if (sorted.empty())
+	{
+		return 0.0;
+	}
+	auto index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(index, sorted.size() - 1)] / 1000.0;
+}
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+	BenchmarkOptions opts;
+	try
+	{
+		for (int ii = 1; ii < argc; ++ii)
+		{
+			std::string arg = argv[ii];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			auto next = [&]() -> std::string {
+				if (ii + 1 >= argc)
+				{
+					throw std::invalid_argument(arg + " requires a value");
+				}
+				return argv[++ii];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			};
+			if (arg == "--writers")
+			{
+				opts.writers = std::stoi(next());
+			}
+			else if (arg == "--readers")
+			{
+				opts.readers = std::stoi(next());
+			}
+			else if (arg == "--events")
+			{
+				opts.events = std::stoul(next());
+			}
+			else if (arg == "--counts")
+			{
+				opts.counts = parse_list(next());
+			}
+			else if (arg == "--sizes")
+			{
+				opts.sizes = parse_list(next());
+			}
+			else if (arg == "--timeout")
+			{
+				opts.timeout_s = std::stoul(next());
+			}
+			else if (arg == "--buffer-timeout-ms")
+			{
+				opts.buffer_timeout_ms = std::stoul(next());
+			}
+			else if (arg == "--fragments")
+			{
+				opts.fragments = true;
+			}
+			else if (arg == "--modes")
+			{
+				opts.broadcast.clear();
+				std::istringstream ss(next());
+				std::string mode;
+				while (std::getline(ss, mode, ','))
+				{
+					if (mode != "destructive" && mode != "broadcast")
+					{
+						throw std::invalid_argument("unknown mode " + mode);
+					}
+					opts.broadcast.push_back(mode == "broadcast");
+				}
+			}
+			else if (arg == "--quick")
+			{
+				opts.events = 500;
+				opts.counts = {4};
+				opts.sizes = {0x1000};
+				opts.timeout_s = 30;
+			}
+			else
+			{
+				throw std::invalid_argument("unknown option " + arg);
+			}
+		}
+	}
+	catch (std::exception const& e)
+	{
+		std::cerr << e.what() << std::endl;
+		usage(argv[0]);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		return 2;
+	}
+	if (opts.writers < 1 || opts.readers < 1 || opts.events == 0)
+	{
+		usage(argv[0]);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		return 2;
+	}
+
+	artdaq::configureMessageFacility("SharedMemoryBenchmark", false, false);
+
+	int failed = 0;
+	std::cout << "[" << std::endl;
+	bool first = true;
+	for (auto broadcast : opts.broadcast)
+	{
+		// SharedMemoryFragmentManager reads are always destructive
+		if (broadcast && opts.fragments)
+		{
+			TLOG(TLVL_INFO) << "Skipping broadcast mode: SharedMemoryFragmentManager only supports destructive reads";
+			continue;
+		}
+		for (auto count : opts.counts)
+		{
+			for (auto size : opts.sizes)
+			{
+				if (size < sizeof(artdaq::detail::RawFragmentHeader) + sizeof(uint64_t))
+				{
+					TLOG(TLVL_WARNING) << "Skipping buffer size " << size << ": too small to hold a timestamp";
+					continue;
+				}
+				Benchmark bench(opts, count, size, broadcast);
+				auto result = bench.Run();
+				if (!result.ok)
+				{
+					++failed;
+				}
+				std::sort(result.latencies_ns.begin(), result.latencies_ns.end());
+				auto rate = result.elapsed_s > 0 ? result.delivered / result.elapsed_s : 0.0;
+
+				std::cout << (first ? "" : ",\n") << "  {\"manager\": \"" << (opts.fragments ? "SharedMemoryFragmentManager" : "SharedMemoryManager")
+				          << "\", \"mode\": \"" << (broadcast ? "broadcast" : "destructive") << "\", \"writers\": " << opts.writers
+				          << ", \"readers\": " << opts.readers << ", \"buffer_count\": " << count << ", \"buffer_size\": " << size
+				          << ", \"events\": " << opts.events << ", \"expected\": " << result.expected << ", \"delivered\": " << result.delivered
+				          << ", \"lost\": " << result.lost << ", \"elapsed_s\": " << result.elapsed_s
+				          << ", \"events_per_s\": " << rate << ", \"gb_per_s\": " << rate * size / 1e9
+				          << ", \"latency_us\": {\"p50\": " << percentile_us(result.latencies_ns, 0.5)
+				          << ", \"p99\": " << percentile_us(result.latencies_ns, 0.99) << ", \"p999\": " << percentile_us(result.latencies_ns, 0.999)
+				          << ", \"max\": " << (result.latencies_ns.empty() ? 0.0 : result.latencies_ns.back() / 1000.0)
+				          << "}, \"ok\": " << (result.ok ? "true" : "false") << "}";
+				first = false;
+			}
+		}
+	}
+	std::cout << "\n]" << std::endl;
+	return failed == 0 ? 0 : 1;
+}
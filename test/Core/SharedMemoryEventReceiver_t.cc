@@ -0,0 +1,351 @@
+#define TRACE_NAME "SharedMemoryEventReceiver_t"
+
+#include <atomic>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "artdaq-core/Core/SharedMemoryEventReceiver.hh"
+#include "artdaq-core/Core/SharedMemoryManager.hh"
+#include "artdaq-core/Data/Fragment.hh"
+#include "artdaq-core/Data/RawEvent.hh"
+#include "artdaq-core/Utilities/configureMessageFacility.hh"
+#include "TRACE/tracemf.h"
+
+#define BOOST_TEST_MODULE(SharedMemoryEventReceiver_t)
+#include "SharedMemoryTestShims.hh"
+#include "cetlib/quiet_unit_test.hpp"
+
+namespace {
+artdaq::FragmentPtr MakeFragment(artdaq::Fragment::sequence_id_t seq, artdaq::Fragment::fragment_id_t id, artdaq::Fragment::type_t type, size_t words)
+{
+	auto frag = std::make_unique<artdaq::Fragment>(words);
+	frag->setSequenceID(seq);
+	frag->setFragmentID(id);
+	frag->setSystemType(type);
+	for (size_t ii = 0; ii < words; ++ii)
+	{
+		*(frag->dataBegin() + ii) = (static_cast<artdaq::RawDataType>(id) << 32) + ii;
+	}
+	return frag;
+}
+
+// Write an event in the layout used by SharedMemoryEventManager: a RawEventHeader followed by complete Fragments
+void WriteEvent(artdaq::SharedMemoryManager& writer, artdaq::Fragment::sequence_id_t seq, std::vector<artdaq::FragmentPtr> const& frags)
+{
+	auto buf = writer.GetBufferForWriting(false);
+	BOOST_REQUIRE_NE(buf, -1);
+	artdaq::detail::RawEventHeader hdr(1, 1, seq, seq, seq);
+	std::vector<artdaq::SharedMemoryManager::WriteSegment> segments{{&hdr, sizeof(hdr)}};
+	for (auto& frag : frags)
+	{
+		segments.push_back({frag->headerAddress(), frag->sizeBytes()});
+	}
+	writer.WriteV(buf, segments);
+	writer.MarkBufferFull(buf);
+}
+
+// Write an event with a table of contents reserving toc_capacity entries between the RawEventHeader and the Fragments
+void WriteEventWithTOC(artdaq::SharedMemoryManager& writer, artdaq::Fragment::sequence_id_t seq, std::vector<artdaq::FragmentPtr> const& frags, uint32_t toc_capacity)
+{
+	auto buf = writer.GetBufferForWriting(false);
+	BOOST_REQUIRE_NE(buf, -1);
+	artdaq::detail::RawEventHeader hdr(1, 1, seq, seq, seq);
+	writer.Write(buf, &hdr, sizeof(hdr));
+	artdaq::detail::RawEventTOC toc(toc_capacity);
+	writer.Write(buf, &toc, sizeof(toc));
+	std::vector<artdaq::detail::RawEventTOCEntry> entries(toc_capacity);
+	writer.Write(buf, entries.data(), entries.size() * sizeof(artdaq::detail::RawEventTOCEntry));
+
+	auto tocInBuffer = reinterpret_cast<artdaq::detail::RawEventTOC*>(static_cast<uint8_t*>(writer.GetBufferStart(buf)) + sizeof(hdr));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	for (auto& frag : frags)
+	{
+		BOOST_REQUIRE(tocInBuffer->add(writer.BufferDataSize(buf), *reinterpret_cast<artdaq::detail::RawFragmentHeader const*>(frag->headerAddress())));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		writer.Write(buf, frag->headerAddress(), frag->sizeBytes());
+	}
+	writer.MarkBufferFull(buf);
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(SharedMemoryEventReceiver_test)
+
+BOOST_AUTO_TEST_CASE(FragmentViews)
+{
+	artdaq::configureMessageFacility("SharedMemoryEventReceiver_t", true, true);
+	TLOG(TLVL_INFO) << "BEGIN TEST FragmentViews";
+	uint32_t key = GetRandomKey(0xE7E7);
+	uint32_t broadcast_key = GetRandomKey(0xB7B7);
+	artdaq::SharedMemoryManager writer(key, 4, 0x10000);
+	artdaq::SharedMemoryManager broadcasts(broadcast_key, 4, 0x1000);
+	artdaq::SharedMemoryEventReceiver receiver(key, broadcast_key);
+
+	std::vector<artdaq::FragmentPtr> frags;
+	frags.push_back(MakeFragment(1, 0, artdaq::Fragment::DataFragmentType, 0x10));
+	frags.push_back(MakeFragment(1, 1, artdaq::Fragment::EmptyFragmentType, 0x20));
+	frags.push_back(MakeFragment(1, 2, artdaq::Fragment::DataFragmentType, 0x30));
+	WriteEvent(writer, 1, frags);
+
+	BOOST_REQUIRE_EQUAL(receiver.ReadyForRead(false, 1000000), true);
+	bool err = false;
+	auto hdr = receiver.ReadHeader(err);
+	BOOST_REQUIRE_EQUAL(err, false);
+	BOOST_REQUIRE_EQUAL(hdr->sequence_id, 1);
+
+	auto views = receiver.GetFragmentViewsByType(err, artdaq::Fragment::DataFragmentType);
+	BOOST_REQUIRE_EQUAL(err, false);
+	BOOST_REQUIRE_EQUAL(views.size(), 2);
+	BOOST_REQUIRE_EQUAL(views[0].header->fragment_id, 0);
+	BOOST_REQUIRE_EQUAL(views[1].header->fragment_id, 2);
+	BOOST_REQUIRE_EQUAL(views[1].payload.size, 0x30);
+	BOOST_REQUIRE_EQUAL(views[1].sizeBytes(), frags[2]->sizeBytes());
+	BOOST_REQUIRE_EQUAL(*(views[1].payload.begin() + 5), (2ull << 32) + 5);
+
+	// Views and copies see the same data
+	auto all = receiver.GetFragmentViewsByType(err, artdaq::Fragment::InvalidFragmentType);
+	auto copies = receiver.GetFragmentsByType(err, artdaq::Fragment::InvalidFragmentType);
+	BOOST_REQUIRE_EQUAL(all.size(), 3);
+	BOOST_REQUIRE_EQUAL(copies->size(), 3);
+	for (size_t ii = 0; ii < all.size(); ++ii)
+	{
+		BOOST_REQUIRE_EQUAL(all[ii].header->type, copies->at(ii).type());
+		BOOST_REQUIRE(std::equal(all[ii].payload.begin(), all[ii].payload.end(), copies->at(ii).dataBegin()));
+	}
+
+	receiver.ReleaseBuffer();
+	BOOST_REQUIRE_EQUAL(writer.WriteReadyCount(false), 4);
+	TLOG(TLVL_INFO) << "END TEST FragmentViews";
+}
+
+BOOST_AUTO_TEST_CASE(GroupedByType)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST GroupedByType";
+	uint32_t key = GetRandomKey(0xE7E7);
+	uint32_t broadcast_key = GetRandomKey(0xB7B7);
+	artdaq::SharedMemoryManager writer(key, 4, 0x10000);
+	artdaq::SharedMemoryManager broadcasts(broadcast_key, 4, 0x1000);
+	artdaq::SharedMemoryEventReceiver receiver(key, broadcast_key);
+
+	std::vector<artdaq::FragmentPtr> frags;
+	for (artdaq::Fragment::fragment_id_t id = 0; id < 6; ++id)
+	{
+		frags.push_back(MakeFragment(2, id, id % 3 == 0 ? artdaq::Fragment::EmptyFragmentType : artdaq::Fragment::DataFragmentType, 0x8 + id));
+	}
+	WriteEvent(writer, 2, frags);
+
+	BOOST_REQUIRE_EQUAL(receiver.ReadyForRead(false, 1000000), true);
+	bool err = false;
+	receiver.ReadHeader(err);
+	auto grouped = receiver.GetFragmentsGroupedByType(err);
+	BOOST_REQUIRE_EQUAL(err, false);
+	BOOST_REQUIRE_EQUAL(grouped.size(), 2);
+	BOOST_REQUIRE_EQUAL(grouped.count(artdaq::Fragment::EmptyFragmentType), 1);
+	BOOST_REQUIRE_EQUAL(grouped.count(artdaq::Fragment::DataFragmentType), 1);
+
+	for (auto& group : grouped)
+	{
+		auto by_type = receiver.GetFragmentsByType(err, group.first);
+		BOOST_REQUIRE_EQUAL(group.second->size(), by_type->size());
+		for (size_t ii = 0; ii < by_type->size(); ++ii)
+		{
+			BOOST_REQUIRE_EQUAL(group.second->at(ii).fragmentID(), by_type->at(ii).fragmentID());
+			BOOST_REQUIRE_EQUAL(group.second->at(ii).size(), by_type->at(ii).size());
+			BOOST_REQUIRE(std::equal(group.second->at(ii).dataBegin(), group.second->at(ii).dataEnd(), by_type->at(ii).dataBegin()));
+		}
+	}
+	BOOST_REQUIRE_EQUAL(grouped[artdaq::Fragment::EmptyFragmentType]->size(), 2);
+	BOOST_REQUIRE_EQUAL(grouped[artdaq::Fragment::DataFragmentType]->size(), 4);
+
+	receiver.ReleaseBuffer();
+	TLOG(TLVL_INFO) << "END TEST GroupedByType";
+}
+
+BOOST_AUTO_TEST_CASE(TableOfContents)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST TableOfContents";
+	uint32_t key = GetRandomKey(0xE7E7);
+	uint32_t broadcast_key = GetRandomKey(0xB7B7);
+	artdaq::SharedMemoryManager writer(key, 4, 0x10000);
+	artdaq::SharedMemoryManager broadcasts(broadcast_key, 4, 0x1000);
+	artdaq::SharedMemoryEventReceiver receiver(key, broadcast_key);
+
+	std::vector<artdaq::FragmentPtr> frags;
+	for (artdaq::Fragment::fragment_id_t id = 0; id < 5; ++id)
+	{
+		frags.push_back(MakeFragment(3, id, id == 2 ? artdaq::Fragment::EmptyFragmentType : artdaq::Fragment::DataFragmentType, 0x10 + id));
+	}
+	// Reserve more entries than used, as a writer which does not know the final Fragment count would
+	WriteEventWithTOC(writer, 3, frags, 8);
+	WriteEvent(writer, 4, frags);
+
+	for (artdaq::Fragment::sequence_id_t seq = 3; seq <= 4; ++seq)
+	{
+		BOOST_REQUIRE_EQUAL(receiver.ReadyForRead(false, 1000000), true);
+		bool err = false;
+		auto hdr = receiver.ReadHeader(err);
+		BOOST_REQUIRE_EQUAL(hdr->sequence_id, seq);
+
+		auto types = receiver.GetFragmentTypes(err);
+		BOOST_REQUIRE_EQUAL(err, false);
+		BOOST_REQUIRE_EQUAL(types.size(), 2);
+		BOOST_REQUIRE_EQUAL(types.count(artdaq::Fragment::EmptyFragmentType), 1);
+
+		auto views = receiver.GetFragmentViewsByType(err, artdaq::Fragment::DataFragmentType);
+		BOOST_REQUIRE_EQUAL(err, false);
+		BOOST_REQUIRE_EQUAL(views.size(), 4);
+		BOOST_REQUIRE_EQUAL(views[2].header->fragment_id, 3);
+		BOOST_REQUIRE_EQUAL(views[2].payload.size, 0x13);
+		BOOST_REQUIRE_EQUAL(*(views[2].payload.begin() + 5), (3ull << 32) + 5);
+
+		auto empties = receiver.GetFragmentsByType(err, artdaq::Fragment::EmptyFragmentType);
+		BOOST_REQUIRE_EQUAL(err, false);
+		BOOST_REQUIRE_EQUAL(empties->size(), 1);
+		BOOST_REQUIRE_EQUAL(empties->front().fragmentID(), 2);
+		BOOST_REQUIRE(std::equal(empties->front().dataBegin(), empties->front().dataEnd(), frags[2]->dataBegin()));
+
+		auto grouped = receiver.GetFragmentsGroupedByType(err);
+		BOOST_REQUIRE_EQUAL(err, false);
+		BOOST_REQUIRE_EQUAL(grouped[artdaq::Fragment::DataFragmentType]->size(), 4);
+		receiver.ReleaseBuffer();
+	}
+	TLOG(TLVL_INFO) << "END TEST TableOfContents";
+}
+
+BOOST_AUTO_TEST_CASE(ReadAhead)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST ReadAhead";
+	uint32_t key = GetRandomKey(0xE7E7);
+	uint32_t broadcast_key = GetRandomKey(0xB7B7);
+	artdaq::SharedMemoryManager writer(key, 4, 0x10000);
+	artdaq::SharedMemoryManager broadcasts(broadcast_key, 4, 0x1000);
+	auto receiver = std::make_unique<artdaq::SharedMemoryEventReceiver>(key, broadcast_key);
+	receiver->SetPrefetch(true);
+
+	for (artdaq::Fragment::sequence_id_t seq = 1; seq <= 3; ++seq)
+	{
+		std::vector<artdaq::FragmentPtr> frags;
+		frags.push_back(MakeFragment(seq, 0, artdaq::Fragment::DataFragmentType, 0x10));
+		WriteEventWithTOC(writer, seq, frags, 1);
+	}
+
+	// Reading the first event reserves the second
+	BOOST_REQUIRE_EQUAL(receiver->ReadyForRead(false, 1000000), true);
+	bool err = false;
+	BOOST_REQUIRE_EQUAL(receiver->ReadHeader(err)->sequence_id, 1);
+	BOOST_REQUIRE_EQUAL(writer.ReadReadyCount(), 1);
+	BOOST_REQUIRE_EQUAL(receiver->ReadReadyCount(), 2);
+	receiver->ReleaseBuffer();
+
+	// A broadcast is still delivered before the event read ahead
+	std::vector<artdaq::FragmentPtr> init;
+	init.push_back(MakeFragment(0, 0, artdaq::Fragment::DataFragmentType, 0x4));
+	WriteEvent(broadcasts, 0, init);
+	BOOST_REQUIRE_EQUAL(receiver->ReadyForRead(false, 1000000), true);
+	BOOST_REQUIRE_EQUAL(receiver->ReadHeader(err)->sequence_id, 0);
+	receiver->ReleaseBuffer();
+
+	BOOST_REQUIRE_EQUAL(receiver->ReadyForRead(false, 1000000), true);
+	BOOST_REQUIRE_EQUAL(receiver->ReadHeader(err)->sequence_id, 2);
+	auto frags = receiver->GetFragmentsByType(err, artdaq::Fragment::DataFragmentType);
+	BOOST_REQUIRE_EQUAL(err, false);
+	BOOST_REQUIRE_EQUAL(frags->size(), 1);
+	BOOST_REQUIRE_EQUAL(writer.ReadReadyCount(), 0);
+	receiver->ReleaseBuffer();
+
+	// The buffer read ahead is given back unread when the receiver goes away
+	receiver.reset();
+	BOOST_REQUIRE_EQUAL(writer.ReadReadyCount(), 1);
+	artdaq::SharedMemoryEventReceiver receiver2(key, broadcast_key);
+	BOOST_REQUIRE_EQUAL(receiver2.ReadyForRead(false, 1000000), true);
+	BOOST_REQUIRE_EQUAL(receiver2.ReadHeader(err)->sequence_id, 3);
+	receiver2.ReleaseBuffer();
+	BOOST_REQUIRE_EQUAL(writer.WriteReadyCount(false), 4);
+	TLOG(TLVL_INFO) << "END TEST ReadAhead";
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentHandles)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST ConcurrentHandles";
+	uint32_t key = GetRandomKey(0xE7E7);
+	uint32_t broadcast_key = GetRandomKey(0xB7B7);
+	artdaq::SharedMemoryManager writer(key, 8, 0x10000);
+	artdaq::SharedMemoryManager broadcasts(broadcast_key, 4, 0x1000);
+	artdaq::SharedMemoryEventReceiver receiver(key, broadcast_key);
+
+	const size_t nEvents = 32;
+	const size_t nThreads = 4;
+	std::vector<std::vector<artdaq::Fragment::sequence_id_t>> seen(nThreads);
+	std::atomic<int> errors(0);
+	std::vector<std::thread> threads;
+	for (size_t tt = 0; tt < nThreads; ++tt)
+	{
+		threads.emplace_back([&, tt]() {
+			while (seen[tt].size() < nEvents / nThreads)
+			{
+				auto event = receiver.AcquireEvent(false, 1000000);
+				if (!event.IsValid())
+				{
+					continue;
+				}
+				// Boost.Test assertions are not thread-safe; record failures and check them after joining
+				bool err = false;
+				auto frags = event.GetFragmentsByType(err, artdaq::Fragment::DataFragmentType);
+				if (err || frags->size() != 1 || frags->front().sequenceID() != event.Header()->sequence_id)
+				{
+					errors++;
+				}
+				seen[tt].push_back(event.Header()->sequence_id);
+			}
+		});
+	}
+
+	for (artdaq::Fragment::sequence_id_t seq = 1; seq <= nEvents; ++seq)
+	{
+		while (!writer.ReadyForWrite(false))
+		{
+			writer.WaitForWritable(100000);
+		}
+		std::vector<artdaq::FragmentPtr> frags;
+		frags.push_back(MakeFragment(seq, 0, artdaq::Fragment::DataFragmentType, 0x10));
+		WriteEvent(writer, seq, frags);
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	BOOST_REQUIRE_EQUAL(errors.load(), 0);
+
+	std::set<artdaq::Fragment::sequence_id_t> all;
+	for (auto& ids : seen)
+	{
+		all.insert(ids.begin(), ids.end());
+	}
+	BOOST_REQUIRE_EQUAL(all.size(), nEvents);
+	BOOST_REQUIRE_EQUAL(*all.begin(), 1);
+	BOOST_REQUIRE_EQUAL(*all.rbegin(), nEvents);
+
+	// Two handles may be held at once and released in any order
+	for (artdaq::Fragment::sequence_id_t seq = nEvents + 1; seq <= nEvents + 2; ++seq)
+	{
+		std::vector<artdaq::FragmentPtr> frags;
+		frags.push_back(MakeFragment(seq, 0, artdaq::Fragment::DataFragmentType, 0x10));
+		WriteEvent(writer, seq, frags);
+	}
+	auto first = receiver.AcquireEvent(false, 1000000);
+	auto second = receiver.AcquireEvent(false, 1000000);
+	BOOST_REQUIRE(first.IsValid());
+	BOOST_REQUIRE(second.IsValid());
+	BOOST_REQUIRE_NE(first.GetBuffer(), second.GetBuffer());
+	BOOST_REQUIRE_NE(first.Header()->sequence_id, second.Header()->sequence_id);
+	second.Release();
+	BOOST_REQUIRE(!second.IsValid());
+	BOOST_REQUIRE(first.CheckBuffer());
+	auto moved = std::move(first);
+	BOOST_REQUIRE(!first.IsValid());  // NOLINT(bugprone-use-after-move,hicpp-invalid-access-moved)
+	BOOST_REQUIRE(moved.IsValid());
+	moved = artdaq::SharedMemoryEventReceiver::EventHandle();
+	BOOST_REQUIRE_EQUAL(writer.WriteReadyCount(false), 8);
+	TLOG(TLVL_INFO) << "END TEST ConcurrentHandles";
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,9 @@
 #define TRACE_NAME "SharedMemoryFragmentManager_t"
 
+#include <chrono>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include "artdaq-core/Core/SharedMemoryFragmentManager.hh"
 #include "artdaq-core/Data/Fragment.hh"
@@ -239,4 +242,250 @@ BOOST_AUTO_TEST_CASE(Timeout)
 	TLOG(TLVL_INFO) << "END TEST Timeout";
 }
 
+BOOST_AUTO_TEST_CASE(SizeClasses)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST SizeClasses";
+	uint32_t key = GetRandomKey(0xF4A6);
+	artdaq::SharedMemoryFragmentManager man(key, {{0x400, 2}, {0x4000, 1}});
+	artdaq::SharedMemoryFragmentManager man2(key);
+
+	// Small Fragments use the small buffers, a large one uses the large buffer
+	for (auto words : {0x10, 0x10, 0x100})
+	{
+		artdaq::Fragment frag(words);
+		frag.setSequenceID(words);
+		BOOST_REQUIRE_EQUAL(man.WriteFragment(std::move(frag), false, 0), 0);
+	}
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 0);
+
+	for (size_t ii = 0; ii < 3; ++ii)
+	{
+		artdaq::detail::RawFragmentHeader hdr;
+		BOOST_REQUIRE_EQUAL(man2.ReadFragmentHeader(hdr), 0);
+		artdaq::Fragment frag(hdr.word_count - hdr.num_words());
+		BOOST_REQUIRE_EQUAL(man2.ReadFragmentData(frag.headerAddress() + hdr.num_words(), hdr.word_count - hdr.num_words()), 0);
+	}
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false, 0x1000), 1);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 3);
+	TLOG(TLVL_INFO) << "END TEST SizeClasses";
+}
+
+BOOST_AUTO_TEST_CASE(WaitStrategies)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST WaitStrategies";
+	using Strategy = artdaq::SharedMemoryManager::WaitStrategy;
+	for (auto strategy : {Strategy::Block, Strategy::Spin, Strategy::SpinYield, Strategy::SpinBlock, Strategy::Adaptive})
+	{
+		uint32_t key = GetRandomKey(0xF4A6);
+		artdaq::SharedMemoryManager::SegmentOptions options;
+		options.wait_strategy = strategy;
+		options.spin_us = 200;
+		artdaq::SharedMemoryFragmentManager man(key, 1, 0x1000, 100 * 1000000, options);
+		artdaq::SharedMemoryFragmentManager man2(key);
+		BOOST_REQUIRE(man.GetWaitStrategy() == strategy);
+
+		artdaq::Fragment frag(0x10);
+		BOOST_REQUIRE_EQUAL(man.WriteFragment(std::move(frag), false, 0), 0);
+		BOOST_REQUIRE_EQUAL(man.WaitForWritable(2000), false);
+
+		// The second write waits until the reader frees the only buffer. Boost.Test assertions are not thread-safe, so the
+		// reader's results are checked after joining.
+		int header_sts = -99;
+		int data_sts = -99;
+		std::thread reader([&man2, &header_sts, &data_sts] {
+			usleep(5000);
+			artdaq::detail::RawFragmentHeader hdr;
+			header_sts = man2.ReadFragmentHeader(hdr);
+			if (header_sts == 0)
+			{
+				std::vector<artdaq::RawDataType> data(hdr.word_count - hdr.num_words());
+				data_sts = man2.ReadFragmentData(data.data(), data.size());
+			}
+		});
+		artdaq::Fragment frag2(0x10);
+		auto write_sts = man.WriteFragment(std::move(frag2), false, 0);
+		reader.join();
+		BOOST_REQUIRE_EQUAL(write_sts, 0);
+		BOOST_REQUIRE_EQUAL(header_sts, 0);
+		BOOST_REQUIRE_EQUAL(data_sts, 0);
+		BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 1);
+	}
+	TLOG(TLVL_INFO) << "END TEST WaitStrategies";
+}
+
+BOOST_AUTO_TEST_CASE(Packing)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST Packing";
+	uint32_t key = GetRandomKey(0xF4A6);
+	artdaq::SharedMemoryFragmentManager man(key, 4, 0x1000);
+	artdaq::SharedMemoryFragmentManager man2(key);
+
+	artdaq::SharedMemoryFragmentManager::PackingOptions packing;
+	packing.max_fragments = 0;
+	packing.max_delay_us = 0;
+	man.SetPacking(packing);
+
+	// Small Fragments share one buffer, which readers only see once it is flushed
+	for (size_t ii = 0; ii < 10; ++ii)
+	{
+		artdaq::Fragment frag(0x10);
+		frag.setSequenceID(ii);
+		*frag.dataBegin() = ii;
+		BOOST_REQUIRE_EQUAL(man.WriteFragment(std::move(frag), false, 0), 0);
+	}
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 0);
+	BOOST_REQUIRE_EQUAL(man.FlushPackedFragments(), 10);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 1);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 3);
+
+	for (size_t ii = 0; ii < 10; ++ii)
+	{
+		artdaq::Fragment frag;
+		BOOST_REQUIRE_EQUAL(man2.ReadFragment(frag), 0);
+		BOOST_REQUIRE_EQUAL(frag.sequenceID(), ii);
+		BOOST_REQUIRE_EQUAL(frag.dataSizeBytes(), 0x10 * sizeof(artdaq::RawDataType));
+		BOOST_REQUIRE_EQUAL(*frag.dataBegin(), ii);
+	}
+	artdaq::detail::RawFragmentHeader hdr;
+	BOOST_REQUIRE_EQUAL(man2.ReadFragmentHeader(hdr), -1);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 4);
+
+	// Count threshold: 7 Fragments in buffers of 3, the last one flushed by hand
+	packing.max_fragments = 3;
+	man.SetPacking(packing);
+	for (size_t ii = 0; ii < 7; ++ii)
+	{
+		artdaq::Fragment frag(0x10);
+		frag.setSequenceID(ii);
+		BOOST_REQUIRE_EQUAL(man.WriteFragment(std::move(frag), false, 0), 0);
+	}
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 2);
+	BOOST_REQUIRE_EQUAL(man.FlushPackedFragments(), 1);
+	for (size_t ii = 0; ii < 7; ++ii)
+	{
+		artdaq::Fragment frag;
+		BOOST_REQUIRE_EQUAL(man2.ReadFragment(frag), 0);
+		BOOST_REQUIRE_EQUAL(frag.sequenceID(), ii);
+	}
+
+	// Size: a Fragment which does not fit in the open buffer starts a new one
+	packing.max_fragments = 0;
+	man.SetPacking(packing);
+	for (size_t ii = 7; ii < 9; ++ii)
+	{
+		artdaq::Fragment frag(0x100);
+		frag.setSequenceID(ii);
+		BOOST_REQUIRE_EQUAL(man.WriteFragment(std::move(frag), false, 0), 0);
+	}
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 1);
+	BOOST_REQUIRE_EQUAL(man.FlushPackedFragments(), 1);
+	for (size_t ii = 7; ii < 9; ++ii)
+	{
+		artdaq::Fragment frag;
+		BOOST_REQUIRE_EQUAL(man2.ReadFragment(frag), 0);
+		BOOST_REQUIRE_EQUAL(frag.sequenceID(), ii);
+	}
+
+	// Deadline: an old open buffer is released, at the latest by the next ReadyForWrite
+	packing.max_delay_us = 100000;
+	man.SetPacking(packing);
+	artdaq::Fragment frag(0x10);
+	BOOST_REQUIRE_EQUAL(man.WriteFragment(std::move(frag), false, 0), 0);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 0);
+	usleep(200000);
+	BOOST_REQUIRE_EQUAL(man.ReadyForWrite(false), true);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 1);
+	TLOG(TLVL_INFO) << "END TEST Packing";
+}
+
+BOOST_AUTO_TEST_CASE(PackingIdleWriter)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST PackingIdleWriter";
+	uint32_t key = GetRandomKey(0xF4A6);
+	artdaq::SharedMemoryFragmentManager man(key, 4, 0x1000);
+	artdaq::SharedMemoryFragmentManager man2(key);
+
+	artdaq::SharedMemoryFragmentManager::PackingOptions packing;
+	packing.max_fragments = 0;
+	packing.max_delay_us = 20000;
+	man.SetPacking(packing);
+
+	// The writer goes idle after three Fragments; the packing timer releases them without another write
+	for (int round = 0; round < 2; ++round)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (size_t ii = 0; ii < 3; ++ii)
+		{
+			artdaq::Fragment frag(0x10);
+			frag.setSequenceID(ii);
+			BOOST_REQUIRE_EQUAL(man.WriteFragment(std::move(frag), false, 0), 0);
+		}
+		BOOST_REQUIRE_EQUAL(man2.WaitForReadable(1000000), true);
+		auto elapsed = artdaq::TimeUtils::GetElapsedTimeMicroseconds(start);
+		BOOST_REQUIRE_GE(elapsed, packing.max_delay_us);
+		BOOST_REQUIRE_LT(elapsed, 500000);
+		for (size_t ii = 0; ii < 3; ++ii)
+		{
+			artdaq::Fragment frag;
+			BOOST_REQUIRE_EQUAL(man2.ReadFragment(frag), 0);
+			BOOST_REQUIRE_EQUAL(frag.sequenceID(), ii);
+		}
+		BOOST_REQUIRE_EQUAL(man.FlushPackedFragments(), 0);
+	}
+
+	// Without a deadline, the Fragments wait for the next write or an explicit flush
+	packing.max_delay_us = 0;
+	man.SetPacking(packing);
+	artdaq::Fragment frag(0x10);
+	BOOST_REQUIRE_EQUAL(man.WriteFragment(std::move(frag), false, 0), 0);
+	BOOST_REQUIRE_EQUAL(man2.WaitForReadable(50000), false);
+	BOOST_REQUIRE_EQUAL(man.FlushPackedFragments(), 1);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 1);
+	TLOG(TLVL_INFO) << "END TEST PackingIdleWriter";
+}
+
+BOOST_AUTO_TEST_CASE(PackingBlockedWriter)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST PackingBlockedWriter";
+	uint32_t key = GetRandomKey(0xF4A6);
+	artdaq::SharedMemoryFragmentManager man(key, 1, 0x1000);
+	artdaq::SharedMemoryFragmentManager man2(key);
+
+	artdaq::SharedMemoryFragmentManager::PackingOptions packing;
+	packing.max_fragments = 0;
+	packing.max_delay_us = 0;
+	man.SetPacking(packing);
+	artdaq::Fragment frag(0x10);
+	BOOST_REQUIRE_EQUAL(man.WriteFragment(std::move(frag), false, 0), 0);
+	BOOST_REQUIRE_EQUAL(man.FlushPackedFragments(), 1);
+
+	// The second write waits for the only buffer; meanwhile the packing state is not locked
+	int write_sts = -99;
+	std::thread writer([&man, &write_sts] {
+		artdaq::Fragment frag2(0x10);
+		write_sts = man.WriteFragment(std::move(frag2), false, 0);
+	});
+	int read_sts = -99;
+	std::thread reader([&man2, &read_sts] {
+		usleep(300000);
+		artdaq::Fragment read;
+		read_sts = man2.ReadFragment(read);
+	});
+	usleep(20000);
+	auto start = std::chrono::steady_clock::now();
+	auto flushed = man.FlushPackedFragments();
+	auto ready = man.ReadyForWrite(false);
+	auto elapsed = artdaq::TimeUtils::GetElapsedTimeMicroseconds(start);
+	reader.join();
+	writer.join();
+	BOOST_REQUIRE_EQUAL(flushed, 0);
+	BOOST_REQUIRE_EQUAL(ready, false);
+	BOOST_REQUIRE_LT(elapsed, 200000);
+	BOOST_REQUIRE_EQUAL(read_sts, 0);
+	BOOST_REQUIRE_EQUAL(write_sts, 0);
+	BOOST_REQUIRE_EQUAL(man.FlushPackedFragments(), 1);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 1);
+	TLOG(TLVL_INFO) << "END TEST PackingBlockedWriter";
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,219 @@
+#define TRACE_NAME "SharedMemoryInspector_t"
+
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "artdaq-core/Core/SharedMemoryFragmentManager.hh"
+#include "artdaq-core/Core/SharedMemoryInspector.hh"
+#include "artdaq-core/Core/SharedMemoryManager.hh"
+#include "artdaq-core/Data/Fragment.hh"
+#include "artdaq-core/Data/RawEvent.hh"
+#include "artdaq-core/Utilities/configureMessageFacility.hh"
+#include "TRACE/tracemf.h"
+
+#define BOOST_TEST_MODULE(SharedMemoryInspector_t)
+#include "SharedMemoryTestShims.hh"
+#include "cetlib/quiet_unit_test.hpp"
+
+namespace {
+artdaq::Fragment MakeFragment(artdaq::Fragment::sequence_id_t seq, artdaq::Fragment::type_t type, size_t words)
+{
+	artdaq::Fragment frag(words);
+	frag.setSequenceID(seq);
+	frag.setSystemType(type);
+	return frag;
+}
+
+using BufferContents = artdaq::SharedMemoryInspector::BufferContents;
+using BufferSemaphoreFlags = artdaq::SharedMemoryManager::BufferSemaphoreFlags;
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(SharedMemoryInspector_test)
+
+BOOST_AUTO_TEST_CASE(NoSegment)
+{
+	artdaq::configureMessageFacility("SharedMemoryInspector_t", true, true);
+	TLOG(TLVL_INFO) << "BEGIN TEST NoSegment";
+	artdaq::SharedMemoryInspector inspector(GetRandomKey(0x1A5C));
+	BOOST_REQUIRE_EQUAL(inspector.Attach(), false);
+	BOOST_REQUIRE_EQUAL(inspector.IsValid(), false);
+	BOOST_REQUIRE_EQUAL(inspector.Snapshot().buffer_count, 0);
+	TLOG(TLVL_INFO) << "END TEST NoSegment";
+}
+
+BOOST_AUTO_TEST_CASE(BufferStates)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST BufferStates";
+	uint32_t key = GetRandomKey(0x1A5C);
+	artdaq::SharedMemoryFragmentManager writer(key, 4, 0x1000);
+	artdaq::SharedMemoryFragmentManager reader(key);
+
+	BOOST_REQUIRE_EQUAL(writer.WriteFragment(MakeFragment(5, artdaq::Fragment::DataFragmentType, 0x10), false, 0), 0);
+	BOOST_REQUIRE_EQUAL(writer.WriteFragment(MakeFragment(6, artdaq::Fragment::EmptyFragmentType, 0x20), false, 0), 0);
+	auto writing = writer.GetBufferForWriting(false);
+	BOOST_REQUIRE_NE(writing, -1);
+	auto read_ready = reader.ReadReadyCount();
+
+	artdaq::SharedMemoryInspector inspector(key);
+	BOOST_REQUIRE_EQUAL(inspector.Attach(), true);
+	auto snapshot = inspector.Snapshot();
+	BOOST_REQUIRE_EQUAL(snapshot.buffer_count, 4);
+	BOOST_REQUIRE_EQUAL(snapshot.buffers.size(), 4);
+	BOOST_REQUIRE_EQUAL(snapshot.destructive_read_mode, true);
+	BOOST_REQUIRE_EQUAL(snapshot.state_counts.empty, 1);
+	BOOST_REQUIRE_EQUAL(snapshot.state_counts.writing, 1);
+	BOOST_REQUIRE_EQUAL(snapshot.state_counts.full, 2);
+	BOOST_REQUIRE_EQUAL(snapshot.state_counts.reading, 0);
+
+	size_t full = 0;
+	for (auto const& buf : snapshot.buffers)
+	{
+		if (buf.state == BufferSemaphoreFlags::Full)
+		{
+			++full;
+			BOOST_REQUIRE_EQUAL(buf.fragments.is_event, false);
+			BOOST_REQUIRE_EQUAL(buf.fragments.fragment_count, 1);
+			BOOST_REQUIRE_EQUAL(buf.fragments.complete, true);
+			BOOST_REQUIRE_EQUAL(buf.fragments.fragment_bytes, buf.write_pos);
+			auto type = buf.fragments.first_sequence_id == 5 ? artdaq::Fragment::DataFragmentType : artdaq::Fragment::EmptyFragmentType;
+			BOOST_REQUIRE_EQUAL(buf.fragments.type_counts.count(type), 1);
+		}
+		if (buf.index == writing)
+		{
+			BOOST_REQUIRE(buf.state == BufferSemaphoreFlags::Writing);
+			BOOST_REQUIRE_EQUAL(buf.owner_id, writer.GetMyId());
+			BOOST_REQUIRE_EQUAL(buf.owner_pid, getpid());
+			BOOST_REQUIRE_EQUAL(buf.write_pos, 0);
+		}
+	}
+	BOOST_REQUIRE_EQUAL(full, 2);
+
+	auto text = artdaq::SharedMemoryInspector::Format(snapshot, &snapshot);
+	BOOST_REQUIRE_NE(text.find("2 Full"), std::string::npos);
+	BOOST_REQUIRE_NE(text.find("Writing"), std::string::npos);
+
+	// Inspecting the segment does not change what readers see
+	BOOST_REQUIRE_EQUAL(reader.ReadReadyCount(), read_ready);
+	artdaq::Fragment frag;
+	BOOST_REQUIRE_EQUAL(reader.ReadFragment(frag), 0);
+	BOOST_REQUIRE_EQUAL(frag.sequenceID(), 5);
+	BOOST_REQUIRE_EQUAL(inspector.Snapshot().state_counts.full, 1);
+	writer.MarkBufferEmpty(writing, true);
+	TLOG(TLVL_INFO) << "END TEST BufferStates";
+}
+
+BOOST_AUTO_TEST_CASE(MappedAttachedCount)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST MappedAttachedCount";
+	for (auto backend : {artdaq::SharedMemoryBackend::Posix, artdaq::SharedMemoryBackend::File})
+	{
+		uint32_t key = GetRandomKey(0x1A5C);
+		artdaq::SharedMemoryManager::SegmentOptions options;
+		options.backend = backend;
+		artdaq::SharedMemoryManager writer(key, 4, 0x1000, 100 * 1000000, true, options);
+		artdaq::SharedMemoryManager reader(key, 0, 0, 100 * 1000000, true, options);
+
+		// A read-only inspector holds no attach slot, so it does not count itself
+		artdaq::SharedMemoryInspector inspector(key, backend);
+		BOOST_REQUIRE_EQUAL(inspector.Attach(), true);
+		BOOST_REQUIRE_EQUAL(inspector.Snapshot().attached_count, 2);
+		BOOST_REQUIRE_EQUAL(writer.GetAttachedCount(), 2);
+	}
+	TLOG(TLVL_INFO) << "END TEST MappedAttachedCount";
+}
+
+BOOST_AUTO_TEST_CASE(Events)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST Events";
+	uint32_t key = GetRandomKey(0x1A5C);
+	artdaq::SharedMemoryManager writer(key, 4, 0x10000);
+	auto frag1 = MakeFragment(7, artdaq::Fragment::DataFragmentType, 0x10);
+	auto frag2 = MakeFragment(7, artdaq::Fragment::ContainerFragmentType, 0x20);
+
+	auto buf = writer.GetBufferForWriting(false);
+	artdaq::detail::RawEventHeader hdr(1, 1, 7, 7, 7);
+	writer.Write(buf, &hdr, sizeof(hdr));
+	writer.Write(buf, frag1.headerAddress(), frag1.sizeBytes());
+	writer.Write(buf, frag2.headerAddress(), frag2.sizeBytes());
+	writer.MarkBufferFull(buf);
+
+	auto toc_buf = writer.GetBufferForWriting(false);
+	artdaq::detail::RawEventHeader toc_hdr(1, 1, 8, 8, 8);
+	writer.Write(toc_buf, &toc_hdr, sizeof(toc_hdr));
+	artdaq::detail::RawEventTOC toc(4);
+	toc.entry_count = 1;
+	writer.Write(toc_buf, &toc, sizeof(toc));
+	std::vector<artdaq::detail::RawEventTOCEntry> entries(4);
+	writer.Write(toc_buf, entries.data(), entries.size() * sizeof(artdaq::detail::RawEventTOCEntry));
+	writer.Write(toc_buf, frag1.headerAddress(), frag1.sizeBytes());
+	writer.MarkBufferFull(toc_buf);
+
+	artdaq::SharedMemoryInspector inspector(key);
+	BOOST_REQUIRE_EQUAL(inspector.Attach(), true);
+	for (auto contents : {BufferContents::Auto, BufferContents::Events})
+	{
+		auto snapshot = inspector.Snapshot(contents);
+		auto const& event = snapshot.buffers[buf].fragments;
+		BOOST_REQUIRE_EQUAL(event.is_event, true);
+		BOOST_REQUIRE_EQUAL(event.event_sequence_id, 7);
+		BOOST_REQUIRE_EQUAL(event.has_toc, false);
+		BOOST_REQUIRE_EQUAL(event.fragment_count, 2);
+		BOOST_REQUIRE_EQUAL(event.complete, true);
+		BOOST_REQUIRE_EQUAL(event.type_counts.size(), 2);
+
+		auto const& toc_event = snapshot.buffers[toc_buf].fragments;
+		BOOST_REQUIRE_EQUAL(toc_event.is_event, true);
+		BOOST_REQUIRE_EQUAL(toc_event.event_sequence_id, 8);
+		BOOST_REQUIRE_EQUAL(toc_event.has_toc, true);
+		BOOST_REQUIRE_EQUAL(toc_event.toc_entries, 1);
+		BOOST_REQUIRE_EQUAL(toc_event.toc_capacity, 4);
+		BOOST_REQUIRE_EQUAL(toc_event.fragment_count, 1);
+		BOOST_REQUIRE_EQUAL(toc_event.complete, true);
+	}
+
+	// Read as bare Fragments, the event header is not a valid Fragment header
+	auto snapshot = inspector.Snapshot(BufferContents::Fragments);
+	BOOST_REQUIRE_EQUAL(snapshot.buffers[buf].fragments.complete, false);
+	BOOST_REQUIRE_EQUAL(inspector.Snapshot(BufferContents::Auto, false).buffers[buf].fragments.fragment_count, 0);
+	TLOG(TLVL_INFO) << "END TEST Events";
+}
+
+BOOST_AUTO_TEST_CASE(CorruptContents)
+{
+	TLOG(TLVL_INFO) << "BEGIN TEST CorruptContents";
+	auto frag = MakeFragment(9, artdaq::Fragment::DataFragmentType, 0x10);
+	std::vector<uint8_t> data(frag.sizeBytes() * 2);
+	memcpy(data.data(), frag.headerAddress(), frag.sizeBytes());
+	memcpy(data.data() + frag.sizeBytes(), frag.headerAddress(), frag.sizeBytes());
+
+	auto summary = artdaq::SharedMemoryInspector::SummarizeFragments(data.data(), data.size(), BufferContents::Fragments);
+	BOOST_REQUIRE_EQUAL(summary.fragment_count, 2);
+	BOOST_REQUIRE_EQUAL(summary.complete, true);
+
+	// A Fragment which runs past the end of the data is not counted
+	summary = artdaq::SharedMemoryInspector::SummarizeFragments(data.data(), data.size() - 8, BufferContents::Fragments);
+	BOOST_REQUIRE_EQUAL(summary.fragment_count, 1);
+	BOOST_REQUIRE_EQUAL(summary.complete, false);
+
+	// A huge word count in the second header
+	auto hdr = reinterpret_cast<artdaq::detail::RawFragmentHeader*>(data.data() + frag.sizeBytes());  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+	hdr->word_count = 0xFFFFFFFF;
+	summary = artdaq::SharedMemoryInspector::SummarizeFragments(data.data(), data.size(), BufferContents::Fragments);
+	BOOST_REQUIRE_EQUAL(summary.fragment_count, 1);
+	BOOST_REQUIRE_EQUAL(summary.complete, false);
+
+	// A TOC whose capacity does not fit in the data
+	std::vector<uint8_t> event(sizeof(artdaq::detail::RawEventHeader) + sizeof(artdaq::detail::RawEventTOC));
+	artdaq::detail::RawEventTOC toc(1000);
+	memcpy(event.data() + sizeof(artdaq::detail::RawEventHeader), &toc, sizeof(toc));
+	summary = artdaq::SharedMemoryInspector::SummarizeFragments(event.data(), event.size(), BufferContents::Auto);
+	BOOST_REQUIRE_EQUAL(summary.has_toc, true);
+	BOOST_REQUIRE_EQUAL(summary.fragment_count, 0);
+	BOOST_REQUIRE_EQUAL(summary.complete, false);
+	TLOG(TLVL_INFO) << "END TEST CorruptContents";
+}
+
+BOOST_AUTO_TEST_SUITE_END()
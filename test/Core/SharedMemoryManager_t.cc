@@ -1,3 +1,11 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <set>
+#include <thread>
+#include <sys/shm.h>
+#include <sys/wait.h>
 #include "artdaq-core/Core/SharedMemoryManager.hh"
 #include "artdaq-core/Utilities/TimeUtils.hh"
 #include "artdaq-core/Utilities/configureMessageFacility.hh"
@@ -272,7 +280,8 @@ BOOST_AUTO_TEST_CASE(Broadcast)
 	BOOST_REQUIRE_EQUAL(readbuf, buf);
 	BOOST_REQUIRE_EQUAL(man2.GetBuffersOwnedByManager().size(), 1);
 	BOOST_REQUIRE_EQUAL(man.ReadyForRead(), false);
-	BOOST_REQUIRE_EQUAL(man3.ReadyForRead(), false);
+	// Readers do not wait for each other; man3 reads the buffer after man2 has released it below
+	BOOST_REQUIRE_EQUAL(man3.ReadyForRead(), true);
 	BOOST_REQUIRE_EQUAL(man2.CheckBuffer(buf, artdaq::SharedMemoryManager::BufferSemaphoreFlags::Reading), true);
 	BOOST_REQUIRE_EQUAL(man2.MoreDataInBuffer(readbuf), true);
 	uint8_t byte;
@@ -334,11 +343,937 @@ BOOST_AUTO_TEST_CASE(Broadcast)
 
 	BOOST_REQUIRE_EQUAL(man2.GetBuffersOwnedByManager().size(), 0);
 	BOOST_REQUIRE_EQUAL(man.GetBuffersOwnedByManager().size(), 0);
-	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 9);
-	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(true), 10);
-	sleep(1);
+	// Both attached readers have released the buffer, so it is reused without waiting for the timeout
 	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 10);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(true), 10);
 	TLOG(TLVL_DEBUG) << "END TEST Broadcast";
 }
 
+BOOST_AUTO_TEST_CASE(ReadyQueues)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST ReadyQueues";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 1000, 0x10);
+	artdaq::SharedMemoryManager man2(key);
+	artdaq::SharedMemoryManager man3(key);
+
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 1000);
+
+	// Fill every buffer, addressing every other one to man3
+	std::vector<int> bufs;
+	for (size_t ii = 0; ii < 1000; ++ii)
+	{
+		int buf = man.GetBufferForWriting(false);
+		BOOST_REQUIRE_NE(buf, -1);
+		man.Write(buf, &ii, sizeof(ii));
+		bufs.push_back(buf);
+	}
+	BOOST_REQUIRE_EQUAL(man.GetBufferForWriting(false), -1);
+	BOOST_REQUIRE_EQUAL(man.ReadyForWrite(false), false);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 0);
+	for (size_t ii = 0; ii < bufs.size(); ++ii)
+	{
+		man.MarkBufferFull(bufs[ii], ii % 2 ? man3.GetMyId() : -1);
+	}
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 500);
+	BOOST_REQUIRE_EQUAL(man3.ReadReadyCount(), 1000);
+
+	// man2 only receives unaddressed buffers, in the order they were marked Full
+	for (size_t ii = 0; ii < 1000; ii += 2)
+	{
+		BOOST_REQUIRE_EQUAL(man2.ReadyForRead(), true);
+		auto buf = man2.GetBufferForReading();
+		BOOST_REQUIRE_EQUAL(buf, bufs[ii]);
+		size_t value = 0;
+		BOOST_REQUIRE_EQUAL(man2.Read(buf, &value, sizeof(value)), true);
+		BOOST_REQUIRE_EQUAL(value, ii);
+		man2.MarkBufferEmpty(buf);
+	}
+	BOOST_REQUIRE_EQUAL(man2.ReadyForRead(), false);
+	BOOST_REQUIRE_EQUAL(man2.GetBufferForReading(), -1);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 500);
+
+	BOOST_REQUIRE_EQUAL(man3.ReadReadyCount(), 500);
+	std::set<int> expected, received;
+	for (size_t ii = 1; ii < 1000; ii += 2)
+	{
+		expected.insert(bufs[ii]);
+		auto buf = man3.GetBufferForReading();
+		BOOST_REQUIRE_NE(buf, -1);
+		received.insert(buf);
+		man3.MarkBufferEmpty(buf);
+	}
+	BOOST_REQUIRE(expected == received);
+	BOOST_REQUIRE_EQUAL(man3.ReadyForRead(), false);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 1000);
+	TLOG(TLVL_DEBUG) << "END TEST ReadyQueues";
+}
+
+BOOST_AUTO_TEST_CASE(BlockingWaits)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST BlockingWaits";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 1, 0x1000);
+	artdaq::SharedMemoryManager man2(key);
+
+	// Nothing to read: the wait times out
+	auto start_time = std::chrono::steady_clock::now();
+	BOOST_REQUIRE_EQUAL(man2.WaitForReadable(50000), false);
+	BOOST_REQUIRE_GE(artdaq::TimeUtils::GetElapsedTimeMicroseconds(start_time), 50000);
+	BOOST_REQUIRE_EQUAL(man2.WaitForReadable(0), false);
+
+	// The reader is woken by MarkBufferFull
+	std::thread writer([&]() {
+		usleep(100000);
+		int buf = man.GetBufferForWriting(false);
+		man.MarkBufferFull(buf);
+	});
+	start_time = std::chrono::steady_clock::now();
+	BOOST_REQUIRE_EQUAL(man2.WaitForReadable(10000000), true);
+	BOOST_REQUIRE_LT(artdaq::TimeUtils::GetElapsedTimeMicroseconds(start_time), 5000000);
+	writer.join();
+
+	// The only buffer is Full, so a writer must wait until the reader marks it Empty
+	BOOST_REQUIRE_EQUAL(man.WaitForWritable(0), false);
+	int readbuf = man2.GetBufferForReading();
+	BOOST_REQUIRE_NE(readbuf, -1);
+	std::thread reader([&]() {
+		usleep(100000);
+		man2.MarkBufferEmpty(readbuf);
+	});
+	start_time = std::chrono::steady_clock::now();
+	BOOST_REQUIRE_EQUAL(man.WaitForWritable(10000000), true);
+	BOOST_REQUIRE_LT(artdaq::TimeUtils::GetElapsedTimeMicroseconds(start_time), 5000000);
+	reader.join();
+	TLOG(TLVL_DEBUG) << "END TEST BlockingWaits";
+}
+
+BOOST_AUTO_TEST_CASE(WriteTransaction)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST WriteTransaction";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 2, 0x1000);
+	artdaq::SharedMemoryManager man2(key);
+
+	{
+		auto txn = man.BeginWrite();
+		BOOST_REQUIRE_EQUAL(txn.IsValid(), true);
+		auto span = txn.Span<uint32_t>();
+		BOOST_REQUIRE_EQUAL(span.size, 0x1000 / sizeof(uint32_t));
+		BOOST_REQUIRE_EQUAL(static_cast<void*>(span.data), man.GetWritePos(txn.GetBuffer()));
+		std::iota(span.begin(), span.begin() + 0x10, 0);
+		BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 1);
+		BOOST_REQUIRE_EQUAL(txn.Commit(0x10 * sizeof(uint32_t)), true);
+		BOOST_REQUIRE_EQUAL(txn.IsValid(), false);
+		BOOST_REQUIRE_EQUAL(txn.Commit(1), false);
+	}
+
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 1);
+	auto readbuf = man2.GetBufferForReading();
+	BOOST_REQUIRE_EQUAL(man2.BufferDataSize(readbuf), 0x10 * sizeof(uint32_t));
+	uint32_t values[0x10];
+	BOOST_REQUIRE_EQUAL(man2.Read(readbuf, values, sizeof(values)), true);
+	for (uint32_t ii = 0; ii < 0x10; ++ii)
+	{
+		BOOST_REQUIRE_EQUAL(values[ii], ii);
+	}
+	man2.MarkBufferEmpty(readbuf);
+
+	// Abandoned transactions release their buffer
+	{
+		auto txn = man.BeginWrite();
+		auto txn2 = man.BeginWrite();
+		BOOST_REQUIRE_EQUAL(txn2.IsValid(), true);
+		BOOST_REQUIRE_EQUAL(man.BeginWrite().IsValid(), false);
+		BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 0);
+		txn2 = std::move(txn);
+		BOOST_REQUIRE_EQUAL(txn.IsValid(), false);
+		BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 1);
+	}
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 2);
+	BOOST_REQUIRE_EQUAL(man2.ReadyForRead(), false);
+	TLOG(TLVL_DEBUG) << "END TEST WriteTransaction";
+}
+
+BOOST_AUTO_TEST_CASE(SegmentOptions)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST SegmentOptions";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager::SegmentOptions options;
+	options.huge_pages = artdaq::SharedMemoryManager::HugePageSize::Size2MB;
+	options.prefault = true;
+	options.lock_memory = true;
+
+	// Huge pages and mlock may not be available; the segment must still be usable
+	artdaq::SharedMemoryManager man(key, 4, 0x10000, 100 * 1000000, true, options);
+	BOOST_REQUIRE_EQUAL(man.IsValid(), true);
+	TLOG(TLVL_INFO) << "Segment using huge pages: " << std::boolalpha << man.UsingHugePages();
+	artdaq::SharedMemoryManager man2(key, 0, 0, 100 * 1000000, true, options);
+	BOOST_REQUIRE_EQUAL(man2.IsValid(), true);
+	BOOST_REQUIRE_EQUAL(man2.UsingHugePages(), false);
+	BOOST_REQUIRE_EQUAL(man2.size(), 4);
+	BOOST_REQUIRE_EQUAL(man2.BufferSize(), 0x10000);
+
+	int n = 0xF00D;
+	auto buf = man.GetBufferForWriting(false);
+	man.Write(buf, &n, sizeof(n));
+	man.MarkBufferFull(buf);
+	auto readbuf = man2.GetBufferForReading();
+	BOOST_REQUIRE_EQUAL(readbuf, buf);
+	int m = 0;
+	BOOST_REQUIRE_EQUAL(man2.Read(readbuf, &m, sizeof(m)), true);
+	BOOST_REQUIRE_EQUAL(m, n);
+	man2.MarkBufferEmpty(readbuf);
+	TLOG(TLVL_DEBUG) << "END TEST SegmentOptions";
+}
+
+BOOST_AUTO_TEST_CASE(SegmentBackends)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST SegmentBackends";
+	for (auto backend : {artdaq::SharedMemoryBackend::Posix, artdaq::SharedMemoryBackend::File})
+	{
+		uint32_t key = GetRandomKey(0x7357);
+		artdaq::SharedMemoryManager::SegmentOptions options;
+		options.backend = backend;
+		auto man = std::make_unique<artdaq::SharedMemoryManager>(key, 4, 0x1000, 100 * 1000000, true, options);
+		BOOST_REQUIRE_EQUAL(man->IsValid(), true);
+		BOOST_REQUIRE_EQUAL(man->GetAttachedCount(), 1);
+		{
+			artdaq::SharedMemoryManager man2(key, 0, 0, 100 * 1000000, true, options);
+			BOOST_REQUIRE_EQUAL(man2.IsValid(), true);
+			BOOST_REQUIRE_EQUAL(man2.GetMyId(), 1);
+			BOOST_REQUIRE_EQUAL(man2.size(), 4);
+			BOOST_REQUIRE_EQUAL(man->GetAttachedCount(), 2);
+			BOOST_REQUIRE_EQUAL(man2.GetAttachedCount(), 2);
+
+			int n = 0xBEEF;
+			auto buf = man->GetBufferForWriting(false);
+			man->Write(buf, &n, sizeof(n));
+			man->MarkBufferFull(buf);
+			auto readbuf = man2.GetBufferForReading();
+			BOOST_REQUIRE_EQUAL(readbuf, buf);
+			int m = 0;
+			BOOST_REQUIRE_EQUAL(man2.Read(readbuf, &m, sizeof(m)), true);
+			BOOST_REQUIRE_EQUAL(m, n);
+			man2.MarkBufferEmpty(readbuf);
+			BOOST_REQUIRE_EQUAL(man2.IsEndOfData(), false);
+		}
+		BOOST_REQUIRE_EQUAL(man->GetAttachedCount(), 1);
+
+		artdaq::SharedMemoryManager man3(key, 0, 0, 100 * 1000000, true, options);
+		man.reset();
+		BOOST_REQUIRE_EQUAL(man3.IsEndOfData(), true);
+	}
+	TLOG(TLVL_DEBUG) << "END TEST SegmentBackends";
+}
+
+BOOST_AUTO_TEST_CASE(SizeClasses)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST SizeClasses";
+	uint32_t key = GetRandomKey(0x7357);
+	// Deliberately out of order; classes are sorted by size
+	artdaq::SharedMemoryManager man(key, {{0x10000, 2}, {0x100, 4}, {0x1000, 3}});
+	artdaq::SharedMemoryManager man2(key);
+
+	BOOST_REQUIRE_EQUAL(man.size(), 9);
+	BOOST_REQUIRE_EQUAL(man2.size(), 9);
+	BOOST_REQUIRE_EQUAL(man2.BufferSize(), 0x10000);
+	auto classes = man2.GetSizeClasses();
+	BOOST_REQUIRE_EQUAL(classes.size(), 3);
+	BOOST_REQUIRE_EQUAL(classes[0].buffer_size, 0x100);
+	BOOST_REQUIRE_EQUAL(classes[0].buffer_count, 4);
+	BOOST_REQUIRE_EQUAL(classes[2].buffer_size, 0x10000);
+	BOOST_REQUIRE_EQUAL(man2.BufferSize(0), 0x100);
+	BOOST_REQUIRE_EQUAL(man2.BufferSize(4), 0x1000);
+	BOOST_REQUIRE_EQUAL(man2.BufferSize(8), 0x10000);
+
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 9);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false, 0x800), 5);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false, 0x8000), 2);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false, 0x20000), 0);
+	BOOST_REQUIRE_EQUAL(man.GetBufferForWriting(false, 0x20000), -1);
+
+	// The smallest class which can hold the data is used first, then larger ones
+	std::vector<int> buffers;
+	for (int ii = 0; ii < 5; ++ii)
+	{
+		auto buf = man.GetBufferForWriting(false, 0x100);
+		BOOST_REQUIRE_NE(buf, -1);
+		buffers.push_back(buf);
+	}
+	BOOST_REQUIRE_EQUAL(man.BufferSize(buffers[3]), 0x100);
+	BOOST_REQUIRE_EQUAL(man.BufferSize(buffers[4]), 0x1000);
+	auto big = man.GetBufferForWriting(false, 0x2000);
+	BOOST_REQUIRE_EQUAL(man.BufferSize(big), 0x10000);
+
+	// Buffers in different classes do not overlap
+	std::vector<uint8_t> data(0x10000, 0xAB);
+	man.Write(big, data.data(), data.size());
+	std::vector<uint8_t> small(0x1000, 0xCD);
+	man.Write(buffers[4], small.data(), small.size());
+	BOOST_REQUIRE_EQUAL(man.GetWritePos(buffers[4]), static_cast<uint8_t*>(man.GetBufferStart(buffers[4])) + 0x1000);
+	auto bigStart = static_cast<uint8_t*>(man.GetBufferStart(big));
+	BOOST_REQUIRE(std::all_of(bigStart, bigStart + data.size(), [](uint8_t b) { return b == 0xAB; }));
+	BOOST_REQUIRE_THROW(man.Write(buffers[4], small.data(), 1), cet::exception);
+	TLOG(TLVL_DEBUG) << "END TEST SizeClasses";
+}
+
+BOOST_AUTO_TEST_CASE(ReaperThread)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST ReaperThread";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager::SegmentOptions options;
+	options.reaper_thread = true;
+	artdaq::SharedMemoryManager man(key, 4, 0x1000, 200000, true, options);
+	artdaq::SharedMemoryManager man2(key, 0, 0, 200000);
+	BOOST_REQUIRE_EQUAL(man.IsReaperActive(), true);
+	BOOST_REQUIRE_EQUAL(man2.IsReaperActive(), true);
+
+	int n = 0xF00D;
+	auto buf = man.GetBufferForWriting(false);
+	man.Write(buf, &n, sizeof(n));
+	man.MarkBufferFull(buf);
+
+	// A reader which goes away without releasing its buffer; nobody scans the buffers afterwards
+	auto readbuf = man2.GetBufferForReading();
+	BOOST_REQUIRE_EQUAL(readbuf, buf);
+	BOOST_REQUIRE(man.GetBufferReport()[buf].second == artdaq::SharedMemoryManager::BufferSemaphoreFlags::Reading);
+	usleep(600000);
+	BOOST_REQUIRE(man.GetBufferReport()[buf].second == artdaq::SharedMemoryManager::BufferSemaphoreFlags::Full);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 1);
+
+	man.Detach();
+	BOOST_REQUIRE_EQUAL(man.IsReaperActive(), false);
+	TLOG(TLVL_DEBUG) << "END TEST ReaperThread";
+}
+
+BOOST_AUTO_TEST_CASE(BroadcastReaderCursors)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST BroadcastReaderCursors";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 4, 0x100, 100 * 1000000, false);
+	auto man2 = std::make_unique<artdaq::SharedMemoryManager>(key);
+	artdaq::SharedMemoryManager man3(key);
+	// Readers register on their first read-side call, not at attach
+	BOOST_REQUIRE_EQUAL(man.GetBroadcastReaderCount(), 0);
+	BOOST_REQUIRE_EQUAL(man2->ReadyForRead(), false);
+	BOOST_REQUIRE_EQUAL(man3.ReadyForRead(), false);
+	BOOST_REQUIRE_EQUAL(man.GetBroadcastReaderCount(), 2);
+
+	// Far more buffers than the segment holds pass through, limited only by how fast the readers release them
+	for (int ii = 0; ii < 20; ++ii)
+	{
+		auto buf = man.GetBufferForWriting(false);
+		BOOST_REQUIRE(buf != -1);
+		man.Write(buf, &ii, sizeof(ii));
+		man.MarkBufferFull(buf);
+
+		for (auto reader : {man2.get(), &man3})
+		{
+			auto readbuf = reader->GetBufferForReading();
+			BOOST_REQUIRE_EQUAL(readbuf, buf);
+			int jj = -1;
+			reader->Read(readbuf, &jj, sizeof(jj));
+			BOOST_REQUIRE_EQUAL(jj, ii);
+			if (reader == &man3)
+			{
+				BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 3);
+			}
+			reader->MarkBufferEmpty(readbuf);
+		}
+		BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 4);
+	}
+
+	// A buffer only waiting for a reader which detaches is reused
+	auto buf = man.GetBufferForWriting(false);
+	man.MarkBufferFull(buf);
+	auto readbuf = man3.GetBufferForReading();
+	man3.MarkBufferEmpty(readbuf);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 3);
+	man2.reset();
+	BOOST_REQUIRE_EQUAL(man.GetBroadcastReaderCount(), 1);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 4);
+	TLOG(TLVL_DEBUG) << "END TEST BroadcastReaderCursors";
+}
+
+BOOST_AUTO_TEST_CASE(BroadcastConcurrentReaders)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST BroadcastConcurrentReaders";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 4, 0x100, 100 * 1000000, false);
+	artdaq::SharedMemoryManager man2(key);
+	artdaq::SharedMemoryManager man3(key);
+	BOOST_REQUIRE_EQUAL(man2.ReadyForRead(), false);
+	BOOST_REQUIRE_EQUAL(man3.ReadyForRead(), false);
+
+	std::vector<int> bufs;
+	for (int ii = 0; ii < 3; ++ii)
+	{
+		auto buf = man.GetBufferForWriting(false);
+		int data[2] = {ii, ii + 100};
+		man.Write(buf, data, sizeof(data));
+		man.MarkBufferFull(buf);
+		bufs.push_back(buf);
+	}
+
+	// Both readers hold the first buffer at the same time, each with its own read position
+	auto readbuf2 = man2.GetBufferForReading();
+	auto readbuf3 = man3.GetBufferForReading();
+	BOOST_REQUIRE_EQUAL(readbuf2, bufs[0]);
+	BOOST_REQUIRE_EQUAL(readbuf3, bufs[0]);
+	BOOST_REQUIRE_EQUAL(man2.CheckBuffer(readbuf2, artdaq::SharedMemoryManager::BufferSemaphoreFlags::Reading), true);
+	BOOST_REQUIRE_EQUAL(man3.CheckBuffer(readbuf3, artdaq::SharedMemoryManager::BufferSemaphoreFlags::Reading), true);
+	int value = -1;
+	BOOST_REQUIRE_EQUAL(man2.Read(readbuf2, &value, sizeof(value)), true);
+	BOOST_REQUIRE_EQUAL(value, 0);
+	BOOST_REQUIRE_EQUAL(man3.Read(readbuf3, &value, sizeof(value)), true);
+	BOOST_REQUIRE_EQUAL(value, 0);
+	BOOST_REQUIRE_EQUAL(man2.Read(readbuf2, &value, sizeof(value)), true);
+	BOOST_REQUIRE_EQUAL(value, 100);
+	BOOST_REQUIRE_EQUAL(man2.MoreDataInBuffer(readbuf2), false);
+	BOOST_REQUIRE_EQUAL(man3.MoreDataInBuffer(readbuf3), true);
+
+	// A reader which stalls while holding a buffer does not hold back the other one
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 2);
+	man2.MarkBufferEmpty(readbuf2);
+	for (int ii = 1; ii < 3; ++ii)
+	{
+		auto readbuf = man2.GetBufferForReading();
+		BOOST_REQUIRE_EQUAL(readbuf, bufs[ii]);
+		BOOST_REQUIRE_EQUAL(man2.Read(readbuf, &value, sizeof(value)), true);
+		BOOST_REQUIRE_EQUAL(value, ii);
+		man2.MarkBufferEmpty(readbuf);
+	}
+	BOOST_REQUIRE_EQUAL(man2.ReadyForRead(), false);
+	BOOST_REQUIRE_EQUAL(man3.ReadReadyCount(), 2);
+
+	// No buffer is reused until man3 has released it as well
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 1);
+	man3.MarkBufferEmpty(readbuf3);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 2);
+
+	// A buffer returned unread is found again by the same reader
+	auto readbuf = man3.GetBufferForReading();
+	BOOST_REQUIRE_EQUAL(readbuf, bufs[1]);
+	man3.ReturnBufferUnread(readbuf);
+	BOOST_REQUIRE_EQUAL(man3.ReadReadyCount(), 2);
+	BOOST_REQUIRE_EQUAL(man3.GetBufferForReading(), bufs[1]);
+	man3.MarkBufferEmpty(bufs[1]);
+	BOOST_REQUIRE_EQUAL(man3.GetBufferForReading(), bufs[2]);
+	man3.MarkBufferEmpty(bufs[2]);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 4);
+	TLOG(TLVL_DEBUG) << "END TEST BroadcastConcurrentReaders";
+}
+
+BOOST_AUTO_TEST_CASE(BroadcastWriterAttach)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST BroadcastWriterAttach";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 4, 0x100, 100 * 1000000, false);
+	artdaq::SharedMemoryManager writer(key);
+	artdaq::SharedMemoryManager writer2(key);
+	// Managers which only write never register a cursor, so they do not keep buffers from being reused
+	BOOST_REQUIRE_EQUAL(man.GetBroadcastReaderCount(), 0);
+	// A reader registers on its first read-side call, even when there is nothing to read
+	BOOST_REQUIRE_EQUAL(man.ReadReadyCount(), 0);
+	BOOST_REQUIRE_EQUAL(man.GetBroadcastReaderCount(), 1);
+
+	for (int ii = 0; ii < 20; ++ii)
+	{
+		auto& source = ii % 2 == 0 ? writer : writer2;
+		auto buf = source.GetBufferForWriting(false);
+		BOOST_REQUIRE(buf != -1);
+		source.Write(buf, &ii, sizeof(ii));
+		source.MarkBufferFull(buf);
+
+		auto readbuf = man.GetBufferForReading();
+		BOOST_REQUIRE_EQUAL(readbuf, buf);
+		int jj = -1;
+		man.Read(readbuf, &jj, sizeof(jj));
+		BOOST_REQUIRE_EQUAL(jj, ii);
+		man.MarkBufferEmpty(readbuf);
+		BOOST_REQUIRE_EQUAL(man.GetBroadcastReaderCount(), 1);
+		BOOST_REQUIRE_EQUAL(writer.WriteReadyCount(false), 4);
+	}
+	TLOG(TLVL_DEBUG) << "END TEST BroadcastWriterAttach";
+}
+
+BOOST_AUTO_TEST_CASE(BroadcastReaderOverflow)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST BroadcastReaderOverflow";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 4, 0x100, 100 * 1000000, false);
+	std::vector<std::unique_ptr<artdaq::SharedMemoryManager>> readers;
+	for (int ii = 0; ii <= artdaq::SharedMemoryManager::MaxBroadcastReaders; ++ii)
+	{
+		readers.push_back(std::make_unique<artdaq::SharedMemoryManager>(key));
+		BOOST_REQUIRE_EQUAL(readers.back()->ReadyForRead(), false);
+	}
+	BOOST_REQUIRE_EQUAL(man.GetBroadcastReaderCount(), artdaq::SharedMemoryManager::MaxBroadcastReaders);
+
+	// The last reader has no cursor, so buffers cannot be reused before the timeout
+	auto buf = man.GetBufferForWriting(false);
+	man.MarkBufferFull(buf);
+	for (auto& reader : readers)
+	{
+		auto readbuf = reader->GetBufferForReading();
+		BOOST_REQUIRE_EQUAL(readbuf, buf);
+		reader->MarkBufferEmpty(readbuf);
+	}
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 3);
+
+	// Once a cursor frees up, the reader registers on its next call and the buffer is reused
+	readers.front().reset();
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 3);
+	BOOST_REQUIRE_EQUAL(readers.back()->ReadyForRead(), false);
+	BOOST_REQUIRE_EQUAL(man.GetBroadcastReaderCount(), artdaq::SharedMemoryManager::MaxBroadcastReaders);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 4);
+	TLOG(TLVL_DEBUG) << "END TEST BroadcastReaderOverflow";
+}
+
+BOOST_AUTO_TEST_CASE(Destinations)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST Destinations";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 12, 0x100);
+	artdaq::SharedMemoryManager man2(key);
+	auto man3 = std::make_unique<artdaq::SharedMemoryManager>(key);
+	BOOST_REQUIRE_EQUAL(man2.RegisterDestination(1), true);
+	BOOST_REQUIRE_EQUAL(man3->RegisterDestination(2), true);
+	BOOST_REQUIRE_EQUAL(man.GetDestinationCount(), 2);
+
+	auto fill = [&](int destination) {
+		auto buf = man.GetBufferForWriting(false);
+		BOOST_REQUIRE(buf != -1);
+		man.MarkBufferFull(buf, destination);
+		return buf;
+	};
+
+	// Unaddressed buffers are dealt out 1:2
+	for (int ii = 0; ii < 6; ++ii)
+	{
+		fill(-1);
+	}
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 2);
+	BOOST_REQUIRE_EQUAL(man3->ReadReadyCount(), 4);
+
+	// Addressed buffers go straight to their destination
+	auto addressed = fill(man2.GetMyId());
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 3);
+	BOOST_REQUIRE_EQUAL(man3->ReadReadyCount(), 4);
+
+	std::set<int> read;
+	for (int ii = 0; ii < 3; ++ii)
+	{
+		auto buf = man2.GetBufferForReading();
+		BOOST_REQUIRE(buf != -1);
+		read.insert(buf);
+		man2.MarkBufferEmpty(buf);
+	}
+	BOOST_REQUIRE_EQUAL(man2.GetBufferForReading(), -1);
+	BOOST_REQUIRE_EQUAL(read.count(addressed), 1);
+
+	// Buffers queued for a destination which goes away are handed to the remaining readers
+	man3.reset();
+	BOOST_REQUIRE_EQUAL(man.GetDestinationCount(), 1);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 4);
+
+	// A reader which is not registered only sees buffers while no destination takes them
+	artdaq::SharedMemoryManager man4(key);
+	BOOST_REQUIRE_EQUAL(man4.ReadReadyCount(), 0);
+	man2.UnregisterDestination();
+	BOOST_REQUIRE_EQUAL(man.GetDestinationCount(), 0);
+	BOOST_REQUIRE_EQUAL(man4.ReadReadyCount(), 4);
+	TLOG(TLVL_DEBUG) << "END TEST Destinations";
+}
+
+BOOST_AUTO_TEST_CASE(BroadcastOrdering)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST BroadcastOrdering";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 8, 0x100, 100 * 1000000, false);
+	artdaq::SharedMemoryManager man2(key);
+
+	// Buffers are delivered in sequence ID order, not in the order they were marked Full
+	for (int round = 0; round < 5; ++round)
+	{
+		std::vector<int> buffers;
+		for (int ii = 0; ii < 6; ++ii)
+		{
+			auto buf = man.GetBufferForWriting(false);
+			BOOST_REQUIRE(buf != -1);
+			man.Write(buf, &ii, sizeof(ii));
+			buffers.push_back(buf);
+		}
+		for (auto ii : {3, 5, 0, 4, 1, 2})
+		{
+			man.MarkBufferFull(buffers[ii]);
+		}
+		BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 6);
+
+		for (int ii = 0; ii < 6; ++ii)
+		{
+			auto buf = man2.GetBufferForReading();
+			BOOST_REQUIRE_EQUAL(buf, buffers[ii]);
+			int jj = -1;
+			man2.Read(buf, &jj, sizeof(jj));
+			BOOST_REQUIRE_EQUAL(jj, ii);
+			man2.MarkBufferEmpty(buf);
+		}
+		BOOST_REQUIRE_EQUAL(man2.ReadyForRead(), false);
+		BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 8);
+	}
+	TLOG(TLVL_DEBUG) << "END TEST BroadcastOrdering";
+}
+
+BOOST_AUTO_TEST_CASE(BroadcastLateBuffer)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST BroadcastLateBuffer";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 4, 0x100, 100 * 1000000, false);
+	artdaq::SharedMemoryManager man2(key);
+	artdaq::SharedMemoryManager man3(key);
+	BOOST_REQUIRE_EQUAL(man2.ReadyForRead(), false);
+	BOOST_REQUIRE_EQUAL(man3.ReadyForRead(), false);
+
+	// The second buffer is marked Full first and read by both readers; the first one is still delivered to both
+	auto early = man.GetBufferForWriting(false);
+	auto late = man.GetBufferForWriting(false);
+	BOOST_REQUIRE(early != -1 && late != -1);
+	man.MarkBufferFull(late);
+	for (auto reader : {&man2, &man3})
+	{
+		BOOST_REQUIRE_EQUAL(reader->GetBufferForReading(), late);
+		reader->MarkBufferEmpty(late);
+	}
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 3);
+
+	man.MarkBufferFull(early);
+	for (auto reader : {&man2, &man3})
+	{
+		BOOST_REQUIRE_EQUAL(reader->ReadReadyCount(), 1);
+		BOOST_REQUIRE_EQUAL(reader->GetBufferForReading(), early);
+		reader->MarkBufferEmpty(early);
+		BOOST_REQUIRE_EQUAL(reader->ReadyForRead(), false);
+	}
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 4);
+	TLOG(TLVL_DEBUG) << "END TEST BroadcastLateBuffer";
+}
+
+BOOST_AUTO_TEST_CASE(LayoutV2)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST LayoutV2";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, {{0x100, 4}, {0x3000, 2}});
+	artdaq::SharedMemoryManager man2(key);
+	BOOST_REQUIRE_EQUAL(man2.IsValid(), true);
+	for (int ii = 0; ii < 6; ++ii)
+	{
+		auto address = reinterpret_cast<uintptr_t>(man.GetBufferStart(ii));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		auto alignment = man.BufferSize(ii) >= artdaq::SharedMemoryManager::DataAlignment ? artdaq::SharedMemoryManager::DataAlignment : artdaq::SharedMemoryManager::CacheLineSize;
+		BOOST_REQUIRE_EQUAL(address % alignment, 0);
+	}
+	TLOG(TLVL_DEBUG) << "END TEST LayoutV2";
+}
+
+BOOST_AUTO_TEST_CASE(LayoutVersionMismatch)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST LayoutVersionMismatch";
+	uint32_t key = GetRandomKey(0x7357);
+
+	// A segment whose header was written by a different layout must be refused
+	auto id = shmget(key, 0x100000, IPC_CREAT | 0666);
+	BOOST_REQUIRE(id != -1);
+	auto header = static_cast<uint64_t*>(shmat(id, nullptr, 0));
+	header[0] = 0xCAFE1111;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	artdaq::SharedMemoryManager man(key);
+	BOOST_REQUIRE_EQUAL(man.IsValid(), false);
+	shmdt(header);
+	shmctl(id, IPC_RMID, nullptr);
+	TLOG(TLVL_DEBUG) << "END TEST LayoutVersionMismatch";
+}
+
+BOOST_AUTO_TEST_CASE(DeadProcessReclaim)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST DeadProcessReclaim";
+	uint32_t key = GetRandomKey(0x7357);
+	// The buffer timeout is far longer than the test: buffers must come back because their holder exited
+	artdaq::SharedMemoryManager man(key, 4, 0x1000, 100 * 1000000);
+	auto buf = man.GetBufferForWriting(false);
+	BOOST_REQUIRE(buf != -1);
+	man.MarkBufferFull(buf);
+
+	// The child takes a buffer for writing and the Full buffer for reading, then exits without releasing them
+	auto pid = fork();
+	if (pid == 0)
+	{
+		artdaq::SharedMemoryManager child(key);
+		auto write_buf = child.GetBufferForWriting(false);
+		auto read_buf = child.GetBufferForReading();
+		_exit(write_buf != -1 && read_buf == buf ? 0 : 1);
+	}
+	BOOST_REQUIRE(pid > 0);
+	int status = -1;
+	waitpid(pid, &status, 0);
+	BOOST_REQUIRE(WIFEXITED(status));
+	BOOST_REQUIRE_EQUAL(WEXITSTATUS(status), 0);
+
+	auto start = std::chrono::steady_clock::now();
+	BOOST_REQUIRE_EQUAL(man.WaitForReadable(1000000), true);
+	BOOST_REQUIRE_EQUAL(man.GetBufferForReading(), buf);
+	man.MarkBufferEmpty(buf);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 4);
+	BOOST_REQUIRE_LT(artdaq::TimeUtils::GetElapsedTimeMicroseconds(start), 1000000);
+	TLOG(TLVL_DEBUG) << "END TEST DeadProcessReclaim";
+}
+
+BOOST_AUTO_TEST_CASE(ReaperDeadProcessReclaim)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST ReaperDeadProcessReclaim";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager::SegmentOptions options;
+	options.reaper_thread = true;
+	artdaq::SharedMemoryManager man(key, 4, 0x1000, 100 * 1000000, true, options);
+	BOOST_REQUIRE_EQUAL(man.IsReaperActive(), true);
+	auto buf = man.GetBufferForWriting(false);
+	BOOST_REQUIRE(buf != -1);
+	man.MarkBufferFull(buf);
+
+	auto pid = fork();
+	if (pid == 0)
+	{
+		artdaq::SharedMemoryManager child(key);
+		auto read_buf = child.GetBufferForReading();
+		_exit(read_buf == buf ? 0 : 1);
+	}
+	BOOST_REQUIRE(pid > 0);
+	int status = -1;
+	waitpid(pid, &status, 0);
+	BOOST_REQUIRE(WIFEXITED(status));
+	BOOST_REQUIRE_EQUAL(WEXITSTATUS(status), 0);
+
+	// Nobody scans the buffers; the reaper finds that the holder has exited
+	auto start = std::chrono::steady_clock::now();
+	while (man.GetBufferReport()[buf].second != artdaq::SharedMemoryManager::BufferSemaphoreFlags::Full && artdaq::TimeUtils::GetElapsedTimeMicroseconds(start) < 1000000)
+	{
+		usleep(1000);
+	}
+	BOOST_REQUIRE(man.GetBufferReport()[buf].second == artdaq::SharedMemoryManager::BufferSemaphoreFlags::Full);
+	BOOST_REQUIRE_EQUAL(man.GetBufferForReading(), buf);
+	man.MarkBufferEmpty(buf);
+	TLOG(TLVL_DEBUG) << "END TEST ReaperDeadProcessReclaim";
+}
+
+BOOST_AUTO_TEST_CASE(DeadProcessReclaimRace)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST DeadProcessReclaimRace";
+	uint32_t key = GetRandomKey(0x7357);
+	const size_t events = 2000;
+	artdaq::SharedMemoryManager man(key, 4, 0x1000, 100 * 1000000);
+	artdaq::SharedMemoryManager man2(key);
+
+	// A helper process keeps taking Full buffers from processes which exit while reading them, so that liveness checks
+	// reclaim buffers while the writer and reader threads below acquire them
+	auto helper = fork();
+	if (helper == 0)
+	{
+		for (auto ii = 0; ii < 20; ++ii)
+		{
+			auto pid = fork();
+			if (pid == 0)
+			{
+				artdaq::SharedMemoryManager child(key);
+				child.WaitForReadable(100000);
+				child.GetBufferForReading();
+				_exit(0);
+			}
+			waitpid(pid, nullptr, 0);
+			usleep(5000);
+		}
+		_exit(0);
+	}
+	BOOST_REQUIRE(helper > 0);
+
+	// Every event must be read exactly once: a reclaimed buffer which a live process holds would be lost or delivered twice
+	std::vector<size_t> reads(events, 0);
+	std::thread writer([&man, events] {
+		auto start = std::chrono::steady_clock::now();
+		for (size_t ii = 0; ii < events && artdaq::TimeUtils::GetElapsedTime(start) < 20;)
+		{
+			if (!man.WaitForWritable(100000))
+			{
+				continue;
+			}
+			auto buf = man.GetBufferForWriting(false);
+			if (buf == -1)
+			{
+				continue;
+			}
+			man.Write(buf, &ii, sizeof(ii));
+			man.MarkBufferFull(buf);
+			++ii;
+		}
+	});
+	std::thread reader([&man2, &reads, events] {
+		auto start = std::chrono::steady_clock::now();
+		for (size_t count = 0; count < events && artdaq::TimeUtils::GetElapsedTime(start) < 20;)
+		{
+			if (!man2.WaitForReadable(100000))
+			{
+				continue;
+			}
+			auto buf = man2.GetBufferForReading();
+			if (buf == -1)
+			{
+				continue;
+			}
+			size_t value = events;
+			man2.Read(buf, &value, sizeof(value));
+			man2.MarkBufferEmpty(buf);
+			if (value < events)
+			{
+				++reads[value];
+			}
+			++count;
+		}
+	});
+	writer.join();
+	reader.join();
+	waitpid(helper, nullptr, 0);
+
+	BOOST_REQUIRE_EQUAL(std::count(reads.begin(), reads.end(), 1), events);
+	TLOG(TLVL_DEBUG) << "END TEST DeadProcessReclaimRace";
+}
+
+BOOST_AUTO_TEST_CASE(Batches)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST Batches";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 10, 0x1000);
+	artdaq::SharedMemoryManager man2(key);
+
+	auto writes = man.GetBuffersForWriting(6);
+	BOOST_REQUIRE_EQUAL(writes.size(), 6);
+	BOOST_REQUIRE_EQUAL(std::set<int>(writes.begin(), writes.end()).size(), 6);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 4);
+	for (size_t ii = 0; ii < writes.size(); ++ii)
+	{
+		man.Write(writes[ii], &ii, sizeof(ii));
+	}
+
+	// A reader waiting when the batch is marked Full is woken. Boost.Test assertions are not thread-safe, so the result
+	// is checked after joining.
+	bool readable = false;
+	std::thread waiter([&man2, &readable] { readable = man2.WaitForReadable(1000000); });
+	usleep(10000);
+	man.MarkBuffersFull(writes);
+	waiter.join();
+	BOOST_REQUIRE_EQUAL(readable, true);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 6);
+
+	auto reads = man2.GetBuffersForReading(10);
+	BOOST_REQUIRE(reads == writes);
+	for (size_t ii = 0; ii < reads.size(); ++ii)
+	{
+		size_t value = 99;
+		man2.Read(reads[ii], &value, sizeof(value));
+		BOOST_REQUIRE_EQUAL(value, ii);
+	}
+	BOOST_REQUIRE_EQUAL(man2.GetBuffersForReading(10).size(), 0);
+	man2.MarkBuffersEmpty(reads);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false), 10);
+	BOOST_REQUIRE_EQUAL(man.GetBuffersForWriting(20).size(), 10);
+	TLOG(TLVL_DEBUG) << "END TEST Batches";
+}
+
+BOOST_AUTO_TEST_CASE(StateCounts)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST StateCounts";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, {{0x100, 4}, {0x3000, 2}});
+	artdaq::SharedMemoryManager man2(key);
+	artdaq::SharedMemoryManager man3(key);
+
+	auto counts = man2.GetBufferStateCounts();
+	BOOST_REQUIRE_EQUAL(counts.empty, 6);
+	BOOST_REQUIRE_EQUAL(man2.GetBufferStateCounts(0x1000).empty, 2);
+
+	auto small = man.GetBufferForWriting(false);
+	auto large = man.GetBufferForWriting(false, 0x1000);
+	auto addressed = man.GetBufferForWriting(false);
+	counts = man2.GetBufferStateCounts();
+	BOOST_REQUIRE_EQUAL(counts.empty, 3);
+	BOOST_REQUIRE_EQUAL(counts.writing, 3);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(false, 0x1000), 1);
+	BOOST_REQUIRE_EQUAL(man.WriteReadyCount(true), 3);
+
+	man.MarkBufferFull(small);
+	man.MarkBufferFull(large);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 2);
+
+	// A buffer addressed to one reader is only counted for that reader
+	man.MarkBufferFull(addressed, man2.GetMyId());
+	BOOST_REQUIRE_EQUAL(man2.GetBufferStateCounts().full, 3);
+	BOOST_REQUIRE_EQUAL(man2.ReadReadyCount(), 3);
+	BOOST_REQUIRE_EQUAL(man3.ReadReadyCount(), 2);
+
+	auto read = man3.GetBufferForReading();
+	BOOST_REQUIRE(read != -1);
+	counts = man.GetBufferStateCounts();
+	BOOST_REQUIRE_EQUAL(counts.full, 2);
+	BOOST_REQUIRE_EQUAL(counts.reading, 1);
+	man3.MarkBufferEmpty(read);
+
+	while (man2.ReadReadyCount() > 0)
+	{
+		man2.MarkBufferEmpty(man2.GetBufferForReading());
+	}
+	counts = man.GetBufferStateCounts();
+	BOOST_REQUIRE_EQUAL(counts.empty, 6);
+	BOOST_REQUIRE_EQUAL(counts.writing + counts.full + counts.reading, 0);
+	BOOST_REQUIRE_EQUAL(man3.ReadReadyCount(), 0);
+	TLOG(TLVL_DEBUG) << "END TEST StateCounts";
+}
+
+BOOST_AUTO_TEST_CASE(ScatterGatherWrite)
+{
+	TLOG(TLVL_DEBUG) << "BEGIN TEST ScatterGatherWrite";
+	uint32_t key = GetRandomKey(0x7357);
+	artdaq::SharedMemoryManager man(key, 2, 0x100000);
+	artdaq::SharedMemoryManager man2(key);
+
+	// A small header leaves the large segment unaligned in the buffer; the large segment is copied with streaming stores
+	std::vector<uint8_t> header(3), payload(300001), trailer(77);
+	std::iota(header.begin(), header.end(), 1);
+	std::iota(payload.begin(), payload.end(), 5);
+	std::iota(trailer.begin(), trailer.end(), 9);
+	std::vector<artdaq::SharedMemoryManager::WriteSegment> segments{{header.data(), header.size()}, {nullptr, 0}, {payload.data(), payload.size()}, {trailer.data(), trailer.size()}};
+
+	auto buf = man.GetBufferForWriting(false);
+	BOOST_REQUIRE_EQUAL(man.WriteV(buf, segments), header.size() + payload.size() + trailer.size());
+	BOOST_REQUIRE_EQUAL(man.WriteV(buf, segments.data(), 1), header.size());
+	BOOST_REQUIRE_EQUAL(man.BufferDataSize(buf), 2 * header.size() + payload.size() + trailer.size());
+	man.MarkBufferFull(buf);
+
+	auto readbuf = man2.GetBufferForReading();
+	BOOST_REQUIRE_EQUAL(readbuf, buf);
+	std::vector<uint8_t> expected;
+	for (auto const* block : {&header, &payload, &trailer, &header})
+	{
+		expected.insert(expected.end(), block->begin(), block->end());
+	}
+	std::vector<uint8_t> data(expected.size());
+	BOOST_REQUIRE_EQUAL(man2.Read(readbuf, data.data(), data.size()), true);
+	BOOST_REQUIRE(data == expected);
+	man2.MarkBufferEmpty(readbuf);
+
+	// Segments which do not fit together are rejected before anything is written
+	buf = man.GetBufferForWriting(false);
+	std::vector<uint8_t> large(0x80000);
+	BOOST_REQUIRE_EXCEPTION(man.WriteV(buf, {{large.data(), large.size()}, {large.data(), large.size()}, {header.data(), header.size()}}), cet::exception,
+	                        [&](cet::exception e) { return e.category() == "SharedMemoryWrite"; });
+	BOOST_REQUIRE_EQUAL(man2.BufferDataSize(buf), 0);
+	TLOG(TLVL_DEBUG) << "END TEST ScatterGatherWrite";
+}
+
 BOOST_AUTO_TEST_SUITE_END()